@@ -0,0 +1,47 @@
+#!/bin/sh
+##
+##  door_daemon
+##
+##  Copyright (C) 2009 Christian Pointner <equinox@spreadspace.org>
+##
+##  This file is part of door_daemon.
+##
+##  door_daemon is free software: you can redistribute it and/or modify
+##  it under the terms of the GNU General Public License as published by
+##  the Free Software Foundation, either version 3 of the License, or
+##  any later version.
+##
+##  door_daemon is distributed in the hope that it will be useful,
+##  but WITHOUT ANY WARRANTY; without even the implied warranty of
+##  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+##  GNU General Public License for more details.
+##
+##  You should have received a copy of the GNU General Public License
+##  along with door_daemon. If not, see <http://www.gnu.org/licenses/>.
+##
+
+## runs door_daemon against door_sim and drives it with door_bench
+## usage: ./bench.sh [<results file>] [<door_bench options>]
+## results are appended as one JSON line per run, labeled with the git revision
+
+RESULTS=${1:-bench-results.jsonl}
+[ $# -gt 0 ] && shift
+
+DIR=`mktemp -d /tmp/door_bench.XXXXXX` || exit 1
+LABEL=`git describe --always --dirty 2>/dev/null || echo unknown`
+
+./door_sim -l $DIR/door -m 200 -w 50 > $DIR/sim.log 2>&1 &
+SIM_PID=$!
+sleep 0.5
+./door_daemon -D -d $DIR/door -s $DIR/cmd.sock -L stderr:3 > $DIR/daemon.log 2>&1 &
+DAEMON_PID=$!
+sleep 0.5
+
+./door_bench -s $DIR/cmd.sock -p $DAEMON_PID -o "$RESULTS" -L "$LABEL" "$@"
+RET=$?
+
+kill $DAEMON_PID $SIM_PID 2>/dev/null
+wait 2>/dev/null
+rm -rf $DIR
+tail -n 1 "$RESULTS"
+exit $RET
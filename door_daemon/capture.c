@@ -0,0 +1,252 @@
+/*
+ *  door_daemon
+ *
+ *  Copyright (C) 2009 Christian Pointner <equinox@spreadspace.org>
+ *
+ *  This file is part of door_daemon.
+ *
+ *  door_daemon is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  door_daemon is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with door_daemon. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "datatypes.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "capture.h"
+
+#define CAPTURE_SIZE_MIN (64*1024)
+
+static u_int32_t capture_record_size(u_int32_t len)
+{
+  return (sizeof(capture_record_t) + len + CAPTURE_ALIGN - 1) & ~(CAPTURE_ALIGN - 1);
+}
+
+static capture_record_t* capture_record_at(capture_t* cap, u_int64_t pos)
+{
+  return (capture_record_t*)(cap->data_ + pos % cap->hdr_->size_);
+}
+
+static int capture_map(capture_t* cap, const char* path, int writeable, u_int32_t size)
+{
+  cap->hdr_ = NULL;
+  cap->fd_ = open(path, writeable ? O_RDWR | O_CREAT : O_RDONLY, 0640);
+  if(cap->fd_ < 0)
+    return -1;
+
+  struct stat st;
+  if(fstat(cap->fd_, &st))
+    goto error;
+  if(!writeable) {
+    if(st.st_size < sizeof(capture_header_t))
+      goto error;
+    cap->map_len_ = st.st_size;
+  }
+  else {
+    cap->map_len_ = sizeof(capture_header_t) + size;
+    if(st.st_size != cap->map_len_ && ftruncate(cap->fd_, cap->map_len_))
+      goto error;
+  }
+
+  void* map = mmap(NULL, cap->map_len_, writeable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, cap->fd_, 0);
+  if(map == MAP_FAILED)
+    goto error;
+  cap->hdr_ = map;
+  cap->data_ = (u_int8_t*)map + sizeof(capture_header_t);
+  return 0;
+
+error:
+  close(cap->fd_);
+  cap->fd_ = -1;
+  return -1;
+}
+
+static int capture_header_valid(capture_t* cap)
+{
+  capture_header_t* h = cap->hdr_;
+  return !memcmp(h->magic_, CAPTURE_MAGIC, sizeof(h->magic_)) && h->version_ == CAPTURE_VERSION &&
+    sizeof(capture_header_t) + (size_t)h->size_ <= cap->map_len_ && !(h->size_ % CAPTURE_ALIGN) &&
+    h->tail_ <= h->head_ && h->head_ - h->tail_ <= h->size_ && h->tail_ <= h->last_ && h->last_ <= h->head_;
+}
+
+int capture_open(capture_t* cap, const char* path, u_int32_t size)
+{
+  if(!cap || !path)
+    return -1;
+
+  size &= ~(CAPTURE_ALIGN - 1);
+  if(size < CAPTURE_SIZE_MIN)
+    size = CAPTURE_SIZE_MIN;
+
+  if(capture_map(cap, path, 1, size))
+    return -1;
+
+      // an existing capture of the same size is continued, anything else starts over
+  capture_header_t* h = cap->hdr_;
+  if(!capture_header_valid(cap) || h->size_ != size) {
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic_, CAPTURE_MAGIC, sizeof(h->magic_));
+    h->version_ = CAPTURE_VERSION;
+    h->size_ = size;
+  }
+  h->last_ = h->head_;
+  cap->last_us_ = 0;
+  return 0;
+}
+
+int capture_open_read(capture_t* cap, const char* path)
+{
+  if(!cap || !path)
+    return -1;
+
+  if(capture_map(cap, path, 0, 0))
+    return -1;
+
+  if(!capture_header_valid(cap)) {
+    capture_close(cap);
+    errno = EINVAL;
+    return -1;
+  }
+  return 0;
+}
+
+void capture_close(capture_t* cap)
+{
+  if(!cap || !cap->hdr_)
+    return;
+
+  munmap(cap->hdr_, cap->map_len_);
+  close(cap->fd_);
+  cap->hdr_ = NULL;
+  cap->fd_ = -1;
+}
+
+static void capture_evict(capture_t* cap, u_int32_t need)
+{
+  capture_header_t* h = cap->hdr_;
+  while(h->size_ - (h->head_ - h->tail_) < need && h->tail_ < h->head_) {
+    u_int32_t off = h->tail_ % h->size_;
+    capture_record_t* rec = capture_record_at(cap, h->tail_);
+    if(h->size_ - off < sizeof(capture_record_t) || rec->dir_ == CAPTURE_PAD)
+      h->tail_ += h->size_ - off;
+    else
+      h->tail_ += capture_record_size(rec->len_);
+  }
+}
+
+static int capture_append(capture_t* cap, capture_dir_t dir, const u_int8_t* buf, u_int32_t len, u_int64_t now)
+{
+  capture_header_t* h = cap->hdr_;
+  if(dir != CAPTURE_RX && dir != CAPTURE_TX)
+    return 0;
+  if(h->last_ == h->head_ || now - cap->last_us_ > CAPTURE_COALESCE_US)
+    return 0;
+
+  capture_record_t* rec = capture_record_at(cap, h->last_);
+  if(rec->dir_ != dir || rec->len_ + len > CAPTURE_RECORD_MAX)
+    return 0;
+
+  u_int32_t old_size = capture_record_size(rec->len_);
+  u_int32_t new_size = capture_record_size(rec->len_ + len);
+  if(h->last_ % h->size_ + new_size > h->size_)
+    return 0;
+
+  capture_evict(cap, new_size - old_size);
+  memcpy((u_int8_t*)(rec + 1) + rec->len_, buf, len);
+  rec->len_ += len;
+  __sync_synchronize();
+  h->head_ = h->last_ + new_size;
+  h->bytes_ += len;
+  return 1;
+}
+
+void capture_write(capture_t* cap, capture_dir_t dir, const u_int8_t* buf, u_int32_t len, const struct timeval* now)
+{
+  if(!cap || !cap->hdr_ || !buf || !len)
+    return;
+
+  capture_header_t* h = cap->hdr_;
+  u_int64_t now_us = (u_int64_t)now->tv_sec * 1000000 + now->tv_usec;
+  if(capture_append(cap, dir, buf, len, now_us)) {
+    cap->last_us_ = now_us;
+    return;
+  }
+
+  while(len) {
+    u_int32_t chunk = len > CAPTURE_RECORD_MAX ? CAPTURE_RECORD_MAX : len;
+    u_int32_t need = capture_record_size(chunk);
+    u_int32_t off = h->head_ % h->size_;
+    if(off + need > h->size_) {
+      u_int32_t pad = h->size_ - off;
+      capture_evict(cap, pad);
+      if(pad >= sizeof(capture_record_t)) {
+        capture_record_t* rec = capture_record_at(cap, h->head_);
+        memset(rec, 0, sizeof(*rec));
+        rec->dir_ = CAPTURE_PAD;
+      }
+      h->head_ += pad;
+    }
+    capture_evict(cap, need);
+
+    capture_record_t* rec = capture_record_at(cap, h->head_);
+    rec->time_us_ = now_us;
+    rec->len_ = chunk;
+    rec->dir_ = dir;
+    rec->reserved_ = 0;
+    rec->reserved2_ = 0;
+    memcpy(rec + 1, buf, chunk);
+    __sync_synchronize();
+    h->last_ = h->head_;
+    h->head_ += need;
+    h->records_++;
+    h->bytes_ += chunk;
+
+    buf += chunk;
+    len -= chunk;
+  }
+  cap->last_us_ = now_us;
+}
+
+int capture_next(capture_t* cap, u_int64_t* pos, const capture_record_t** rec, const u_int8_t** data)
+{
+  if(!cap || !cap->hdr_ || !pos)
+    return -1;
+
+  capture_header_t* h = cap->hdr_;
+  if(*pos < h->tail_)
+    *pos = h->tail_;
+
+  while(*pos < h->head_) {
+    u_int32_t off = *pos % h->size_;
+    const capture_record_t* r = capture_record_at(cap, *pos);
+    if(h->size_ - off < sizeof(capture_record_t) || r->dir_ == CAPTURE_PAD) {
+      *pos += h->size_ - off;
+      continue;
+    }
+    if(r->dir_ > CAPTURE_MARK || off + capture_record_size(r->len_) > h->size_)
+      return -1;
+
+    *rec = r;
+    *data = (const u_int8_t*)(r + 1);
+    *pos += capture_record_size(r->len_);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,83 @@
+/*
+ *  door_daemon
+ *
+ *  Copyright (C) 2009 Christian Pointner <equinox@spreadspace.org>
+ *
+ *  This file is part of door_daemon.
+ *
+ *  door_daemon is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  door_daemon is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with door_daemon. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DOOR_DAEMON_capture_h_INCLUDED
+#define DOOR_DAEMON_capture_h_INCLUDED
+
+#include <sys/time.h>
+
+#include "datatypes.h"
+
+// Wire capture: every byte exchanged with the firmware is appended to a
+// ring buffer in a memory mapped file. Bytes in the same direction which
+// follow each other within CAPTURE_COALESCE_US share a record. Records
+// never wrap around the end of the ring, the space left at the end is
+// filled with a pad record (or is too small to hold a record header).
+// The daemon writes a mark record whenever it opens the file, its payload
+// is the int64 offset in usec between the monotonic timestamps and unix time.
+
+#define CAPTURE_MAGIC "DOORCAP1"
+#define CAPTURE_VERSION 1
+#define CAPTURE_COALESCE_US 2000
+#define CAPTURE_RECORD_MAX 4096
+#define CAPTURE_ALIGN 8
+
+enum capture_dir_enum { CAPTURE_RX = 0, CAPTURE_TX = 1, CAPTURE_PAD = 2, CAPTURE_MARK = 3 };
+typedef enum capture_dir_enum capture_dir_t;
+
+struct capture_header_struct {
+  char magic_[8];
+  u_int32_t version_;
+  u_int32_t size_;          // size of the data area following the header
+  u_int64_t head_;          // position of the next record, positions grow forever
+  u_int64_t tail_;          // position of the oldest record
+  u_int64_t last_;          // position of the newest record, equals head_ if none
+  u_int64_t records_;       // records ever written
+  u_int64_t bytes_;         // payload bytes ever written
+  u_int64_t reserved_;
+};
+typedef struct capture_header_struct capture_header_t;
+
+struct capture_record_struct {
+  u_int64_t time_us_;       // monotonic
+  u_int16_t len_;
+  u_int8_t dir_;
+  u_int8_t reserved_;
+  u_int32_t reserved2_;
+};
+typedef struct capture_record_struct capture_record_t;
+
+struct capture_struct {
+  int fd_;
+  capture_header_t* hdr_;
+  u_int8_t* data_;
+  size_t map_len_;
+  u_int64_t last_us_;       // time of the last write, for coalescing
+};
+typedef struct capture_struct capture_t;
+
+int capture_open(capture_t* cap, const char* path, u_int32_t size);
+int capture_open_read(capture_t* cap, const char* path);
+void capture_close(capture_t* cap);
+void capture_write(capture_t* cap, capture_dir_t dir, const u_int8_t* buf, u_int32_t len, const struct timeval* now);
+int capture_next(capture_t* cap, u_int64_t* pos, const capture_record_t** rec, const u_int8_t** data);
+
+#endif
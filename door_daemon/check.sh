@@ -0,0 +1,238 @@
+#!/bin/sh
+##
+##  door_daemon
+##
+##  Copyright (C) 2009 Christian Pointner <equinox@spreadspace.org>
+##
+##  This file is part of door_daemon.
+##
+##  door_daemon is free software: you can redistribute it and/or modify
+##  it under the terms of the GNU General Public License as published by
+##  the Free Software Foundation, either version 3 of the License, or
+##  any later version.
+##
+##  door_daemon is distributed in the hope that it will be useful,
+##  but WITHOUT ANY WARRANTY; without even the implied warranty of
+##  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+##  GNU General Public License for more details.
+##
+##  You should have received a copy of the GNU General Public License
+##  along with door_daemon. If not, see <http://www.gnu.org/licenses/>.
+##
+
+## functional checks against door_sim, run by 'make check'
+## usage: ./check.sh
+## every check prints ok or FAIL, the exit code is the number of failed checks,
+## the logs of a failed run are kept
+
+DIR=`mktemp -d /tmp/door_check.XXXXXX` || exit 1
+FAILED=0
+
+## sends each argument as a command line on one connection,
+## 'sleep:<seconds>' pauses, the connection is closed without reading any answer
+send_cmds()
+{
+  perl -e '
+    use Socket;
+    my $sock = shift;
+    socket(my $conn, PF_UNIX, SOCK_STREAM, 0) || die "socket: $!";
+    connect($conn, sockaddr_un($sock)) || die "connect: $!";
+    $conn->autoflush(1);
+    foreach(@ARGV) {
+      if(/^sleep:(.*)/) { select(undef, undef, undef, $1); next; }
+      print $conn "$_\n";
+    }
+    close($conn);' "$@"
+}
+
+## like send_cmds, but waits for the answers after each line and prints them,
+## also the ones which arrive during a 'sleep:<seconds>'
+talk()
+{
+  perl -e '
+    use Socket;
+    use Time::HiRes qw(time);
+    my $sock = shift;
+    socket(my $conn, PF_UNIX, SOCK_STREAM, 0) || die "socket: $!";
+    connect($conn, sockaddr_un($sock)) || die "connect: $!";
+    $conn->autoflush(1);
+    my $rin = "";
+    vec($rin, fileno($conn), 1) = 1;
+    my $buf;
+    foreach(@ARGV) {
+      if(/^sleep:(.*)/) {
+        my $end = time + $1;
+        while((my $left = $end - time) > 0) {
+          next unless select(my $rout = $rin, undef, undef, $left) > 0;
+          last unless sysread($conn, $buf, 4096);
+          print $buf;
+        }
+        next;
+      }
+      print $conn "$_\n";
+      while(select(my $rout = $rin, undef, undef, 0.3) > 0 && sysread($conn, $buf, 4096)) { print $buf; }
+    }
+    close($conn);' "$@"
+}
+
+## starts door_daemon in virtual time, it logs to $DIR/<name>.log,
+## the other arguments are passed on
+start_daemon()
+{
+  NAME=$1
+  shift
+  ./door_daemon -D -V -s $DIR/cmd.sock -L stderr:5 "$@" >> $DIR/$NAME.log 2>&1 &
+  DAEMON_PID=$!
+  sleep 0.5
+}
+
+stop_daemon()
+{
+  kill $DAEMON_PID 2>/dev/null
+  wait $DAEMON_PID 2>/dev/null
+}
+
+## starts door_sim on $DIR/door, it never answers and logs to $DIR/<name>_sim.log
+start_sim()
+{
+  ./door_sim -l $DIR/door -n 100 -v > $DIR/$1_sim.log 2>&1 &
+  SIM_PID=$!
+  sleep 0.5
+}
+
+stop_sim()
+{
+  kill $SIM_PID 2>/dev/null
+  wait $SIM_PID 2>/dev/null
+}
+
+check()
+{
+  if [ $1 -eq 0 ]; then
+    echo "ok: $2"
+  else
+    echo "FAIL: $2"
+    FAILED=`expr $FAILED + 1`
+  fi
+}
+
+## the firmware never answers: the status stays in flight until it expires,
+## checkcard.pl style clients send an open and hang up while it is waiting
+./door_sim -l $DIR/door -n 100 -v > $DIR/sim.log 2>&1 &
+SIM_PID=$!
+sleep 0.5
+./door_daemon -D -d $DIR/door -s $DIR/cmd.sock -L stderr:5 > $DIR/daemon.log 2>&1 &
+DAEMON_PID=$!
+sleep 0.5
+
+send_cmds $DIR/cmd.sock status sleep:3 &
+sleep 0.3
+send_cmds $DIR/cmd.sock "open checkcard"
+sleep 2
+grep -q '^door_sim: < o' $DIR/sim.log
+check $? "a command queued by a client which disconnected is still sent"
+
+kill $DAEMON_PID $SIM_PID 2>/dev/null
+wait 2>/dev/null
+
+## the ring log target stamps its records with the daemon clock
+start_daemon ring -d loop: -L ring:5,16
+talk $DIR/cmd.sock "clock advance 3456000000" "log ring check" "logtail 1" > $DIR/ring.out
+stop_daemon
+grep -q "^`date -d '+40 days' '+%a %b %e'` .*ext msg: ring check" $DIR/ring.out
+check $? "ring log records carry the virtual time"
+
+## a client gets a burst of -B commands, after that one per second of -R
+start_daemon ratelimit -d loop: -R 1 -B 2
+talk $DIR/cmd.sock status status status "clock advance 1000" status > $DIR/ratelimit.out
+stop_daemon
+[ `grep -c '^Status:' $DIR/ratelimit.out` -eq 3 ] && [ `grep -c '^Error: rate limit exceeded' $DIR/ratelimit.out` -eq 1 ]
+check $? "the token bucket refuses commands beyond the burst until it refilled"
+
+## the clients take turns within a class, a command which has to wait is told so
+start_sim turns
+start_daemon turns -d $DIR/door
+talk $DIR/cmd.sock status "open a" "open b" sleep:3 > $DIR/turns_a.out &
+TALK_A_PID=$!
+sleep 1.5
+talk $DIR/cmd.sock toggle sleep:2 > $DIR/turns_b.out &
+TALK_B_PID=$!
+sleep 0.5
+talk $DIR/cmd.sock "clock advance 1100" "clock advance 1100" "clock advance 1100" > /dev/null
+wait $TALK_A_PID $TALK_B_PID
+stop_daemon
+stop_sim
+[ "`sed -n 's/^door_sim: < //p' $DIR/turns_sim.log | tr -d '\n'`" = "soto" ] && grep -q '^Delayed: 2 ahead' $DIR/turns_a.out && grep -q '^Delayed: 2 ahead' $DIR/turns_b.out
+check $? "clients take turns and waiting commands are answered with Delayed"
+
+## reset and close go before toggle and status, with -c a close drops the waiting opens
+start_sim prio
+start_daemon prio -d $DIR/door -c
+talk $DIR/cmd.sock status toggle status "open a" "open b" reset close sleep:3 > $DIR/prio.out &
+TALK_PID=$!
+sleep 3
+talk $DIR/cmd.sock "clock advance 1100" "clock advance 1100" "clock advance 1100" "clock advance 1100" > /dev/null
+wait $TALK_PID
+stop_daemon
+stop_sim
+[ "`sed -n 's/^door_sim: < //p' $DIR/prio_sim.log | tr -d '\n'`" = "srcts" ] && [ `grep -c '^Error: cancelled by close' $DIR/prio.out` -eq 2 ]
+check $? "priority classes order the commands and a close cancels the waiting opens"
+
+## a close while the door is still opening is refused by the daemon with the firmware's own words,
+## with -A the firmware is asked and says the same
+start_daemon local -d loop:1000
+talk $DIR/cmd.sock open close > $DIR/local.out
+stop_daemon
+start_daemon firmware -d loop:1000 -A
+talk $DIR/cmd.sock open close > $DIR/firmware.out
+stop_daemon
+grep -q '^Error: Operation in progress' $DIR/local.out && grep -q 'door-local: Error: Operation in progress' $DIR/local.log &&
+  grep -q 'door-firmware: Error: Operation in progress' $DIR/firmware.log && cmp -s $DIR/local.out $DIR/firmware.out
+check $? "commands the firmware would refuse are answered locally"
+
+## an expired status is sent again after 200 and 400ms, the client only hears the final outcome
+start_sim retry
+start_daemon retry -d $DIR/door -y status:3:200:5000
+talk $DIR/cmd.sock status sleep:3 > $DIR/retry.out &
+TALK_PID=$!
+sleep 0.5
+talk $DIR/cmd.sock "clock advance 1100" "clock advance 300" "clock advance 1100" "clock advance 500" "clock advance 1100" stats > $DIR/retry_stats.out
+wait $TALK_PID
+stop_daemon
+stop_sim
+[ `grep -c '^door_sim: < s' $DIR/retry_sim.log` -eq 3 ] && [ `wc -l < $DIR/retry.out` -eq 1 ] && grep -q '^Error: no answer from door' $DIR/retry.out &&
+  grep -q '^door_daemon_commands_retried_total 2' $DIR/retry_stats.out && grep -q '^door_daemon_commands_retry_failed_total 1' $DIR/retry_stats.out
+check $? "retries are counted and the client gets exactly one outcome"
+
+## a scheduled close survives a restart and runs once it is due
+start_daemon schedule -d loop: -t $DIR/schedule
+talk $DIR/cmd.sock "schedule +3600 close" > /dev/null
+stop_daemon
+start_daemon schedule -d loop: -t $DIR/schedule
+talk $DIR/cmd.sock schedule "clock advance 3601000" sleep:0.5 schedule > $DIR/schedule.out
+stop_daemon
+grep -q '^Scheduled: id=1 door=0 cmd=close' $DIR/schedule.out && grep -q '^Schedules: 0' $DIR/schedule.out &&
+  [ `grep -c 'running schedule entry 1 ' $DIR/schedule.log` -eq 1 ]
+check $? "scheduled commands are persisted and run after a restart"
+
+## the door state comes back unverified from the state file, a file whose checksum doesn't match is ignored
+start_daemon warm -d loop:100 -T $DIR/state
+talk $DIR/cmd.sock open "clock advance 2000" status > /dev/null
+stop_daemon
+start_daemon warm -d loop:100 -T $DIR/state
+stop_daemon
+grep -q "restored state of door 'door': State: lock=opened .*verified=0" $DIR/warm.log
+check $? "the door state survives a restart in the state file"
+
+sed -i 's/^seq .*/seq 12345/' $DIR/state
+start_daemon damaged -d loop:100 -T $DIR/state
+stop_daemon
+grep -q 'ignoring damaged state file' $DIR/damaged.log && ! grep -q 'restored state' $DIR/damaged.log
+check $? "a state file with a wrong checksum is ignored"
+
+if [ $FAILED -eq 0 ]; then
+  rm -rf $DIR
+else
+  echo "$FAILED check(s) failed, logs are in $DIR"
+fi
+exit $FAILED
@@ -20,9 +20,11 @@
  */
 
 #include <stdlib.h>
+#include <unistd.h>
 
 #include "client_list.h"
 #include "datatypes.h"
+#include "clock.h"
 
 client_t* client_get_last(client_t* first)
 {
@@ -36,6 +38,14 @@ client_t* client_get_last(client_t* first)
   return first;
 }
 
+static void client_clear_queue(client_t* client)
+{
+  int i;
+  for(i = 0; i < CMD_PRIO_MAX; ++i)
+    cmd_clear(&client->cmd_q[i]);
+  client->queued = 0;
+}
+
 int client_add(client_t** first, int fd)
 {
   if(!first)
@@ -49,8 +59,25 @@ int client_add(client_t** first, int fd)
   new_client->status_listener = 0;
   new_client->error_listener = 0;
   new_client->request_listener = 0;
+  new_client->state_listener = 0;
+  new_client->raw_listener = 0;
+  new_client->numbered = 0;
+  new_client->raw_pos = 0;
+  int i;
+  for(i = 0; i < CMD_PRIO_MAX; ++i) {
+    new_client->cmd_q[i] = NULL;
+    new_client->active[i] = 0;
+    new_client->active_next[i] = NULL;
+  }
+  new_client->queued = 0;
+  new_client->tokens = -1;
+  timerclear(&new_client->refill);
+  new_client->accepted = 0;
+  new_client->rejected = 0;
+  new_client->delayed = 0;
   new_client->next = NULL;
   new_client->buffer.offset = 0;
+  new_client->buffer.overflow = 0;
 
   if(!(*first)) {
     *first = new_client;
@@ -71,6 +98,7 @@ void client_remove(client_t** first, int fd)
   if((*first)->fd == fd) {
     *first = (*first)->next;
     close(deletee->fd);
+    client_clear_queue(deletee);
     free(deletee);
     return;
   }
@@ -81,6 +109,7 @@ void client_remove(client_t** first, int fd)
     if(deletee->fd == fd) {
       prev->next = deletee->next;
       close(deletee->fd);
+      client_clear_queue(deletee);
       free(deletee);
       return;
     }
@@ -103,6 +132,36 @@ client_t* client_find(client_t* first, int fd)
   return NULL;
 }
 
+int client_is_listener(client_t* client)
+{
+  return client->status_listener || client->error_listener || client->request_listener ||
+    client->state_listener || client->raw_listener;
+}
+
+    // rate commands per second, up to burst at once, a new client starts with a full bucket
+int client_take_token(client_t* client, u_int32_t rate, u_int32_t burst)
+{
+  if(!client || !rate)
+    return 0;
+
+  struct timeval now, diff;
+  clock_now(&now);
+  if(client->tokens < 0)
+    client->tokens = burst;
+  else {
+    timersub(&now, &client->refill, &diff);
+    client->tokens += (diff.tv_sec + diff.tv_usec / 1000000.0) * rate;
+    if(client->tokens > burst)
+      client->tokens = burst;
+  }
+  client->refill = now;
+
+  if(client->tokens < 1)
+    return -1;
+  client->tokens -= 1;
+  return 0;
+}
+
 void client_clear(client_t** first)
 {
   if(!first || !(*first)) 
@@ -112,6 +171,7 @@ void client_clear(client_t** first)
     client_t* deletee = *first;
     *first = (*first)->next;
     close(deletee->fd);
+    client_clear_queue(deletee);
     free(deletee);
   }
 }
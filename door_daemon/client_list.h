@@ -22,13 +22,29 @@
 #ifndef DOOR_DAEMON_client_list_h_INCLUDED
 #define DOOR_DAEMON_client_list_h_INCLUDED
 
+#include <sys/time.h>
+
 #include "datatypes.h"
+#include "command_queue.h"
 
 struct client_struct {
   int fd;
   int status_listener;
   int error_listener;
   int request_listener;
+  int state_listener;
+  int raw_listener;
+  int numbered;                   // event lines are prefixed with their sequence number
+  u_int64_t raw_pos;
+  cmd_t* cmd_q[CMD_PRIO_MAX];      // door commands waiting for their turn, by priority class
+  u_int32_t queued;
+  int active[CMD_PRIO_MAX];       // in the round robin list of the class at the door
+  struct client_struct* active_next[CMD_PRIO_MAX];
+  double tokens;                  // token bucket of the rate limit
+  struct timeval refill;
+  u_int32_t accepted;
+  u_int32_t rejected;
+  u_int32_t delayed;              // had to wait for the command of someone else
   struct client_struct* next;
   read_buffer_t buffer;
 };
@@ -37,6 +53,8 @@ typedef struct client_struct client_t;
 int client_add(client_t** first, int fd);
 void client_remove(client_t** first, int fd);
 client_t* client_find(client_t* first, int fd);
+int client_is_listener(client_t* client);
+int client_take_token(client_t* client, u_int32_t rate, u_int32_t burst);
 void client_clear(client_t** first);
 
 #endif
@@ -0,0 +1,113 @@
+/*
+ *  door_daemon
+ *
+ *  Copyright (C) 2009 Christian Pointner <equinox@spreadspace.org>
+ *
+ *  This file is part of door_daemon.
+ *
+ *  door_daemon is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  door_daemon is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with door_daemon. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/select.h>
+
+#include "clock.h"
+
+static int clock_virtual = 0;
+static struct timeval clock_virtual_now;   // monotonic time seen by the daemon
+static time_t clock_virtual_epoch;         // wall clock at clock_init()
+static struct timeval clock_virtual_start;
+static int clock_advanced = 0;
+
+static void clock_real_now(struct timeval* tv)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  tv->tv_sec = now.tv_sec;
+  tv->tv_usec = now.tv_nsec / 1000;
+}
+
+void clock_init(int virtual_time)
+{
+  clock_virtual = virtual_time;
+  clock_real_now(&clock_virtual_now);
+  clock_virtual_start = clock_virtual_now;
+  clock_virtual_epoch = time(NULL);
+  clock_advanced = 0;
+}
+
+int clock_is_virtual()
+{
+  return clock_virtual;
+}
+
+void clock_now(struct timeval* tv)
+{
+  if(clock_virtual)
+    *tv = clock_virtual_now;
+  else
+    clock_real_now(tv);
+}
+
+time_t clock_time()
+{
+  if(!clock_virtual)
+    return time(NULL);
+
+  return clock_virtual_epoch + (clock_virtual_now.tv_sec - clock_virtual_start.tv_sec);
+}
+
+void clock_advance(const struct timeval* delta)
+{
+  if(!clock_virtual || !delta)
+    return;
+
+  timeradd(&clock_virtual_now, delta, &clock_virtual_now);
+  clock_advanced = 1;
+}
+
+void clock_sleep(unsigned int seconds)
+{
+  if(!clock_virtual) {
+    sleep(seconds);
+    return;
+  }
+
+  struct timeval delta;
+  delta.tv_sec = seconds;
+  delta.tv_usec = 0;
+  clock_advance(&delta);
+}
+
+int clock_select(int nfds, fd_set* readfds, fd_set* writefds, fd_set* exceptfds, struct timeval* timeout)
+{
+  if(!clock_virtual)
+    return select(nfds, readfds, writefds, exceptfds, timeout);
+
+      // a zero timeout is a poll and works the same in both modes
+  if(timeout && !timerisset(timeout))
+    return select(nfds, readfds, writefds, exceptfds, timeout);
+
+  if(clock_advanced && timeout) {
+    clock_advanced = 0;
+    if(readfds) FD_ZERO(readfds);
+    if(writefds) FD_ZERO(writefds);
+    if(exceptfds) FD_ZERO(exceptfds);
+    return 0;
+  }
+
+  return select(nfds, readfds, writefds, exceptfds, NULL);
+}
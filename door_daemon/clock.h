@@ -0,0 +1,43 @@
+/*
+ *  door_daemon
+ *
+ *  Copyright (C) 2009 Christian Pointner <equinox@spreadspace.org>
+ *
+ *  This file is part of door_daemon.
+ *
+ *  door_daemon is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  door_daemon is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with door_daemon. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DOOR_DAEMON_clock_h_INCLUDED
+#define DOOR_DAEMON_clock_h_INCLUDED
+
+#include <time.h>
+#include <sys/time.h>
+#include <sys/select.h>
+
+// All time reads and waits of the daemon go through these functions.
+// In virtual mode time stands still until clock_advance() is called (the
+// 'clock advance' command) or the daemon sleeps, which happens instantly.
+// select() then only returns for fd events or after the clock was advanced,
+// so expiries and timeouts fire exactly when the test harness wants them to.
+
+void clock_init(int virtual_time);
+int clock_is_virtual();
+void clock_now(struct timeval* tv);
+time_t clock_time();
+void clock_advance(const struct timeval* delta);
+void clock_sleep(unsigned int seconds);
+int clock_select(int nfds, fd_set* readfds, fd_set* writefds, fd_set* exceptfds, struct timeval* timeout);
+
+#endif
@@ -24,6 +24,7 @@
 
 #include "command_queue.h"
 #include "datatypes.h"
+#include "clock.h"
 
 cmd_t* cmd_get_last(cmd_t* first)
 {
@@ -58,8 +59,11 @@ int cmd_push(cmd_t** first, int fd, cmd_id_t cmd, const char* param)
   else
     new_cmd->param = NULL;
   new_cmd->sent = 0;
+  clock_now(&new_cmd->tv_push);
   new_cmd->tv_start.tv_sec = 0;
   new_cmd->tv_start.tv_usec = 0;
+  new_cmd->retries = 0;
+  timerclear(&new_cmd->tv_retry);
   new_cmd->next = NULL;
 
   if(!(*first)) {
@@ -78,14 +82,14 @@ void cmd_sent(cmd_t* cmd)
     return;
 
   cmd->sent = 1;
-  gettimeofday(&cmd->tv_start, NULL);
+  clock_now(&cmd->tv_start);
 }
 
 int cmd_has_expired(cmd_t cmd)
 {
   struct timeval now;
   timerclear(&now);
-  gettimeofday(&now, NULL);
+  clock_now(&now);
   cmd.tv_start.tv_sec++;
 
   return timercmp(&cmd.tv_start, &now, <);
@@ -103,6 +107,31 @@ void cmd_pop(cmd_t** first)
   free(deletee);
 }
 
+void cmd_orphan(cmd_t* first, int fd)
+{
+  for(; first; first = first->next)
+    if(first->fd == fd)
+      first->fd = -1;
+}
+
+    // unlinks all unsent commands of this type, they are returned in their order
+cmd_t* cmd_extract(cmd_t** first, cmd_id_t cmd)
+{
+  cmd_t* extracted = NULL;
+  cmd_t** last = &extracted;
+  while(first && *first) {
+    if((*first)->cmd == cmd && !(*first)->sent) {
+      *last = *first;
+      *first = (*first)->next;
+      last = &(*last)->next;
+      *last = NULL;
+    }
+    else
+      first = &(*first)->next;
+  }
+  return extracted;
+}
+
 void cmd_clear(cmd_t** first)
 {
   if(!first || !(*first)) 
@@ -24,15 +24,23 @@
 
 #include <sys/time.h>
 
-enum cmd_id_enum { OPEN, CLOSE, TOGGLE, RESET, STATUS, LOG , LISTEN };
+#include "datatypes.h"
+
+enum cmd_id_enum { OPEN, CLOSE, TOGGLE, RESET, STATUS, LOG , LISTEN, LOGTAIL, LOGSTATS, LOGLEVEL, STATS, CLOCK, STATE, HISTORY, CLIENTS, SCHEDULE };
 typedef enum cmd_id_enum cmd_id_t;
 
+#define CMD_DOOR_MAX (STATUS + 1)   // the commands which are sent to the door
+#define CMD_PRIO_MAX 3              // priority classes, 0 goes first
+
 struct cmd_struct {
   int fd;
   cmd_id_t cmd;
   char* param;
   int sent;
+  struct timeval tv_push;
   struct timeval tv_start;
+  u_int32_t retries;
+  struct timeval tv_retry;          // when to try again
   struct cmd_struct* next;
 };
 typedef struct cmd_struct cmd_t;
@@ -41,6 +49,8 @@ int cmd_push(cmd_t** first, int fd, cmd_id_t cmd, const char* param);
 void cmd_sent(cmd_t* cmd);
 int cmd_has_expired(cmd_t cmd);
 void cmd_pop(cmd_t** first);
+void cmd_orphan(cmd_t* first, int fd);
+cmd_t* cmd_extract(cmd_t** first, cmd_id_t cmd);
 void cmd_clear(cmd_t** first);
 
 #endif
@@ -122,6 +122,7 @@ int do_chroot(const char* chrootdir)
     log_printf(ERROR, "can't change to /: %s", strerror(errno));
     return -1;
   }
+  return 0;
 }
 
 void daemonize()
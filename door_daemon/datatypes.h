@@ -42,7 +42,8 @@ typedef struct buffer_struct buffer_t;
 
 struct read_buffer_struct {
   u_int32_t offset;
-  u_int8_t buf[100];
+  int overflow;      // line didn't fit, drop everything up to the next '\n'
+  char buf[100];
 };
 typedef struct read_buffer_struct read_buffer_t;
 
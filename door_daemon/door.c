@@ -0,0 +1,417 @@
+/*
+ *  door_daemon
+ *
+ *  Copyright (C) 2009 Christian Pointner <equinox@spreadspace.org>
+ *
+ *  This file is part of door_daemon.
+ *
+ *  door_daemon is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  door_daemon is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with door_daemon. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "datatypes.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "clock.h"
+#include "door.h"
+
+int door_add(door_t** first, const char* name, const char* dev, const char* sock, const char* state_map)
+{
+  if(!first || !name || !dev || !sock)
+    return -1;
+
+  door_t* door = malloc(sizeof(door_t));
+  if(!door)
+    return -2;
+  memset(door, 0, sizeof(*door));
+  door->transport_.fd_ = -1;
+  door->listen_fd_ = -1;
+  door->state_map_.fd_ = -1;
+
+  door->name_ = strdup(name);
+  door->dev_ = strdup(dev);
+  door->sock_ = strdup(sock);
+  door->state_map_path_ = state_map ? strdup(state_map) : NULL;
+  if(!door->name_ || !door->dev_ || !door->sock_ || (state_map && !door->state_map_path_)
+     || transport_init(&door->transport_, dev)) {
+    door_clear(&door);
+    return -2;
+  }
+  door_state_init(&door->state_);
+  door->prio_[RESET] = 0;
+  door->prio_[CLOSE] = 0;
+  door->prio_[OPEN] = 1;
+  door->prio_[TOGGLE] = 1;
+  door->prio_[STATUS] = 2;
+
+  door_t** last = first;
+  while(*last) {
+    if(!strcmp((*last)->name_, name) || !strcmp((*last)->sock_, sock)) {
+      door_clear(&door);
+      return -3;
+    }
+    door->index_++;
+    last = &(*last)->next_;
+  }
+  *last = door;
+  stats_add_door(&door->stats_, door->name_);
+  return 0;
+}
+
+    // name,device,socket[,state map]
+int door_add_config(door_t** first, const char* config)
+{
+  if(!config)
+    return -1;
+
+  char* fields[4] = { NULL, NULL, NULL, NULL };
+  char* copy = strdup(config);
+  if(!copy)
+    return -2;
+
+  int cnt = 0;
+  char* saveptr = NULL;
+  char* field;
+  for(field = strtok_r(copy, ",", &saveptr); field; field = strtok_r(NULL, ",", &saveptr)) {
+    if(cnt >= 4) {
+      cnt++;
+      break;
+    }
+    fields[cnt++] = field;
+  }
+
+  int ret = -1;
+  if(cnt >= 3 && cnt <= 4)
+    ret = door_add(first, fields[0], fields[1], fields[2], fields[3]);
+  free(copy);
+  return ret;
+}
+
+void door_clear(door_t** first)
+{
+  if(!first)
+    return;
+
+  while(*first) {
+    door_t* deletee = *first;
+    *first = deletee->next_;
+    stats_remove_door(&deletee->stats_);
+    transport_clear(&deletee->transport_);
+    if(deletee->listen_fd_ >= 0)
+      close(deletee->listen_fd_);
+    shm_state_close(&deletee->state_map_);
+    cmd_clear(&deletee->cmd_q_);
+    cmd_clear(&deletee->retry_q_);
+    client_clear(&deletee->clients_);
+    free(deletee->name_);
+    free(deletee->dev_);
+    free(deletee->sock_);
+    if(deletee->state_map_path_)
+      free(deletee->state_map_path_);
+    free(deletee);
+  }
+}
+
+int door_open(door_t* door)
+{
+  if(!door)
+    return -1;
+
+  if(transport_open(&door->transport_))
+    return -1;
+  door->buffer_.offset = 0;
+  door->buffer_.overflow = 0;
+  return 0;
+}
+
+void door_close(door_t* door)
+{
+  if(!door)
+    return;
+
+  transport_close(&door->transport_);
+}
+
+static const char* door_cmd_names[CMD_DOOR_MAX] = { "open", "close", "toggle", "reset", "status" };
+
+    // e.g. reset:0,close:0,open:1,toggle:1,status:2, commands not mentioned keep their class
+int door_set_priorities(door_t* door, const char* mapping)
+{
+  if(!door || !mapping)
+    return -1;
+
+  const char* ptr = mapping;
+  while(*ptr) {
+    const char* colon = strchr(ptr, ':');
+    if(!colon)
+      return -1;
+    int i;
+    for(i = 0; i < CMD_DOOR_MAX; ++i)
+      if(strlen(door_cmd_names[i]) == colon - ptr && !strncmp(ptr, door_cmd_names[i], colon - ptr))
+        break;
+    if(i == CMD_DOOR_MAX || colon[1] < '0' || colon[1] >= '0' + CMD_PRIO_MAX)
+      return -1;
+    door->prio_[i] = colon[1] - '0';
+    ptr = colon + 2;
+    if(*ptr == ',')
+      ptr++;
+    else if(*ptr)
+      return -1;
+  }
+  return 0;
+}
+
+static void door_activate(door_t* door, client_t* client, int prio)
+{
+  if(client->active[prio])
+    return;
+
+  client->active[prio] = 1;
+  client->active_next[prio] = NULL;
+  if(door->active_tail_[prio])
+    door->active_tail_[prio]->active_next[prio] = client;
+  else
+    door->active_[prio] = client;
+  door->active_tail_[prio] = client;
+}
+
+int door_push(door_t* door, client_t* client, int fd, cmd_id_t cmd, const char* param)
+{
+  if(!door || cmd >= CMD_DOOR_MAX)
+    return -1;
+  if(!client)
+    return cmd_push(&door->cmd_q_, fd, cmd, param);
+
+  int prio = door->prio_[cmd];
+  int ret = cmd_push(&client->cmd_q[prio], fd, cmd, param);
+  if(ret)
+    return ret;
+  client->queued++;
+  door_activate(door, client, prio);
+  return 0;
+}
+
+cmd_t* door_schedule(door_t* door)
+{
+  if(!door || door->cmd_q_)
+    return door ? door->cmd_q_ : NULL;
+
+  int prio;
+  for(prio = 0; prio < CMD_PRIO_MAX; ++prio) {
+    client_t* client;
+    while((client = door->active_[prio])) {
+      door->active_[prio] = client->active_next[prio];
+      if(!door->active_[prio])
+        door->active_tail_[prio] = NULL;
+      client->active[prio] = 0;
+
+      cmd_t* cmd = client->cmd_q[prio];
+      if(!cmd)
+        continue;
+      client->cmd_q[prio] = cmd->next;
+      client->queued--;
+      cmd->next = NULL;
+      if(client->cmd_q[prio])
+        door_activate(door, client, prio);
+      door->cmd_q_ = cmd;
+      return cmd;
+    }
+  }
+  return NULL;
+}
+
+static u_int32_t door_count(const cmd_t* cmd)
+{
+  u_int32_t n = 0;
+  for(; cmd; cmd = cmd->next)
+    n++;
+  return n;
+}
+
+    // how many commands go before the newest one of the client if nothing else arrives:
+    // everything in cmd_q_, the more urgent classes and the turns of the other clients
+u_int32_t door_ahead(door_t* door, client_t* client, cmd_id_t cmd)
+{
+  if(!door || !client || cmd >= CMD_DOOR_MAX)
+    return 0;
+
+  int prio = door->prio_[cmd];
+  u_int32_t own = door_count(client->cmd_q[prio]);
+  if(!own)
+    return 0;
+  u_int32_t ahead = door_count(door->cmd_q_) + own - 1;
+  int p;
+  client_t* other;
+  for(p = 0; p < prio; ++p)
+    for(other = door->active_[p]; other; other = other->active_next[p])
+      ahead += door_count(other->cmd_q[p]);
+
+  int before = 1;
+  for(other = door->active_[prio]; other; other = other->active_next[prio]) {
+    if(other == client) {
+      before = 0;
+      continue;
+    }
+    u_int32_t turns = before ? own : own - 1;
+    u_int32_t waiting = door_count(other->cmd_q[prio]);
+    ahead += waiting < turns ? waiting : turns;
+  }
+  return ahead;
+}
+
+void door_forget_client(door_t* door, client_t* client)
+{
+  if(!door || !client)
+    return;
+
+  int prio;
+  for(prio = 0; prio < CMD_PRIO_MAX; ++prio) {
+    if(!client->active[prio])
+      continue;
+    client_t* prev = NULL;
+    client_t* tmp;
+    for(tmp = door->active_[prio]; tmp && tmp != client; tmp = tmp->active_next[prio])
+      prev = tmp;
+    if(!tmp)
+      continue;
+    if(prev)
+      prev->active_next[prio] = client->active_next[prio];
+    else
+      door->active_[prio] = client->active_next[prio];
+    if(door->active_tail_[prio] == client)
+      door->active_tail_[prio] = prev;
+    client->active[prio] = 0;
+  }
+}
+
+    // the commands keep their order by class, nobody gets their answers any more
+void door_orphan_client(door_t* door, client_t* client)
+{
+  if(!door || !client)
+    return;
+
+  door_forget_client(door, client);
+  cmd_t** last = &door->cmd_q_;
+  while(*last)
+    last = &(*last)->next;
+  int prio;
+  for(prio = 0; prio < CMD_PRIO_MAX; ++prio) {
+    cmd_orphan(client->cmd_q[prio], client->fd);
+    *last = client->cmd_q[prio];
+    while(*last)
+      last = &(*last)->next;
+    client->cmd_q[prio] = NULL;
+  }
+  client->queued = 0;
+}
+
+    // e.g. status:3:100:2000
+int door_set_retry(door_t* door, const char* policy)
+{
+  if(!door || !policy)
+    return -1;
+
+  const char* colon = strchr(policy, ':');
+  if(!colon)
+    return -1;
+  int i;
+  for(i = 0; i < CMD_DOOR_MAX; ++i)
+    if(strlen(door_cmd_names[i]) == colon - policy && !strncmp(policy, door_cmd_names[i], colon - policy))
+      break;
+  if(i == CMD_DOOR_MAX)
+    return -1;
+
+  door_retry_t retry = { 0, DOOR_RETRY_BACKOFF_MS, DOOR_RETRY_DEADLINE_MS };
+  if(sscanf(colon + 1, "%u:%u:%u", &retry.attempts_, &retry.backoff_ms_, &retry.deadline_ms_) < 1)
+    return -1;
+  door->retry_[i] = retry;
+  return 0;
+}
+
+    // moves the head of cmd_q_ over to retry_q_ if the policy allows another attempt
+int door_retry(door_t* door)
+{
+  if(!door || !door->cmd_q_ || door->cmd_q_->cmd >= CMD_DOOR_MAX)
+    return 0;
+
+  cmd_t* cmd = door->cmd_q_;
+  door_retry_t* retry = &door->retry_[cmd->cmd];
+  if(cmd->retries + 1 >= retry->attempts_)
+    return 0;
+
+  u_int32_t backoff = retry->backoff_ms_ << (cmd->retries < 16 ? cmd->retries : 16);
+  struct timeval now, delta, deadline;
+  clock_now(&now);
+  delta.tv_sec = backoff / 1000;
+  delta.tv_usec = (backoff % 1000) * 1000;
+  timeradd(&now, &delta, &cmd->tv_retry);
+  delta.tv_sec = retry->deadline_ms_ / 1000;
+  delta.tv_usec = (retry->deadline_ms_ % 1000) * 1000;
+  timeradd(&cmd->tv_push, &delta, &deadline);
+  if(timercmp(&cmd->tv_retry, &deadline, >))
+    return 0;
+
+  door->cmd_q_ = cmd->next;
+  cmd->next = door->retry_q_;
+  door->retry_q_ = cmd;
+  cmd->retries++;
+  cmd->sent = 0;
+  return 1;
+}
+
+    // due commands go back to the head of their client's queue, the ones whose client left to cmd_q_
+int door_retry_due(door_t* door, struct timeval* timeout)
+{
+  if(!door || !door->retry_q_)
+    return 0;
+
+  int count = 0;
+  struct timeval now, left;
+  clock_now(&now);
+  cmd_t** cmd = &door->retry_q_;
+  while(*cmd) {
+    if(timercmp(&(*cmd)->tv_retry, &now, >)) {
+      timersub(&(*cmd)->tv_retry, &now, &left);
+      if(timeout && timercmp(&left, timeout, <))
+        *timeout = left;
+      cmd = &(*cmd)->next;
+      continue;
+    }
+
+    cmd_t* due = *cmd;
+    *cmd = due->next;
+    count++;
+    client_t* client = due->fd >= 0 ? client_find(door->clients_, due->fd) : NULL;
+    if(client) {
+      int prio = door->prio_[due->cmd];
+      due->next = client->cmd_q[prio];
+      client->cmd_q[prio] = due;
+      client->queued++;
+      door_activate(door, client, prio);
+    }
+    else {
+      cmd_t** last = &door->cmd_q_;
+      while(*last)
+        last = &(*last)->next;
+      due->next = NULL;
+      *last = due;
+    }
+  }
+  return count;
+}
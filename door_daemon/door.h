@@ -0,0 +1,125 @@
+/*
+ *  door_daemon
+ *
+ *  Copyright (C) 2009 Christian Pointner <equinox@spreadspace.org>
+ *
+ *  This file is part of door_daemon.
+ *
+ *  door_daemon is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  door_daemon is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with door_daemon. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DOOR_DAEMON_door_h_INCLUDED
+#define DOOR_DAEMON_door_h_INCLUDED
+
+#include <sys/time.h>
+
+#include "datatypes.h"
+#include "command_queue.h"
+#include "client_list.h"
+#include "door_state.h"
+#include "shm_state.h"
+#include "transport.h"
+#include "stats.h"
+
+// One door endpoint: the serial device of the firmware, the command socket
+// its clients connect to, its command queue, clients and state. All doors
+// are served by the same main loop, a door whose device fails is closed
+// and reopened after DOOR_REOPEN_S seconds without disturbing the others.
+// Doors are configured with -e name,device,socket[,state map]; without -e
+// there is a single door named 'door' made of -d, -s and -M. The index of
+// a door is its position in the configuration, history and journal
+// events are tagged with it. The device string selects the transport,
+// see transport.h.
+//
+// Door commands wait in the queue of the client which sent them, the
+// firmware only ever sees one command at a time. Whenever the door is
+// idle door_schedule() moves the next command over to cmd_q_: the most
+// urgent priority class with anything waiting wins, within a class the
+// clients take turns. Every command occupies the link for one round trip,
+// so deficit round robin with equal costs is plain round robin. Each class
+// keeps a list of clients with waiting commands, picking one is O(1).
+// Clients whose queue was emptied behind the scheduler's back (cancelled
+// opens, a failed door) stay in the list and are skipped on the way.
+// Commands without a client (fd -1) go to cmd_q_ directly. So do the
+// waiting commands of a client which disconnects before its turn, by
+// door_orphan_client(): an unlock from checkcard.pl must not get lost
+// because the script didn't wait for the answer. A client whose command
+// has to wait is told how many go before it, see door_ahead().
+
+#define DOOR_REOPEN_S 5
+
+// A command which expired or was refused with 'Error: Operation in
+// progress' may be tried again, configured per command type with
+// -y <cmd>:<attempts>[:<backoff ms>[:<deadline ms>]]. It waits in retry_q_
+// for backoff, 2*backoff, 4*backoff.. and goes back to the head of its
+// client's queue when it is due. The client only gets the final outcome.
+// Toggle is not idempotent: if the firmware saw the first attempt but its
+// answer got lost a retry toggles back.
+
+#define DOOR_RETRY_BACKOFF_MS 200
+#define DOOR_RETRY_DEADLINE_MS 5000
+
+struct door_retry_struct {
+  u_int32_t attempts_;              // 0 or 1 is never retry
+  u_int32_t backoff_ms_;
+  u_int32_t deadline_ms_;           // since the command arrived
+};
+typedef struct door_retry_struct door_retry_t;
+
+struct door_struct {
+  char* name_;
+  char* dev_;
+  char* sock_;
+  char* state_map_path_;
+  u_int32_t index_;
+  transport_t transport_;           // transport_.fd_ is -1 while the device is not open
+  int listen_fd_;
+  struct timeval reopen_;           // when to try to open the device again
+  cmd_t* cmd_q_;
+  client_t* clients_;
+  client_t* active_[CMD_PRIO_MAX];  // clients with waiting commands, by class
+  client_t* active_tail_[CMD_PRIO_MAX];
+  int prio_[CMD_DOOR_MAX];          // priority class of each door command
+  int cancel_opens_;                // a close cancels the waiting opens
+  int local_answers_;               // refuse commands like the firmware would, see door_state_admit()
+  door_retry_t retry_[CMD_DOOR_MAX];
+  cmd_t* retry_q_;
+  u_int32_t rate_;                  // per client commands per second, 0 is unlimited
+  u_int32_t burst_;
+  u_int32_t queue_max_;             // per client, 0 is unlimited
+  read_buffer_t buffer_;
+  door_state_t state_;
+  shm_map_t state_map_;
+  stats_door_t stats_;
+  u_int64_t event_seq_;             // last event of this door
+  struct door_struct* next_;
+};
+typedef struct door_struct door_t;
+
+int door_add(door_t** first, const char* name, const char* dev, const char* sock, const char* state_map);
+int door_add_config(door_t** first, const char* config);
+void door_clear(door_t** first);
+int door_open(door_t* door);
+void door_close(door_t* door);
+int door_set_priorities(door_t* door, const char* mapping);
+int door_push(door_t* door, client_t* client, int fd, cmd_id_t cmd, const char* param);
+cmd_t* door_schedule(door_t* door);
+u_int32_t door_ahead(door_t* door, client_t* client, cmd_id_t cmd);
+void door_forget_client(door_t* door, client_t* client);
+void door_orphan_client(door_t* door, client_t* client);
+int door_set_retry(door_t* door, const char* policy);
+int door_retry(door_t* door);
+int door_retry_due(door_t* door, struct timeval* timeout);
+
+#endif
@@ -0,0 +1,865 @@
+/*
+ *  door_daemon
+ *
+ *  Copyright (C) 2009 Christian Pointner <equinox@spreadspace.org>
+ *
+ *  This file is part of door_daemon.
+ *
+ *  door_daemon is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  door_daemon is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with door_daemon. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * door_bench: load generator for door_daemon
+ *
+ * Opens a number of command clients, which send a configurable mix of
+ * commands in a closed loop (one outstanding command each), and listener
+ * clients, which subscribe to all messages. Every toggle/open/close carries
+ * a unique parameter so the 'Request: ...' line a listener receives can be
+ * matched to the command that caused it, which gives the fan-out latency.
+ * One JSON object per run is appended to the output file.
+ *
+ * In soak mode (-I) the RSS, open fds and queue depth of the daemon and the
+ * latency percentiles of the last interval are sampled periodically and
+ * compared to the first sample. The run stops with exit code 3 as soon as
+ * one of them drifts beyond its limit. Client side faults (disconnects in
+ * the middle of a line, lines written in two parts, listeners which hardly
+ * read) can be mixed in, door_sim provides the faults on the serial side.
+ */
+
+#include "datatypes.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+enum bench_cmd_enum { BENCH_STATUS, BENCH_TOGGLE, BENCH_OPEN, BENCH_CLOSE, BENCH_LOG, BENCH_LISTEN, BENCH_CMD_MAX };
+typedef enum bench_cmd_enum bench_cmd_t;
+
+static const char* bench_cmd_names[BENCH_CMD_MAX] = { "status", "toggle", "open", "close", "log", "listen" };
+
+struct bench_samples_struct {
+  u_int32_t* values_;
+  u_int32_t count_;
+  u_int32_t size_;
+};
+typedef struct bench_samples_struct bench_samples_t;
+
+struct bench_client_struct {
+  int fd_;
+  int listener_;
+  int slow_;            // listener which reads only a few bytes per second
+  int waiting_;
+  u_int64_t sent_;
+  u_int64_t next_;
+  char buf_[256];
+  u_int32_t offset_;
+  char rest_[64];       // second half of a line which is written in two parts
+  int rest_len_;
+};
+typedef struct bench_client_struct bench_client_t;
+
+#define BENCH_SLOW_READ 64   // bytes per second a slow listener reads
+#define BENCH_STRIKES 3      // consecutive intervals queue depth or p99 may be too high
+#define BENCH_CTL_LEAD 250   // ms before a sample the daemon is asked for its stats
+
+struct bench_sample_struct {
+  u_int32_t elapsed_s_;
+  u_int32_t sent_;
+  long rss_kb_;
+  int fds_;
+  int clients_;         // connected clients as seen by the daemon
+  int queue_depth_;
+  u_int32_t p50_us_;
+  u_int32_t p99_us_;
+};
+typedef struct bench_sample_struct bench_sample_t;
+
+struct bench_soak_struct {
+  u_int32_t interval_ms_;
+  u_int32_t disconnect_rate_;
+  u_int32_t partial_rate_;
+  int slow_listeners_;
+  long max_rss_growth_kb_;
+  int max_fd_growth_;
+  int max_queue_;
+  u_int32_t max_p99_factor_;
+  u_int32_t p99_floor_us_;
+
+  int ctl_fd_;          // connection used for 'stats' queries
+  char ctl_buf_[256];
+  u_int32_t ctl_offset_;
+  int clients_;
+  int queue_depth_;
+
+  bench_sample_t* samples_;
+  u_int32_t count_;
+  u_int32_t window_start_;
+  int queue_strikes_;
+  int p99_strikes_;
+  u_int32_t disconnects_;
+  u_int32_t partials_;
+  u_int32_t reconnects_;
+  char drift_[128];
+};
+typedef struct bench_soak_struct bench_soak_t;
+
+#define BENCH_PENDING_MAX 4096
+
+struct bench_struct {
+  const char* sock_path_;
+  int clients_;
+  int listeners_;
+  u_int32_t mix_[BENCH_CMD_MAX];
+  u_int32_t mix_total_;
+  u_int32_t duration_ms_;
+  u_int32_t max_cmds_;
+  u_int32_t think_ms_;
+  u_int32_t timeout_ms_;
+  int reconnect_;
+  int pid_;
+  const char* out_path_;
+  const char* label_;
+
+  u_int32_t sent_[BENCH_CMD_MAX];
+  u_int32_t replies_;
+  u_int32_t timeouts_;
+  u_int32_t errors_;
+  u_int32_t listener_lines_;
+  u_int32_t connect_failures_;
+  bench_samples_t latency_;
+  bench_samples_t fanout_;
+  u_int64_t pending_[BENCH_PENDING_MAX];  // send time of toggle/open/close by request id
+  u_int32_t next_id_;
+
+  bench_soak_t soak_;
+};
+typedef struct bench_struct bench_t;
+
+struct bench_proc_struct {
+  double cpu_s_;
+  long rss_kb_;
+  long rss_max_kb_;
+};
+typedef struct bench_proc_struct bench_proc_t;
+
+u_int64_t bench_now_us()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (u_int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+int bench_samples_add(bench_samples_t* samples, u_int32_t value)
+{
+  if(samples->count_ >= samples->size_) {
+    u_int32_t size = samples->size_ ? samples->size_ * 2 : 1024;
+    u_int32_t* values = realloc(samples->values_, size * sizeof(u_int32_t));
+    if(!values)
+      return -2;
+    samples->values_ = values;
+    samples->size_ = size;
+  }
+  samples->values_[samples->count_++] = value;
+  return 0;
+}
+
+static int bench_cmp_u32(const void* a, const void* b)
+{
+  u_int32_t x = *(const u_int32_t*)a, y = *(const u_int32_t*)b;
+  return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+u_int32_t bench_samples_quantile(bench_samples_t* samples, double q)
+{
+  if(!samples->count_)
+    return 0;
+  u_int32_t idx = (u_int32_t)(q * samples->count_);
+  if(idx >= samples->count_)
+    idx = samples->count_ - 1;
+  return samples->values_[idx];
+}
+
+void bench_samples_print(FILE* out, const char* name, bench_samples_t* samples)
+{
+  qsort(samples->values_, samples->count_, sizeof(u_int32_t), bench_cmp_u32);
+  u_int64_t sum = 0;
+  u_int32_t i;
+  for(i = 0; i < samples->count_; ++i)
+    sum += samples->values_[i];
+  fprintf(out, "\"%s\":{\"count\":%u,\"mean\":%llu,\"p50\":%u,\"p99\":%u,\"p999\":%u,\"max\":%u}", name, samples->count_,
+          samples->count_ ? (unsigned long long)(sum / samples->count_) : 0ULL,
+          bench_samples_quantile(samples, 0.5), bench_samples_quantile(samples, 0.99),
+          bench_samples_quantile(samples, 0.999), samples->count_ ? samples->values_[samples->count_ - 1] : 0);
+}
+
+int bench_proc_sample(int pid, bench_proc_t* proc)
+{
+  proc->cpu_s_ = 0;
+  proc->rss_kb_ = 0;
+  proc->rss_max_kb_ = 0;
+  if(pid <= 0)
+    return -1;
+
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+  FILE* f = fopen(path, "r");
+  if(!f)
+    return -1;
+  unsigned long utime = 0, stime = 0;
+  int ret = fscanf(f, "%*d %*s %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime);
+  fclose(f);
+  if(ret != 2)
+    return -1;
+  proc->cpu_s_ = (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+
+  snprintf(path, sizeof(path), "/proc/%d/status", pid);
+  f = fopen(path, "r");
+  if(!f)
+    return -1;
+  char line[128];
+  while(fgets(line, sizeof(line), f)) {
+    if(!strncmp(line, "VmRSS:", 6))
+      proc->rss_kb_ = atol(line + 6);
+    else if(!strncmp(line, "VmHWM:", 6))
+      proc->rss_max_kb_ = atol(line + 6);
+  }
+  fclose(f);
+  return 0;
+}
+
+int bench_connect(bench_t* bench)
+{
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(fd < 0)
+    return -1;
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, bench->sock_path_, sizeof(addr.sun_path) - 1);
+      // non-blocking: fail instead of waiting while the daemon doesn't accept
+  fcntl(fd, F_SETFL, O_NONBLOCK);
+  if(connect(fd, (struct sockaddr*)&addr, sizeof(addr))) {
+    close(fd);
+    bench->connect_failures_++;
+    return -1;
+  }
+  return fd;
+}
+
+int bench_count_fds(int pid)
+{
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/fd", pid);
+  DIR* dir = opendir(path);
+  if(!dir)
+    return -1;
+  int cnt = 0;
+  struct dirent* entry;
+  while((entry = readdir(dir)))
+    if(entry->d_name[0] != '.')
+      cnt++;
+  closedir(dir);
+  return cnt;
+}
+
+int bench_write(int fd, const char* buf, int len)
+{
+  int offset = 0;
+  while(offset < len) {
+    int ret = write(fd, &buf[offset], len - offset);
+    if(ret < 0) {
+      if(errno == EINTR || errno == EAGAIN)
+        continue;
+      return -1;
+    }
+    offset += ret;
+  }
+  return 0;
+}
+
+bench_cmd_t bench_pick_cmd(bench_t* bench)
+{
+  u_int32_t r = rand() % bench->mix_total_;
+  int i;
+  for(i = 0; i < BENCH_CMD_MAX; ++i) {
+    if(r < bench->mix_[i])
+      return i;
+    r -= bench->mix_[i];
+  }
+  return BENCH_STATUS;
+}
+
+int bench_send(bench_t* bench, bench_client_t* client, u_int64_t now)
+{
+  if(client->fd_ < 0) {
+    client->fd_ = bench_connect(bench);
+    if(client->fd_ < 0)
+      return -1;
+  }
+
+  char buf[64];
+  int len;
+  bench_cmd_t cmd = bench_pick_cmd(bench);
+  switch(cmd) {
+  case BENCH_TOGGLE:
+  case BENCH_OPEN:
+  case BENCH_CLOSE: {
+    u_int32_t id = bench->next_id_++;
+    bench->pending_[id % BENCH_PENDING_MAX] = now;
+    len = snprintf(buf, sizeof(buf), "%s bench-%u\n", bench_cmd_names[cmd], id);
+    break;
+  }
+  case BENCH_LOG: len = snprintf(buf, sizeof(buf), "log bench\n"); break;
+  case BENCH_LISTEN: len = snprintf(buf, sizeof(buf), "listen request\n"); break;
+  default: len = snprintf(buf, sizeof(buf), "%s\n", bench_cmd_names[cmd]); break;
+  }
+
+  bench_soak_t* soak = &bench->soak_;
+  if(soak->disconnect_rate_ && (u_int32_t)(rand() % 100) < soak->disconnect_rate_) {
+    bench_write(client->fd_, buf, len / 2);
+    close(client->fd_);
+    client->fd_ = -1;
+    client->offset_ = 0;
+    soak->disconnects_++;
+    return 0;
+  }
+  if(soak->partial_rate_ && (u_int32_t)(rand() % 100) < soak->partial_rate_ && len > 1) {
+    client->rest_len_ = len - len / 2;
+    memcpy(client->rest_, &buf[len / 2], client->rest_len_);
+    len /= 2;
+    soak->partials_++;
+  }
+
+  if(bench_write(client->fd_, buf, len)) {
+    close(client->fd_);
+    client->fd_ = -1;
+    client->rest_len_ = 0;
+    return -1;
+  }
+  bench->sent_[cmd]++;
+  client->sent_ = now;
+  client->waiting_ = (cmd != BENCH_LOG && cmd != BENCH_LISTEN);
+  if(!client->waiting_)
+    client->next_ = now + bench->think_ms_ * 1000;
+  return 0;
+}
+
+void bench_line(bench_t* bench, bench_client_t* client, const char* line, u_int64_t now)
+{
+  if(client->listener_) {
+    bench->listener_lines_++;
+    unsigned int id;
+    if(sscanf(line, "Request: %*s bench-%u", &id) == 1 && id < bench->next_id_ && bench->next_id_ - id <= BENCH_PENDING_MAX)
+      bench_samples_add(&bench->fanout_, (u_int32_t)(now - bench->pending_[id % BENCH_PENDING_MAX]));
+    return;
+  }
+
+      // the daemon's notice that the command has to wait, the answer comes later
+  if(!client->waiting_ || !strncmp(line, "Delayed:", 8))
+    return;
+
+  bench->replies_++;
+  if(!strncmp(line, "Error", 5))
+    bench->errors_++;
+  bench_samples_add(&bench->latency_, (u_int32_t)(now - client->sent_));
+  client->waiting_ = 0;
+  client->next_ = now + bench->think_ms_ * 1000;
+  if(bench->reconnect_) {
+    close(client->fd_);
+    client->fd_ = -1;
+  }
+}
+
+int bench_read(bench_t* bench, bench_client_t* client, u_int64_t now)
+{
+  char buf[512];
+  int len = read(client->fd_, buf, client->slow_ ? BENCH_SLOW_READ : sizeof(buf));
+  if(len == 0 || (len < 0 && errno != EAGAIN && errno != EINTR)) {
+    close(client->fd_);
+    client->fd_ = -1;
+    client->waiting_ = 0;
+    client->offset_ = 0;
+    client->rest_len_ = 0;
+    return -1;
+  }
+  if(client->slow_)
+    client->next_ = now + 1000000;
+
+  int i;
+  for(i = 0; i < len; ++i) {
+    if(buf[i] == '\n') {
+      client->buf_[client->offset_] = 0;
+      bench_line(bench, client, client->buf_, now);
+      client->offset_ = 0;
+    }
+    else if(client->offset_ < sizeof(client->buf_) - 1)
+      client->buf_[client->offset_++] = buf[i];
+  }
+  return 0;
+}
+
+void bench_soak_ctl_read(bench_t* bench)
+{
+  bench_soak_t* soak = &bench->soak_;
+  char buf[1024];
+  int len = read(soak->ctl_fd_, buf, sizeof(buf));
+  if(len == 0 || (len < 0 && errno != EAGAIN && errno != EINTR)) {
+    close(soak->ctl_fd_);
+    soak->ctl_fd_ = -1;
+    soak->ctl_offset_ = 0;
+    return;
+  }
+
+  int i;
+  for(i = 0; i < len; ++i) {
+    if(buf[i] != '\n') {
+      if(soak->ctl_offset_ < sizeof(soak->ctl_buf_) - 1)
+        soak->ctl_buf_[soak->ctl_offset_++] = buf[i];
+      continue;
+    }
+    soak->ctl_buf_[soak->ctl_offset_] = 0;
+    soak->ctl_offset_ = 0;
+        // the queue depth is per door, all doors together count
+    if(!strcmp(soak->ctl_buf_, "# TYPE door_daemon_queue_depth gauge"))
+      soak->queue_depth_ = 0;
+    else if(!strncmp(soak->ctl_buf_, "door_daemon_queue_depth{", 24)) {
+      char* value = strstr(soak->ctl_buf_, "} ");
+      if(value)
+        soak->queue_depth_ += atoi(&value[2]);
+    }
+    else if(!strncmp(soak->ctl_buf_, "door_daemon_clients ", 20))
+      soak->clients_ = atoi(&soak->ctl_buf_[20]);
+  }
+}
+
+/* takes a sample and checks it against the first one, returns -1 on drift */
+int bench_soak_sample(bench_t* bench, u_int64_t elapsed_us, u_int32_t sent)
+{
+  bench_soak_t* soak = &bench->soak_;
+  bench_sample_t* samples = realloc(soak->samples_, (soak->count_ + 1) * sizeof(bench_sample_t));
+  if(!samples)
+    return 0;
+  soak->samples_ = samples;
+  bench_sample_t* sample = &samples[soak->count_];
+
+  bench_proc_t proc;
+  if(bench_proc_sample(bench->pid_, &proc)) {
+    snprintf(soak->drift_, sizeof(soak->drift_), "daemon process %d is gone", bench->pid_);
+    return -1;
+  }
+  sample->elapsed_s_ = elapsed_us / 1000000;
+  sample->sent_ = sent;
+  sample->rss_kb_ = proc.rss_kb_;
+  sample->fds_ = bench_count_fds(bench->pid_);
+  sample->clients_ = soak->clients_;
+  sample->queue_depth_ = soak->queue_depth_;
+
+  bench_samples_t window;
+  window.count_ = bench->latency_.count_ - soak->window_start_;
+  window.size_ = window.count_;
+  window.values_ = malloc((window.count_ + 1) * sizeof(u_int32_t));
+  if(window.values_) {
+    memcpy(window.values_, &bench->latency_.values_[soak->window_start_], window.count_ * sizeof(u_int32_t));
+    qsort(window.values_, window.count_, sizeof(u_int32_t), bench_cmp_u32);
+    sample->p50_us_ = bench_samples_quantile(&window, 0.5);
+    sample->p99_us_ = bench_samples_quantile(&window, 0.99);
+    free(window.values_);
+  }
+  soak->window_start_ = bench->latency_.count_;
+  soak->count_++;
+
+  fprintf(stderr, "door_bench: t=%us sent=%u rss=%ldkB fds=%d clients=%d queue=%d p50=%uus p99=%uus\n",
+          sample->elapsed_s_, sample->sent_, sample->rss_kb_, sample->fds_, sample->clients_,
+          sample->queue_depth_, sample->p50_us_, sample->p99_us_);
+
+  if(soak->count_ < 2)
+    return 0;
+
+  bench_sample_t* base = &samples[0];
+  if(sample->rss_kb_ - base->rss_kb_ > soak->max_rss_growth_kb_)
+    snprintf(soak->drift_, sizeof(soak->drift_), "rss grew from %ld to %ld kB", base->rss_kb_, sample->rss_kb_);
+  else if((sample->fds_ - sample->clients_) - (base->fds_ - base->clients_) > soak->max_fd_growth_)
+    snprintf(soak->drift_, sizeof(soak->drift_), "fds not owned by clients grew from %d to %d",
+             base->fds_ - base->clients_, sample->fds_ - sample->clients_);
+  else {
+    soak->queue_strikes_ = sample->queue_depth_ > soak->max_queue_ ? soak->queue_strikes_ + 1 : 0;
+    u_int32_t limit = base->p99_us_ * soak->max_p99_factor_;
+    if(limit < soak->p99_floor_us_)
+      limit = soak->p99_floor_us_;
+    soak->p99_strikes_ = sample->p99_us_ > limit ? soak->p99_strikes_ + 1 : 0;
+
+    if(soak->queue_strikes_ >= BENCH_STRIKES)
+      snprintf(soak->drift_, sizeof(soak->drift_), "queue depth %d above %d for %d intervals",
+               sample->queue_depth_, soak->max_queue_, soak->queue_strikes_);
+    else if(soak->p99_strikes_ >= BENCH_STRIKES)
+      snprintf(soak->drift_, sizeof(soak->drift_), "p99 latency %u us above %u us for %d intervals",
+               sample->p99_us_, limit, soak->p99_strikes_);
+  }
+  return soak->drift_[0] ? -1 : 0;
+}
+
+void bench_soak_print(FILE* out, bench_soak_t* soak)
+{
+  fprintf(out, ",\"soak\":{\"interval_s\":%u,\"disconnects\":%u,\"partial_lines\":%u,\"slow_listeners\":%d,\"reconnects\":%u,",
+          soak->interval_ms_ / 1000, soak->disconnects_, soak->partials_, soak->slow_listeners_, soak->reconnects_);
+  fprintf(out, "\"drift\":\"%s\",\"samples\":[", soak->drift_[0] ? soak->drift_ : "none");
+  u_int32_t i;
+  for(i = 0; i < soak->count_; ++i) {
+    bench_sample_t* s = &soak->samples_[i];
+    fprintf(out, "%s{\"t\":%u,\"sent\":%u,\"rss_kb\":%ld,\"fds\":%d,\"clients\":%d,\"queue\":%d,\"p50\":%u,\"p99\":%u}",
+            i ? "," : "", s->elapsed_s_, s->sent_, s->rss_kb_, s->fds_, s->clients_, s->queue_depth_, s->p50_us_, s->p99_us_);
+  }
+  fprintf(out, "]}");
+}
+
+int bench_parse_mix(bench_t* bench, const char* mix)
+{
+  memset(bench->mix_, 0, sizeof(bench->mix_));
+  bench->mix_total_ = 0;
+  const char* ptr = mix;
+  while(ptr && *ptr) {
+    int i;
+    for(i = 0; i < BENCH_CMD_MAX; ++i) {
+      size_t len = strlen(bench_cmd_names[i]);
+      if(!strncmp(ptr, bench_cmd_names[i], len) && ptr[len] == ':')
+        break;
+    }
+    if(i >= BENCH_CMD_MAX)
+      return -1;
+    ptr = strchr(ptr, ':') + 1;
+    bench->mix_[i] = atoi(ptr);
+    bench->mix_total_ += bench->mix_[i];
+    ptr = strchr(ptr, ',');
+    if(ptr)
+      ptr++;
+  }
+  return bench->mix_total_ ? 0 : -1;
+}
+
+void bench_report(bench_t* bench, const char* mix, u_int64_t elapsed_us, bench_proc_t* before, bench_proc_t* after)
+{
+  FILE* out = stdout;
+  if(bench->out_path_) {
+    out = fopen(bench->out_path_, "a");
+    if(!out) {
+      fprintf(stderr, "door_bench: unable to open '%s': %s\n", bench->out_path_, strerror(errno));
+      out = stdout;
+    }
+  }
+
+  u_int32_t sent = 0;
+  int i;
+  for(i = 0; i < BENCH_CMD_MAX; ++i)
+    sent += bench->sent_[i];
+  double elapsed = elapsed_us / 1e6;
+
+  fprintf(out, "{\"time\":%ld,\"label\":\"%s\",\"clients\":%d,\"listeners\":%d,\"mix\":\"%s\",\"reconnect\":%d,",
+          (long)time(NULL), bench->label_ ? bench->label_ : "", bench->clients_, bench->listeners_, mix, bench->reconnect_);
+  fprintf(out, "\"duration_s\":%.3f,\"sent\":%u,\"replies\":%u,\"errors\":%u,\"timeouts\":%u,\"connect_failures\":%u,",
+          elapsed, sent, bench->replies_, bench->errors_, bench->timeouts_, bench->connect_failures_);
+  fprintf(out, "\"throughput_per_s\":%.1f,\"listener_lines\":%u,", elapsed > 0 ? sent / elapsed : 0.0, bench->listener_lines_);
+  fprintf(out, "\"sent_by_cmd\":{");
+  for(i = 0; i < BENCH_CMD_MAX; ++i)
+    fprintf(out, "%s\"%s\":%u", i ? "," : "", bench_cmd_names[i], bench->sent_[i]);
+  fprintf(out, "},");
+  bench_samples_print(out, "latency_us", &bench->latency_);
+  fprintf(out, ",");
+  bench_samples_print(out, "fanout_latency_us", &bench->fanout_);
+  if(bench->pid_ > 0)
+    fprintf(out, ",\"daemon\":{\"cpu_s\":%.3f,\"cpu_percent\":%.1f,\"rss_kb\":%ld,\"rss_max_kb\":%ld}",
+            after->cpu_s_ - before->cpu_s_, elapsed > 0 ? 100.0 * (after->cpu_s_ - before->cpu_s_) / elapsed : 0.0,
+            after->rss_kb_, after->rss_max_kb_);
+  if(bench->soak_.interval_ms_)
+    bench_soak_print(out, &bench->soak_);
+  fprintf(out, "}\n");
+
+  if(out != stdout)
+    fclose(out);
+}
+
+void bench_print_usage()
+{
+  printf("USAGE:\n");
+  printf("door_bench [-h|--help]                         prints this...\n");
+  printf("           [-s|--socket] <unix sock>           the command socket of the daemon\n");
+  printf("           [-c|--clients] <n>                  number of command clients (default: 4)\n");
+  printf("           [-l|--listeners] <n>                number of listener clients (default: 2)\n");
+  printf("           [-m|--mix] <cmd>:<weight>[,..]      command mix, cmd is one of status, toggle, open, close,\n");
+  printf("                                               log or listen (default: status:80,toggle:10,log:10)\n");
+  printf("           [-t|--time] <seconds>               duration of the run (default: 10)\n");
+  printf("           [-n|--count] <n>                    stop after this many commands\n");
+  printf("           [-w|--think] <ms>                   pause of each client between commands (default: 0)\n");
+  printf("           [-T|--timeout] <ms>                 give up waiting for a reply after this (default: 2000)\n");
+  printf("           [-R|--reconnect]                    open a new connection for every command\n");
+  printf("           [-p|--pid] <pid>                    sample cpu time and memory of this daemon process\n");
+  printf("           [-o|--output] <file>                append the result as a JSON line to this file\n");
+  printf("           [-L|--label] <label>                label stored with the result, e.g. a git revision\n");
+  printf("           [-I|--soak] <seconds>               sample the daemon (needs -p) this often and stop on drift\n");
+  printf("           [-X|--disconnect-rate] <percent>    chance to write half a command and disconnect\n");
+  printf("           [-Y|--partial-rate] <percent>       chance to write a command in two parts\n");
+  printf("           [-W|--slow-listeners] <n>           listeners which read only %d bytes per second\n", BENCH_SLOW_READ);
+  printf("           [--max-rss-growth] <kB>             allowed rss growth in soak mode (default: 1024)\n");
+  printf("           [--max-fd-growth] <n>               allowed growth of fds not owned by clients (default: 2)\n");
+  printf("           [--max-queue] <n>                   allowed queue depth (default: 2 * clients + 4)\n");
+  printf("           [--max-p99-factor] <n>              allowed p99 latency relative to the first sample (default: 10)\n");
+}
+
+int main(int argc, char* argv[])
+{
+  bench_t bench;
+  memset(&bench, 0, sizeof(bench));
+  bench.sock_path_ = "/var/run/door_daemon/cmd.sock";
+  bench.clients_ = 4;
+  bench.listeners_ = 2;
+  bench.duration_ms_ = 10000;
+  bench.timeout_ms_ = 2000;
+  bench.soak_.max_rss_growth_kb_ = 1024;
+  bench.soak_.max_fd_growth_ = 2;
+  bench.soak_.max_queue_ = -1;
+  bench.soak_.max_p99_factor_ = 10;
+  bench.soak_.p99_floor_us_ = 100000;
+  bench.soak_.ctl_fd_ = -1;
+  const char* mix = "status:80,toggle:10,log:10";
+
+  int i;
+  for(i = 1; i < argc; ++i) {
+    const char* str = argv[i];
+    if(!strcmp(str, "-h") || !strcmp(str, "--help")) {
+      bench_print_usage();
+      return 0;
+    }
+    else if(!strcmp(str, "-R") || !strcmp(str, "--reconnect"))
+      bench.reconnect_ = 1;
+    else if(i + 1 >= argc) {
+      bench_print_usage();
+      return 1;
+    }
+    else if(!strcmp(str, "-s") || !strcmp(str, "--socket"))
+      bench.sock_path_ = argv[++i];
+    else if(!strcmp(str, "-c") || !strcmp(str, "--clients"))
+      bench.clients_ = atoi(argv[++i]);
+    else if(!strcmp(str, "-l") || !strcmp(str, "--listeners"))
+      bench.listeners_ = atoi(argv[++i]);
+    else if(!strcmp(str, "-m") || !strcmp(str, "--mix"))
+      mix = argv[++i];
+    else if(!strcmp(str, "-t") || !strcmp(str, "--time"))
+      bench.duration_ms_ = atoi(argv[++i]) * 1000;
+    else if(!strcmp(str, "-n") || !strcmp(str, "--count"))
+      bench.max_cmds_ = atoi(argv[++i]);
+    else if(!strcmp(str, "-w") || !strcmp(str, "--think"))
+      bench.think_ms_ = atoi(argv[++i]);
+    else if(!strcmp(str, "-T") || !strcmp(str, "--timeout"))
+      bench.timeout_ms_ = atoi(argv[++i]);
+    else if(!strcmp(str, "-p") || !strcmp(str, "--pid"))
+      bench.pid_ = atoi(argv[++i]);
+    else if(!strcmp(str, "-o") || !strcmp(str, "--output"))
+      bench.out_path_ = argv[++i];
+    else if(!strcmp(str, "-L") || !strcmp(str, "--label"))
+      bench.label_ = argv[++i];
+    else if(!strcmp(str, "-I") || !strcmp(str, "--soak"))
+      bench.soak_.interval_ms_ = atoi(argv[++i]) * 1000;
+    else if(!strcmp(str, "-X") || !strcmp(str, "--disconnect-rate"))
+      bench.soak_.disconnect_rate_ = atoi(argv[++i]);
+    else if(!strcmp(str, "-Y") || !strcmp(str, "--partial-rate"))
+      bench.soak_.partial_rate_ = atoi(argv[++i]);
+    else if(!strcmp(str, "-W") || !strcmp(str, "--slow-listeners"))
+      bench.soak_.slow_listeners_ = atoi(argv[++i]);
+    else if(!strcmp(str, "--max-rss-growth"))
+      bench.soak_.max_rss_growth_kb_ = atol(argv[++i]);
+    else if(!strcmp(str, "--max-fd-growth"))
+      bench.soak_.max_fd_growth_ = atoi(argv[++i]);
+    else if(!strcmp(str, "--max-queue"))
+      bench.soak_.max_queue_ = atoi(argv[++i]);
+    else if(!strcmp(str, "--max-p99-factor"))
+      bench.soak_.max_p99_factor_ = atoi(argv[++i]);
+    else {
+      bench_print_usage();
+      return 1;
+    }
+  }
+  if(bench_parse_mix(&bench, mix)) {
+    fprintf(stderr, "door_bench: invalid command mix '%s'\n", mix);
+    return 1;
+  }
+  if(bench.clients_ < 0 || bench.listeners_ < 0 || bench.clients_ + bench.listeners_ <= 0 ||
+     (bench.soak_.interval_ms_ && bench.pid_ <= 0)) {
+    bench_print_usage();
+    return 1;
+  }
+  if(bench.soak_.max_queue_ < 0)
+    bench.soak_.max_queue_ = 2 * bench.clients_ + 4;
+
+  int total = bench.clients_ + bench.listeners_ + bench.soak_.slow_listeners_;
+  bench_client_t* clients = calloc(total, sizeof(bench_client_t));
+  struct pollfd* fds = calloc(total + 1, sizeof(struct pollfd));
+  if(!clients || !fds) {
+    fprintf(stderr, "door_bench: memory error\n");
+    return 2;
+  }
+
+  for(i = 0; i < total; ++i) {
+    clients[i].listener_ = i >= bench.clients_;
+    clients[i].slow_ = i >= bench.clients_ + bench.listeners_;
+    clients[i].fd_ = -1;
+    int tries;
+    for(tries = 0; tries < 100 && clients[i].fd_ < 0 && (clients[i].listener_ || !bench.reconnect_); ++tries) {
+      clients[i].fd_ = bench_connect(&bench);
+      if(clients[i].fd_ < 0)
+        usleep(20000);  // the daemon's listen backlog is small
+    }
+    if(clients[i].listener_) {
+      if(clients[i].fd_ < 0 || bench_write(clients[i].fd_, "listen\n", 7)) {
+        fprintf(stderr, "door_bench: unable to connect to '%s': %s\n", bench.sock_path_, strerror(errno));
+        return 1;
+      }
+    }
+  }
+  usleep(100000);
+
+  bench_proc_t before, after;
+  bench_proc_sample(bench.pid_, &before);
+
+  u_int64_t start = bench_now_us();
+  u_int64_t end = start + (u_int64_t)bench.duration_ms_ * 1000;
+  u_int64_t next_sample = bench.soak_.interval_ms_ ? start + (u_int64_t)bench.soak_.interval_ms_ * 1000 : 0;
+  u_int64_t next_query = next_sample ? next_sample - BENCH_CTL_LEAD * 1000 : 0;
+  u_int32_t sent_total = 0;
+  int ret = 0;
+  for(;;) {
+    u_int64_t now = bench_now_us();
+    if(now >= end || (bench.max_cmds_ && sent_total >= bench.max_cmds_))
+      break;
+
+    u_int64_t next_wakeup = end;
+    if(next_sample) {
+      if(now >= next_query) {
+        if(bench.soak_.ctl_fd_ < 0)
+          bench.soak_.ctl_fd_ = bench_connect(&bench);
+        if(bench.soak_.ctl_fd_ >= 0 && bench_write(bench.soak_.ctl_fd_, "stats\n", 6)) {
+          close(bench.soak_.ctl_fd_);
+          bench.soak_.ctl_fd_ = -1;
+        }
+        next_query = next_sample + (u_int64_t)bench.soak_.interval_ms_ * 1000 - BENCH_CTL_LEAD * 1000;
+      }
+      if(now >= next_sample) {
+        if(bench_soak_sample(&bench, now - start, sent_total)) {
+          fprintf(stderr, "door_bench: drift detected: %s\n", bench.soak_.drift_);
+          ret = 3;
+          break;
+        }
+        next_sample += (u_int64_t)bench.soak_.interval_ms_ * 1000;
+      }
+      if(next_query < next_wakeup)
+        next_wakeup = next_query;
+      if(next_sample < next_wakeup)
+        next_wakeup = next_sample;
+    }
+
+    for(i = 0; i < bench.clients_; ++i) {
+      bench_client_t* client = &clients[i];
+      if(client->rest_len_ && client->fd_ >= 0 && now - client->sent_ >= 1000) {
+        if(bench_write(client->fd_, client->rest_, client->rest_len_)) {
+          close(client->fd_);
+          client->fd_ = -1;
+          client->waiting_ = 0;
+        }
+        client->rest_len_ = 0;
+      }
+      if(client->waiting_ && now - client->sent_ >= (u_int64_t)bench.timeout_ms_ * 1000) {
+        bench.timeouts_++;
+        client->waiting_ = 0;
+        client->next_ = now;
+      }
+      if(!client->waiting_ && !client->rest_len_ && client->next_ <= now && (!bench.max_cmds_ || sent_total < bench.max_cmds_)) {
+        if(!bench_send(&bench, client, now))
+          sent_total++;
+        else
+          client->next_ = now + 100000;
+      }
+      if(client->rest_len_ && client->sent_ + 1000 < next_wakeup)
+        next_wakeup = client->sent_ + 1000;
+      if(client->waiting_ && client->sent_ + (u_int64_t)bench.timeout_ms_ * 1000 < next_wakeup)
+        next_wakeup = client->sent_ + (u_int64_t)bench.timeout_ms_ * 1000;
+      else if(!client->waiting_ && client->next_ < next_wakeup)
+        next_wakeup = client->next_;
+    }
+
+        // listeners get dropped when the daemon reopens the door
+    for(; i < total; ++i) {
+      bench_client_t* client = &clients[i];
+      if(client->fd_ < 0 && client->next_ <= now) {
+        client->fd_ = bench_connect(&bench);
+        if(client->fd_ >= 0 && bench_write(client->fd_, "listen\n", 7)) {
+          close(client->fd_);
+          client->fd_ = -1;
+        }
+        if(client->fd_ < 0)
+          client->next_ = now + 100000;
+        else
+          bench.soak_.reconnects_++;
+      }
+      if((client->fd_ < 0 || client->slow_) && client->next_ > now && client->next_ < next_wakeup)
+        next_wakeup = client->next_;
+    }
+
+    for(i = 0; i < total; ++i) {
+      fds[i].fd = (clients[i].slow_ && clients[i].next_ > now) ? -1 : clients[i].fd_;
+      fds[i].events = POLLIN;
+      fds[i].revents = 0;
+    }
+    fds[total].fd = bench.soak_.ctl_fd_;
+    fds[total].events = POLLIN;
+    fds[total].revents = 0;
+
+    int timeout = next_wakeup > now ? (int)((next_wakeup - now + 999) / 1000) : 0;
+    int cnt = poll(fds, total + 1, timeout);
+    if(cnt < 0 && errno != EINTR) {
+      fprintf(stderr, "door_bench: poll error: %s\n", strerror(errno));
+      break;
+    }
+    now = bench_now_us();
+    for(i = 0; cnt > 0 && i < total; ++i) {
+      if(fds[i].revents & (POLLIN | POLLHUP | POLLERR))
+        bench_read(&bench, &clients[i], now);
+    }
+    if(cnt > 0 && (fds[total].revents & (POLLIN | POLLHUP | POLLERR)))
+      bench_soak_ctl_read(&bench);
+  }
+  u_int64_t elapsed = bench_now_us() - start;
+
+  bench_proc_sample(bench.pid_, &after);
+  bench_report(&bench, mix, elapsed, &before, &after);
+
+  for(i = 0; i < total; ++i)
+    if(clients[i].fd_ >= 0)
+      close(clients[i].fd_);
+  if(bench.soak_.ctl_fd_ >= 0)
+    close(bench.soak_.ctl_fd_);
+  free(clients);
+  free(fds);
+  free(bench.latency_.values_);
+  free(bench.fanout_.values_);
+  free(bench.soak_.samples_);
+  return ret;
+}
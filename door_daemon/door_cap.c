@@ -0,0 +1,477 @@
+/*
+ *  door_daemon
+ *
+ *  Copyright (C) 2009 Christian Pointner <equinox@spreadspace.org>
+ *
+ *  This file is part of door_daemon.
+ *
+ *  door_daemon is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  door_daemon is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with door_daemon. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * door_cap: reads the wire capture written by door_daemon -w <file>
+ *
+ *   door_cap info <file>        header and fill level of the ring
+ *   door_cap dump <file>        hex and ascii dump of all records
+ *   door_cap replay <file>      play the bytes received from the door back
+ *                               on a pty, with the original timing
+ *   door_cap tap <socket>       watch the live byte stream of a running
+ *                               daemon ('listen raw'), no capture file needed
+ *
+ * The capture may be read while the daemon is writing to it. Records which
+ * get overwritten while they are dumped are skipped.
+ */
+
+#include "datatypes.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "capture.h"
+#include "pty.h"
+#include "tap.h"
+
+#define CAP_LINE_BYTES 16
+
+static char cap_hex[256][3];
+static char cap_ascii[256];
+
+static volatile sig_atomic_t cap_done = 0;
+
+static void cap_sig_handler(int sig)
+{
+  cap_done = 1;
+}
+
+static void cap_init_tables()
+{
+  static const char digits[] = "0123456789ABCDEF";
+  int i;
+  for(i = 0; i < 256; ++i) {
+    cap_hex[i][0] = digits[i >> 4];
+    cap_hex[i][1] = digits[i & 0x0F];
+    cap_hex[i][2] = ' ';
+    cap_ascii[i] = (i >= 0x20 && i < 0x7F) ? i : '.';
+  }
+}
+
+struct cap_dump_struct {
+  int hex_;
+  int dirs_;                  // bitmask of (1 << capture_dir_t)
+  int have_offset_;
+  int64_t offset_us_;
+};
+typedef struct cap_dump_struct cap_dump_t;
+
+static void cap_print_time(cap_dump_t* dump, u_int64_t time_us)
+{
+  if(!dump->have_offset_) {
+    printf("+%llu.%06u", (unsigned long long)(time_us / 1000000), (unsigned int)(time_us % 1000000));
+    return;
+  }
+
+  int64_t real = (int64_t)time_us + dump->offset_us_;
+  time_t sec = real / 1000000;
+  struct tm tm;
+  char buf[32];
+  localtime_r(&sec, &tm);
+  strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm);
+  printf("%s.%06u", buf, (unsigned int)(real % 1000000));
+}
+
+static void cap_print_hex(const u_int8_t* data, u_int32_t len)
+{
+  char line[8 + CAP_LINE_BYTES * 3 + CAP_LINE_BYTES + 8];
+  u_int32_t off;
+  for(off = 0; off < len; off += CAP_LINE_BYTES) {
+    u_int32_t n = len - off < CAP_LINE_BYTES ? len - off : CAP_LINE_BYTES;
+    char* p = line;
+    *p++ = ' ';
+    *p++ = ' ';
+    *p++ = cap_hex[(off >> 8) & 0xFF][0];
+    *p++ = cap_hex[(off >> 8) & 0xFF][1];
+    *p++ = cap_hex[off & 0xFF][0];
+    *p++ = cap_hex[off & 0xFF][1];
+    *p++ = ' ';
+    *p++ = ' ';
+    u_int32_t i;
+    for(i = 0; i < CAP_LINE_BYTES; ++i) {
+      if(i < n)
+        memcpy(p, cap_hex[data[off + i]], 3);
+      else
+        memset(p, ' ', 3);
+      p += 3;
+    }
+    *p++ = ' ';
+    *p++ = '|';
+    for(i = 0; i < n; ++i)
+      *p++ = cap_ascii[data[off + i]];
+    *p++ = '|';
+    *p++ = '\n';
+    fwrite(line, 1, p - line, stdout);
+  }
+}
+
+static void cap_print_text(const u_int8_t* data, u_int32_t len)
+{
+  u_int32_t i;
+  putchar(' ');
+  for(i = 0; i < len; ++i) {
+    u_int8_t c = data[i];
+    if(c == '\r')
+      fputs("\\r", stdout);
+    else if(c == '\n')
+      fputs("\\n", stdout);
+    else if(c == '\\')
+      fputs("\\\\", stdout);
+    else if(cap_ascii[c] == c)
+      putchar(c);
+    else {
+      putchar('\\');
+      putchar('x');
+      putchar(cap_hex[c][0]);
+      putchar(cap_hex[c][1]);
+    }
+  }
+  putchar('\n');
+}
+
+static void cap_print_record(cap_dump_t* dump, const capture_record_t* rec, const u_int8_t* data)
+{
+  if(rec->dir_ == CAPTURE_MARK) {
+    if(rec->len_ >= sizeof(int64_t)) {
+      memcpy(&dump->offset_us_, data, sizeof(int64_t));
+      dump->have_offset_ = 1;
+    }
+    if(!(dump->dirs_ & (1 << CAPTURE_MARK)))
+      return;
+    cap_print_time(dump, rec->time_us_);
+    printf(" -- daemon started\n");
+    return;
+  }
+  if(!(dump->dirs_ & (1 << rec->dir_)))
+    return;
+
+  cap_print_time(dump, rec->time_us_);
+  printf(" %s %3u", rec->dir_ == CAPTURE_RX ? "<" : ">", rec->len_);
+  if(dump->hex_) {
+    putchar('\n');
+    cap_print_hex(data, rec->len_);
+  }
+  else
+    cap_print_text(data, rec->len_);
+}
+
+int cap_info(capture_t* cap)
+{
+  capture_header_t* h = cap->hdr_;
+  printf("size:      %u bytes\n", h->size_);
+  printf("used:      %llu bytes\n", (unsigned long long)(h->head_ - h->tail_));
+  printf("written:   %llu records, %llu bytes of payload\n", (unsigned long long)h->records_, (unsigned long long)h->bytes_);
+  printf("wrapped:   %s\n", h->head_ > h->size_ ? "yes" : "no");
+
+  u_int64_t pos = 0, count = 0;
+  const capture_record_t* rec;
+  const u_int8_t* data;
+  while(capture_next(cap, &pos, &rec, &data) > 0)
+    count++;
+  printf("retained:  %llu records\n", (unsigned long long)count);
+  return 0;
+}
+
+int cap_dump(capture_t* cap, cap_dump_t* dump, int follow)
+{
+  u_int64_t pos = 0, held = 0;
+  u_int32_t held_len = 0;
+  const capture_record_t* rec;
+  const u_int8_t* data;
+  for(;;) {
+    if(pos < cap->hdr_->tail_)
+      pos = cap->hdr_->tail_;
+    u_int64_t start = pos;
+    int ret = capture_next(cap, &pos, &rec, &data);
+    if(ret < 0) {
+      fprintf(stderr, "door_cap: corrupt record at %llu\n", (unsigned long long)start);
+      return 1;
+    }
+    if(ret > 0) {
+          // the daemon may still coalesce bytes into the newest record, when
+          // following it is printed once it did not grow for one round
+      if(!follow || pos != cap->hdr_->head_ || rec->dir_ == CAPTURE_MARK || (start == held && rec->len_ == held_len)) {
+        cap_print_record(dump, rec, data);
+        continue;
+      }
+      held = start;
+      held_len = rec->len_;
+      pos = start;
+    }
+    if(!follow || cap_done)
+      return 0;
+    fflush(stdout);
+    usleep(100000);
+  }
+}
+
+static void cap_replay_wait(int fd, int delay_ms)
+{
+      // print what the daemon sends while waiting
+  struct timespec start, now;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for(;;) {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int left = delay_ms - ((now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000);
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    if(poll(&pfd, 1, left > 0 ? left : 0) > 0) {
+      u_int8_t buf[256];
+      ssize_t len = read(fd, buf, sizeof(buf));
+      if(len > 0) {
+        printf("> %3u", (unsigned int)len);
+        cap_print_text(buf, len);
+        fflush(stdout);
+      }
+      continue;
+    }
+    if(left <= 0 || cap_done)
+      return;
+  }
+}
+
+int cap_replay(capture_t* cap, const char* link, double speed, int wait_ms, int max_gap_ms)
+{
+  int slave_fd;
+  int fd = pty_open("door_cap", link, &slave_fd);
+  if(fd < 0)
+    return 1;
+
+  fprintf(stderr, "door_cap: starting replay in %d ms\n", wait_ms);
+  usleep(wait_ms * 1000);
+
+  cap_dump_t dump;
+  memset(&dump, 0, sizeof(dump));
+  dump.dirs_ = 1 << CAPTURE_TX;
+
+  u_int64_t pos = 0, last_us = 0, bytes = 0, records = 0;
+  const capture_record_t* rec;
+  const u_int8_t* data;
+  while(!cap_done && capture_next(cap, &pos, &rec, &data) > 0) {
+    if(rec->dir_ == CAPTURE_MARK)
+      cap_print_record(&dump, rec, data);
+    if(rec->dir_ != CAPTURE_RX)
+      continue;
+
+    int delay_ms = 0;
+    if(last_us && speed > 0) {
+      u_int64_t gap = (rec->time_us_ - last_us) / 1000;
+      if(gap > max_gap_ms)
+        gap = max_gap_ms;
+      delay_ms = gap / speed;
+    }
+    last_us = rec->time_us_;
+
+    cap_replay_wait(fd, delay_ms);
+
+    u_int32_t off = 0;
+    while(off < rec->len_) {
+      ssize_t len = write(fd, data + off, rec->len_ - off);
+      if(len < 0 && errno != EAGAIN && errno != EINTR) {
+        fprintf(stderr, "door_cap: write to pty failed: %s\n", strerror(errno));
+        return 1;
+      }
+      if(len > 0)
+        off += len;
+      else
+        usleep(1000);
+    }
+    bytes += rec->len_;
+    records++;
+  }
+      // give the daemon the chance to read everything before the pty goes away
+  int pending;
+  while(!cap_done && !ioctl(slave_fd, FIONREAD, &pending) && pending > 0)
+    cap_replay_wait(fd, 10);
+  cap_replay_wait(fd, wait_ms);
+  fprintf(stderr, "door_cap: replayed %llu records, %llu bytes\n", (unsigned long long)records, (unsigned long long)bytes);
+
+  unlink(link);
+  close(slave_fd);
+  close(fd);
+  return 0;
+}
+
+int cap_tap(const char* sock_path, cap_dump_t* dump)
+{
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, sock_path, sizeof(addr.sun_path) - 1);
+  if(fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr))) {
+    fprintf(stderr, "door_cap: unable to connect to '%s': %s\n", sock_path, strerror(errno));
+    return 2;
+  }
+  const char* cmd = "listen raw\n";
+  if(write(fd, cmd, strlen(cmd)) != strlen(cmd)) {
+    fprintf(stderr, "door_cap: unable to subscribe: %s\n", strerror(errno));
+    close(fd);
+    return 2;
+  }
+
+      // live records carry wall clock time already
+  dump->have_offset_ = 1;
+  dump->offset_us_ = 0;
+
+  u_int8_t buf[4096];
+  u_int32_t fill = 0;
+  while(!cap_done) {
+    ssize_t len = read(fd, buf + fill, sizeof(buf) - fill);
+    if(len <= 0) {
+      if(len < 0 && errno == EINTR)
+        continue;
+      fprintf(stderr, "door_cap: connection closed by daemon\n");
+      break;
+    }
+    fill += len;
+
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    capture_record_t rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.time_us_ = (u_int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+
+    u_int32_t off = 0;
+    while(fill - off >= 2 && fill - off >= 2u + buf[off + 1]) {
+      if(buf[off] != TAP_RX && buf[off] != TAP_TX) {
+        fprintf(stderr, "door_cap: lost frame sync\n");
+        close(fd);
+        return 1;
+      }
+      rec.dir_ = buf[off] == TAP_RX ? CAPTURE_RX : CAPTURE_TX;
+      rec.len_ = buf[off + 1];
+      cap_print_record(dump, &rec, buf + off + 2);
+      off += 2 + rec.len_;
+    }
+    memmove(buf, buf + off, fill - off);
+    fill -= off;
+    fflush(stdout);
+  }
+  close(fd);
+  return 0;
+}
+
+void cap_print_usage()
+{
+  printf("USAGE:\n");
+  printf("door_cap info <file>\n");
+  printf("door_cap dump [options] <file>\n");
+  printf("         [-x|--hex]                          hex and ascii dump instead of one escaped line per record\n");
+  printf("         [-r|--rx]                           only bytes received from the door\n");
+  printf("         [-t|--tx]                           only bytes sent to the door\n");
+  printf("         [-f|--follow]                       keep printing new records\n");
+  printf("door_cap tap [-x] [-r] [-t] <socket>      same output as dump, live from the daemon\n");
+  printf("door_cap replay [options] <file>\n");
+  printf("         [-l|--link] <path>                  symlink to the pty (default: /tmp/door)\n");
+  printf("         [-s|--speed] <factor>               replay speed, 0 is as fast as possible (default: 1)\n");
+  printf("         [-w|--wait] <ms>                    wait for the daemon to open the pty (default: 1000)\n");
+  printf("         [-g|--max-gap] <ms>                 shorten longer pauses to this (default: 5000)\n");
+}
+
+int main(int argc, char* argv[])
+{
+  if(argc < 3) {
+    cap_print_usage();
+    return 1;
+  }
+  cap_init_tables();
+
+  const char* mode = argv[1];
+  cap_dump_t dump;
+  memset(&dump, 0, sizeof(dump));
+  int follow = 0;
+  const char* link = "/tmp/door";
+  double speed = 1;
+  int wait_ms = 1000, max_gap_ms = 5000;
+
+  int i;
+  for(i = 2; i < argc - 1; ++i) {
+    const char* str = argv[i];
+    if(!strcmp(str, "-x") || !strcmp(str, "--hex"))
+      dump.hex_ = 1;
+    else if(!strcmp(str, "-r") || !strcmp(str, "--rx"))
+      dump.dirs_ |= 1 << CAPTURE_RX;
+    else if(!strcmp(str, "-t") || !strcmp(str, "--tx"))
+      dump.dirs_ |= 1 << CAPTURE_TX;
+    else if(!strcmp(str, "-f") || !strcmp(str, "--follow"))
+      follow = 1;
+    else if(i + 2 >= argc) {
+      cap_print_usage();
+      return 1;
+    }
+    else if(!strcmp(str, "-l") || !strcmp(str, "--link"))
+      link = argv[++i];
+    else if(!strcmp(str, "-s") || !strcmp(str, "--speed"))
+      speed = atof(argv[++i]);
+    else if(!strcmp(str, "-w") || !strcmp(str, "--wait"))
+      wait_ms = atoi(argv[++i]);
+    else if(!strcmp(str, "-g") || !strcmp(str, "--max-gap"))
+      max_gap_ms = atoi(argv[++i]);
+    else {
+      cap_print_usage();
+      return 1;
+    }
+  }
+  if(!dump.dirs_)
+    dump.dirs_ = (1 << CAPTURE_RX) | (1 << CAPTURE_TX) | (1 << CAPTURE_MARK);
+
+  struct sigaction act;
+  act.sa_handler = cap_sig_handler;
+  sigemptyset(&act.sa_mask);
+  act.sa_flags = 0;
+  sigaction(SIGINT, &act, NULL);
+  sigaction(SIGTERM, &act, NULL);
+
+  if(!strcmp(mode, "tap"))
+    return cap_tap(argv[argc - 1], &dump);
+
+  capture_t cap;
+  if(capture_open_read(&cap, argv[argc - 1])) {
+    fprintf(stderr, "door_cap: unable to open capture '%s': %s\n", argv[argc - 1], strerror(errno));
+    return 2;
+  }
+
+  int ret;
+  if(!strcmp(mode, "info"))
+    ret = cap_info(&cap);
+  else if(!strcmp(mode, "dump"))
+    ret = cap_dump(&cap, &dump, follow);
+  else if(!strcmp(mode, "replay"))
+    ret = cap_replay(&cap, link, speed, wait_ms, max_gap_ms);
+  else {
+    cap_print_usage();
+    ret = 1;
+  }
+
+  capture_close(&cap);
+  return ret;
+}
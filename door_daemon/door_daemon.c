@@ -19,6 +19,8 @@
  *  along with door_daemon. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE
+
 #include "datatypes.h"
 
 #include <termios.h>
@@ -28,6 +30,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <ctype.h>
 
 #include <sys/un.h>
 
@@ -37,6 +40,18 @@
 
 #include "command_queue.h"
 #include "client_list.h"
+#include "stats.h"
+#include "clock.h"
+#include "capture.h"
+#include "tap.h"
+#include "session.h"
+#include "door_state.h"
+#include "shm_state.h"
+#include "history.h"
+#include "journal.h"
+#include "schedule.h"
+#include "state_file.h"
+#include "door.h"
 
 #include "daemon.h"
 
@@ -74,9 +89,38 @@ int init_command_socket(const char* path)
   return fd;
 }
 
-int send_command(int door_fd, cmd_t* cmd)
+static capture_t door_capture;
+static journal_t door_journal = { .fd_ = -1 };
+
+static void capture_door(capture_dir_t dir, const u_int8_t* buf, u_int32_t len)
+{
+  if(!door_capture.hdr_)
+    return;
+
+  struct timeval now;
+  clock_now(&now);
+  capture_write(&door_capture, dir, buf, len, &now);
+}
+
+static int capture_door_open(const char* path, int size_kb)
 {
-  if(!cmd)
+  if(capture_open(&door_capture, path, size_kb * 1024)) {
+    log_printf(ERROR, "unable to open capture file '%s': %s", path, strerror(errno));
+    return -1;
+  }
+
+      // the mark record tells the dump tool how to turn the monotonic timestamps into wall clock time
+  struct timeval now;
+  clock_now(&now);
+  int64_t offset = (int64_t)clock_time() * 1000000 - ((int64_t)now.tv_sec * 1000000 + now.tv_usec);
+  capture_write(&door_capture, CAPTURE_MARK, (u_int8_t*)&offset, sizeof(offset), &now);
+  log_printf(NOTICE, "capturing door traffic to '%s'", path);
+  return 0;
+}
+
+int send_command(door_t* door, cmd_t* cmd)
+{
+  if(!cmd || door->transport_.fd_ < 0)
     return -1;
   
   char c;
@@ -87,14 +131,19 @@ int send_command(int door_fd, cmd_t* cmd)
   case STATUS: c = 's'; break;
   case RESET: c = 'r'; break;
   case LOG: return 0;
+  default: return -1;               // not a door command
   }
   
-  int ret;
-  do {
-    ret = write(door_fd, &c, 1);
-  } while(!ret || (ret == -1 && errno == EINTR));
+  int ret = transport_write(&door->transport_, (u_int8_t*)&c, 1);
 
   if(ret > 0) {
+    door->stats_.door_bytes_out_++;
+        // capture, raw tap and session recording only cover the first door
+    if(!door->index_) {
+      capture_door(CAPTURE_TX, (u_int8_t*)&c, 1);
+      tap_write(TAP_TX, (u_int8_t*)&c, 1);
+      session_door_out((u_int8_t*)&c, 1);
+    }
     cmd_sent(cmd);
     return 0;
   }
@@ -104,8 +153,9 @@ int send_command(int door_fd, cmd_t* cmd)
 
 int send_response(int fd, const char* response)
 {
-  if(!response)
+  if(!response || fd < 0)
     return -1;
+  session_client_out(fd, response);
 
   int len = strlen(response);
   int offset = 0;
@@ -127,17 +177,159 @@ int send_response(int fd, const char* response)
     ret = write(fd, "\n", 1);
   } while(!ret || (ret == -1 && errno == EINTR));
 
-  if(ret > 0)
+  if(ret > 0) {
+    stats.client_bytes_out_ += len + 1;
     return 0;
+  }
 
   return ret;
 }
 
-int process_cmd(const char* cmd, int fd, cmd_t **cmd_q, client_t* client_lst)
+int client_wants_event(client_t* client, history_type_t type)
+{
+  switch(type) {
+  case EVENT_REQUEST: return client->request_listener;
+  case EVENT_STATUS:
+  case EVENT_MANUAL: return client->status_listener;
+  case EVENT_ERROR: return client->error_listener;
+  case EVENT_STATE: return client->state_listener;
+  default: return 0;
+  }
+}
+
+void send_numbered(int fd, u_int64_t seq, const char* line)
+{
+  char numbered[HISTORY_LINE_MAX + 24];
+  snprintf(numbered, sizeof(numbered), "%llu %s", (unsigned long long)seq, line);
+  send_response(fd, numbered);
+}
+
+void send_event(door_t* door, history_type_t type, const char* line, int skip_fd)
+{
+  state_file_reserve(history.seq_ + 1);
+  u_int64_t seq = history_add(type, door->index_, line);
+  door->event_seq_ = seq;
+      // status lines are mostly answers to polls, they would drown the audit trail
+  if(type != EVENT_STATUS)
+    journal_add(&door_journal, history_get(seq));
+  client_t* client;
+  int listener_cnt = 0;
+  for(client = door->clients_; client; client = client->next)
+    if(client->fd != skip_fd && client_wants_event(client, type)) {
+      if(client->numbered)
+        send_numbered(client->fd, seq, line);
+      else
+        send_response(client->fd, line);
+      listener_cnt++;
+    }
+  log_printf(DEBUG, "sent %s to %d additional listeners", history_type_to_string(type), listener_cnt);
+}
+
+void send_history(door_t* door, client_t* requested, int fd, u_int64_t since)
+{
+  char lost[80];
+  if(since > history.seq_) {
+        // the listener saw events of an earlier daemon instance
+    snprintf(lost, sizeof(lost), "Lost: sequence %llu is unknown, last is %llu", (unsigned long long)since, (unsigned long long)history.seq_);
+    send_response(fd, lost);
+    return;
+  }
+  u_int64_t seq = since + 1;
+  if(seq < history_oldest()) {
+    snprintf(lost, sizeof(lost), "Lost: events %llu to %llu", (unsigned long long)seq, (unsigned long long)(history_oldest() - 1));
+    send_response(fd, lost);
+    seq = history_oldest();
+  }
+  int replay_cnt = 0;
+  for(; seq <= history.seq_; ++seq) {
+    const history_event_t* ev = history_get(seq);
+    if(ev && ev->door_ == door->index_ && client_wants_event(requested, ev->type_)) {
+      send_numbered(fd, ev->seq_, ev->line_);
+      replay_cnt++;
+    }
+  }
+  log_printf(DEBUG, "replayed %d events since %llu to listener %d", replay_cnt, (unsigned long long)since, fd);
+}
+
+struct journal_query_struct {
+  int fd_;
+  u_int32_t door_;
+  int count_;
+  u_int64_t last_;     // time of the last event sent
+  int more_;           // the reply is full, there are more events from next_ on
+  u_int64_t next_;
+};
+typedef struct journal_query_struct journal_query_t;
+
+int send_journal_entry(const journal_entry_t* entry, void* arg)
+{
+  journal_query_t* query = arg;
+  if(entry->door_ != query->door_)
+    return 0;
+      // the reply ends between two seconds so the next query starts right after it
+  if(query->count_ >= JOURNAL_REPLY_MAX && entry->time_ != query->last_) {
+    query->more_ = 1;
+    query->next_ = entry->time_;
+    return 1;
+  }
+  char line[JOURNAL_TEXT_MAX + 48];
+  snprintf(line, sizeof(line), "%llu %llu %s", (unsigned long long)entry->time_, (unsigned long long)entry->seq_, entry->text_);
+  send_response(query->fd_, line);
+  query->last_ = entry->time_;
+  query->count_++;
+  return 0;
+}
+
+void send_logtail_line(const char* line, void* arg)
+{
+  send_response(*((int*)arg), line);
+}
+
+    // commands started by the schedule carry the id of their entry and the attempt in param
+void schedule_outcome(cmd_t* cmd, const char* reply)
+{
+  if(!cmd || cmd->fd >= 0 || !cmd->param || strncmp(cmd->param, "schedule:", 9))
+    return;
+  char* end;
+  u_int32_t id = strtoul(&cmd->param[9], &end, 10);
+  u_int32_t attempt = *end == ':' ? strtoul(end + 1, NULL, 10) : 0;
+      // a close cancelled the open on purpose, trying it again would undo the close
+  int failed = !strncmp(reply, "Error:", 6) && strcmp(reply, "Error: cancelled by close");
+  schedule_done(id, attempt, failed, clock_time());
+}
+
+    // a close makes the opens which are still waiting pointless, the one in flight stays
+void cancel_opens(door_t* door)
+{
+  cmd_t* cancelled = cmd_extract(&door->cmd_q_, OPEN);
+  cmd_t** last = &cancelled;
+  cmd_t* cmd;
+  client_t* client;
+  int prio;
+  for(client = door->clients_; client; client = client->next) {
+    for(prio = 0; prio < CMD_PRIO_MAX; ++prio) {
+      while(*last)
+        last = &(*last)->next;
+      *last = cmd_extract(&client->cmd_q[prio], OPEN);
+      for(cmd = *last; cmd; cmd = cmd->next)
+        client->queued--;
+    }
+  }
+
+  for(cmd = cancelled; cmd; cmd = cmd->next) {
+    send_response(cmd->fd, "Error: cancelled by close");
+    schedule_outcome(cmd, "Error: cancelled by close");
+    stats.cmds_cancelled_++;
+  }
+  stats_cmd_cleared(&door->stats_, cancelled);
+  cmd_clear(&cancelled);
+}
+
+int process_cmd(const char* cmd, int fd, door_t* door)
 {
   log_printf(DEBUG, "processing command from %d", fd);
 
-  if(!cmd_q || !cmd)
+  if(!door || !cmd)
     return -1;
   
   cmd_id_t cmd_id;
@@ -151,11 +343,29 @@ int process_cmd(const char* cmd, int fd, cmd_t **cmd_q, client_t* client_lst)
     cmd_id = RESET;
   else if(!strncmp(cmd, "status", 6))
     cmd_id = STATUS;
+  else if(!strncmp(cmd, "state", 5))
+    cmd_id = STATE;
+  else if(!strncmp(cmd, "logtail", 7))
+    cmd_id = LOGTAIL;
+  else if(!strncmp(cmd, "logstats", 8))
+    cmd_id = LOGSTATS;
+  else if(!strncmp(cmd, "loglevel", 8))
+    cmd_id = LOGLEVEL;
   else if(!strncmp(cmd, "log", 3))
     cmd_id = LOG;
   else if(!strncmp(cmd, "listen", 6)) {
     cmd_id = LISTEN;
   }
+  else if(!strncmp(cmd, "stats", 5))
+    cmd_id = STATS;
+  else if(!strncmp(cmd, "clock", 5))
+    cmd_id = CLOCK;
+  else if(!strncmp(cmd, "history", 7))
+    cmd_id = HISTORY;
+  else if(!strncmp(cmd, "clients", 7))
+    cmd_id = CLIENTS;
+  else if(!strncmp(cmd, "schedule", 8))
+    cmd_id = SCHEDULE;
   else {
     log_printf(WARNING, "unknown command '%s'", cmd);
     return 0;
@@ -164,36 +374,77 @@ int process_cmd(const char* cmd, int fd, cmd_t **cmd_q, client_t* client_lst)
   if(param) 
     param++;
 
-  if(cmd_id == OPEN || cmd_id == CLOSE || cmd_id == TOGGLE) {
-    char* resp;
-    asprintf(&resp, "Request: %s", cmd);
-    if(resp) {
-      char* linefeed = strchr(resp, '\n');
-      if(linefeed) linefeed[0] = 0;
-      client_t* client;
-      int listener_cnt = 0;
-      for(client = client_lst; client; client = client->next)
-        if(client->request_listener && client->fd != fd) {
-          send_response(client->fd, resp);
-          listener_cnt++;
-        }
-      free(resp);
-      log_printf(DEBUG, "sent request to %d additional listeners", listener_cnt);
-    }
-// else silently ignore memory alloc error
-  }
-
   switch(cmd_id) {
   case OPEN:
   case CLOSE:
   case TOGGLE:
   case STATUS:
   case RESET: {
-    int ret = cmd_push(cmd_q, fd, cmd_id, param);
+    if(door->transport_.fd_ < 0) {
+      send_response(fd, "Error: door not available");
+      break;
+    }
+    client_t* client = client_find(door->clients_, fd);
+    if(client && door->queue_max_ && client->queued >= door->queue_max_) {
+      client->rejected++;
+      stats.cmds_rejected_++;
+      send_response(fd, "Error: too many queued commands");
+      break;
+    }
+    if(client && client_take_token(client, door->rate_, door->burst_)) {
+      client->rejected++;
+      stats.cmds_ratelimited_++;
+      send_response(fd, "Error: rate limit exceeded");
+      break;
+    }
+        // 'open for <sec> [actor]' keeps the door open for a while and closes it again
+    if(cmd_id == OPEN && param && !strncmp(param, "for ", 4)) {
+      char* end;
+      long window = strtol(&param[4], &end, 10);
+      if(end == &param[4] || (*end && *end != ' ') || window <= 0) {
+        send_response(fd, "Error: invalid open window");
+        break;
+      }
+      int id = schedule_add(door->index_, CLOSE, clock_time() + window, SCHEDULE_DAILY_NONE);
+      if(id < 0) {
+        send_response(fd, "Error: schedule is full");
+        break;
+      }
+      log_printf(NOTICE, "door '%s' will be closed in %ld seconds (schedule id %d)", door->name_, window, id);
+      while(*end == ' ')
+        end++;
+      param = *end ? end : NULL;
+    }
+        // only requests which made it past the limits end up in the journal
+    if(cmd_id == OPEN || cmd_id == CLOSE || cmd_id == TOGGLE) {
+      char* resp;
+      if(asprintf(&resp, "Request: %s", cmd) >= 0) {
+        char* linefeed = strchr(resp, '\n');
+        if(linefeed) linefeed[0] = 0;
+        send_event(door, EVENT_REQUEST, resp, fd);
+        free(resp);
+      }
+// else silently ignore memory alloc error
+    }
+    if(cmd_id == CLOSE && door->cancel_opens_)
+      cancel_opens(door);
+    int ret = door_push(door, client, fd, cmd_id, param);
     if(ret)
       return ret;
+    stats_cmd_pushed(&door->stats_, cmd_id);
+    if(client) {
+      client->accepted++;
+      u_int32_t ahead = door_ahead(door, client, cmd_id);
+      if(ahead) {
+        client->delayed++;
+        stats.cmds_delayed_++;
+        char delayed[40];
+        snprintf(delayed, sizeof(delayed), "Delayed: %u ahead", ahead);
+        send_response(fd, delayed);
+      }
+    }
 
-    log_printf(NOTICE, "command: %s", cmd); 
+    log_printf(NOTICE, "command(%s): %s", door->name_, cmd); 
     break;
   }
   case LOG: {
@@ -203,26 +454,247 @@ int process_cmd(const char* cmd, int fd, cmd_t **cmd_q, client_t* client_lst)
       log_printf(DEBUG, "ignoring empty ext log message");
     break;
   }
+  case LOGTAIL: {
+    u_int32_t n = 0;
+    if(param && param[0])
+      n = strtoul(param, NULL, 10);
+    int ret = log_ring_tail(n, send_logtail_line, &fd);
+    if(ret < 0)
+      send_response(fd, "Error: no ring log target configured");
+    else
+      log_printf(DEBUG, "sent %d log lines to %d", ret, fd);
+    break;
+  }
+  case LOGSTATS: {
+    u_int32_t repeated, ratelimited;
+    log_get_suppressed(&repeated, &ratelimited);
+    char* resp;
+    if(asprintf(&resp, "log_suppressed_repeated %u\nlog_suppressed_ratelimited %u", repeated, ratelimited) >= 0) {
+      send_response(fd, resp);
+      free(resp);
+    }
+    break;
+  }
+  case LOGLEVEL: {
+    if(!param || !param[0]) {
+      log_print_prio(send_logtail_line, &fd);
+      break;
+    }
+    if(!strncmp(param, "reset", 5)) {
+      log_reset_prio();
+      log_printf(NOTICE, "log levels reset to configured values");
+      break;
+    }
+    char target[16];
+    char* level = strchr(param, ' ');
+    if(!level || (size_t)(level - param) >= sizeof(target)) {
+      send_response(fd, "Error: usage: loglevel [<target> <level>|reset]");
+      break;
+    }
+    memcpy(target, param, level - param);
+    target[level - param] = 0;
+    char* end;
+    long prio = strtol(&level[1], &end, 10);
+    if(end == &level[1] || (*end && *end != ' ') || prio < 0 || prio > DEBUG) {
+      send_response(fd, "Error: invalid log level, expected 0-5");
+      break;
+    }
+    int ret = log_set_prio(target, prio);
+    if(ret <= 0)
+      send_response(fd, "Error: no such log target");
+    else
+      log_printf(NOTICE, "log level of %s target(s) changed to %ld", target, prio);
+    break;
+  }
+  case STATS: {
+    char* resp = NULL;
+    size_t len = 0;
+    FILE* out = open_memstream(&resp, &len);
+    if(!out)
+      break;
+    stats_write(out);
+    fclose(out);
+    if(resp) {
+      if(len > 0 && resp[len-1] == '\n')
+        resp[len-1] = 0;
+      send_response(fd, resp);
+      free(resp);
+    }
+    break;
+  }
+  case HISTORY: {
+    if(door_journal.fd_ < 0) {
+      send_response(fd, "Error: no journal configured");
+      break;
+    }
+    if(!param || !param[0]) {
+      send_response(fd, "Error: history <from> [<to>]");
+      break;
+    }
+    u_int64_t now = clock_time();
+    u_int64_t from = journal_parse_time(param, now);
+    const char* to_str = strchr(param + 1, ' ');
+    u_int64_t to = to_str ? journal_parse_time(to_str, now) : now;
+        // a long range is served in pieces, the client asks again from where the reply stopped
+    journal_query_t query = { fd, door->index_, 0, 0, 0, 0 };
+    if(journal_query(&door_journal, from, to, send_journal_entry, &query) < 0) {
+      send_response(fd, "Error: unable to read journal");
+      break;
+    }
+    char* resp;
+    int ret = query.more_ ? asprintf(&resp, "History: %d events, more from %llu", query.count_, (unsigned long long)query.next_)
+                          : asprintf(&resp, "History: %d events", query.count_);
+    if(ret >= 0) {
+      send_response(fd, resp);
+      free(resp);
+    }
+    break;
+  }
+  case CLOCK: {
+    if(param && !strncmp(param, "advance ", 8)) {
+      if(!clock_is_virtual()) {
+        send_response(fd, "Error: clock is not virtual");
+        break;
+      }
+      u_int32_t ms = strtoul(&param[8], NULL, 10);
+      struct timeval delta;
+      delta.tv_sec = ms / 1000;
+      delta.tv_usec = (ms % 1000) * 1000;
+      clock_advance(&delta);
+      log_printf(DEBUG, "virtual clock advanced by %u ms", ms);
+    }
+    struct timeval now;
+    clock_now(&now);
+    char* resp;
+    if(asprintf(&resp, "Clock: %s %ld.%06ld", clock_is_virtual() ? "virtual" : "real", (long)now.tv_sec, (long)now.tv_usec) >= 0) {
+      send_response(fd, resp);
+      free(resp);
+    }
+    break;
+  }
+  case STATE: {
+    send_response(fd, door->state_.line_);
+    break;
+  }
+  case CLIENTS: {
+    u_int32_t count = 0;
+    client_t* client;
+    for(client = door->clients_; client; client = client->next, count++) {
+      char line[160];
+      snprintf(line, sizeof(line), "Client: fd=%d listener=%d queued=%u accepted=%u rejected=%u delayed=%u",
+               client->fd, client_is_listener(client), client->queued, client->accepted, client->rejected, client->delayed);
+      send_response(fd, line);
+    }
+    char line[32];
+    snprintf(line, sizeof(line), "Clients: %u", count);
+    send_response(fd, line);
+    break;
+  }
+  case SCHEDULE: {
+    if(!param || !strncmp(param, "list", 4)) {
+      schedule_entry_t entries[SCHEDULE_MAX];
+      u_int32_t count = schedule_list(door->index_, entries);
+      u_int32_t i;
+      for(i = 0; i < count; ++i) {
+        char line[128];
+        strcpy(line, "Scheduled: ");
+        schedule_entry_to_string(&entries[i], &line[11], sizeof(line) - 11);
+        send_response(fd, line);
+      }
+      char line[32];
+      snprintf(line, sizeof(line), "Schedules: %u", count);
+      send_response(fd, line);
+      break;
+    }
+    if(!strncmp(param, "cancel ", 7)) {
+      u_int32_t id = strtoul(&param[7], NULL, 10);
+      if(schedule_cancel(door->index_, id)) {
+        send_response(fd, "Error: no such schedule entry");
+        break;
+      }
+      log_printf(NOTICE, "cancelled schedule entry %u of door '%s'", id, door->name_);
+      send_response(fd, "Ok, cancelled");
+      break;
+    }
+        // schedule <HH:MM|+sec|@unix time> <cmd>
+    time_t due;
+    int daily;
+    char* cmd_str = strchr(param, ' ');
+    if(schedule_parse_time(param, clock_time(), &due, &daily) || !cmd_str) {
+      send_response(fd, "Error: invalid schedule");
+      break;
+    }
+    cmd_id_t scheduled;
+    for(scheduled = 0; scheduled < CMD_DOOR_MAX; ++scheduled)
+      if(!strcmp(&cmd_str[1], schedule_cmd_to_string(scheduled)))
+        break;
+    if(scheduled >= CMD_DOOR_MAX) {
+      send_response(fd, "Error: invalid schedule");
+      break;
+    }
+    int id = schedule_add(door->index_, scheduled, due, daily);
+    if(id < 0) {
+      send_response(fd, "Error: schedule is full");
+      break;
+    }
+    schedule_entry_t entry = { id, door->index_, scheduled, due, daily, 0, 0 };
+    char line[128];
+    strcpy(line, "Scheduled: ");
+    schedule_entry_to_string(&entry, &line[11], sizeof(line) - 11);
+    log_printf(NOTICE, "door '%s': %s", door->name_, line);
+    send_response(fd, line);
+    break;
+  }
   case LISTEN: {
-    client_t* listener = client_find(client_lst, fd);
+    client_t* listener = client_find(door->clients_, fd);
     if(listener) {
-      if(!param) {
-        listener->status_listener = 1;
-        listener->error_listener = 1;      
-        listener->request_listener = 1;
+      int was_listener = client_is_listener(listener);
+      const char* since = param ? strstr(param, "since") : NULL;
+      client_t requested;
+      memset(&requested, 0, sizeof(requested));
+      if(!param || param == since) {
+        requested.status_listener = 1;
+        requested.error_listener = 1;      
+        requested.request_listener = 1;
       }
       else {
         if(!strncmp(param, "status", 6))
-          listener->status_listener = 1;
+          requested.status_listener = 1;
         else if(!strncmp(param, "error", 5))
-          listener->error_listener = 1;      
+          requested.error_listener = 1;      
         else if(!strncmp(param, "request", 7))
-          listener->request_listener = 1;
+          requested.request_listener = 1;
+        else if(!strncmp(param, "state", 5))
+          requested.state_listener = 1;
+        else if(!strncmp(param, "raw", 3)) {
+          if(door->index_) {
+            send_response(fd, "Error: the raw tap is only available for the first door");
+            break;
+          }
+          if(!listener->raw_listener) {
+            listener->raw_listener = 1;
+            listener->raw_pos = tap.head_;
+            tap.subscribers_++;
+          }
+        }
         else {
           log_printf(DEBUG, "unkown listener type '%s'", param);
           break;
         }
       }
+      listener->status_listener |= requested.status_listener;
+      listener->error_listener |= requested.error_listener;
+      listener->request_listener |= requested.request_listener;
+      listener->state_listener |= requested.state_listener;
+          // the missed events go out before any live event, from now on all event lines are numbered
+      if(since) {
+        listener->numbered = 1;
+        send_history(door, &requested, fd, strtoull(since + 5, NULL, 10));
+      }
+      if(!was_listener) {
+        stats.listeners_++;
+        door->stats_.listeners_++;
+      }
       log_printf(DEBUG, "listener %d requests %s messages", fd, param ? param:"all");
     }
     else {
@@ -235,7 +707,7 @@ int process_cmd(const char* cmd, int fd, cmd_t **cmd_q, client_t* client_lst)
   return 0;
 }
 
-int nonblock_recvline(read_buffer_t* buffer, int fd, cmd_t** cmd_q, client_t* client_lst)
+int nonblock_recvline(read_buffer_t* buffer, int fd, door_t* door)
 {
   int ret = 0;
   for(;;) {
@@ -244,12 +716,23 @@ int nonblock_recvline(read_buffer_t* buffer, int fd, cmd_t** cmd_q, client_t* cl
       return 2;
     if(ret == -1 && errno == EAGAIN)
       return 0;
-    else if(ret < 0)
-      break;
+    else if(ret < 0) {
+      if(errno == EINTR)
+        continue;
+          // e.g. ECONNRESET, drop the client instead of stopping the daemon
+      log_printf(DEBUG, "recv returned with error: %s (fd=%d)", strerror(errno), fd);
+      return 2;
+    }
+    stats.client_bytes_in_++;
 
     if(buffer->buf[buffer->offset] == '\n') {
       buffer->buf[buffer->offset] = 0;
-      ret = process_cmd(buffer->buf, fd, cmd_q, client_lst);
+      if(buffer->overflow)
+        buffer->overflow = 0;
+      else {
+        session_client_in(fd, buffer->buf);
+        ret = process_cmd(buffer->buf, fd, door);
+      }
       buffer->offset = 0;
       break;
     }
@@ -258,6 +741,7 @@ int nonblock_recvline(read_buffer_t* buffer, int fd, cmd_t** cmd_q, client_t* cl
     if(buffer->offset >= sizeof(buffer->buf)) {
       log_printf(DEBUG, "string too long (fd=%d)", fd);
       buffer->offset = 0;
+      buffer->overflow = 1;
       return 0;
     }
   }
@@ -265,30 +749,36 @@ int nonblock_recvline(read_buffer_t* buffer, int fd, cmd_t** cmd_q, client_t* cl
   return ret;
 }
 
-int process_door(read_buffer_t* buffer, int door_fd, cmd_t **cmd_q, client_t* client_lst)
+    // the head of the door queue waits for another attempt if its retry policy allows it
+int retry_command(door_t* door)
+{
+  cmd_t* cmd = door->cmd_q_;
+  if(!door_retry(door))
+    return 0;
+
+  log_printf(INFO, "%s: will try command %d from %d again (attempt %u)", door->name_, cmd->cmd, cmd->fd, cmd->retries + 1);
+  stats.cmds_retried_++;
+  return 1;
+}
+
+int process_door(door_t* door)
 {
+  read_buffer_t* buffer = &door->buffer_;
+  cmd_t** cmd_q = &door->cmd_q_;
   int ret = 0;
-  struct timeval tv;
-  fd_set fds;
-  FD_ZERO(&fds);
-  FD_SET(door_fd, &fds);
 
   for(;;) {
-    tv.tv_sec = 0;
-    tv.tv_usec = 0;
-    ret = select(door_fd+1, &fds, NULL, NULL, &tv);
+    ret = transport_read(&door->transport_, (u_int8_t*)&buffer->buf[buffer->offset], 1);
     if(!ret)
       return 0;
     else if(ret < 0)
-      return ret;
-
-    ret = read(door_fd, &buffer->buf[buffer->offset], 1);
-    if(!ret)
       return 2;
-    if(ret == -1 && errno == EAGAIN)
-      return 0;
-    else if(ret < 0)
-      break;
+    door->stats_.door_bytes_in_++;
+    if(!door->index_) {
+      capture_door(CAPTURE_RX, (u_int8_t*)&buffer->buf[buffer->offset], 1);
+      tap_write(TAP_RX, (u_int8_t*)&buffer->buf[buffer->offset], 1);
+      session_door_in((u_int8_t*)&buffer->buf[buffer->offset], 1);
+    }
 
     if(buffer->buf[buffer->offset] == '\n') {
       buffer->buf[buffer->offset] = 0;
@@ -296,45 +786,54 @@ int process_door(read_buffer_t* buffer, int door_fd, cmd_t **cmd_q, client_t* cl
       if(buffer->offset > 0 && buffer->buf[buffer->offset-1] == '\r')
         buffer->buf[buffer->offset-1] = 0;
 
-      log_printf(NOTICE, "door-firmware: %s", buffer->buf);      
+      if(buffer->overflow) {
+        log_printf(WARNING, "dropped overlong line from %s-firmware", door->name_);
+        buffer->overflow = 0;
+        buffer->offset = 0;
+        return 0;
+      }
 
+      log_printf(NOTICE, "%s-firmware: %s", door->name_, buffer->buf);      
+
+          // a line which arrives before the command went out is not its answer
+      cmd_t* cmd = *cmd_q && (*cmd_q)->sent ? *cmd_q : NULL;
+      int retry = cmd && !strcmp(buffer->buf, "Error: Operation in progress") && retry_command(door);
       int cmd_fd = -1;
-      if(cmd_q && (*cmd_q)) {
-        cmd_fd = (*cmd_q)->fd;
+      if(cmd && !retry) {
+        cmd_fd = cmd->fd;
         send_response(cmd_fd, buffer->buf);
+        schedule_outcome(cmd, buffer->buf);
+        if(cmd->retries && !strncmp(buffer->buf, "Error:", 6))
+          stats.cmds_retry_failed_++;
       }
       
-      if(!strncmp(buffer->buf, "Status:", 7)) {
-        client_t* client;
-        int listener_cnt = 0;
-        for(client = client_lst; client; client = client->next)
-          if(client->status_listener && client->fd != cmd_fd) {
-            send_response(client->fd, buffer->buf);
-            listener_cnt++;
-          }
-        log_printf(DEBUG, "sent status to %d additional listeners", listener_cnt);
-      }
+      if(!strncmp(buffer->buf, "Status:", 7))
+        send_event(door, EVENT_STATUS, buffer->buf, cmd_fd);
 
       if(!strncmp(buffer->buf, "Error:", 6)) {
-        client_t* client;
-        int listener_cnt = 0;
-        for(client = client_lst; client; client = client->next)
-          if(client->error_listener && client->fd != cmd_fd) {
-            send_response(client->fd, buffer->buf);
-            listener_cnt++;
-          }
-        log_printf(DEBUG, "sent error to %d additional listeners", listener_cnt);
+        door->stats_.firmware_errors_++;
+        send_event(door, EVENT_ERROR, buffer->buf, cmd_fd);
       }
+
+      if(strstr(buffer->buf, "forced manually"))
+        send_event(door, EVENT_MANUAL, buffer->buf, cmd_fd);
       
-      cmd_pop(cmd_q);
+      if(door_state_update(&door->state_, buffer->buf, cmd))
+        send_event(door, EVENT_STATE, door->state_.line_, -1);
+
+      if(cmd && !retry) {
+        stats_cmd_finished(&door->stats_, cmd, 0);
+        cmd_pop(cmd_q);
+      }
       buffer->offset = 0;
       return 0;
     }
 
     buffer->offset++;
     if(buffer->offset >= sizeof(buffer->buf)) {
-      log_printf(DEBUG, "string too long (fd=%d)", door_fd);
+      log_printf(DEBUG, "string too long (%s)", door->name_);
       buffer->offset = 0;
+      buffer->overflow = 1;
       return 0;
     }
   }
@@ -342,20 +841,169 @@ int process_door(read_buffer_t* buffer, int door_fd, cmd_t **cmd_q, client_t* cl
   return ret;
 }
 
-int main_loop(int door_fd, int cmd_listen_fd)
+void remove_client(door_t* door, client_t* deletee, fd_set* readfds)
+{
+  stats.clients_--;
+  door->stats_.clients_--;
+  if(client_is_listener(deletee)) {
+    stats.listeners_--;
+    door->stats_.listeners_--;
+  }
+  if(deletee->raw_listener)
+    tap.subscribers_--;
+  FD_CLR(deletee->fd, readfds);
+  session_disconnect(deletee->fd);
+  cmd_orphan(door->cmd_q_, deletee->fd); // the fd number will be reused by the next client
+  cmd_orphan(door->retry_q_, deletee->fd);
+  door_orphan_client(door, deletee);
+  client_remove(&door->clients_, deletee->fd);
+}
+
+int send_tap(client_t* client)
+{
+  int ret = tap_send(client->fd, &client->raw_pos);
+  if(ret == -1) {
+    log_printf(WARNING, "raw listener %d fell behind, dropping it", client->fd);
+    stats.tap_overruns_++;
+  }
+  if(ret < 0)
+    return 2;
+
+  stats.client_bytes_out_ += ret;
+  return 0;
+}
+
+    // the reply the firmware would give, without bothering it
+int answer_locally(door_t* door)
+{
+  cmd_t* cmd = door->cmd_q_;
+  const char* reply = door->local_answers_ ? door_state_admit(&door->state_, cmd->cmd) : NULL;
+  if(!reply)
+    return 0;
+
+  log_printf(NOTICE, "%s-local: %s", door->name_, reply);
+  int retry = !strcmp(reply, "Error: Operation in progress") && retry_command(door);
+  send_event(door, EVENT_ERROR, reply, retry ? -1 : cmd->fd);
+  stats.cmds_local_++;
+  if(retry)
+    return 1;
+  send_response(cmd->fd, reply);
+  schedule_outcome(cmd, reply);
+  if(cmd->retries)
+    stats.cmds_retry_failed_++;
+  stats_cmd_finished(&door->stats_, cmd, 0);
+  cmd_pop(&door->cmd_q_);
+  return 1;
+}
+
+    // the clients stay connected, queued commands are answered right away
+void fail_door(door_t* door, fd_set* readfds)
+{
+  log_printf(ERROR, "%s error, trying to reopen in %d seconds..", door->dev_, DOOR_REOPEN_S);
+  door->stats_.door_reopens_++;
+  if(door->transport_.fd_ >= 0)
+    FD_CLR(door->transport_.fd_, readfds);
+  door_close(door);
+
+  cmd_t* cmd;
+  for(cmd = door->cmd_q_; cmd; cmd = cmd->next) {
+    send_response(cmd->fd, "Error: door not available");
+    schedule_outcome(cmd, "Error: door not available");
+  }
+  stats_cmd_cleared(&door->stats_, door->cmd_q_);
+  cmd_clear(&door->cmd_q_);
+  for(cmd = door->retry_q_; cmd; cmd = cmd->next) {
+    send_response(cmd->fd, "Error: door not available");
+    schedule_outcome(cmd, "Error: door not available");
+  }
+  stats_cmd_cleared(&door->stats_, door->retry_q_);
+  cmd_clear(&door->retry_q_);
+  client_t* client;
+  for(client = door->clients_; client; client = client->next) {
+    int prio;
+    for(prio = 0; prio < CMD_PRIO_MAX; ++prio) {
+      for(cmd = client->cmd_q[prio]; cmd; cmd = cmd->next)
+        send_response(cmd->fd, "Error: door not available");
+      stats_cmd_cleared(&door->stats_, client->cmd_q[prio]);
+      cmd_clear(&client->cmd_q[prio]);
+    }
+    client->queued = 0;
+  }
+
+  clock_now(&door->reopen_);
+  door->reopen_.tv_sec += DOOR_REOPEN_S;
+}
+
+    // whether the door still has the command of a schedule entry, waiting, in flight or to be retried
+int schedule_queued(door_t* door, const char* param)
+{
+  cmd_t* cmd;
+  for(cmd = door->cmd_q_; cmd; cmd = cmd->next)
+    if(cmd->fd < 0 && cmd->param && !strcmp(cmd->param, param))
+      return 1;
+  for(cmd = door->retry_q_; cmd; cmd = cmd->next)
+    if(cmd->fd < 0 && cmd->param && !strcmp(cmd->param, param))
+      return 1;
+  return 0;
+}
+
+    // due scheduled commands go through process_cmd() like ones from a client,
+    // the entry learns how it went through schedule_outcome()
+int run_schedule(door_t* doors)
+{
+  int count = 0;
+  int ret;
+  schedule_entry_t entry;
+  while((ret = schedule_pop_due(clock_time(), &entry))) {
+    door_t* door;
+    for(door = doors; door; door = door->next_)
+      if(door->index_ == entry.door_)
+        break;
+    if(!door) {
+      log_printf(WARNING, "dropping schedule entry %u for unknown door %u", entry.id_, entry.door_);
+      schedule_cancel(entry.door_, entry.id_);
+      continue;
+    }
+    char param[32];
+    snprintf(param, sizeof(param), "schedule:%u:%u", entry.id_, entry.inflight_);
+    if(ret == 2) {
+      if(schedule_queued(door, param))
+        continue;
+      log_printf(WARNING, "command of schedule entry %u for door '%s' got lost", entry.id_, door->name_);
+      schedule_done(entry.id_, entry.inflight_, 1, clock_time());
+      continue;
+    }
+    count++;
+    if(door->transport_.fd_ < 0) {
+      log_printf(WARNING, "scheduled %s for door '%s' failed: door not available", schedule_cmd_to_string(entry.cmd_), door->name_);
+      schedule_done(entry.id_, entry.inflight_, 1, clock_time());
+      continue;
+    }
+
+    char line[48];
+    snprintf(line, sizeof(line), "%s %s", schedule_cmd_to_string(entry.cmd_), param);
+    log_printf(NOTICE, "running schedule entry %u for door '%s' (attempt %u): %s", entry.id_, door->name_, entry.attempts_, line);
+    process_cmd(line, -1, door);
+    if(!schedule_queued(door, param)) {
+      log_printf(WARNING, "scheduled %s for door '%s' was not queued", schedule_cmd_to_string(entry.cmd_), door->name_);
+      schedule_done(entry.id_, entry.inflight_, 1, clock_time());
+    }
+  }
+  return count;
+}
+
+int main_loop(door_t* doors, options_t* opt)
 {
   log_printf(NOTICE, "entering main loop");
 
-  fd_set readfds, tmpfds;
+  fd_set readfds, tmpfds, writefds;
   FD_ZERO(&readfds);
-  FD_SET(door_fd, &readfds);
-  FD_SET(cmd_listen_fd, &readfds);
-  int max_fd = door_fd > cmd_listen_fd ? door_fd : cmd_listen_fd;
-  cmd_t* cmd_q = NULL;
-  client_t* client_lst = NULL;
-
-  read_buffer_t door_buffer;
-  door_buffer.offset = 0;
+  int max_fd = 0;
+  door_t* door;
+  for(door = doors; door; door = door->next_) {
+    FD_SET(door->listen_fd_, &readfds);
+    max_fd = (max_fd < door->listen_fd_) ? door->listen_fd_ : max_fd;
+  }
 
   int sig_fd = signal_init();
   if(sig_fd < 0)
@@ -363,14 +1011,69 @@ int main_loop(int door_fd, int cmd_listen_fd)
   FD_SET(sig_fd, &readfds);
   max_fd = (max_fd < sig_fd) ? sig_fd : max_fd;
 
+  struct timeval now, stats_next;
+  clock_now(&stats_next);
+
   struct timeval timeout;
   int return_value = 0;
   while(!return_value) {
-    memcpy(&tmpfds, &readfds, sizeof(tmpfds));
+    clock_now(&now);
+    if(opt->stats_file_) {
+      if(!timercmp(&now, &stats_next, <)) {
+        stats_write_file(opt->stats_file_);
+        stats_next = now;
+        stats_next.tv_sec += opt->stats_interval_ > 0 ? opt->stats_interval_ : 10;
+      }
+    }
+    state_file_flush(opt->state_file_, doors);
+        // with busy clients select never times out, the summaries of suppressed messages are due anyway
+    log_flush();
+
+    for(door = doors; door; door = door->next_) {
+      if(door->transport_.fd_ >= 0 || timercmp(&now, &door->reopen_, <))
+        continue;
+      if(door_open(door)) {
+        fail_door(door, &readfds);
+        continue;
+      }
+      log_printf(NOTICE, "opened door '%s' on %s", door->name_, door->dev_);
+          // a restored state is served until the firmware tells us better
+      if(door->state_.unverified_ && !door_push(door, NULL, -1, STATUS, "warm start"))
+        stats_cmd_pushed(&door->stats_, STATUS);
+      FD_SET(door->transport_.fd_, &readfds);
+      max_fd = (max_fd < door->transport_.fd_) ? door->transport_.fd_ : max_fd;
+    }
 
     timeout.tv_sec = 0;
     timeout.tv_usec = 200000;
-    int ret = select(max_fd+1, &tmpfds, NULL, NULL, &timeout);
+    int due = 0;
+    for(door = doors; door; door = door->next_) {
+      if(door->transport_.fd_ >= 0 && transport_health(&door->transport_, &timeout))
+        fail_door(door, &readfds);
+      due += door_retry_due(door, &timeout);
+    }
+
+    memcpy(&tmpfds, &readfds, sizeof(tmpfds));
+    FD_ZERO(&writefds);
+    if(tap.subscribers_) {
+      client_t* client;
+      for(client = doors->clients_; client; client = client->next)
+        if(client->raw_listener && client->raw_pos < tap.head_)
+          FD_SET(client->fd, &writefds);
+    }
+        // a connect in progress or bytes the door didn't take yet
+    for(door = doors; door; door = door->next_)
+      if(transport_want_write(&door->transport_))
+        FD_SET(door->transport_.fd_, &writefds);
+
+        // local readers see the outcome of the last round while we wait for the next one
+    for(door = doors; door; door = door->next_)
+      shm_state_publish(&door->state_map_, &door->state_, &door->stats_, door->event_seq_);
+
+    time_t next_due = schedule_next_due();
+    if(due || (next_due && next_due <= clock_time()))
+      timerclear(&timeout);
+    int ret = clock_select(max_fd+1, &tmpfds, &writefds, NULL, &timeout);
     if(ret == -1 && errno != EINTR) {
       log_printf(ERROR, "select returned with error: %s", strerror(errno));
       return_value = -1;
@@ -379,13 +1082,30 @@ int main_loop(int door_fd, int cmd_listen_fd)
     if(ret == -1)
       continue;
     if(!ret) {
-      if(cmd_q && cmd_has_expired(*cmd_q)) {
-        log_printf(ERROR, "last command expired");
-        cmd_pop(&cmd_q);
+      session_flush();
+      journal_flush(&door_journal);
+    }
+    else if(journal_due(&door_journal, clock_time()))
+      journal_flush(&door_journal);
+        // checked on every round, with busy clients select might never time out
+    int expired = 0;
+    for(door = doors; door; door = door->next_) {
+      if(door->cmd_q_ && door->cmd_q_->sent && cmd_has_expired(*door->cmd_q_)) {
+        expired = 1;
+        if(retry_command(door))
+          continue;
+        log_printf(ERROR, "last command expired (%s)", door->name_);
+        send_response(door->cmd_q_->fd, "Error: no answer from door");
+        schedule_outcome(door->cmd_q_, "Error: no answer from door");
+        if(door->cmd_q_->retries)
+          stats.cmds_retry_failed_++;
+        stats_cmd_finished(&door->stats_, door->cmd_q_, 1);
+        cmd_pop(&door->cmd_q_);
       }
-      else
-        continue;
     }
+    due += run_schedule(doors);
+    if(!ret && !expired && !due)
+      continue;
 
     if(FD_ISSET(sig_fd, &tmpfds)) {
       if(signal_handle()) {
@@ -393,116 +1113,96 @@ int main_loop(int door_fd, int cmd_listen_fd)
         break;
       }
     }
-   
-    if(FD_ISSET(door_fd, &tmpfds)) {
-      return_value = process_door(&door_buffer, door_fd, &cmd_q, client_lst);
-      if(return_value)
-        break;
-    }
 
-    if(FD_ISSET(cmd_listen_fd, &tmpfds)) {
-      int new_fd = accept(cmd_listen_fd, NULL, NULL);
-      if(new_fd < 0) {
-        log_printf(ERROR, "accept returned with error: %s", strerror(errno));
-        return_value = -1;
-        break;
-      }  
-      log_printf(DEBUG, "new command connection (fd=%d)", new_fd);
-      FD_SET(new_fd, &readfds);
-      max_fd = (max_fd < new_fd) ? new_fd : max_fd;
-      fcntl(new_fd, F_SETFL, O_NONBLOCK);
-      client_add(&client_lst, new_fd);
-    }
-
-    client_t* lst = client_lst;
-    while(lst) {
-      if(FD_ISSET(lst->fd, &tmpfds)) {
-        return_value = nonblock_recvline(&(lst->buffer), lst->fd, &cmd_q, client_lst);
+    for(door = doors; door && !return_value; door = door->next_) {
+      if(door->transport_.fd_ >= 0 && FD_ISSET(door->transport_.fd_, &writefds)) {
+        if(transport_flush(&door->transport_))
+          fail_door(door, &readfds);
+      }
+      if(door->transport_.fd_ >= 0 && FD_ISSET(door->transport_.fd_, &tmpfds)) {
+        if(process_door(door))
+          fail_door(door, &readfds);
+      }
+
+      if(FD_ISSET(door->listen_fd_, &tmpfds)) {
+        int new_fd = accept(door->listen_fd_, NULL, NULL);
+        if(new_fd < 0) {
+          log_printf(ERROR, "accept returned with error: %s", strerror(errno));
+          return_value = -1;
+          break;
+        }  
+        log_printf(DEBUG, "new command connection (fd=%d)", new_fd);
+        FD_SET(new_fd, &readfds);
+        max_fd = (max_fd < new_fd) ? new_fd : max_fd;
+        fcntl(new_fd, F_SETFL, O_NONBLOCK);
+        if(!client_add(&door->clients_, new_fd)) {
+          stats.clients_++;
+          door->stats_.clients_++;
+          session_connect(new_fd);
+        }
+      }
+
+      client_t* lst = door->clients_;
+      while(lst) {
+        if(FD_ISSET(lst->fd, &tmpfds))
+          return_value = nonblock_recvline(&(lst->buffer), lst->fd, door);
+            // a listener with a full socket never becomes writeable, catch it falling behind as well
+        if(!return_value && lst->raw_listener && (FD_ISSET(lst->fd, &writefds) || tap_overrun(lst->raw_pos)))
+          return_value = send_tap(lst);
         if(return_value == 2) {
           log_printf(DEBUG, "removing closed command connection (fd=%d)", lst->fd);
           client_t* deletee = lst;
           lst = lst->next;
-          FD_CLR(deletee->fd, &readfds);
-          client_remove(&client_lst, deletee->fd);
+          remove_client(door, deletee, &readfds);
           return_value = 0;
           continue;
         }
         if(return_value)
           break;
 
-      }
-      if(lst)
         lst = lst->next;
-    }
-
-    if(cmd_q && !cmd_q->sent)
-      send_command(door_fd, cmd_q);
-  }
-
-  cmd_clear(&cmd_q);
-  client_clear(&client_lst);
-  signal_stop();
-  return return_value;
-}
-
-int setup_tty(int fd)
-{
-  struct termios tmio;
-  
-  int ret = tcgetattr(fd, &tmio);
-  if(ret) {
-    log_printf(ERROR, "Error on tcgetattr(): %s", strerror(errno));
-    return ret;
-  }
-
-  ret = cfsetospeed(&tmio, B9600);
-  if(ret) {
-    log_printf(ERROR, "Error on cfsetospeed(): %s", strerror(errno));
-    return ret;
-  }
-
-  ret = cfsetispeed(&tmio, B9600);
-  if(ret) {
-    log_printf(ERROR, "Error on cfsetispeed(): %s", strerror(errno));
-    return ret;
-  }
-
-  tmio.c_lflag &= ~ECHO;
+      }
 
-  ret = tcsetattr(fd, TCSANOW, &tmio);
-  if(ret) {
-    log_printf(ERROR, "Error on tcsetattr(): %s", strerror(errno));
-    return ret;
-  }
-  
-  ret = tcflush(fd, TCIFLUSH);
-  if(ret) {
-    log_printf(ERROR, "Error on tcflush(): %s", strerror(errno));
-    return ret;
+      if(!return_value && door->transport_.fd_ >= 0)
+        while(door_schedule(door) && !door->cmd_q_->sent && answer_locally(door));
+      if(!return_value && door->cmd_q_ && !door->cmd_q_->sent)
+        send_command(door, door->cmd_q_);
+    }
+        // whatever was read from or written to the door this round becomes visible to raw listeners
+    tap_flush();
   }
 
-  fd_set fds;
-  struct timeval tv;
-  FD_ZERO(&fds);
-  FD_SET(fd, &fds);
-  tv.tv_sec = 0;
-  tv.tv_usec = 50000;
-  for(;;) {
-    ret = select(fd+1, &fds, NULL, NULL, &tv);
-    if(ret > 0) {
-      char buffer[100];
-      ret = read(fd, buffer, sizeof(buffer));
+  for(door = doors; door; door = door->next_) {
+    stats_cmd_cleared(&door->stats_, door->cmd_q_);
+    cmd_clear(&door->cmd_q_);
+    stats_cmd_cleared(&door->stats_, door->retry_q_);
+    cmd_clear(&door->retry_q_);
+    client_t* client;
+    for(client = door->clients_; client; client = client->next) {
+      int prio;
+      for(prio = 0; prio < CMD_PRIO_MAX; ++prio)
+        stats_cmd_cleared(&door->stats_, client->cmd_q[prio]);
+      session_disconnect(client->fd);
     }
-    else
-      break;
+    client_clear(&door->clients_);
   }
-
-  return 0;
+  tap.subscribers_ = 0;
+  stats.clients_ = 0;
+  stats.listeners_ = 0;
+  for(door = doors; door; door = door->next_) {
+    door->stats_.clients_ = 0;
+    door->stats_.listeners_ = 0;
+  }
+  signal_stop();
+  return return_value;
 }
 
 int main(int argc, char* argv[])
 {
   log_init();
+  clock_init(0);
+  stats_init();
+  history_init();
 
   options_t opt;
   int ret = options_parse(&opt, argc, argv);
@@ -533,6 +1233,7 @@ int main(int argc, char* argv[])
         case -2: fprintf(stderr, "memory error on log_add_target, exitting\n"); break;
         case -3: fprintf(stderr, "unknown log target: '%s', exitting\n", tmp->string_); break;
         case -4: fprintf(stderr, "this log target is only allowed once: '%s', exitting\n", tmp->string_); break;
+        case -5: fprintf(stderr, "too many log targets: '%s', exitting\n", tmp->string_); break;
         default: fprintf(stderr, "syntax error near: '%s', exitting\n", tmp->string_); break;
         }
         
@@ -545,6 +1246,11 @@ int main(int argc, char* argv[])
   }
   log_printf(NOTICE, "just started...");
   options_parse_post(&opt);
+  if(opt.virtual_time_) {
+    clock_init(1);
+    stats_init();
+    log_printf(NOTICE, "using virtual time");
+  }
 
   priv_info_t priv;
   if(opt.username_)
@@ -562,6 +1268,56 @@ int main(int argc, char* argv[])
     }
   }
 
+  if(opt.capture_file_)
+    capture_door_open(opt.capture_file_, opt.capture_size_);
+  if(opt.session_file_)
+    session_open(opt.session_file_);
+  if(opt.journal_file_ && journal_open(&door_journal, opt.journal_file_))
+    log_printf(ERROR, "unable to open journal '%s': %s", opt.journal_file_, strerror(errno));
+
+  door_t* doors = NULL;
+  ret = 0;
+  if(!opt.doors_.first_)
+    ret = door_add(&doors, "door", opt.door_dev_, opt.command_sock_, opt.state_map_);
+  for(tmp = opt.doors_.first_; tmp && !ret; tmp = tmp->next_) {
+    ret = door_add_config(&doors, tmp->string_);
+    if(ret)
+      log_printf(ERROR, "invalid door '%s', expected name,device,socket[,state map]", tmp->string_);
+  }
+  if(ret) {
+    door_clear(&doors);
+    options_clear(&opt);
+    log_close();
+    exit(-1);
+  }
+  door_t* door;
+  for(door = doors; door; door = door->next_) {
+    door->rate_ = opt.rate_limit_ > 0 ? opt.rate_limit_ : 0;
+    door->burst_ = opt.rate_burst_ > 0 ? opt.rate_burst_ : (door->rate_ ? door->rate_ : 1);
+    door->queue_max_ = opt.client_queue_ > 0 ? opt.client_queue_ : 0;
+    door->cancel_opens_ = opt.cancel_opens_;
+    door->local_answers_ = opt.local_answers_;
+    for(tmp = opt.retries_.first_; tmp; tmp = tmp->next_) {
+      if(door_set_retry(door, tmp->string_)) {
+        log_printf(ERROR, "invalid retry policy '%s', expected <command>:<attempts>[:<backoff ms>[:<deadline ms>]]", tmp->string_);
+        ret = -1;
+      }
+    }
+    if(opt.priorities_ && door_set_priorities(door, opt.priorities_)) {
+      log_printf(ERROR, "invalid priorities '%s', expected <command>:<class 0-%d>[,..]", opt.priorities_, CMD_PRIO_MAX - 1);
+      ret = -1;
+    }
+  }
+  if(ret) {
+    door_clear(&doors);
+    options_clear(&opt);
+    log_close();
+    exit(-1);
+  }
+  for(door = doors; door; door = door->next_)
+    if(door->state_map_path_ && shm_state_open(&door->state_map_, door->state_map_path_))
+      log_printf(ERROR, "unable to open state map '%s': %s", door->state_map_path_, strerror(errno));
+
   if(opt.chroot_dir_)
     if(do_chroot(opt.chroot_dir_)) {
       options_clear(&opt);
@@ -587,39 +1343,29 @@ int main(int argc, char* argv[])
     fclose(pid_file);
   }
 
-  int cmd_listen_fd = init_command_socket(opt.command_sock_);
-  if(cmd_listen_fd < 0) {
-    options_clear(&opt);
-    log_close();
-    exit(-1);
-  }
-  
-  int door_fd = 0;
-  for(;;) {
-    door_fd = open(opt.door_dev_, O_RDWR | O_NOCTTY);
-    if(door_fd < 0)
-      ret = 2;
-    else {
-      ret = setup_tty(door_fd);
-      if(ret)
-        ret = 2;
-      else
-        ret = main_loop(door_fd, cmd_listen_fd);
-    }
-
-    if(ret == 2) {
-      log_printf(ERROR, "%s error, trying to reopen in 5 seconds..", opt.door_dev_);
-      if(door_fd > 0)
-        close(door_fd);
-      sleep(5);
+      // like the stats file the schedule file is rewritten inside the chroot
+  schedule_init(opt.schedule_file_);
+  ret = schedule_load();
+  if(ret > 0)
+    log_printf(NOTICE, "loaded %d scheduled commands from '%s'", ret, opt.schedule_file_);
+  state_file_load(opt.state_file_, doors);
+  for(door = doors; door; door = door->next_)
+    if(door->state_.unverified_)
+      send_event(door, EVENT_STATE, door->state_.line_, -1);
+
+  for(door = doors; door; door = door->next_) {
+    door->listen_fd_ = init_command_socket(door->sock_);
+    if(door->listen_fd_ < 0) {
+      door_clear(&doors);
+      options_clear(&opt);
+      log_close();
+      exit(-1);
     }
-    else
-      break;
   }
-
-  close(cmd_listen_fd);
-  if(door_fd > 0)
-    close(door_fd);
+  
+  ret = main_loop(doors, &opt);
+  state_file_save(opt.state_file_, doors);
+  door_clear(&doors);
 
   if(!ret)
     log_printf(NOTICE, "normal shutdown");
@@ -628,6 +1374,10 @@ int main(int argc, char* argv[])
   else
     log_printf(NOTICE, "shutdown after signal");
 
+  capture_close(&door_capture);
+  journal_close(&door_journal);
+  schedule_clear();
+  session_close();
   options_clear(&opt);
   log_close();
 
@@ -0,0 +1,117 @@
+/*
+ *  door_daemon
+ *
+ *  Copyright (C) 2009 Christian Pointner <equinox@spreadspace.org>
+ *
+ *  This file is part of door_daemon.
+ *
+ *  door_daemon is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  door_daemon is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with door_daemon. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * door_journal: reads the event journal written by door_daemon -J <file>
+ *
+ *   door_journal <file> [<from> [<to>]]   events in the time range, times are
+ *                                        unix time or seconds ago if negative
+ *   door_journal -i <file>               number of blocks and time span
+ *
+ * Only the index records and the blocks in range are read, this is the
+ * same query the daemon answers to 'history <from> <to>'. The journal may
+ * be read while the daemon is appending to it.
+ */
+
+#include "datatypes.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "journal.h"
+
+static void journal_print_usage()
+{
+  printf("USAGE:\n");
+  printf("door_journal <file> [<from> [<to>]]   print the events between from and to (default: all)\n");
+  printf("door_journal -i <file>               print the number of blocks and the time span\n");
+  printf("             from and to are unix time or, if negative, seconds before now\n");
+}
+
+static const char* journal_format_time(u_int64_t t, char* buf, size_t len)
+{
+  time_t tt = t;
+  struct tm tm;
+  if(!localtime_r(&tt, &tm) || !strftime(buf, len, "%Y-%m-%d %H:%M:%S", &tm))
+    snprintf(buf, len, "%llu", (unsigned long long)t);
+  return buf;
+}
+
+static int journal_print_entry(const journal_entry_t* entry, void* arg)
+{
+  char buf[32];
+  printf("%s %8llu %2u %-7s %s\n", journal_format_time(entry->time_, buf, sizeof(buf)), (unsigned long long)entry->seq_,
+         entry->door_, history_type_to_string(entry->type_), entry->text_);
+  return 0;
+}
+
+static int journal_info(journal_t* j)
+{
+  u_int64_t blocks = journal_blocks(j);
+  printf("size: %llu bytes\n", (unsigned long long)j->size_);
+  printf("blocks: %llu of %d records\n", (unsigned long long)blocks, JOURNAL_BLOCK_RECORDS);
+
+  journal_index_t first, last;
+  if(!blocks || journal_read_index(j, 0, &first) || journal_read_index(j, blocks - 1, &last))
+    return 0;
+  char buf[32];
+  printf("first block: %s seq %llu\n", journal_format_time(first.time_, buf, sizeof(buf)), (unsigned long long)first.seq_);
+  printf("last block: %s seq %llu\n", journal_format_time(last.time_, buf, sizeof(buf)), (unsigned long long)last.seq_);
+  return 0;
+}
+
+int main(int argc, char* argv[])
+{
+  if(argc < 2 || argc > 4) {
+    journal_print_usage();
+    return 1;
+  }
+
+  int info = !strcmp(argv[1], "-i") || !strcmp(argv[1], "--info");
+  if(info && argc != 3) {
+    journal_print_usage();
+    return 1;
+  }
+  const char* path = argv[info ? 2 : 1];
+
+  journal_t j;
+  if(journal_open_read(&j, path)) {
+    fprintf(stderr, "unable to open '%s': %s\n", path, strerror(errno));
+    return 1;
+  }
+
+  int ret;
+  if(info)
+    ret = journal_info(&j);
+  else {
+    u_int64_t now = time(NULL);
+    u_int64_t from = argc > 2 ? journal_parse_time(argv[2], now) : 0;
+    u_int64_t to = argc > 3 ? journal_parse_time(argv[3], now) : (u_int64_t)-1;
+    ret = journal_query(&j, from, to, journal_print_entry, NULL) < 0;
+  }
+
+  journal_close(&j);
+  return ret ? 2 : 0;
+}
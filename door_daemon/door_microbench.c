@@ -0,0 +1,447 @@
+/*
+ *  door_daemon
+ *
+ *  Copyright (C) 2009 Christian Pointner <equinox@spreadspace.org>
+ *
+ *  This file is part of door_daemon.
+ *
+ *  door_daemon is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  door_daemon is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with door_daemon. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * door_microbench: microbenchmarks for the daemon's data structures and parsers
+ *
+ * Every benchmark runs a fixed workload and reports the time and the number
+ * of heap allocations per operation. Allocations are counted by wrapping
+ * the glibc allocator, so calls made from inside libc (asprintf, strdup,
+ * open_memstream, ..) are included.
+ */
+
+#include "datatypes.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "options.h"
+#include "string_list.h"
+#include "command_queue.h"
+#include "client_list.h"
+#include "capture.h"
+#include "tap.h"
+#include "shm_state.h"
+#include "journal.h"
+#include "door.h"
+#include "transport.h"
+
+int process_cmd(const char* cmd, int fd, door_t* door);
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t nmemb, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void __libc_free(void* ptr);
+
+static u_int64_t alloc_count = 0;
+
+void* malloc(size_t size)
+{
+  alloc_count++;
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t nmemb, size_t size)
+{
+  alloc_count++;
+  return __libc_calloc(nmemb, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+  alloc_count++;
+  return __libc_realloc(ptr, size);
+}
+
+void free(void* ptr)
+{
+  __libc_free(ptr);
+}
+
+typedef void (*bench_func_t)(u_int32_t iterations);
+
+struct bench_case_struct {
+  const char* name_;
+  bench_func_t func_;
+  u_int32_t iterations_;
+};
+typedef struct bench_case_struct bench_case_t;
+
+static u_int64_t now_ns()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (u_int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/* keeps the compiler from optimizing away results */
+static volatile u_int64_t sink;
+
+#define QUEUE_DEPTH 16
+#define CLIENT_CNT 64
+#define CLIENT_FD_BASE 10000 // client_remove() closes the fd, keep away from real ones
+
+static void bench_cmd_push_pop(u_int32_t iterations)
+{
+  cmd_t* q = NULL;
+  u_int32_t i;
+  for(i = 0; i < QUEUE_DEPTH; ++i)
+    cmd_push(&q, i, STATUS, NULL);
+  for(i = 0; i < iterations; ++i) {
+    cmd_push(&q, i, TOGGLE, "bench");
+    cmd_pop(&q);
+  }
+  cmd_clear(&q);
+}
+
+static void bench_client_find(u_int32_t iterations)
+{
+  client_t* lst = NULL;
+  u_int32_t i;
+  for(i = 0; i < CLIENT_CNT; ++i)
+    client_add(&lst, CLIENT_FD_BASE + i);
+  for(i = 0; i < iterations; ++i)
+    sink += client_find(lst, CLIENT_FD_BASE + i % CLIENT_CNT) != NULL;
+  client_clear(&lst);
+}
+
+static void bench_client_add_remove(u_int32_t iterations)
+{
+  client_t* lst = NULL;
+  u_int32_t i;
+  for(i = 0; i < CLIENT_CNT; ++i)
+    client_add(&lst, CLIENT_FD_BASE + i);
+  for(i = 0; i < iterations; ++i) {
+    client_add(&lst, CLIENT_FD_BASE + CLIENT_CNT);
+    client_remove(&lst, CLIENT_FD_BASE + CLIENT_CNT);
+  }
+  client_clear(&lst);
+}
+
+    // every client keeps one status waiting, the door serves them in turns
+static void bench_door_schedule(u_int32_t iterations)
+{
+  door_t* door = NULL;
+  if(door_add(&door, "bench", "loop:", "/tmp/door_microbench.sock", NULL))
+    return;
+  u_int32_t i;
+  for(i = 0; i < CLIENT_CNT; ++i)
+    client_add(&door->clients_, CLIENT_FD_BASE + i);
+  client_t* client;
+  for(client = door->clients_; client; client = client->next)
+    door_push(door, client, client->fd, STATUS, NULL);
+  for(i = 0; i < iterations; ++i) {
+    cmd_t* cmd = door_schedule(door);
+    int fd = cmd->fd;
+    cmd_pop(&door->cmd_q_);
+    door_push(door, client_find(door->clients_, fd), fd, STATUS, NULL);
+  }
+  door_clear(&door);
+}
+
+static void bench_string_list_add(u_int32_t iterations)
+{
+  string_list_t list;
+  string_list_init(&list);
+  u_int32_t i;
+  for(i = 0; i < iterations; ++i) {
+    string_list_add(&list, "stderr:3");
+    if(i % 16 == 15) {
+      string_list_clear(&list);
+      string_list_init(&list);
+    }
+  }
+  string_list_clear(&list);
+}
+
+    // a door which looks open, process_cmd never writes to it
+static door_t* bench_door()
+{
+  static door_t door;
+  if(!door.name_) {
+    door.name_ = "bench";
+    door.transport_.fd_ = 0;
+    door_state_init(&door.state_);
+  }
+  return &door;
+}
+
+static void bench_process_cmd_status(u_int32_t iterations)
+{
+  door_t* door = bench_door();
+  u_int32_t i;
+  for(i = 0; i < iterations; ++i) {
+    process_cmd("status", -1, door);
+    cmd_pop(&door->cmd_q_);
+  }
+  cmd_clear(&door->cmd_q_);
+}
+
+static void bench_process_cmd_toggle(u_int32_t iterations)
+{
+  door_t* door = bench_door();
+  u_int32_t i;
+  for(i = 0; i < iterations; ++i) {
+    process_cmd("toggle card 0123456789", -1, door);
+    cmd_pop(&door->cmd_q_);
+  }
+  cmd_clear(&door->cmd_q_);
+}
+
+static void bench_process_cmd_log(u_int32_t iterations)
+{
+  door_t* door = bench_door();
+  u_int32_t i;
+  for(i = 0; i < iterations; ++i)
+    process_cmd("log some external message", -1, door);
+  cmd_clear(&door->cmd_q_);
+}
+
+static void bench_process_cmd_unknown(u_int32_t iterations)
+{
+  door_t* door = bench_door();
+  u_int32_t i;
+  for(i = 0; i < iterations; ++i)
+    process_cmd("frobnicate", -1, door);
+  cmd_clear(&door->cmd_q_);
+}
+
+static void bench_log_printf_disabled(u_int32_t iterations)
+{
+  u_int32_t i;
+  for(i = 0; i < iterations; ++i)
+    log_printf(DEBUG, "disabled message %u", i);
+}
+
+static void bench_log_printf_repeated(u_int32_t iterations)
+{
+  u_int32_t i;
+  for(i = 0; i < iterations; ++i)
+    log_printf(NOTICE, "the same message over and over");
+}
+
+static void bench_log_printf_distinct(u_int32_t iterations)
+{
+  u_int32_t i;
+  for(i = 0; i < iterations; ++i)
+    log_printf(NOTICE, "distinct message %u", i);
+}
+
+static void bench_parse_hex_string(u_int32_t iterations)
+{
+  buffer_t buffer;
+  buffer.buf_ = NULL;
+  buffer.length_ = 0;
+  u_int32_t i;
+  for(i = 0; i < iterations; ++i)
+    options_parse_hex_string("00112233445566778899AABBCCDDEEFF00112233445566778899aabbccddeeff", &buffer);
+  sink += buffer.buf_[31];
+  free(buffer.buf_);
+}
+
+static void bench_log_hex_dump(u_int32_t iterations)
+{
+  u_int8_t buf[64];
+  u_int32_t i;
+  for(i = 0; i < sizeof(buf); ++i)
+    buf[i] = i;
+  for(i = 0; i < iterations; ++i)
+    log_print_hex_dump(NOTICE, buf, sizeof(buf));
+}
+
+static void bench_capture(u_int32_t iterations, int coalesce)
+{
+  const char* path = "/tmp/door_microbench.cap";
+  capture_t cap;
+  if(capture_open(&cap, path, 1024*1024))
+    return;
+
+  struct timeval now = { 1, 0 };
+  u_int8_t c = 'x';
+  u_int32_t i;
+  for(i = 0; i < iterations; ++i) {
+    if(!coalesce)
+      now.tv_usec = (i % 1000) * 1000;
+    capture_write(&cap, (coalesce || i % 2) ? CAPTURE_RX : CAPTURE_TX, &c, 1, &now);
+  }
+  capture_close(&cap);
+  unlink(path);
+}
+
+static void bench_capture_coalesced(u_int32_t iterations)
+{
+  bench_capture(iterations, 1);
+}
+
+static void bench_capture_record(u_int32_t iterations)
+{
+  bench_capture(iterations, 0);
+}
+
+static void bench_tap_write(u_int32_t iterations)
+{
+  tap_init();
+  tap.subscribers_ = 1;
+  u_int8_t c = 'x';
+  u_int32_t i;
+  for(i = 0; i < iterations; ++i) {
+    tap_write((i & 31) ? TAP_RX : TAP_TX, &c, 1);
+    if(!(i & 31))
+      tap_flush();
+  }
+  tap_init();
+}
+
+static void bench_shm_state(u_int32_t iterations, int publish)
+{
+  const char* path = "/tmp/door_microbench.shm";
+  shm_map_t map;
+  if(shm_state_open(&map, path))
+    return;
+
+  door_state_t state;
+  door_state_init(&state);
+  stats_door_t counters;
+  memset(&counters, 0, sizeof(counters));
+  shm_state_t snap;
+  u_int32_t i;
+  for(i = 0; i < iterations; ++i) {
+    if(publish)
+      shm_state_publish(&map, &state, &counters, i + 1);   // a new event every time, so it is written
+    else if(!shm_state_read(map.shm_, &snap, 1))
+      sink += snap.event_seq_;
+  }
+  shm_state_close(&map);
+  unlink(path);
+}
+
+static void bench_shm_state_publish(u_int32_t iterations)
+{
+  bench_shm_state(iterations, 1);
+}
+
+static void bench_shm_state_read(u_int32_t iterations)
+{
+  bench_shm_state(iterations, 0);
+}
+
+    // includes the batched write and fdatasync every JOURNAL_PENDING_MAX events
+static void bench_journal_add(u_int32_t iterations)
+{
+  const char* path = "/tmp/door_microbench.jnl";
+  unlink(path);
+  static journal_t j;
+  if(journal_open(&j, path))
+    return;
+
+  history_event_t ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.type_ = EVENT_REQUEST;
+  strcpy(ev.line_, "Request: toggle Card someone");
+  u_int32_t i;
+  for(i = 0; i < iterations; ++i) {
+    ev.seq_ = i + 1;
+    ev.time_ = 1000000 + i / 16;
+    journal_add(&j, &ev);
+  }
+  journal_close(&j);
+  unlink(path);
+}
+
+    // 's' to the in-process firmware model and its status line back through the pipe
+static void bench_transport_loop(u_int32_t iterations)
+{
+  transport_t t;
+  if(transport_init(&t, "loop:") || transport_open(&t))
+    return;
+
+  u_int8_t buf[128];
+  u_int32_t i;
+  for(i = 0; i < iterations; ++i) {
+    transport_write(&t, (const u_int8_t*)"s", 1);
+    int len = 0, ret;
+    while((ret = transport_read(&t, &buf[len], sizeof(buf) - len)) > 0) {
+      len += ret;
+      if(buf[len-1] == '\n')
+        break;
+    }
+  }
+  transport_clear(&t);
+}
+
+static bench_case_t bench_cases[] = {
+  { "cmd_push+cmd_pop", bench_cmd_push_pop, 1000000 },
+  { "client_find (64 clients)", bench_client_find, 1000000 },
+  { "client_add+client_remove", bench_client_add_remove, 1000000 },
+  { "door_push+schedule (64 clients)", bench_door_schedule, 1000000 },
+  { "string_list_add", bench_string_list_add, 1000000 },
+  { "process_cmd status", bench_process_cmd_status, 1000000 },
+  { "process_cmd toggle", bench_process_cmd_toggle, 1000000 },
+  { "process_cmd log", bench_process_cmd_log, 200000 },
+  { "process_cmd unknown", bench_process_cmd_unknown, 200000 },
+  { "log_printf disabled", bench_log_printf_disabled, 10000000 },
+  { "log_printf repeated", bench_log_printf_repeated, 1000000 },
+  { "log_printf distinct", bench_log_printf_distinct, 200000 },
+  { "options_parse_hex_string 32B", bench_parse_hex_string, 200000 },
+  { "log_print_hex_dump 64B", bench_log_hex_dump, 200000 },
+  { "capture_write 1B coalesced", bench_capture_coalesced, 10000000 },
+  { "capture_write 1B new record", bench_capture_record, 10000000 },
+  { "tap_write 1B", bench_tap_write, 10000000 },
+  { "shm_state_publish", bench_shm_state_publish, 1000000 },
+  { "shm_state_read", bench_shm_state_read, 10000000 },
+  { "journal_add", bench_journal_add, 200000 },
+  { "transport loop status", bench_transport_loop, 200000 },
+  { NULL, NULL, 0 }
+};
+
+int main(int argc, char* argv[])
+{
+  const char* filter = argc > 1 ? argv[1] : NULL;
+
+  log_init();
+  log_add_target("ring:3,1024");
+
+  printf("%-32s %12s %12s %12s\n", "benchmark", "iterations", "ns/op", "allocs/op");
+  bench_case_t* c;
+  for(c = bench_cases; c->name_; ++c) {
+    if(filter && !strstr(c->name_, filter))
+      continue;
+
+    c->func_(c->iterations_ / 100);
+
+    u_int64_t allocs = alloc_count;
+    u_int64_t start = now_ns();
+    c->func_(c->iterations_);
+    u_int64_t elapsed = now_ns() - start;
+    allocs = alloc_count - allocs;
+
+    printf("%-32s %12u %12.1f %12.2f\n", c->name_, c->iterations_,
+           (double)elapsed / c->iterations_, (double)allocs / c->iterations_);
+  }
+
+  log_close();
+  return 0;
+}
@@ -0,0 +1,821 @@
+/*
+ *  door_daemon
+ *
+ *  Copyright (C) 2009 Christian Pointner <equinox@spreadspace.org>
+ *
+ *  This file is part of door_daemon.
+ *
+ *  door_daemon is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  door_daemon is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with door_daemon. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * door_replay: replays a session recorded with door_daemon -r <file>
+ *
+ * door_replay plays the firmware on a pty and all recorded clients on the
+ * command socket of the daemon under test. The recorded outputs are
+ * compared per connection (and for the door) in order. Before each input
+ * door_replay waits until the daemon produced every output which was
+ * recorded before that input, outputs may arrive earlier than recorded
+ * as the daemon handles several inputs per main loop round. After each
+ * input it waits until the daemon has read it, otherwise the daemon would
+ * handle inputs arriving together in the order of its client list. Lines starting with one of the
+ * ignore prefixes (counters, clock readings) are left out of the comparison.
+ *
+ * If the daemon runs with virtual time (-V) the recorded pauses are
+ * replayed with 'clock advance', which makes expiries happen at exactly
+ * the same points as in the recording without waiting for them. Otherwise
+ * the pauses are replayed in real time scaled by -S, or skipped with -S 0.
+ *
+ * The result contains throughput and command latency of the recording and
+ * of the replay, one JSON object per run can be appended to a file.
+ */
+
+#include "datatypes.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+
+#include "session.h"
+#include "pty.h"
+
+#define REPLAY_IGNORE_MAX 16
+#define REPLAY_LINE_MAX 4096
+#define REPLAY_DIFFS_PRINTED 20
+
+struct replay_event_struct {
+  session_event_t ev_;
+  u_int8_t* data_;
+};
+typedef struct replay_event_struct replay_event_t;
+
+struct replay_samples_struct {
+  u_int32_t* values_;
+  u_int32_t count_;
+  u_int32_t size_;
+};
+typedef struct replay_samples_struct replay_samples_t;
+
+struct replay_expected_struct {
+  u_int32_t idx_;             // index of the recorded event
+  char* line_;
+};
+typedef struct replay_expected_struct replay_expected_t;
+
+struct replay_conn_struct {
+  int fd_;
+  char buf_[REPLAY_LINE_MAX];
+  u_int32_t fill_;
+  replay_expected_t* expected_;
+  u_int32_t expected_head_;
+  u_int32_t expected_tail_;
+  u_int32_t expected_size_;
+  u_int64_t sent_us_;         // when the last command was written, 0 once its answer arrived
+};
+typedef struct replay_conn_struct replay_conn_t;
+
+struct replay_struct {
+  const char* sock_path_;
+  const char* link_;
+  const char* label_;
+  const char* out_path_;
+  double speed_;
+  int timeout_ms_;
+  const char* ignore_[REPLAY_IGNORE_MAX];
+  int ignore_count_;
+
+  replay_event_t* events_;
+  u_int32_t event_count_;
+  u_int32_t max_conn_;
+  replay_conn_t** conns_;
+
+  int door_fd_;
+  int door_slave_fd_;
+  u_int8_t* door_expected_;
+  u_int32_t* door_expected_idx_;
+  u_int32_t door_expected_head_;
+  u_int32_t door_expected_tail_;
+  u_int32_t door_expected_size_;
+
+  int ctl_fd_;
+  int virtual_;
+  u_int64_t advance_rest_us_;
+
+  u_int32_t current_;         // index of the next input
+  u_int32_t* consumed_;       // per event: how many of its outputs arrived or were given up
+  u_int32_t pending_;         // outputs recorded before the next input which did not arrive yet
+  u_int32_t inputs_;
+  u_int32_t matched_;
+  u_int32_t mismatched_;
+  u_int32_t missing_;
+  u_int32_t unexpected_;
+  u_int32_t diffs_printed_;
+  replay_samples_t recorded_latency_;
+  replay_samples_t replay_latency_;
+  double recorded_s_;
+  double replay_s_;
+};
+typedef struct replay_struct replay_t;
+
+u_int64_t replay_now_us()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (u_int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+int replay_samples_add(replay_samples_t* samples, u_int32_t value)
+{
+  if(samples->count_ >= samples->size_) {
+    u_int32_t size = samples->size_ ? samples->size_ * 2 : 1024;
+    u_int32_t* values = realloc(samples->values_, size * sizeof(u_int32_t));
+    if(!values)
+      return -2;
+    samples->values_ = values;
+    samples->size_ = size;
+  }
+  samples->values_[samples->count_++] = value;
+  return 0;
+}
+
+static int replay_cmp_u32(const void* a, const void* b)
+{
+  u_int32_t x = *(const u_int32_t*)a, y = *(const u_int32_t*)b;
+  return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+u_int32_t replay_samples_quantile(replay_samples_t* samples, double q)
+{
+  if(!samples->count_)
+    return 0;
+  u_int32_t idx = (u_int32_t)(q * samples->count_);
+  if(idx >= samples->count_)
+    idx = samples->count_ - 1;
+  return samples->values_[idx];
+}
+
+int replay_load(replay_t* replay, const char* path)
+{
+  FILE* in = fopen(path, "r");
+  if(!in) {
+    fprintf(stderr, "door_replay: unable to open '%s': %s\n", path, strerror(errno));
+    return -1;
+  }
+  session_header_t hdr;
+  if(session_read_header(in, &hdr)) {
+    fprintf(stderr, "door_replay: '%s' is not a session recording\n", path);
+    fclose(in);
+    return -1;
+  }
+
+  u_int32_t size = 0;
+  u_int8_t data[0x10000];
+  session_event_t ev;
+  int ret;
+  while((ret = session_read_event(in, &ev, data, sizeof(data))) > 0) {
+    if(replay->event_count_ >= size) {
+      size = size ? size * 2 : 4096;
+      replay_event_t* events = realloc(replay->events_, size * sizeof(replay_event_t));
+      if(!events) {
+        fclose(in);
+        return -2;
+      }
+      replay->events_ = events;
+    }
+    replay_event_t* e = &replay->events_[replay->event_count_++];
+    e->ev_ = ev;
+    e->data_ = malloc(ev.len_ + 1);
+    if(!e->data_) {
+      fclose(in);
+      return -2;
+    }
+    memcpy(e->data_, data, ev.len_ + 1);
+    if(ev.conn_ > replay->max_conn_)
+      replay->max_conn_ = ev.conn_;
+  }
+  if(ret < 0)
+    fprintf(stderr, "door_replay: '%s' ends with a truncated event, ignoring it\n", path);
+  fclose(in);
+
+  replay->conns_ = calloc(replay->max_conn_ + 1, sizeof(replay_conn_t*));
+  if(!replay->conns_)
+    return -2;
+  return 0;
+}
+
+static void replay_recorded_stats(replay_t* replay)
+{
+      // the latency of a command is the time until the first line on the same connection
+  u_int64_t* pending = calloc(replay->max_conn_ + 1, sizeof(u_int64_t));
+  if(!pending)
+    return;
+
+  u_int32_t i;
+  for(i = 0; i < replay->event_count_; ++i) {
+    session_event_t* ev = &replay->events_[i].ev_;
+    if(ev->type_ == SESSION_CLIENT_IN)
+      pending[ev->conn_] = ev->time_us_;
+    else if(ev->type_ == SESSION_CLIENT_OUT && pending[ev->conn_]) {
+      replay_samples_add(&replay->recorded_latency_, (u_int32_t)(ev->time_us_ - pending[ev->conn_]));
+      pending[ev->conn_] = 0;
+    }
+  }
+  free(pending);
+  if(replay->event_count_)
+    replay->recorded_s_ = (replay->events_[replay->event_count_ - 1].ev_.time_us_ - replay->events_[0].ev_.time_us_) / 1e6;
+}
+
+static int replay_ignored(replay_t* replay, const char* line)
+{
+  int i;
+  for(i = 0; i < replay->ignore_count_; ++i)
+    if(!strncmp(line, replay->ignore_[i], strlen(replay->ignore_[i])))
+      return 1;
+  return 0;
+}
+
+static void replay_diff(replay_t* replay, const char* fmt, u_int32_t conn, const char* a, const char* b)
+{
+  if(replay->diffs_printed_++ >= REPLAY_DIFFS_PRINTED)
+    return;
+  printf(fmt, conn, a, b);
+  if(replay->diffs_printed_ == REPLAY_DIFFS_PRINTED)
+    printf("further differences are not printed\n");
+}
+
+static replay_conn_t* replay_conn(replay_t* replay, u_int32_t id)
+{
+  if(id > replay->max_conn_)
+    return NULL;
+  if(!replay->conns_[id]) {
+    replay->conns_[id] = calloc(1, sizeof(replay_conn_t));
+    if(replay->conns_[id])
+      replay->conns_[id]->fd_ = -1;
+  }
+  return replay->conns_[id];
+}
+
+static void replay_expect_line(replay_conn_t* conn, u_int32_t idx, const char* line, size_t len)
+{
+  if(conn->expected_tail_ >= conn->expected_size_) {
+    u_int32_t size = conn->expected_size_ ? conn->expected_size_ * 2 : 16;
+    replay_expected_t* expected = realloc(conn->expected_, size * sizeof(replay_expected_t));
+    if(!expected)
+      return;
+    conn->expected_ = expected;
+    conn->expected_size_ = size;
+  }
+  char* copy = strndup(line, len);
+  if(!copy)
+    return;
+  conn->expected_[conn->expected_tail_].idx_ = idx;
+  conn->expected_[conn->expected_tail_++].line_ = copy;
+}
+
+static u_int32_t replay_expect_client(replay_t* replay, u_int32_t idx, u_int32_t id, const u_int8_t* data, u_int32_t len)
+{
+  replay_conn_t* conn = replay_conn(replay, id);
+  if(!conn)
+    return 0;
+
+      // a response may hold several lines (e.g. stats), they are compared one by one
+  u_int32_t count = 0;
+  const char* line = (const char*)data;
+  const char* end = line + len;
+  while(line <= end) {
+    const char* nl = memchr(line, '\n', end - line);
+    size_t n = nl ? (size_t)(nl - line) : (size_t)(end - line);
+    char tmp[REPLAY_LINE_MAX];
+    snprintf(tmp, sizeof(tmp), "%.*s", (int)n, line);
+    if(!replay_ignored(replay, tmp)) {
+      replay_expect_line(conn, idx, line, n);
+      count++;
+    }
+    if(!nl)
+      break;
+    line = nl + 1;
+  }
+  return count;
+}
+
+static u_int32_t replay_expect_door(replay_t* replay, u_int32_t idx, const u_int8_t* data, u_int32_t len)
+{
+  if(replay->door_expected_tail_ + len > replay->door_expected_size_) {
+    u_int32_t size = replay->door_expected_size_ ? replay->door_expected_size_ * 2 : 1024;
+    while(size < replay->door_expected_tail_ + len)
+      size *= 2;
+    u_int8_t* buf = realloc(replay->door_expected_, size);
+    if(buf)
+      replay->door_expected_ = buf;
+    u_int32_t* idxs = realloc(replay->door_expected_idx_, size * sizeof(u_int32_t));
+    if(idxs)
+      replay->door_expected_idx_ = idxs;
+    if(!buf || !idxs)
+      return 0;
+    replay->door_expected_size_ = size;
+  }
+  u_int32_t i;
+  for(i = 0; i < len; ++i) {
+    replay->door_expected_[replay->door_expected_tail_] = data[i];
+    replay->door_expected_idx_[replay->door_expected_tail_++] = idx;
+  }
+  return len;
+}
+
+static void replay_consumed(replay_t* replay, u_int32_t idx)
+{
+  replay->consumed_[idx]++;
+  if(idx < replay->current_)
+    replay->pending_--;
+}
+
+static void replay_got_line(replay_t* replay, u_int32_t id, replay_conn_t* conn, const char* line)
+{
+  if(conn->sent_us_) {
+    replay_samples_add(&replay->replay_latency_, (u_int32_t)(replay_now_us() - conn->sent_us_));
+    conn->sent_us_ = 0;
+  }
+  if(replay_ignored(replay, line))
+    return;
+
+  if(conn->expected_head_ == conn->expected_tail_) {
+    replay->unexpected_++;
+    replay_diff(replay, "conn %u: unexpected '%s'%s\n", id, line, "");
+    return;
+  }
+  replay_consumed(replay, conn->expected_[conn->expected_head_].idx_);
+  char* expected = conn->expected_[conn->expected_head_++].line_;
+  if(strcmp(expected, line)) {
+    replay->mismatched_++;
+    replay_diff(replay, "conn %u: expected '%s', got '%s'\n", id, expected, line);
+  }
+  else
+    replay->matched_++;
+  free(expected);
+}
+
+static void replay_got_door(replay_t* replay, const u_int8_t* data, u_int32_t len)
+{
+  u_int32_t i;
+  for(i = 0; i < len; ++i) {
+    char got[2] = { data[i], 0 };
+    if(replay->door_expected_head_ == replay->door_expected_tail_) {
+      replay->unexpected_++;
+      replay_diff(replay, "door%.0u: unexpected '%s'%s\n", 0, got, "");
+      continue;
+    }
+    replay_consumed(replay, replay->door_expected_idx_[replay->door_expected_head_]);
+    char expected[2] = { replay->door_expected_[replay->door_expected_head_++], 0 };
+    if(expected[0] != got[0]) {
+      replay->mismatched_++;
+      replay_diff(replay, "door%.0u: expected '%s', got '%s'\n", 0, expected, got);
+    }
+    else
+      replay->matched_++;
+  }
+}
+
+static void replay_read_conn(replay_t* replay, u_int32_t id, replay_conn_t* conn)
+{
+  ssize_t len = read(conn->fd_, conn->buf_ + conn->fill_, sizeof(conn->buf_) - 1 - conn->fill_);
+  if(len <= 0) {
+    if(len < 0 && (errno == EAGAIN || errno == EINTR))
+      return;
+    close(conn->fd_);
+    conn->fd_ = -1;
+    return;
+  }
+  conn->fill_ += len;
+  conn->buf_[conn->fill_] = 0;
+
+  char* line = conn->buf_;
+  char* nl;
+  while((nl = strchr(line, '\n'))) {
+    *nl = 0;
+    replay_got_line(replay, id, conn, line);
+    line = nl + 1;
+  }
+  conn->fill_ -= line - conn->buf_;
+  memmove(conn->buf_, line, conn->fill_);
+  if(conn->fill_ == sizeof(conn->buf_) - 1)
+    conn->fill_ = 0;
+}
+
+    // reads whatever the daemon sends until the deadline, or until nothing is outstanding if wait_all is set
+static void replay_poll(replay_t* replay, u_int64_t deadline, int wait_all)
+{
+  static struct pollfd* fds = NULL;
+  static u_int32_t* ids = NULL;
+  if(!fds) {
+    fds = calloc(replay->max_conn_ + 2, sizeof(struct pollfd));
+    ids = calloc(replay->max_conn_ + 2, sizeof(u_int32_t));
+    if(!fds || !ids)
+      return;
+  }
+
+  for(;;) {
+    if(wait_all && !replay->pending_)
+      return;
+    u_int64_t now = replay_now_us();
+    int timeout = now >= deadline ? 0 : (int)((deadline - now + 999) / 1000);
+
+    u_int32_t n = 0, i;
+    fds[n].fd = replay->door_fd_;
+    fds[n++].events = POLLIN;
+    for(i = 1; i <= replay->max_conn_; ++i)
+      if(replay->conns_[i] && replay->conns_[i]->fd_ >= 0) {
+        fds[n].fd = replay->conns_[i]->fd_;
+        fds[n].events = POLLIN;
+        ids[n++] = i;
+      }
+
+    int ret = poll(fds, n, timeout);
+    if(ret < 0 && errno != EINTR)
+      return;
+    if(ret <= 0) {
+      if(timeout == 0)
+        return;
+      continue;
+    }
+    if(fds[0].revents & POLLIN) {
+      u_int8_t buf[256];
+      ssize_t len = read(replay->door_fd_, buf, sizeof(buf));
+      if(len > 0)
+        replay_got_door(replay, buf, len);
+    }
+    for(i = 1; i < n; ++i)
+      if(fds[i].revents)
+        replay_read_conn(replay, ids[i], replay->conns_[ids[i]]);
+  }
+}
+
+    // drops what should have arrived before event idx, later outputs would be compared to it otherwise
+static void replay_give_up(replay_t* replay, u_int32_t idx)
+{
+  u_int32_t i;
+  for(i = 1; i <= replay->max_conn_; ++i) {
+    replay_conn_t* conn = replay->conns_[i];
+    if(!conn)
+      continue;
+    while(conn->expected_head_ < conn->expected_tail_ && conn->expected_[conn->expected_head_].idx_ < idx) {
+      replay_consumed(replay, conn->expected_[conn->expected_head_].idx_);
+      char* expected = conn->expected_[conn->expected_head_++].line_;
+      replay->missing_++;
+      replay_diff(replay, "conn %u: missing '%s'%s\n", i, expected, "");
+      free(expected);
+    }
+  }
+  while(replay->door_expected_head_ < replay->door_expected_tail_ && replay->door_expected_idx_[replay->door_expected_head_] < idx) {
+    replay_consumed(replay, replay->door_expected_idx_[replay->door_expected_head_]);
+    char expected[2] = { replay->door_expected_[replay->door_expected_head_++], 0 };
+    replay->missing_++;
+    replay_diff(replay, "door%.0u: missing '%s'%s\n", 0, expected, "");
+  }
+}
+
+static int replay_connect(const char* path)
+{
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(fd < 0)
+    return -1;
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+  if(connect(fd, (struct sockaddr*)&addr, sizeof(addr))) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static int replay_ctl(replay_t* replay, const char* cmd, char* reply, size_t size)
+{
+  if(write(replay->ctl_fd_, cmd, strlen(cmd)) != strlen(cmd))
+    return -1;
+
+  size_t fill = 0;
+  while(fill < size - 1) {
+    struct pollfd pfd = { replay->ctl_fd_, POLLIN, 0 };
+    if(poll(&pfd, 1, replay->timeout_ms_) <= 0)
+      return -1;
+    ssize_t len = read(replay->ctl_fd_, reply + fill, 1);
+    if(len <= 0)
+      return -1;
+    if(reply[fill] == '\n')
+      break;
+    fill++;
+  }
+  reply[fill] = 0;
+  return 0;
+}
+
+static int replay_start(replay_t* replay)
+{
+  replay->door_fd_ = pty_open("door_replay", replay->link_, &replay->door_slave_fd_);
+  if(replay->door_fd_ < 0)
+    return -1;
+
+      // the daemon answers 'clock' only once it is in its main loop, i.e. the door is open
+  int tries;
+  for(tries = 0; tries < 500 && replay->ctl_fd_ < 0; ++tries) {
+    replay->ctl_fd_ = replay_connect(replay->sock_path_);
+    if(replay->ctl_fd_ < 0)
+      usleep(20000);
+  }
+  char reply[128];
+  if(replay->ctl_fd_ < 0 || replay_ctl(replay, "clock\n", reply, sizeof(reply)) || strncmp(reply, "Clock:", 6)) {
+    fprintf(stderr, "door_replay: no daemon answering on '%s'\n", replay->sock_path_);
+    return -1;
+  }
+  replay->virtual_ = !strncmp(reply, "Clock: virtual", 14);
+  fprintf(stderr, "door_replay: daemon is up, %s time\n", replay->virtual_ ? "virtual" : "real");
+  return 0;
+}
+
+static void replay_pace(replay_t* replay, u_int64_t gap_us, u_int64_t due_us)
+{
+  if(replay->virtual_) {
+    replay->advance_rest_us_ += gap_us;
+    u_int64_t ms = replay->advance_rest_us_ / 1000;
+    if(!ms)
+      return;
+    replay->advance_rest_us_ -= ms * 1000;
+    char cmd[64], reply[128];
+    snprintf(cmd, sizeof(cmd), "clock advance %llu\n", (unsigned long long)ms);
+    if(replay_ctl(replay, cmd, reply, sizeof(reply)))
+      fprintf(stderr, "door_replay: clock advance failed\n");
+        // let the daemon act on the new time (expiries) before the next input
+    replay_poll(replay, replay_now_us() + 1000, 0);
+    return;
+  }
+  if(replay->speed_ > 0)
+    replay_poll(replay, due_us, 0);
+}
+
+    // waits until the peer has read everything written to fd
+static void replay_drain(replay_t* replay, int fd, int request)
+{
+  u_int64_t deadline = replay_now_us() + replay->timeout_ms_ * 1000;
+  int pending;
+  while(!ioctl(fd, request, &pending) && pending > 0 && replay_now_us() < deadline) {
+    replay_poll(replay, 0, 0);
+    usleep(20);
+  }
+}
+
+static void replay_input(replay_t* replay, replay_event_t* e)
+{
+  replay_conn_t* conn = e->ev_.conn_ ? replay_conn(replay, e->ev_.conn_) : NULL;
+  switch(e->ev_.type_) {
+  case SESSION_CONNECT:
+    if(conn && conn->fd_ < 0) {
+      conn->fd_ = replay_connect(replay->sock_path_);
+      if(conn->fd_ < 0)
+        fprintf(stderr, "door_replay: connect failed: %s\n", strerror(errno));
+      else
+        fcntl(conn->fd_, F_SETFL, O_NONBLOCK);
+    }
+    break;
+  case SESSION_DISCONNECT:
+    if(conn && conn->fd_ >= 0) {
+      close(conn->fd_);
+      conn->fd_ = -1;
+    }
+    break;
+  case SESSION_CLIENT_IN: {
+    if(!conn || conn->fd_ < 0)
+      break;
+    char line[REPLAY_LINE_MAX];
+    int len = snprintf(line, sizeof(line), "%s\n", (char*)e->data_);
+    conn->sent_us_ = replay_now_us();
+    if(send(conn->fd_, line, len, MSG_NOSIGNAL) != len)
+      fprintf(stderr, "door_replay: write to conn %u failed\n", e->ev_.conn_);
+    replay_drain(replay, conn->fd_, SIOCOUTQ);
+    break;
+  }
+  case SESSION_DOOR_IN: {
+    u_int32_t off = 0;
+    while(off < e->ev_.len_) {
+      ssize_t len = write(replay->door_fd_, e->data_ + off, e->ev_.len_ - off);
+      if(len > 0)
+        off += len;
+      else if(len < 0 && errno != EAGAIN && errno != EINTR)
+        break;
+      else
+        replay_poll(replay, replay_now_us() + 1000, 0);
+    }
+    replay_drain(replay, replay->door_slave_fd_, FIONREAD);
+    break;
+  }
+  }
+}
+
+int replay_run(replay_t* replay)
+{
+  if(!replay->event_count_)
+    return 0;
+
+  u_int32_t* outputs = calloc(replay->event_count_, sizeof(u_int32_t));
+  replay->consumed_ = calloc(replay->event_count_, sizeof(u_int32_t));
+  if(!outputs || !replay->consumed_)
+    return -2;
+  u_int32_t i;
+  for(i = 0; i < replay->event_count_; ++i) {
+    replay_event_t* e = &replay->events_[i];
+    if(e->ev_.type_ == SESSION_CLIENT_OUT)
+      outputs[i] = replay_expect_client(replay, i, e->ev_.conn_, e->data_, e->ev_.len_);
+    else if(e->ev_.type_ == SESSION_DOOR_OUT)
+      outputs[i] = replay_expect_door(replay, i, e->data_, e->ev_.len_);
+  }
+
+  u_int64_t first_us = replay->events_[0].ev_.time_us_;
+  u_int64_t last_input_us = first_us;
+  u_int64_t start = replay_now_us();
+  for(i = 0; i < replay->event_count_; ++i) {
+    replay_event_t* e = &replay->events_[i];
+    replay->current_ = i + 1;
+    if(e->ev_.type_ == SESSION_CLIENT_OUT || e->ev_.type_ == SESSION_DOOR_OUT) {
+      replay->pending_ += outputs[i] - replay->consumed_[i];
+      continue;
+    }
+
+    replay_poll(replay, replay_now_us() + replay->timeout_ms_ * 1000, 1);
+    if(replay->pending_)
+      replay_give_up(replay, i);
+
+    u_int64_t due = start + (u_int64_t)((e->ev_.time_us_ - first_us) / (replay->speed_ > 0 ? replay->speed_ : 1));
+    replay_pace(replay, e->ev_.time_us_ - last_input_us, due);
+    last_input_us = e->ev_.time_us_;
+
+    replay_input(replay, e);
+    replay->inputs_++;
+  }
+  free(outputs);
+  replay_poll(replay, replay_now_us() + replay->timeout_ms_ * 1000, 1);
+  if(replay->pending_)
+    replay_give_up(replay, replay->event_count_);
+  replay->replay_s_ = (replay_now_us() - start) / 1e6;
+      // catch anything the daemon sends which was not in the recording
+  replay_poll(replay, replay_now_us() + 100000, 0);
+  return 0;
+}
+
+static void replay_print_latency(FILE* out, const char* name, replay_samples_t* samples)
+{
+  qsort(samples->values_, samples->count_, sizeof(u_int32_t), replay_cmp_u32);
+  fprintf(out, "\"%s\":{\"count\":%u,\"p50\":%u,\"p99\":%u,\"p999\":%u,\"max\":%u}", name, samples->count_,
+          replay_samples_quantile(samples, 0.5), replay_samples_quantile(samples, 0.99),
+          replay_samples_quantile(samples, 0.999), samples->count_ ? samples->values_[samples->count_ - 1] : 0);
+}
+
+static void replay_print_compare(const char* name, u_int32_t recorded, u_int32_t replayed)
+{
+  printf("  %-6s %10u %10u %+9.1f%%\n", name, recorded, replayed,
+         recorded ? 100.0 * ((double)replayed - recorded) / recorded : 0.0);
+}
+
+void replay_report(replay_t* replay, const char* session_path)
+{
+  double recorded_rate = replay->recorded_s_ > 0 ? replay->inputs_ / replay->recorded_s_ : 0;
+  double replay_rate = replay->replay_s_ > 0 ? replay->inputs_ / replay->replay_s_ : 0;
+  u_int32_t differences = replay->mismatched_ + replay->missing_ + replay->unexpected_;
+
+  printf("events: %u, inputs: %u\n", replay->event_count_, replay->inputs_);
+  printf("outputs: %u matched, %u mismatched, %u missing, %u unexpected\n",
+         replay->matched_, replay->mismatched_, replay->missing_, replay->unexpected_);
+  printf("duration: recorded %.3f s, replay %.3f s\n", replay->recorded_s_, replay->replay_s_);
+  printf("inputs/s: recorded %.1f, replay %.1f\n", recorded_rate, replay_rate);
+  printf("command latency (us):  recorded     replay\n");
+  qsort(replay->recorded_latency_.values_, replay->recorded_latency_.count_, sizeof(u_int32_t), replay_cmp_u32);
+  qsort(replay->replay_latency_.values_, replay->replay_latency_.count_, sizeof(u_int32_t), replay_cmp_u32);
+  replay_print_compare("p50", replay_samples_quantile(&replay->recorded_latency_, 0.5), replay_samples_quantile(&replay->replay_latency_, 0.5));
+  replay_print_compare("p99", replay_samples_quantile(&replay->recorded_latency_, 0.99), replay_samples_quantile(&replay->replay_latency_, 0.99));
+  replay_print_compare("p999", replay_samples_quantile(&replay->recorded_latency_, 0.999), replay_samples_quantile(&replay->replay_latency_, 0.999));
+  printf("result: %s\n", differences ? "DIFFERENT" : "identical");
+
+  if(!replay->out_path_)
+    return;
+  FILE* out = fopen(replay->out_path_, "a");
+  if(!out) {
+    fprintf(stderr, "door_replay: unable to open '%s': %s\n", replay->out_path_, strerror(errno));
+    return;
+  }
+  fprintf(out, "{\"time\":%ld,\"label\":\"%s\",\"session\":\"%s\",\"virtual\":%d,\"speed\":%g,\"events\":%u,\"inputs\":%u,",
+          (long)time(NULL), replay->label_ ? replay->label_ : "", session_path, replay->virtual_, replay->speed_,
+          replay->event_count_, replay->inputs_);
+  fprintf(out, "\"matched\":%u,\"mismatched\":%u,\"missing\":%u,\"unexpected\":%u,",
+          replay->matched_, replay->mismatched_, replay->missing_, replay->unexpected_);
+  fprintf(out, "\"recorded_s\":%.3f,\"replay_s\":%.3f,\"recorded_inputs_per_s\":%.1f,\"replay_inputs_per_s\":%.1f,",
+          replay->recorded_s_, replay->replay_s_, recorded_rate, replay_rate);
+  replay_print_latency(out, "recorded_latency_us", &replay->recorded_latency_);
+  fprintf(out, ",");
+  replay_print_latency(out, "replay_latency_us", &replay->replay_latency_);
+  fprintf(out, "}\n");
+  fclose(out);
+}
+
+void replay_print_usage()
+{
+  printf("USAGE:\n");
+  printf("door_replay [-h|--help]                        prints this...\n");
+  printf("            [-s|--socket] <unix sock>          the command socket of the daemon under test\n");
+  printf("            [-l|--link] <path>                 symlink to the pty the daemon uses as door (default: /tmp/door)\n");
+  printf("            [-S|--speed] <factor>              replay speed in real time mode, 0 is as fast as possible (default: 1)\n");
+  printf("            [-T|--timeout] <ms>                wait this long for the recorded outputs (default: 2000)\n");
+  printf("            [-i|--ignore] <prefix>             don't compare lines starting with this, can be invoked several times\n");
+  printf("                                               (default: door_daemon_, Clock:, log_suppressed_)\n");
+  printf("            [-o|--output] <file>               append the result as a JSON line to this file\n");
+  printf("            [-L|--label] <label>               label stored with the result, e.g. a git revision\n");
+  printf("            <session file>\n");
+}
+
+int main(int argc, char* argv[])
+{
+  replay_t replay;
+  memset(&replay, 0, sizeof(replay));
+  replay.sock_path_ = "/var/run/door_daemon/cmd.sock";
+  replay.link_ = "/tmp/door";
+  replay.speed_ = 1;
+  replay.timeout_ms_ = 2000;
+  replay.ctl_fd_ = -1;
+  replay.door_fd_ = -1;
+
+  int i;
+  for(i = 1; i < argc - 1; ++i) {
+    const char* str = argv[i];
+    if(i + 2 >= argc) {
+      replay_print_usage();
+      return 1;
+    }
+    else if(!strcmp(str, "-s") || !strcmp(str, "--socket"))
+      replay.sock_path_ = argv[++i];
+    else if(!strcmp(str, "-l") || !strcmp(str, "--link"))
+      replay.link_ = argv[++i];
+    else if(!strcmp(str, "-S") || !strcmp(str, "--speed"))
+      replay.speed_ = atof(argv[++i]);
+    else if(!strcmp(str, "-T") || !strcmp(str, "--timeout"))
+      replay.timeout_ms_ = atoi(argv[++i]);
+    else if(!strcmp(str, "-i") || !strcmp(str, "--ignore")) {
+      if(replay.ignore_count_ < REPLAY_IGNORE_MAX)
+        replay.ignore_[replay.ignore_count_++] = argv[++i];
+    }
+    else if(!strcmp(str, "-o") || !strcmp(str, "--output"))
+      replay.out_path_ = argv[++i];
+    else if(!strcmp(str, "-L") || !strcmp(str, "--label"))
+      replay.label_ = argv[++i];
+    else {
+      replay_print_usage();
+      return 1;
+    }
+  }
+  if(i != argc - 1 || !strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+    replay_print_usage();
+    return 1;
+  }
+  if(!replay.ignore_count_) {
+    replay.ignore_[replay.ignore_count_++] = "door_daemon_";
+    replay.ignore_[replay.ignore_count_++] = "Clock:";
+    replay.ignore_[replay.ignore_count_++] = "log_suppressed_";
+  }
+
+  const char* session_path = argv[argc - 1];
+  int ret = replay_load(&replay, session_path);
+  if(ret) {
+    if(ret == -2)
+      fprintf(stderr, "door_replay: memory error\n");
+    return 2;
+  }
+  replay_recorded_stats(&replay);
+  fprintf(stderr, "door_replay: loaded %u events\n", replay.event_count_);
+
+  if(replay_start(&replay))
+    return 2;
+  replay_run(&replay);
+  replay_report(&replay, session_path);
+
+  unlink(replay.link_);
+  return (replay.mismatched_ + replay.missing_ + replay.unexpected_) ? 3 : 0;
+}
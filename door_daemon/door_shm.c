@@ -0,0 +1,139 @@
+/*
+ *  door_daemon
+ *
+ *  Copyright (C) 2009 Christian Pointner <equinox@spreadspace.org>
+ *
+ *  This file is part of door_daemon.
+ *
+ *  door_daemon is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  door_daemon is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with door_daemon. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * door_shm: prints the state published by door_daemon -M <file>
+ *
+ *   door_shm <file>                  all fields of one snapshot
+ *   door_shm -f [-i <ms>] <file>     print the state line whenever an event
+ *                                    happened or the state changed
+ *
+ * Reading the snapshot does not involve the daemon at all, it is what a
+ * status LED or web page generator would do in its own process.
+ */
+
+#include "datatypes.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+
+#include "shm_state.h"
+
+#define SHM_READ_TRIES 1000
+
+static volatile sig_atomic_t shm_done = 0;
+
+static void shm_sig_handler(int sig)
+{
+  shm_done = 1;
+}
+
+static void shm_print_usage()
+{
+  printf("USAGE:\n");
+  printf("door_shm [-f|--follow] [-i|--interval <ms>] <file>\n");
+  printf("         -f        print the state line on every change instead of one snapshot\n");
+  printf("         -i <ms>   how often to look for changes (default: 100)\n");
+}
+
+static void shm_print(const shm_state_t* s)
+{
+  printf("pid=%u\n", s->pid_);
+  printf("updated=%llu\n", (unsigned long long)s->updated_);
+  printf("event_seq=%llu\n", (unsigned long long)s->event_seq_);
+  printf("lock=%d\n", s->lock_);
+  printf("motion=%d\n", s->motion_);
+  printf("ajar=%d\n", s->ajar_);
+  printf("error=%d\n", s->error_);
+  printf("changed=%lld\n", (long long)s->changed_);
+  printf("verified=%d\n", !s->unverified_);
+  printf("actor=%.*s\n", (int)sizeof(s->actor_), s->actor_);
+  printf("cmds_completed=%u\n", s->cmds_completed_);
+  printf("cmds_expired=%u\n", s->cmds_expired_);
+  printf("queue_depth=%u\n", s->queue_depth_);
+  printf("clients=%u\n", s->clients_);
+  printf("listeners=%u\n", s->listeners_);
+  printf("door_reopens=%u\n", s->door_reopens_);
+  printf("firmware_errors=%u\n", s->firmware_errors_);
+  printf("door_bytes_in=%llu\n", (unsigned long long)s->door_bytes_in_);
+  printf("door_bytes_out=%llu\n", (unsigned long long)s->door_bytes_out_);
+  printf("%.*s\n", (int)sizeof(s->line_), s->line_);
+}
+
+int main(int argc, char* argv[])
+{
+  int follow = 0, interval_ms = 100;
+  int i;
+  for(i = 1; i < argc - 1; ++i) {
+    if(!strcmp(argv[i], "-f") || !strcmp(argv[i], "--follow"))
+      follow = 1;
+    else if((!strcmp(argv[i], "-i") || !strcmp(argv[i], "--interval")) && i + 2 < argc)
+      interval_ms = atoi(argv[++i]);
+    else {
+      shm_print_usage();
+      return 1;
+    }
+  }
+  if(i != argc - 1 || interval_ms <= 0) {
+    shm_print_usage();
+    return 1;
+  }
+
+  shm_map_t map;
+  if(shm_state_open_read(&map, argv[i])) {
+    fprintf(stderr, "unable to open '%s': %s\n", argv[i], strerror(errno));
+    return 1;
+  }
+
+  shm_state_t snap;
+  if(!follow) {
+    int ret = shm_state_read(map.shm_, &snap, SHM_READ_TRIES);
+    if(!ret)
+      shm_print(&snap);
+    else
+      fprintf(stderr, "no consistent snapshot after %d tries\n", SHM_READ_TRIES);
+    shm_state_close(&map);
+    return ret ? 2 : 0;
+  }
+
+  signal(SIGINT, shm_sig_handler);
+  signal(SIGTERM, shm_sig_handler);
+  u_int64_t last_event = 0;
+  char last_line[SHM_STATE_LINE_MAX] = "";
+  while(!shm_done) {
+    if(!shm_state_read(map.shm_, &snap, SHM_READ_TRIES) &&
+       (snap.event_seq_ != last_event || strncmp(snap.line_, last_line, sizeof(last_line)))) {
+      printf("%llu %.*s\n", (unsigned long long)snap.event_seq_, (int)sizeof(snap.line_), snap.line_);
+      fflush(stdout);
+      last_event = snap.event_seq_;
+      memcpy(last_line, snap.line_, sizeof(last_line));
+    }
+    usleep(interval_ms * 1000);
+  }
+
+  shm_state_close(&map);
+  return 0;
+}
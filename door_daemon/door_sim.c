@@ -0,0 +1,334 @@
+/*
+ *  door_daemon
+ *
+ *  Copyright (C) 2009 Christian Pointner <equinox@spreadspace.org>
+ *
+ *  This file is part of door_daemon.
+ *
+ *  door_daemon is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  door_daemon is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with door_daemon. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * door_sim: emulates the door firmware on a pseudo terminal so that
+ * door_daemon can be run and tested without the real hardware, e.g.:
+ *
+ *   door_sim -l /tmp/door &
+ *   door_daemon -D -d /tmp/door -s /tmp/door.sock
+ *
+ * Lines read from stdin act as the physical inputs of the door:
+ *   open, close   press the manual open/close key
+ *   ajar, shut    change the state of the reed contact
+ *   jam           the next motion gets stuck and runs into the timeout
+ *   vanish        remove the pty for a second, like an unplugged usb-serial
+ *   status        print the internal state to stderr
+ *
+ * The fault options damage the serial stream on purpose: garbage bytes
+ * before a line, overlong lines, lines without newline and a pty which
+ * disappears periodically.
+ */
+
+#define _GNU_SOURCE
+
+#include "datatypes.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+
+#include "firmware_sim.h"
+#include "pty.h"
+
+struct door_sim_struct {
+  int master_fd_;
+  int slave_fd_;
+  const char* link_;
+  int verbose_;
+  u_int32_t garbage_rate_;
+  u_int32_t overlong_rate_;
+  u_int32_t nonewline_rate_;
+  u_int32_t vanish_sec_;
+  u_int64_t vanish_next_;
+  u_int64_t reappear_;
+};
+typedef struct door_sim_struct door_sim_t;
+
+static volatile sig_atomic_t door_sim_done = 0;
+
+static void door_sim_sig_handler(int sig)
+{
+  door_sim_done = 1;
+}
+
+u_int64_t door_sim_now()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (u_int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static int door_sim_chance(u_int32_t percent)
+{
+  return percent && (u_int32_t)(rand() % 100) < percent;
+}
+
+void door_sim_write(door_sim_t* door, const char* buf, int len)
+{
+  if(door->master_fd_ < 0)
+    return;
+
+  int offset = 0;
+  while(offset < len) {
+    int ret = write(door->master_fd_, &buf[offset], len - offset);
+    if(ret < 0) {
+      if(errno == EINTR)
+        continue;
+      if(errno != EAGAIN && errno != EIO)
+        fprintf(stderr, "door_sim: write error: %s\n", strerror(errno));
+      return;
+    }
+    offset += ret;
+  }
+}
+
+void door_sim_output(void* arg, const char* line)
+{
+  door_sim_t* door = (door_sim_t*)arg;
+  char buf[512];
+  int len, i;
+
+  if(door_sim_chance(door->garbage_rate_)) {
+    len = 1 + rand() % 32;
+    for(i = 0; i < len; ++i)
+      buf[i] = rand() % 256;
+    door_sim_write(door, buf, len);
+    if(door->verbose_)
+      fprintf(stderr, "door_sim: > %d garbage bytes\n", len);
+  }
+  if(door_sim_chance(door->overlong_rate_)) {
+    len = 100 + rand() % 300;
+    memset(buf, 'X', len);
+    memcpy(&buf[len], "\r\n", 2);
+    door_sim_write(door, buf, len + 2);
+    if(door->verbose_)
+      fprintf(stderr, "door_sim: > %d bytes long line\n", len);
+  }
+
+  int newline = !door_sim_chance(door->nonewline_rate_);
+  len = snprintf(buf, sizeof(buf), "%s%s", line, newline ? "\r\n" : "");
+  if(len >= sizeof(buf))
+    len = sizeof(buf) - 1;
+
+  if(door->verbose_)
+    fprintf(stderr, "door_sim: > %s%s\n", line, newline ? "" : " (no newline)");
+
+  door_sim_write(door, buf, len);
+}
+
+void door_sim_vanish(door_sim_t* door, u_int64_t now)
+{
+  if(door->master_fd_ < 0)
+    return;
+
+  fprintf(stderr, "door_sim: pty vanishes for a second\n");
+  unlink(door->link_);
+  close(door->slave_fd_);
+  close(door->master_fd_);
+  door->master_fd_ = -1;
+  door->reappear_ = now + 1000;
+}
+
+void door_sim_stdin(door_sim_t* door, fwsim_t* sim, const char* line, u_int64_t now)
+{
+  if(!strcmp(line, "open"))
+    fwsim_manual_open(sim, now);
+  else if(!strcmp(line, "close"))
+    fwsim_manual_close(sim, now);
+  else if(!strcmp(line, "ajar"))
+    fwsim_set_ajar(sim, 1, now);
+  else if(!strcmp(line, "shut"))
+    fwsim_set_ajar(sim, 0, now);
+  else if(!strcmp(line, "jam"))
+    sim->jammed_ = 1;
+  else if(!strcmp(line, "vanish"))
+    door_sim_vanish(door, now);
+  else if(!strcmp(line, "status"))
+    fprintf(stderr, "door_sim: state=%s position=%u/%u ajar=%d jammed=%d\n", fwsim_state_to_string(sim->state_),
+            sim->position_, sim->motion_ms_, sim->ajar_, sim->jammed_);
+  else if(line[0])
+    fprintf(stderr, "door_sim: unknown input '%s' (open, close, ajar, shut, jam, vanish, status)\n", line);
+}
+
+void door_sim_print_usage()
+{
+  printf("USAGE:\n");
+  printf("door_sim [-h|--help]                         prints this...\n");
+  printf("         [-l|--link] <path>                  symlink pointing to the pty (default: /tmp/door)\n");
+  printf("         [-m|--motion] <ms>                  time from one limit switch to the other (default: 1000)\n");
+  printf("         [-w|--wait] <ms>                    hold time after a motion finished (default: 250)\n");
+  printf("         [-t|--timeout] <ms>                 motion timeout (default: 3200)\n");
+  printf("         [-j|--jam-rate] <percent>           chance that a motion gets stuck (default: 0)\n");
+  printf("         [-n|--drop-rate] <percent>          chance that a command isn't answered (default: 0)\n");
+  printf("         [-g|--garbage-rate] <percent>       chance of random bytes before a line (default: 0)\n");
+  printf("         [-x|--overlong-rate] <percent>      chance of an overlong line before a line (default: 0)\n");
+  printf("         [-e|--no-newline-rate] <percent>    chance that a line isn't terminated (default: 0)\n");
+  printf("         [-y|--vanish] <seconds>             remove the pty for a second this often (default: never)\n");
+  printf("         [-o|--opened]                       start with the door opened\n");
+  printf("         [-r|--seed] <n>                     seed for the fault generator\n");
+  printf("         [-v|--verbose]                      print the serial traffic to stderr\n");
+}
+
+int main(int argc, char* argv[])
+{
+  const char* link = "/tmp/door";
+  int opened = 0;
+  door_sim_t door;
+  memset(&door, 0, sizeof(door));
+
+  fwsim_t sim;
+  fwsim_init(&sim, door_sim_output, &door);
+
+  int i;
+  for(i = 1; i < argc; ++i) {
+    const char* str = argv[i];
+    const char* val = (i + 1 < argc) ? argv[i+1] : NULL;
+    if(!strcmp(str, "-h") || !strcmp(str, "--help")) {
+      door_sim_print_usage();
+      return 0;
+    }
+    else if(!strcmp(str, "-o") || !strcmp(str, "--opened"))
+      opened = 1;
+    else if(!strcmp(str, "-v") || !strcmp(str, "--verbose"))
+      door.verbose_ = 1;
+    else if(!val) {
+      door_sim_print_usage();
+      return 1;
+    }
+    else if(!strcmp(str, "-l") || !strcmp(str, "--link"))
+      link = argv[++i];
+    else if(!strcmp(str, "-m") || !strcmp(str, "--motion"))
+      sim.motion_ms_ = atoi(argv[++i]);
+    else if(!strcmp(str, "-w") || !strcmp(str, "--wait"))
+      sim.wait_ms_ = atoi(argv[++i]);
+    else if(!strcmp(str, "-t") || !strcmp(str, "--timeout"))
+      sim.timeout_ms_ = atoi(argv[++i]);
+    else if(!strcmp(str, "-j") || !strcmp(str, "--jam-rate"))
+      sim.jam_rate_ = atoi(argv[++i]);
+    else if(!strcmp(str, "-n") || !strcmp(str, "--drop-rate"))
+      sim.drop_rate_ = atoi(argv[++i]);
+    else if(!strcmp(str, "-g") || !strcmp(str, "--garbage-rate"))
+      door.garbage_rate_ = atoi(argv[++i]);
+    else if(!strcmp(str, "-x") || !strcmp(str, "--overlong-rate"))
+      door.overlong_rate_ = atoi(argv[++i]);
+    else if(!strcmp(str, "-e") || !strcmp(str, "--no-newline-rate"))
+      door.nonewline_rate_ = atoi(argv[++i]);
+    else if(!strcmp(str, "-y") || !strcmp(str, "--vanish"))
+      door.vanish_sec_ = atoi(argv[++i]);
+    else if(!strcmp(str, "-r") || !strcmp(str, "--seed"))
+      srand(atoi(argv[++i]));
+    else {
+      door_sim_print_usage();
+      return 1;
+    }
+  }
+  if(!sim.motion_ms_)
+    sim.motion_ms_ = 1;
+
+  door.link_ = link;
+  door.master_fd_ = pty_open("door_sim", link, &door.slave_fd_);
+  if(door.master_fd_ < 0)
+    return 1;
+  if(door.vanish_sec_)
+    door.vanish_next_ = door_sim_now() + door.vanish_sec_ * 1000;
+
+  struct sigaction act;
+  act.sa_handler = door_sim_sig_handler;
+  sigemptyset(&act.sa_mask);
+  act.sa_flags = 0;
+  sigaction(SIGINT, &act, NULL);
+  sigaction(SIGTERM, &act, NULL);
+
+  fwsim_start(&sim, door_sim_now(), opened);
+
+  char line[64];
+  size_t line_len = 0;
+  int stdin_open = 1;
+  while(!door_sim_done) {
+    struct pollfd fds[2];
+    fds[0].fd = door.master_fd_;
+    fds[0].events = POLLIN;
+    fds[1].fd = stdin_open ? 0 : -1;
+    fds[1].events = POLLIN;
+
+    u_int64_t now = door_sim_now();
+    int timeout = fwsim_next_event(&sim, now);
+    if(door.master_fd_ < 0 && (timeout < 0 || door.reappear_ - now < (u_int64_t)timeout))
+      timeout = door.reappear_ > now ? door.reappear_ - now : 0;
+    if(door.vanish_next_ && door.master_fd_ >= 0 && (timeout < 0 || door.vanish_next_ - now < (u_int64_t)timeout))
+      timeout = door.vanish_next_ > now ? door.vanish_next_ - now : 0;
+    int ret = poll(fds, 2, timeout);
+    if(ret < 0 && errno != EINTR) {
+      fprintf(stderr, "door_sim: poll error: %s\n", strerror(errno));
+      break;
+    }
+    now = door_sim_now();
+    if(door.vanish_next_ && door.master_fd_ >= 0 && now >= door.vanish_next_) {
+      door_sim_vanish(&door, now);
+      door.vanish_next_ = now + door.vanish_sec_ * 1000;
+    }
+    if(door.master_fd_ < 0 && now >= door.reappear_) {
+      door.master_fd_ = pty_open("door_sim", link, &door.slave_fd_);
+      if(door.master_fd_ < 0)
+        break;
+    }
+    fwsim_tick(&sim, now);
+    if(ret <= 0)
+      continue;
+
+    if(fds[0].revents & POLLIN) {
+      char buf[64];
+      int len = read(door.master_fd_, buf, sizeof(buf));
+      for(i = 0; i < len; ++i) {
+        if(door.verbose_)
+          fprintf(stderr, "door_sim: < %c\n", buf[i]);
+        fwsim_input(&sim, buf[i], now);
+      }
+    }
+    if(fds[1].revents & (POLLIN | POLLHUP)) {
+      char c;
+      if(read(0, &c, 1) <= 0)
+        stdin_open = 0;
+      else if(c == '\n' || line_len >= sizeof(line) - 1) {
+        line[line_len] = 0;
+        door_sim_stdin(&door, &sim, line, now);
+        line_len = 0;
+      }
+      else
+        line[line_len++] = c;
+    }
+  }
+
+  if(door.master_fd_ >= 0) {
+    unlink(link);
+    close(door.slave_fd_);
+    close(door.master_fd_);
+  }
+  return 0;
+}
@@ -0,0 +1,200 @@
+/*
+ *  door_daemon
+ *
+ *  Copyright (C) 2009 Christian Pointner <equinox@spreadspace.org>
+ *
+ *  This file is part of door_daemon.
+ *
+ *  door_daemon is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  door_daemon is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with door_daemon. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "datatypes.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "clock.h"
+#include "door_state.h"
+
+static const char* door_lock_names[] = { "unknown", "opened", "closed", "moving" };
+static const char* door_motion_names[] = { "unknown", "idle", "opening", "closing", "waiting" };
+static const char* door_ajar_names[] = { "unknown", "shut", "ajar" };
+
+static void door_state_render(door_state_t* state)
+{
+  snprintf(state->line_, sizeof(state->line_), "State: lock=%s motion=%s ajar=%s error=%d changed=%ld %sactor=%s",
+           door_lock_names[state->lock_], door_motion_names[state->motion_], door_ajar_names[state->ajar_],
+           state->error_, (long)state->changed_, state->unverified_ ? "verified=0 " : "", state->actor_);
+}
+
+void door_state_init(door_state_t* state)
+{
+  memset(state, 0, sizeof(*state));
+  door_state_render(state);
+}
+
+void door_state_restore(door_state_t* state, door_lock_t lock, door_motion_t motion, door_ajar_t ajar,
+                        int error, time_t changed, const char* actor)
+{
+  door_state_init(state);
+  if(lock > LOCK_MOVING || motion > MOTION_WAITING || ajar > AJAR_AJAR)
+    return;
+  state->lock_ = lock;
+  state->motion_ = motion;
+  state->ajar_ = ajar;
+  state->error_ = error ? 1 : 0;
+  state->changed_ = changed;
+  state->unverified_ = 1;
+  snprintf(state->actor_, sizeof(state->actor_), "%s", actor ? actor : "");
+  door_state_render(state);
+}
+
+static int door_state_match(const char** str, const char** names, int count)
+{
+  int i;
+  for(i = count - 1; i > 0; --i) {
+    size_t len = strlen(names[i]);
+    if(!strncmp(*str, names[i], len)) {
+      *str += len;
+      return i;
+    }
+  }
+  return 0;
+}
+
+// Status: opened|closed|<->, idle|opening|closing|waiting, shut|ajar
+static void door_state_parse_status(const char* str, door_state_t* next)
+{
+  static const char* locks[] = { "", "opened", "closed", "<->" };
+  static const char* ajars[] = { "", "shut", "ajar" };
+
+  str += 7;
+  while(*str == ' ')
+    str++;
+  next->lock_ = door_state_match(&str, locks, 4);
+  if(!strncmp(str, ", ", 2))
+    str += 2;
+  next->motion_ = door_state_match(&str, door_motion_names, 5);
+  if(!strncmp(str, ", ", 2))
+    str += 2;
+  next->ajar_ = door_state_match(&str, ajars, 3);
+  if(next->motion_ != MOTION_UNKNOWN)
+    next->error_ = 0;
+}
+
+static void door_state_set_actor(door_state_t* next, cmd_t* cmd)
+{
+  const char* actor = "socket";
+  if(cmd && cmd->param && cmd->param[0])
+    actor = cmd->param;
+  snprintf(next->actor_, sizeof(next->actor_), "%s", actor);
+}
+
+    // a motion also ends the error state, manual keys work in there as well
+static void door_state_start_motion(door_state_t* next, door_motion_t motion)
+{
+  next->motion_ = motion;
+  next->lock_ = LOCK_MOVING;
+  next->error_ = 0;
+}
+
+int door_state_update(door_state_t* state, const char* line, cmd_t* cmd)
+{
+  if(!state || !line)
+    return 0;
+
+  door_state_t next = *state;
+  if(!strncmp(line, "Status:", 7)) {
+    door_state_parse_status(line, &next);
+    next.unverified_ = 0;
+  }
+  else if(!strcmp(line, "Ok") && cmd) {
+    door_state_set_actor(&next, cmd);
+    if(cmd->cmd == OPEN || (cmd->cmd == TOGGLE && state->lock_ == LOCK_CLOSED))
+      door_state_start_motion(&next, MOTION_OPENING);
+    else if(cmd->cmd == CLOSE || cmd->cmd == TOGGLE)
+      door_state_start_motion(&next, MOTION_CLOSING);
+  }
+  else if(!strncmp(line, "Ok, closing now", 15)) {
+    door_state_set_actor(&next, cmd);
+    next.error_ = 0;
+        // if the door is closed already the firmware goes straight to idle
+    if(state->lock_ == LOCK_CLOSED)
+      next.motion_ = MOTION_IDLE;
+    else
+      door_state_start_motion(&next, MOTION_CLOSING);
+  }
+  else if(!strcmp(line, "Already open") || !strcmp(line, "Already opened")) {
+    next.lock_ = LOCK_OPENED;
+    next.motion_ = MOTION_IDLE;
+  }
+  else if(!strcmp(line, "Already closed")) {
+    next.lock_ = LOCK_CLOSED;
+    next.motion_ = MOTION_IDLE;
+  }
+  else if(!strcmp(line, "open forced manually")) {
+    snprintf(next.actor_, sizeof(next.actor_), "manual");
+    door_state_start_motion(&next, MOTION_OPENING);
+  }
+  else if(!strcmp(line, "close forced manually")) {
+    snprintf(next.actor_, sizeof(next.actor_), "manual");
+    door_state_start_motion(&next, MOTION_CLOSING);
+  }
+  else if(strstr(line, "took too long!")) {
+    next.error_ = 1;
+    next.motion_ = MOTION_UNKNOWN;
+  }
+  else if(!strcmp(line, "init complete")) {
+    next.lock_ = LOCK_UNKNOWN;
+    next.motion_ = MOTION_UNKNOWN;
+    next.ajar_ = AJAR_UNKNOWN;
+    next.error_ = 0;
+    snprintf(next.actor_, sizeof(next.actor_), "firmware");
+    next.unverified_ = 0;
+  }
+  else
+    return 0;
+
+  if(next.lock_ == state->lock_ && next.motion_ == state->motion_ && next.ajar_ == state->ajar_ &&
+     next.error_ == state->error_ && !strcmp(next.actor_, state->actor_)) {
+    if(next.unverified_ == state->unverified_)
+      return 0;
+        // the firmware confirmed the restored state, it didn't change
+  }
+  else
+    next.changed_ = clock_time();
+  *state = next;
+  door_state_render(state);
+  return 1;
+}
+
+const char* door_state_admit(const door_state_t* state, cmd_id_t cmd)
+{
+  if(!state || cmd == RESET)
+    return NULL;
+      // whatever the firmware did while the daemon was down, it has to be asked
+  if(state->unverified_)
+    return NULL;
+
+  if(state->error_)
+    return "Error: last open/close operation took too long!";
+
+  if(cmd == STATUS)
+    return NULL;
+  if(state->motion_ != MOTION_OPENING && state->motion_ != MOTION_CLOSING && state->motion_ != MOTION_WAITING)
+    return NULL;
+  if(clock_time() - state->changed_ >= DOOR_STATE_MOTION_MAX_S)
+    return NULL;
+  return "Error: Operation in progress";
+}
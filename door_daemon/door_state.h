@@ -0,0 +1,77 @@
+/*
+ *  door_daemon
+ *
+ *  Copyright (C) 2009 Christian Pointner <equinox@spreadspace.org>
+ *
+ *  This file is part of door_daemon.
+ *
+ *  door_daemon is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  door_daemon is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with door_daemon. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DOOR_DAEMON_door_state_h_INCLUDED
+#define DOOR_DAEMON_door_state_h_INCLUDED
+
+#include <time.h>
+
+#include "command_queue.h"
+
+// The door state as the daemon learns it from the firmware lines: status
+// lines, replies to commands and the spontaneous messages. The text form
+// is rendered once per change and the same buffer is sent to everybody,
+// it looks like:
+//   State: lock=opened motion=idle ajar=shut error=0 changed=1234567890 actor=Card foo
+// The actor is the rest of the line and may contain spaces. A state which
+// was restored from the state file after a restart (see state_file.h) and
+// not yet confirmed by a firmware status line carries 'verified=0' in
+// front of the actor.
+
+enum door_lock_enum { LOCK_UNKNOWN, LOCK_OPENED, LOCK_CLOSED, LOCK_MOVING };
+typedef enum door_lock_enum door_lock_t;
+
+enum door_motion_enum { MOTION_UNKNOWN, MOTION_IDLE, MOTION_OPENING, MOTION_CLOSING, MOTION_WAITING };
+typedef enum door_motion_enum door_motion_t;
+
+enum door_ajar_enum { AJAR_UNKNOWN, AJAR_SHUT, AJAR_AJAR };
+typedef enum door_ajar_enum door_ajar_t;
+
+// door_state_admit() returns the error the firmware would answer to cmd in
+// this state or NULL if it has to be asked. A motion the firmware hasn't
+// reported the end of after DOOR_STATE_MOTION_MAX_S (timeout plus wait) is
+// not trusted any more, neither is a restored state. 'Already open' and
+// 'Already closed' are never answered locally, the lock may have been
+// turned by hand.
+#define DOOR_STATE_MOTION_MAX_S 5
+
+#define DOOR_STATE_ACTOR_MAX 48
+#define DOOR_STATE_LINE_MAX 160
+
+struct door_state_struct {
+  door_lock_t lock_;
+  door_motion_t motion_;
+  door_ajar_t ajar_;
+  int error_;                     // the firmware is in its error state and only accepts reset
+  time_t changed_;
+  int unverified_;                // restored at startup, the firmware hasn't confirmed it yet
+  char actor_[DOOR_STATE_ACTOR_MAX];
+  char line_[DOOR_STATE_LINE_MAX];
+};
+typedef struct door_state_struct door_state_t;
+
+void door_state_init(door_state_t* state);
+void door_state_restore(door_state_t* state, door_lock_t lock, door_motion_t motion, door_ajar_t ajar,
+                        int error, time_t changed, const char* actor);
+int door_state_update(door_state_t* state, const char* line, cmd_t* cmd);
+const char* door_state_admit(const door_state_t* state, cmd_id_t cmd);
+
+#endif
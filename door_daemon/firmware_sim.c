@@ -0,0 +1,276 @@
+/*
+ *  door_daemon
+ *
+ *  Copyright (C) 2009 Christian Pointner <equinox@spreadspace.org>
+ *
+ *  This file is part of door_daemon.
+ *
+ *  door_daemon is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  door_daemon is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with door_daemon. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "firmware_sim.h"
+
+static void fwsim_println(fwsim_t* sim, const char* line)
+{
+  if(sim->output_)
+    (*sim->output_)(sim->output_arg_, line);
+}
+
+static int fwsim_is_opened(fwsim_t* sim)
+{
+  return sim->position_ >= sim->motion_ms_;
+}
+
+static int fwsim_is_closed(fwsim_t* sim)
+{
+  return sim->position_ == 0;
+}
+
+static int fwsim_chance(u_int32_t percent)
+{
+  return percent && (u_int32_t)(rand() % 100) < percent;
+}
+
+static void fwsim_start_motion(fwsim_t* sim, fwsim_state_t state, u_int64_t now)
+{
+  sim->state_ = state;
+  sim->started_ = now;
+  sim->last_tick_ = now;
+  if(fwsim_chance(sim->jam_rate_))
+    sim->jammed_ = 1;
+}
+
+static void fwsim_print_status(fwsim_t* sim)
+{
+  char line[64];
+  const char* state;
+  switch(sim->state_) {
+  case FWSIM_IDLE: state = "idle"; break;
+  case FWSIM_OPENING: state = "opening"; break;
+  case FWSIM_CLOSING: state = "closing"; break;
+  case FWSIM_WAIT: state = "waiting"; break;
+  default: state = "<undefined state>"; break;
+  }
+  snprintf(line, sizeof(line), "Status: %s, %s, %s",
+           fwsim_is_opened(sim) ? "opened" : (fwsim_is_closed(sim) ? "closed" : "<->"),
+           state, sim->ajar_ ? "ajar" : "shut");
+  fwsim_println(sim, line);
+}
+
+void fwsim_init(fwsim_t* sim, void (*output)(void* arg, const char* line), void* arg)
+{
+  if(!sim)
+    return;
+
+  sim->state_ = FWSIM_IDLE;
+  sim->position_ = 0;
+  sim->ajar_ = 0;
+  sim->jammed_ = 0;
+  sim->started_ = 0;
+  sim->last_tick_ = 0;
+  sim->motion_ms_ = 1000;
+  sim->wait_ms_ = 250;
+  sim->timeout_ms_ = 3200;
+  sim->jam_rate_ = 0;
+  sim->drop_rate_ = 0;
+  sim->output_ = output;
+  sim->output_arg_ = arg;
+}
+
+void fwsim_start(fwsim_t* sim, u_int64_t now, int opened)
+{
+  if(!sim)
+    return;
+
+  sim->position_ = opened ? sim->motion_ms_ : 0;
+  sim->state_ = FWSIM_IDLE;
+  sim->jammed_ = 0;
+  if(!fwsim_is_closed(sim))
+    fwsim_start_motion(sim, FWSIM_CLOSING, now);
+  fwsim_println(sim, "init complete");
+}
+
+void fwsim_input(fwsim_t* sim, char c, u_int64_t now)
+{
+  if(!sim)
+    return;
+
+  fwsim_tick(sim, now);
+  if(fwsim_chance(sim->drop_rate_))
+    return;
+
+  if(sim->state_ == FWSIM_ERROR && c != 'r') {
+    fwsim_println(sim, "Error: last open/close operation took too long!");
+    return;
+  }
+
+  switch(c) {
+  case 'r': {
+    sim->jammed_ = 0;
+    if(fwsim_is_closed(sim))
+      sim->state_ = FWSIM_IDLE;
+    else
+      fwsim_start_motion(sim, FWSIM_CLOSING, now);
+    fwsim_println(sim, "Ok, closing now");
+    break;
+  }
+  case 'o': {
+    if(sim->state_ != FWSIM_IDLE)
+      fwsim_println(sim, "Error: Operation in progress");
+    else if(fwsim_is_opened(sim))
+      fwsim_println(sim, "Already open");
+    else {
+      fwsim_start_motion(sim, FWSIM_OPENING, now);
+      fwsim_println(sim, "Ok");
+    }
+    break;
+  }
+  case 'c': {
+    if(sim->state_ != FWSIM_IDLE)
+      fwsim_println(sim, "Error: Operation in progress");
+    else if(fwsim_is_closed(sim))
+      fwsim_println(sim, "Already closed");
+    else {
+      fwsim_start_motion(sim, FWSIM_CLOSING, now);
+      fwsim_println(sim, "Ok");
+    }
+    break;
+  }
+  case 't': {
+    if(sim->state_ != FWSIM_IDLE)
+      fwsim_println(sim, "Error: Operation in progress");
+    else {
+      fwsim_start_motion(sim, fwsim_is_closed(sim) ? FWSIM_OPENING : FWSIM_CLOSING, now);
+      fwsim_println(sim, "Ok");
+    }
+    break;
+  }
+  case 's': fwsim_print_status(sim); break;
+  default: fwsim_println(sim, "Error: unknown command"); break;
+  }
+}
+
+void fwsim_manual_open(fwsim_t* sim, u_int64_t now)
+{
+  if(!sim)
+    return;
+
+  fwsim_tick(sim, now);
+  if(!fwsim_is_opened(sim) && (sim->state_ == FWSIM_IDLE || sim->state_ == FWSIM_ERROR)) {
+    fwsim_println(sim, "open forced manually");
+    fwsim_start_motion(sim, FWSIM_OPENING, now);
+  }
+}
+
+void fwsim_manual_close(fwsim_t* sim, u_int64_t now)
+{
+  if(!sim)
+    return;
+
+  fwsim_tick(sim, now);
+  if(!fwsim_is_closed(sim) && (sim->state_ == FWSIM_IDLE || sim->state_ == FWSIM_ERROR)) {
+    fwsim_println(sim, "close forced manually");
+    fwsim_start_motion(sim, FWSIM_CLOSING, now);
+  }
+}
+
+void fwsim_set_ajar(fwsim_t* sim, int ajar, u_int64_t now)
+{
+  if(!sim)
+    return;
+
+  fwsim_tick(sim, now);
+  if((ajar ? 1 : 0) == sim->ajar_)
+    return;
+
+  sim->ajar_ = ajar ? 1 : 0;
+  fwsim_print_status(sim);
+}
+
+void fwsim_tick(fwsim_t* sim, u_int64_t now)
+{
+  if(!sim)
+    return;
+
+  if(sim->state_ == FWSIM_OPENING || sim->state_ == FWSIM_CLOSING) {
+    u_int32_t delta = (u_int32_t)(now - sim->last_tick_);
+    sim->last_tick_ = now;
+    if(!sim->jammed_) {
+      if(sim->state_ == FWSIM_OPENING)
+        sim->position_ = (sim->position_ + delta > sim->motion_ms_) ? sim->motion_ms_ : sim->position_ + delta;
+      else
+        sim->position_ = (delta > sim->position_) ? 0 : sim->position_ - delta;
+    }
+    else if(sim->position_ == 0 || sim->position_ == sim->motion_ms_)
+      sim->position_ = sim->motion_ms_ / 2;
+
+    if((sim->state_ == FWSIM_OPENING && fwsim_is_opened(sim)) ||
+       (sim->state_ == FWSIM_CLOSING && fwsim_is_closed(sim))) {
+      sim->state_ = FWSIM_WAIT;
+      sim->started_ = now;
+    }
+    else if(now - sim->started_ >= sim->timeout_ms_) {
+      sim->state_ = FWSIM_ERROR;
+      fwsim_println(sim, "Error: open/close took too long!");
+      return;
+    }
+  }
+
+  if(sim->state_ == FWSIM_WAIT && now - sim->started_ >= sim->wait_ms_) {
+    char line[64];
+    sim->state_ = FWSIM_IDLE;
+    snprintf(line, sizeof(line), "Status: %s, idle, %s",
+             fwsim_is_opened(sim) ? "opened" : (fwsim_is_closed(sim) ? "closed" : ""),
+             sim->ajar_ ? "ajar" : "shut");
+    fwsim_println(sim, line);
+  }
+}
+
+int fwsim_next_event(fwsim_t* sim, u_int64_t now)
+{
+  if(!sim)
+    return -1;
+
+  u_int64_t due;
+  switch(sim->state_) {
+  case FWSIM_OPENING:
+  case FWSIM_CLOSING: {
+    u_int32_t remaining = sim->state_ == FWSIM_OPENING ? sim->motion_ms_ - sim->position_ : sim->position_;
+    due = sim->started_ + sim->timeout_ms_;
+    if(!sim->jammed_ && sim->last_tick_ + remaining < due)
+      due = sim->last_tick_ + remaining;
+    break;
+  }
+  case FWSIM_WAIT: due = sim->started_ + sim->wait_ms_; break;
+  default: return -1;
+  }
+  return due > now ? (int)(due - now) : 0;
+}
+
+const char* fwsim_state_to_string(fwsim_state_t state)
+{
+  switch(state) {
+  case FWSIM_IDLE: return "idle";
+  case FWSIM_OPENING: return "opening";
+  case FWSIM_CLOSING: return "closing";
+  case FWSIM_WAIT: return "waiting";
+  case FWSIM_ERROR: return "error";
+  }
+  return "unknown";
+}
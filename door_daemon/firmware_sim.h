@@ -0,0 +1,66 @@
+/*
+ *  door_daemon
+ *
+ *  Copyright (C) 2009 Christian Pointner <equinox@spreadspace.org>
+ *
+ *  This file is part of door_daemon.
+ *
+ *  door_daemon is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  door_daemon is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with door_daemon. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef DOOR_DAEMON_firmware_sim_h_INCLUDED
+#define DOOR_DAEMON_firmware_sim_h_INCLUDED
+
+#include "datatypes.h"
+
+/*
+ * Model of the serial protocol spoken by firmware/tuer.pde (see also
+ * firmware-messages.txt). All times are in milliseconds on a clock supplied
+ * by the caller, so the model runs equally well on real or virtual time.
+ */
+
+enum fwsim_state_enum { FWSIM_IDLE, FWSIM_OPENING, FWSIM_CLOSING, FWSIM_WAIT, FWSIM_ERROR };
+typedef enum fwsim_state_enum fwsim_state_t;
+
+struct fwsim_struct {
+  fwsim_state_t state_;
+  u_int32_t position_;    // 0 = closed .. motion_ms_ = opened
+  int ajar_;
+  int jammed_;            // the bolt doesn't move until the next reset
+  u_int64_t started_;     // begin of current motion or wait
+  u_int64_t last_tick_;
+
+  u_int32_t motion_ms_;   // time needed from one limit switch to the other
+  u_int32_t wait_ms_;     // hold time after reaching a limit switch
+  u_int32_t timeout_ms_;  // give up moving after this long
+  u_int32_t jam_rate_;    // chance in percent that a motion jams
+  u_int32_t drop_rate_;   // chance in percent that a command is not answered
+
+  void (*output_)(void* arg, const char* line);
+  void* output_arg_;
+};
+typedef struct fwsim_struct fwsim_t;
+
+void fwsim_init(fwsim_t* sim, void (*output)(void* arg, const char* line), void* arg);
+void fwsim_start(fwsim_t* sim, u_int64_t now, int opened);
+void fwsim_input(fwsim_t* sim, char c, u_int64_t now);
+void fwsim_manual_open(fwsim_t* sim, u_int64_t now);
+void fwsim_manual_close(fwsim_t* sim, u_int64_t now);
+void fwsim_set_ajar(fwsim_t* sim, int ajar, u_int64_t now);
+void fwsim_tick(fwsim_t* sim, u_int64_t now);
+int fwsim_next_event(fwsim_t* sim, u_int64_t now);
+const char* fwsim_state_to_string(fwsim_state_t state);
+
+#endif
@@ -0,0 +1,80 @@
+/*
+ *  door_daemon
+ *
+ *  Copyright (C) 2009 Christian Pointner <equinox@spreadspace.org>
+ *
+ *  This file is part of door_daemon.
+ *
+ *  door_daemon is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  door_daemon is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with door_daemon. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "datatypes.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "clock.h"
+#include "history.h"
+
+history_t history;
+
+void history_init()
+{
+  memset(&history, 0, sizeof(history));
+}
+
+    // only before the first event of this run
+void history_restore(u_int64_t seq)
+{
+  if(history.seq_ >= seq)
+    return;
+  history.seq_ = seq;
+  history.first_ = seq + 1;
+}
+
+u_int64_t history_add(history_type_t type, u_int32_t door, const char* line)
+{
+  history_event_t* ev = &history.events_[++history.seq_ % HISTORY_SIZE];
+  ev->seq_ = history.seq_;
+  ev->time_ = clock_time();
+  ev->type_ = type;
+  ev->door_ = door;
+  snprintf(ev->line_, sizeof(ev->line_), "%s", line ? line : "");
+  return ev->seq_;
+}
+
+u_int64_t history_oldest()
+{
+  u_int64_t oldest = history.seq_ < HISTORY_SIZE ? 1 : history.seq_ - HISTORY_SIZE + 1;
+  return oldest > history.first_ ? oldest : history.first_;
+}
+
+const history_event_t* history_get(u_int64_t seq)
+{
+  if(seq < history_oldest() || seq > history.seq_)
+    return NULL;
+  return &history.events_[seq % HISTORY_SIZE];
+}
+
+const char* history_type_to_string(history_type_t type)
+{
+  switch(type) {
+  case EVENT_REQUEST: return "request";
+  case EVENT_STATUS: return "status";
+  case EVENT_ERROR: return "error";
+  case EVENT_MANUAL: return "manual";
+  case EVENT_STATE: return "state";
+  default: return "unknown";
+  }
+}
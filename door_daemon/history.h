@@ -0,0 +1,71 @@
+/*
+ *  door_daemon
+ *
+ *  Copyright (C) 2009 Christian Pointner <equinox@spreadspace.org>
+ *
+ *  This file is part of door_daemon.
+ *
+ *  door_daemon is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  door_daemon is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with door_daemon. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DOOR_DAEMON_history_h_INCLUDED
+#define DOOR_DAEMON_history_h_INCLUDED
+
+#include <time.h>
+
+#include "datatypes.h"
+
+// Event history: every line sent to the listeners (requests, status and
+// error lines, manual open/close and state changes) gets a sequence number
+// and is kept in a ring of the last HISTORY_SIZE events. A listener which
+// reconnects with 'listen ... since <seq>' is sent the events it missed
+// out of this ring before it gets live events again. Sequence numbers
+// start at 1, 0 means 'nothing seen yet'. All doors share one history and
+// one sequence, every event remembers which door it belongs to. With a
+// state file the sequence continues where the last run stopped, after a
+// crash a little further on (see state_file.h), the events of that run
+// are gone and reported as lost.
+
+#define HISTORY_SIZE 256
+#define HISTORY_LINE_MAX 160
+
+enum history_type_enum { EVENT_REQUEST, EVENT_STATUS, EVENT_ERROR, EVENT_MANUAL, EVENT_STATE };
+typedef enum history_type_enum history_type_t;
+
+struct history_event_struct {
+  u_int64_t seq_;
+  time_t time_;
+  history_type_t type_;
+  u_int32_t door_;            // index of the door in the configuration
+  char line_[HISTORY_LINE_MAX];
+};
+typedef struct history_event_struct history_event_t;
+
+struct history_struct {
+  history_event_t events_[HISTORY_SIZE];
+  u_int64_t seq_;             // sequence number of the newest event
+  u_int64_t first_;           // sequence number of the first event of this run
+};
+typedef struct history_struct history_t;
+
+extern history_t history;
+
+void history_init();
+void history_restore(u_int64_t seq);
+u_int64_t history_add(history_type_t type, u_int32_t door, const char* line);
+u_int64_t history_oldest();
+const history_event_t* history_get(u_int64_t seq);
+const char* history_type_to_string(history_type_t type);
+
+#endif
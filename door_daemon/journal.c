@@ -0,0 +1,368 @@
+/*
+ *  door_daemon
+ *
+ *  Copyright (C) 2009 Christian Pointner <equinox@spreadspace.org>
+ *
+ *  This file is part of door_daemon.
+ *
+ *  door_daemon is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  door_daemon is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with door_daemon. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "datatypes.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "log.h"
+#include "journal.h"
+
+typedef char journal_record_sizes_match[(sizeof(journal_header_t) == JOURNAL_RECORD_SIZE && sizeof(journal_index_t) == JOURNAL_RECORD_SIZE &&
+                                         sizeof(journal_record_t) == JOURNAL_RECORD_SIZE) ? 1 : -1];
+
+    // FNV-1a over everything but the checksum itself
+static u_int32_t journal_sum(const void* rec)
+{
+  const u_int8_t* p = (const u_int8_t*)rec + sizeof(u_int32_t);
+  u_int32_t h = 2166136261u;
+  int i;
+  for(i = sizeof(u_int32_t); i < JOURNAL_RECORD_SIZE; ++i, ++p)
+    h = (h ^ *p) * 16777619u;
+  return h;
+}
+
+static int journal_valid(const void* rec)
+{
+  return *(const u_int32_t*)rec == journal_sum(rec);
+}
+
+static off_t journal_record_offset(u_int64_t block, u_int32_t rec)
+{
+  return sizeof(journal_header_t) + block * JOURNAL_BLOCK_SIZE + rec * JOURNAL_RECORD_SIZE;
+}
+
+static int journal_pread(int fd, void* buf, size_t len, off_t off)
+{
+  size_t done = 0;
+  while(done < len) {
+    ssize_t ret = pread(fd, (u_int8_t*)buf + done, len - done, off + done);
+    if(ret < 0 && errno == EINTR)
+      continue;
+    if(ret <= 0)
+      return done ? done : ret;
+    done += ret;
+  }
+  return done;
+}
+
+static int journal_check_header(journal_t* j)
+{
+  journal_header_t hdr;
+  if(journal_pread(j->fd_, &hdr, sizeof(hdr), 0) != sizeof(hdr) || memcmp(hdr.magic_, JOURNAL_MAGIC, sizeof(hdr.magic_)) ||
+     hdr.version_ != JOURNAL_VERSION || hdr.record_size_ != JOURNAL_RECORD_SIZE || hdr.block_records_ != JOURNAL_BLOCK_RECORDS) {
+    errno = EINVAL;
+    return -1;
+  }
+  return 0;
+}
+
+static void journal_reset(journal_t* j)
+{
+  j->fd_ = -1;
+  j->size_ = 0;
+  j->fill_ = 0;
+  j->sealed_ = 1;
+  j->pending_len_ = 0;
+  j->pending_events_ = 0;
+  j->pending_since_ = 0;
+  j->last_time_ = 0;
+}
+
+    // the newest time in the last block, new events are never stamped earlier
+static void journal_find_last_time(journal_t* j, u_int64_t records)
+{
+  if(!records)
+    return;
+
+  u_int64_t block = (records - 1) / JOURNAL_BLOCK_RECORDS;
+  journal_record_t recs[JOURNAL_BLOCK_RECORDS];
+  int len = journal_pread(j->fd_, recs, sizeof(recs), journal_record_offset(block, 0));
+  journal_index_t idx;
+  memcpy(&idx, &recs[0], sizeof(idx));
+  if(len < (int)sizeof(journal_index_t) || !journal_valid(&idx))
+    return;
+
+  j->last_time_ = idx.time_;
+  int i;
+  for(i = 1; i < len / JOURNAL_RECORD_SIZE; ++i)
+    if(journal_valid(&recs[i]) && recs[i].type_ != JOURNAL_PAD && idx.time_ + recs[i].time_delta_ > j->last_time_)
+      j->last_time_ = idx.time_ + recs[i].time_delta_;
+}
+
+int journal_open(journal_t* j, const char* path)
+{
+  if(!j || !path)
+    return -1;
+
+  journal_reset(j);
+  j->fd_ = open(path, O_RDWR | O_CREAT, 0640);
+  if(j->fd_ < 0)
+    return -1;
+
+  struct stat st;
+  if(fstat(j->fd_, &st))
+    goto error;
+  if(st.st_size < sizeof(journal_header_t)) {
+    journal_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic_, JOURNAL_MAGIC, sizeof(hdr.magic_));
+    hdr.version_ = JOURNAL_VERSION;
+    hdr.record_size_ = JOURNAL_RECORD_SIZE;
+    hdr.block_records_ = JOURNAL_BLOCK_RECORDS;
+    if(ftruncate(j->fd_, 0) || pwrite(j->fd_, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+      goto error;
+    st.st_size = sizeof(hdr);
+  }
+  else if(journal_check_header(j))
+    goto error;
+
+      // cut off a partial record and any garbage a crash left at the end
+  u_int64_t records = (st.st_size - sizeof(journal_header_t)) / JOURNAL_RECORD_SIZE;
+  journal_record_t rec;
+  while(records > 0) {
+    if(journal_pread(j->fd_, &rec, sizeof(rec), journal_record_offset(0, records - 1)) == sizeof(rec) && journal_valid(&rec))
+      break;
+    records--;
+  }
+  j->size_ = journal_record_offset(0, records);
+  if(j->size_ != st.st_size && ftruncate(j->fd_, j->size_))
+    goto error;
+  j->fill_ = records % JOURNAL_BLOCK_RECORDS;
+  journal_find_last_time(j, records);
+  return 0;
+
+error:
+  close(j->fd_);
+  j->fd_ = -1;
+  return -1;
+}
+
+int journal_open_read(journal_t* j, const char* path)
+{
+  if(!j || !path)
+    return -1;
+
+  journal_reset(j);
+  j->fd_ = open(path, O_RDONLY);
+  if(j->fd_ < 0)
+    return -1;
+
+  struct stat st;
+  if(fstat(j->fd_, &st) || journal_check_header(j)) {
+    close(j->fd_);
+    j->fd_ = -1;
+    return -1;
+  }
+  j->size_ = journal_record_offset(0, (st.st_size - sizeof(journal_header_t)) / JOURNAL_RECORD_SIZE);
+  return 0;
+}
+
+void journal_close(journal_t* j)
+{
+  if(!j || j->fd_ < 0)
+    return;
+
+  journal_flush(j);
+  close(j->fd_);
+  j->fd_ = -1;
+}
+
+static void journal_append(journal_t* j, void* rec)
+{
+      // only if the main loop didn't get around to it for a whole lot of events
+  if(j->pending_len_ >= sizeof(j->pending_) / sizeof(j->pending_[0]))
+    journal_flush(j);
+  *(u_int32_t*)rec = journal_sum(rec);
+  memcpy(&j->pending_[j->pending_len_++], rec, JOURNAL_RECORD_SIZE);
+  j->fill_ = (j->fill_ + 1) % JOURNAL_BLOCK_RECORDS;
+}
+
+static void journal_start_block(journal_t* j, const history_event_t* ev, u_int64_t time)
+{
+  journal_record_t pad;
+  memset(&pad, 0, sizeof(pad));
+  pad.type_ = JOURNAL_PAD;
+  while(j->fill_)
+    journal_append(j, &pad);
+
+  memset(&j->index_, 0, sizeof(j->index_));
+  j->index_.time_ = time;
+  j->index_.seq_ = ev->seq_;
+  journal_append(j, &j->index_);
+  j->sealed_ = 0;
+}
+
+void journal_add(journal_t* j, const history_event_t* ev)
+{
+  if(!j || j->fd_ < 0 || !ev)
+    return;
+
+      // queries search the blocks by time, a clock stepping back must not break the order
+  u_int64_t time = ev->time_ > 0 ? ev->time_ : 0;
+  if(time < j->last_time_)
+    time = j->last_time_;
+  j->last_time_ = time;
+  if(j->sealed_ || !j->fill_ || time - j->index_.time_ > 0xFFFFFFFF ||
+     ev->seq_ < j->index_.seq_ || ev->seq_ - j->index_.seq_ > 0xFFFFFFFF)
+    journal_start_block(j, ev, time);
+
+  journal_record_t rec;
+  memset(&rec, 0, sizeof(rec));
+  rec.time_delta_ = time - j->index_.time_;
+  rec.seq_delta_ = ev->seq_ - j->index_.seq_;
+  rec.type_ = ev->type_;
+  rec.door_ = ev->door_;
+  rec.len_ = strnlen(ev->line_, sizeof(rec.text_));
+  memcpy(rec.text_, ev->line_, rec.len_);
+  journal_append(j, &rec);
+
+  if(!j->pending_events_++)
+    j->pending_since_ = time;
+}
+
+    // the main loop flushes when it is idle or this says so, never on the way of an event
+int journal_due(journal_t* j, u_int64_t now)
+{
+  if(!j || j->fd_ < 0 || !j->pending_events_)
+    return 0;
+  return j->pending_events_ >= JOURNAL_PENDING_MAX || now < j->pending_since_ || now >= j->pending_since_ + JOURNAL_FLUSH_S;
+}
+
+int journal_flush(journal_t* j)
+{
+  if(!j || j->fd_ < 0 || !j->pending_len_)
+    return 0;
+
+  size_t len = j->pending_len_ * JOURNAL_RECORD_SIZE;
+  size_t done = 0;
+  while(done < len) {
+    ssize_t ret = pwrite(j->fd_, (u_int8_t*)j->pending_ + done, len - done, j->size_ + done);
+    if(ret < 0 && errno == EINTR)
+      continue;
+    if(ret <= 0)
+      break;
+    done += ret;
+  }
+  j->pending_len_ = 0;
+  j->pending_events_ = 0;
+  if(done < len) {
+    log_printf(ERROR, "unable to write journal: %s, %u events lost", strerror(errno), (unsigned)(len / JOURNAL_RECORD_SIZE));
+        // whatever made it into the file would misalign the blocks, an index record is lost too
+    if(ftruncate(j->fd_, j->size_))
+      log_printf(ERROR, "unable to truncate journal: %s", strerror(errno));
+    j->fill_ = ((j->size_ - sizeof(journal_header_t)) / JOURNAL_RECORD_SIZE) % JOURNAL_BLOCK_RECORDS;
+    j->sealed_ = 1;
+    return -1;
+  }
+  j->size_ += len;
+  fdatasync(j->fd_);
+  return 0;
+}
+
+u_int64_t journal_blocks(journal_t* j)
+{
+  u_int64_t records = (j->size_ - sizeof(journal_header_t)) / JOURNAL_RECORD_SIZE;
+  return (records + JOURNAL_BLOCK_RECORDS - 1) / JOURNAL_BLOCK_RECORDS;
+}
+
+int journal_read_index(journal_t* j, u_int64_t block, journal_index_t* idx)
+{
+  if(journal_pread(j->fd_, idx, sizeof(*idx), journal_record_offset(block, 0)) != sizeof(*idx) || !journal_valid(idx))
+    return -1;
+  return 0;
+}
+
+int journal_query(journal_t* j, u_int64_t from, u_int64_t to, journal_cb_t cb, void* arg)
+{
+  if(!j || j->fd_ < 0 || !cb)
+    return -1;
+
+  journal_flush(j);
+  u_int64_t blocks = journal_blocks(j);
+
+      // the last block which starts before 'from', it may hold events at 'from' which the
+      // next block continues, blocks with a broken index count as early
+  u_int64_t lo = 0, hi = blocks;
+  journal_index_t idx;
+  while(lo < hi) {
+    u_int64_t mid = lo + (hi - lo) / 2;
+    if(journal_read_index(j, mid, &idx) || idx.time_ < from)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  int count = 0;
+  u_int64_t block;
+  for(block = lo ? lo - 1 : 0; block < blocks; ++block) {
+    journal_record_t recs[JOURNAL_BLOCK_RECORDS];
+    int len = journal_pread(j->fd_, recs, sizeof(recs), journal_record_offset(block, 0));
+    if(len < (int)sizeof(journal_index_t))
+      break;
+    memcpy(&idx, &recs[0], sizeof(idx));
+    if(!journal_valid(&idx))
+      continue;
+    if(idx.time_ > to)
+      break;
+
+    int i;
+    for(i = 1; i < len / JOURNAL_RECORD_SIZE; ++i) {
+      journal_record_t* rec = &recs[i];
+      if(!journal_valid(rec) || rec->type_ == JOURNAL_PAD)
+        continue;
+      journal_entry_t entry;
+      entry.time_ = idx.time_ + rec->time_delta_;
+      if(entry.time_ < from || entry.time_ > to)
+        continue;
+      entry.seq_ = idx.seq_ + rec->seq_delta_;
+      entry.type_ = rec->type_;
+      entry.door_ = rec->door_;
+      size_t text_len = rec->len_ < sizeof(rec->text_) ? rec->len_ : sizeof(rec->text_);
+      memcpy(entry.text_, rec->text_, text_len);
+      entry.text_[text_len] = 0;
+      count++;
+      if(cb(&entry, arg))
+        return count;
+    }
+  }
+  return count;
+}
+
+    // unix time, or seconds before now if it starts with '-'
+u_int64_t journal_parse_time(const char* str, u_int64_t now)
+{
+  if(!str)
+    return now;
+  while(*str == ' ')
+    str++;
+  if(*str == '-') {
+    u_int64_t ago = strtoull(str + 1, NULL, 10);
+    return ago < now ? now - ago : 0;
+  }
+  return strtoull(str, NULL, 10);
+}
@@ -0,0 +1,121 @@
+/*
+ *  door_daemon
+ *
+ *  Copyright (C) 2009 Christian Pointner <equinox@spreadspace.org>
+ *
+ *  This file is part of door_daemon.
+ *
+ *  door_daemon is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  door_daemon is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with door_daemon. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DOOR_DAEMON_journal_h_INCLUDED
+#define DOOR_DAEMON_journal_h_INCLUDED
+
+#include "datatypes.h"
+#include "history.h"
+
+// Event journal: an append-only audit trail of requests, manual opens and
+// closes, errors and state changes. The file is a header record followed
+// by blocks of JOURNAL_BLOCK_RECORDS fixed size records. The first record
+// of every block is an index record with the absolute time and sequence
+// number, the event records store their time and sequence number as
+// deltas to it. A time range query does a binary search over the index
+// records and only reads the blocks in range. Every record carries a
+// checksum, a torn write at the end of the file is cut off on the next
+// open. Events are collected in memory and the main loop writes them
+// when the daemon is idle, when JOURNAL_PENDING_MAX of them are waiting or
+// the oldest one is older than JOURNAL_FLUSH_S seconds (journal_due()),
+// adding an event never touches the disk. Times never go backwards in the
+// journal: an event older than the one before it (the clock was stepped
+// back) is stamped with the time of that one. A new block is started whenever the
+// deltas don't fit or the daemon restarts, the rest of the previous
+// block is filled with pad records.
+
+#define JOURNAL_MAGIC "DOORJNL1"
+#define JOURNAL_VERSION 1
+#define JOURNAL_RECORD_SIZE 128
+#define JOURNAL_BLOCK_RECORDS 32
+#define JOURNAL_BLOCK_SIZE (JOURNAL_RECORD_SIZE * JOURNAL_BLOCK_RECORDS)
+#define JOURNAL_TEXT_MAX 112
+#define JOURNAL_PENDING_MAX 64
+#define JOURNAL_FLUSH_S 2
+#define JOURNAL_PAD 0xFF
+#define JOURNAL_REPLY_MAX 100    // events one 'history' reply sends at most
+
+struct journal_header_struct {
+  char magic_[8];
+  u_int32_t version_;
+  u_int32_t record_size_;
+  u_int32_t block_records_;
+  u_int8_t reserved_[JOURNAL_RECORD_SIZE - 20];
+};
+typedef struct journal_header_struct journal_header_t;
+
+struct journal_index_struct {
+  u_int32_t sum_;           // checksum over the rest of the record
+  u_int32_t reserved_;
+  u_int64_t time_;          // unix time, base of the time deltas in this block
+  u_int64_t seq_;           // base of the sequence number deltas in this block
+  u_int8_t reserved2_[JOURNAL_RECORD_SIZE - 24];
+};
+typedef struct journal_index_struct journal_index_t;
+
+struct journal_record_struct {
+  u_int32_t sum_;
+  u_int32_t time_delta_;
+  u_int32_t seq_delta_;
+  u_int8_t type_;           // history_type_t or JOURNAL_PAD
+  u_int8_t len_;
+  u_int16_t door_;
+  char text_[JOURNAL_TEXT_MAX];
+};
+typedef struct journal_record_struct journal_record_t;
+
+struct journal_entry_struct {
+  u_int64_t time_;
+  u_int64_t seq_;
+  history_type_t type_;
+  u_int32_t door_;
+  char text_[JOURNAL_TEXT_MAX + 1];
+};
+typedef struct journal_entry_struct journal_entry_t;
+
+typedef int (*journal_cb_t)(const journal_entry_t* entry, void* arg);
+
+struct journal_struct {
+  int fd_;
+  u_int64_t size_;          // bytes in the file which are known to be good
+  u_int32_t fill_;          // records used in the last block
+  int sealed_;              // the last block belongs to an earlier run and must not be continued
+  journal_index_t index_;   // index record of the last block
+  journal_record_t pending_[JOURNAL_PENDING_MAX + JOURNAL_BLOCK_RECORDS];
+  u_int32_t pending_len_;
+  u_int32_t pending_events_;
+  u_int64_t pending_since_;
+  u_int64_t last_time_;     // time of the newest event
+};
+typedef struct journal_struct journal_t;
+
+int journal_open(journal_t* j, const char* path);
+int journal_open_read(journal_t* j, const char* path);
+void journal_close(journal_t* j);
+void journal_add(journal_t* j, const history_event_t* ev);
+int journal_due(journal_t* j, u_int64_t now);
+int journal_flush(journal_t* j);
+int journal_query(journal_t* j, u_int64_t from, u_int64_t to, journal_cb_t cb, void* arg);
+u_int64_t journal_blocks(journal_t* j);
+int journal_read_index(journal_t* j, u_int64_t block, journal_index_t* idx);
+u_int64_t journal_parse_time(const char* str, u_int64_t now);
+
+#endif
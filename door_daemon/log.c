@@ -38,12 +38,14 @@
 #include <string.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <ctype.h>
 #include <stdio.h>
 
 #define SYSLOG_NAMES
 #include <syslog.h>
 
 #include "log.h"
+#include "clock.h"
 
 log_t stdlog;
 
@@ -61,6 +63,18 @@ const char* log_prio_to_string(log_prio_t prio)
   return "UNKNOWN";
 }
 
+const char* log_target_type_to_string(log_target_type_t type)
+{
+  switch(type) {
+  case TARGET_SYSLOG: return "syslog";
+  case TARGET_FILE: return "file";
+  case TARGET_STDOUT: return "stdout";
+  case TARGET_STDERR: return "stderr";
+  case TARGET_RING: return "ring";
+  default: return "unknown";
+  }
+}
+
 log_target_type_t log_target_parse_type(const char* conf)
 {
   if(!conf)
@@ -70,6 +84,7 @@ log_target_type_t log_target_parse_type(const char* conf)
   if(!strncmp(conf, "file", 4)) return TARGET_FILE;
   if(!strncmp(conf, "stdout", 6)) return TARGET_STDOUT;
   if(!strncmp(conf, "stderr", 6)) return TARGET_STDERR;
+  if(!strncmp(conf, "ring", 4)) return TARGET_RING;
 
   return TARGET_UNKNOWN;
 }
@@ -93,6 +108,13 @@ int log_targets_add(log_targets_t* targets, const char* conf)
   if(!targets)
     return -1;
 
+  int cnt = 0;
+  log_target_t* tmp;
+  for(tmp = targets->first_; tmp; tmp = tmp->next_)
+    cnt++;
+  if(cnt >= LOG_TARGETS_MAX)
+    return -5;
+
   log_target_t* new_target = NULL;
   int duplicates_allowed = 0;
   switch(log_target_parse_type(conf)) {
@@ -100,6 +122,7 @@ int log_targets_add(log_targets_t* targets, const char* conf)
   case TARGET_FILE: new_target = log_target_file_new(); duplicates_allowed = 1; break;
   case TARGET_STDOUT: new_target = log_target_stdout_new(); break;
   case TARGET_STDERR: new_target = log_target_stderr_new(); break;
+  case TARGET_RING: new_target = log_target_ring_new(); break;
   default: return -3;
   }
   if(!new_target)
@@ -121,6 +144,7 @@ int log_targets_add(log_targets_t* targets, const char* conf)
     return -1;
   }
   new_target->max_prio_ = prioptr[0] - '0';
+  new_target->conf_prio_ = new_target->max_prio_;
   if(new_target->max_prio_ > 0)
     new_target->enabled_ = 1;
 
@@ -153,17 +177,32 @@ int log_targets_add(log_targets_t* targets, const char* conf)
   return 0;
 }
 
-void log_targets_log(log_targets_t* targets, log_prio_t prio, const char* msg)
+void log_targets_update_mask(log_targets_t* targets)
 {
   if(!targets)
     return;
 
+  int prio;
+  for(prio = 0; prio <= DEBUG; ++prio) {
+    targets->prio_mask_[prio] = 0;
+    u_int32_t bit = 1;
+    log_target_t* tmp;
+    for(tmp = targets->first_; tmp; tmp = tmp->next_, bit <<= 1)
+      if(tmp->log != NULL && tmp->enabled_ && tmp->max_prio_ >= prio)
+        targets->prio_mask_[prio] |= bit;
+  }
+}
+
+void log_targets_log(log_targets_t* targets, log_prio_t prio, const char* msg)
+{
+  if(!targets || (int)prio < 0 || prio > DEBUG)
+    return;
+
+  u_int32_t mask = targets->prio_mask_[prio];
   log_target_t* tmp = targets->first_;
-  while(tmp) {
-    if(tmp->log != NULL && tmp->enabled_ && tmp->max_prio_ >= prio)
+  for(; tmp && mask; tmp = tmp->next_, mask >>= 1) {
+    if(mask & 1)
       (*tmp->log)(tmp, prio, msg);
-
-    tmp = tmp->next_;
   }
 }
 
@@ -183,26 +222,143 @@ void log_targets_clear(log_targets_t* targets)
   }
 }
 
+int log_targets_ring_tail(log_targets_t* targets, u_int32_t n, void (*cb)(const char* line, void* arg), void* arg)
+{
+  if(!targets)
+    return -1;
+
+  log_target_t* tmp = targets->first_;
+  while(tmp) {
+    if(tmp->type_ == TARGET_RING)
+      return log_target_ring_tail(tmp, n, cb, arg);
+
+    tmp = tmp->next_;
+  }
+  return -1;
+}
+
+
+void log_flush_repeated(log_prio_t prio)
+{
+  log_repeat_t* last = &stdlog.last_[prio];
+  if(!last->repeated_)
+    return;
+
+  static char msg[MSG_LENGTH_MAX];
+  snprintf(msg, MSG_LENGTH_MAX, "last message repeated %u times: %s", last->repeated_, last->msg_);
+  last->repeated_ = 0;
+  last->time_ = clock_time();
+  log_targets_log(&stdlog.targets_, prio, msg);
+}
+
+void log_flush_ratelimited(log_rate_t* slot)
+{
+  if(!slot->suppressed_)
+    return;
+
+  static char msg[MSG_LENGTH_MAX];
+      // a long message loses its end, like any other one
+  if(snprintf(msg, MSG_LENGTH_MAX, "rate limit: suppressed %u times: %s", slot->suppressed_, slot->msg_) < 0)
+    return;
+  slot->suppressed_ = 0;
+  slot->flushed_ = clock_time();
+  log_targets_log(&stdlog.targets_, slot->prio_, msg);
+}
+
+u_int32_t log_hash_msg(log_prio_t prio, const char* msg)
+{
+  u_int32_t hash = 2166136261U ^ prio;
+  for(; *msg; ++msg) {
+    hash ^= (u_int8_t)(*msg);
+    hash *= 16777619U;
+  }
+  return hash;
+}
+
+static void log_rate_refill(log_rate_t* slot, time_t now)
+{
+  if(!slot->last_refill_ || now <= slot->last_refill_)
+    return;
+  u_int32_t refill = (u_int32_t)(now - slot->last_refill_) * LOG_RATE_PER_SEC;
+  slot->tokens_ = (slot->tokens_ + refill > LOG_RATE_BURST) ? LOG_RATE_BURST : slot->tokens_ + refill;
+  slot->last_refill_ = now;
+}
+
+int log_rate_limited(log_prio_t prio, const char* msg, time_t now)
+{
+  u_int32_t hash = log_hash_msg(prio, msg);
+  log_rate_t* slot = &stdlog.rate_[hash % LOG_RATE_SLOTS];
+  if(slot->hash_ != hash || !slot->last_refill_) {
+    log_rate_refill(slot, now);
+        // the message owning the slot is still being limited, don't hand it a fresh bucket
+    if(slot->last_refill_ && (slot->suppressed_ || slot->tokens_ < LOG_RATE_BURST)) {
+      slot = &stdlog.shared_rate_;
+      if(!slot->last_refill_) {
+        slot->tokens_ = LOG_RATE_BURST;
+        slot->last_refill_ = now;
+        slot->flushed_ = now;
+      }
+    }
+    else {
+      slot->hash_ = hash;
+      slot->tokens_ = LOG_RATE_BURST;
+      slot->last_refill_ = now;
+      slot->flushed_ = now;
+      slot->prio_ = prio;
+      strcpy(slot->msg_, msg);
+    }
+  }
+  log_rate_refill(slot, now);
+
+  if(!slot->tokens_) {
+    if(slot == &stdlog.shared_rate_ && !slot->suppressed_) {
+      slot->prio_ = prio;
+      strcpy(slot->msg_, msg);
+    }
+    slot->suppressed_++;
+    stdlog.ratelimited_total_++;
+    return 1;
+  }
+  slot->tokens_--;
+  log_flush_ratelimited(slot);
+  return 0;
+}
 
 void log_init()
 {
   stdlog.max_prio_ = 0;
   stdlog.targets_.first_ = NULL;
+  memset(stdlog.targets_.prio_mask_, 0, sizeof(stdlog.targets_.prio_mask_));
+  memset(stdlog.last_, 0, sizeof(stdlog.last_));
+  memset(stdlog.rate_, 0, sizeof(stdlog.rate_));
+  memset(&stdlog.shared_rate_, 0, sizeof(stdlog.shared_rate_));
+  stdlog.flush_next_ = 0;
+  stdlog.repeated_total_ = 0;
+  stdlog.ratelimited_total_ = 0;
 }
 
 void log_close()
 {
+  int i;
+  for(i = 0; i <= DEBUG; ++i)
+    log_flush_repeated(i);
+  for(i = 0; i < LOG_RATE_SLOTS; ++i)
+    log_flush_ratelimited(&stdlog.rate_[i]);
+  log_flush_ratelimited(&stdlog.shared_rate_);
   log_targets_clear(&stdlog.targets_);
 }
 
 void update_max_prio()
 {
-  log_target_t* tmp = stdlog.targets_.first_;
-  while(tmp) {
-    if(tmp->enabled_ && tmp->max_prio_ > stdlog.max_prio_)
-      stdlog.max_prio_ = tmp->max_prio_;
+  log_targets_update_mask(&stdlog.targets_);
 
-    tmp = tmp->next_;
+  stdlog.max_prio_ = 0;
+  int prio;
+  for(prio = DEBUG; prio > 0; --prio) {
+    if(stdlog.targets_.prio_mask_[prio]) {
+      stdlog.max_prio_ = prio;
+      break;
+    }
   }
 }
 
@@ -216,7 +372,55 @@ int log_add_target(const char* conf)
   return ret;
 }
 
-void log_printf(log_prio_t prio, const char* fmt, ...)
+int log_set_prio(const char* target, log_prio_t prio)
+{
+  if(!target || (int)prio < 0 || prio > DEBUG)
+    return -1;
+
+  int all = !strcmp(target, "all");
+  log_target_type_t type = log_target_parse_type(target);
+  if(!all && type == TARGET_UNKNOWN)
+    return -3;
+
+  int cnt = 0;
+  log_target_t* tmp;
+  for(tmp = stdlog.targets_.first_; tmp; tmp = tmp->next_) {
+    if(all || tmp->type_ == type) {
+      tmp->max_prio_ = prio;
+      tmp->enabled_ = prio > 0 ? 1 : 0;
+      cnt++;
+    }
+  }
+  update_max_prio();
+  return cnt;
+}
+
+void log_reset_prio()
+{
+  log_target_t* tmp;
+  for(tmp = stdlog.targets_.first_; tmp; tmp = tmp->next_) {
+    tmp->max_prio_ = tmp->conf_prio_;
+    tmp->enabled_ = tmp->max_prio_ > 0 ? 1 : 0;
+  }
+  update_max_prio();
+}
+
+int log_print_prio(void (*cb)(const char* line, void* arg), void* arg)
+{
+  if(!cb)
+    return -1;
+
+  char line[64];
+  int cnt = 0;
+  log_target_t* tmp;
+  for(tmp = stdlog.targets_.first_; tmp; tmp = tmp->next_, cnt++) {
+    snprintf(line, sizeof(line), "%s %d (configured: %d)", log_target_type_to_string(tmp->type_), tmp->enabled_ ? tmp->max_prio_ : 0, tmp->conf_prio_);
+    (*cb)(line, arg);
+  }
+  return cnt;
+}
+
+void log_do_printf(log_prio_t prio, const char* fmt, ...)
 {
   if(stdlog.max_prio_ < prio)
     return;
@@ -228,32 +432,95 @@ void log_printf(log_prio_t prio, const char* fmt, ...)
   vsnprintf(msg, MSG_LENGTH_MAX, fmt, args);
   va_end(args);
 
+  if(prio < ERROR || prio > DEBUG) {
+    log_targets_log(&stdlog.targets_, prio, msg);
+    return;
+  }
+
+  time_t now = clock_time();
+  log_repeat_t* last = &stdlog.last_[prio];
+  if(!strcmp(msg, last->msg_) && now - last->time_ < LOG_REPEAT_FLUSH_SEC) {
+    last->repeated_++;
+    stdlog.repeated_total_++;
+    return;
+  }
+  log_flush_repeated(prio);
+
+  if(log_rate_limited(prio, msg, now)) {
+    last->msg_[0] = 0;
+    return;
+  }
+
+  strcpy(last->msg_, msg);
+  last->time_ = now;
   log_targets_log(&stdlog.targets_, prio, msg);
 }
 
-void log_print_hex_dump(log_prio_t prio, const u_int8_t* buf, u_int32_t len)
+    // cheap enough for every round of the main loop, it only looks once a second
+void log_flush()
+{
+  time_t now = clock_time();
+  if(now < stdlog.flush_next_)
+    return;
+  stdlog.flush_next_ = now + 1;
+
+  int i;
+  for(i = 0; i <= DEBUG; ++i) {
+    log_repeat_t* last = &stdlog.last_[i];
+    if(last->repeated_ && now - last->time_ >= LOG_REPEAT_FLUSH_SEC) {
+      log_flush_repeated(i);
+      last->msg_[0] = 0;
+    }
+  }
+  for(i = 0; i < LOG_RATE_SLOTS; ++i) {
+    if(stdlog.rate_[i].suppressed_ && now - stdlog.rate_[i].flushed_ >= LOG_REPEAT_FLUSH_SEC)
+      log_flush_ratelimited(&stdlog.rate_[i]);
+  }
+  if(stdlog.shared_rate_.suppressed_ && now - stdlog.shared_rate_.flushed_ >= LOG_REPEAT_FLUSH_SEC)
+    log_flush_ratelimited(&stdlog.shared_rate_);
+}
+
+void log_get_suppressed(u_int32_t* repeated, u_int32_t* ratelimited)
+{
+  if(repeated)
+    *repeated = stdlog.repeated_total_;
+  if(ratelimited)
+    *ratelimited = stdlog.ratelimited_total_;
+}
+
+void log_do_print_hex_dump(log_prio_t prio, const u_int8_t* buf, u_int32_t len)
 {
   if(stdlog.max_prio_ < prio)
     return;
 
   static char msg[MSG_LENGTH_MAX];
+  static const char hex[] = "0123456789ABCDEF";
 
   if(!buf) {
     snprintf(msg, MSG_LENGTH_MAX, "(NULL)");
+    log_targets_log(&stdlog.targets_, prio, msg);
+    return;
   }
-  else {
-    u_int32_t i;
-    int offset = snprintf(msg, MSG_LENGTH_MAX, "dump(%d): ", len);
-    if(offset < 0)
+
+      // long dumps are split over several messages instead of being truncated
+  u_int32_t i = 0;
+  do {
+    int offset = i ? snprintf(msg, MSG_LENGTH_MAX, "dump(%u) +%u: ", len, i) : snprintf(msg, MSG_LENGTH_MAX, "dump(%u): ", len);
+    if(offset < 0 || offset >= MSG_LENGTH_MAX)
       return;
-    u_int8_t* ptr = &msg[offset];
-    
-    for(i=0; i < len; i++) {
-      if(((i+1)*3) >= (MSG_LENGTH_MAX - offset))
-        break;
-      snprintf(ptr, 3, "%02X ", buf[i]);
-      ptr+=3;
+    char* ptr = &msg[offset];
+    char* end = &msg[MSG_LENGTH_MAX - 1];
+    for(; i < len && ptr + 3 <= end; i++) {
+      *ptr++ = hex[buf[i] >> 4];
+      *ptr++ = hex[buf[i] & 0x0F];
+      *ptr++ = ' ';
     }
-  }
-  log_targets_log(&stdlog.targets_, prio, msg);
+    *ptr = 0;
+    log_targets_log(&stdlog.targets_, prio, msg);
+  } while(i < len);
+}
+
+int log_ring_tail(u_int32_t n, void (*cb)(const char* line, void* arg), void* arg)
+{
+  return log_targets_ring_tail(&stdlog.targets_, n, cb, arg);
 }
@@ -36,15 +36,23 @@
 #ifndef UANYTUN_log_h_INCLUDED
 #define UANYTUN_log_h_INCLUDED
 
+#include <time.h>
+
 #define MSG_LENGTH_MAX 150
 
+#define LOG_REPEAT_FLUSH_SEC 5 // emit "repeated N times" after this much silence
+#define LOG_RATE_SLOTS 64      // number of token buckets, indexed by message hash, colliding
+                               // messages share one more bucket while the slot is in use
+#define LOG_RATE_BURST 10      // messages with the same hash allowed at once
+#define LOG_RATE_PER_SEC 2     // refill rate of each token bucket
+
 enum log_prio_enum { ERROR = 1, WARNING = 2, NOTICE = 3,
                      INFO = 4, DEBUG = 5 };
 typedef enum log_prio_enum log_prio_t;
 
 const char* log_prio_to_string(log_prio_t prio);
 
-enum log_target_type_enum { TARGET_SYSLOG , TARGET_STDOUT, TARGET_STDERR, TARGET_FILE , TARGET_UNKNOWN };
+enum log_target_type_enum { TARGET_SYSLOG , TARGET_STDOUT, TARGET_STDERR, TARGET_FILE , TARGET_RING , TARGET_UNKNOWN };
 typedef enum log_target_type_enum log_target_type_t;
 
 struct log_target_struct {
@@ -57,34 +65,86 @@ struct log_target_struct {
   int opened_;
   int enabled_;
   log_prio_t max_prio_;
+  log_prio_t conf_prio_;
   void* param_;
   struct log_target_struct* next_;
 };
 typedef struct log_target_struct log_target_t;
 
+#define LOG_TARGETS_MAX 32
 
 struct log_targets_struct {
   log_target_t* first_;
+  u_int32_t prio_mask_[DEBUG + 1];
 };
 typedef struct log_targets_struct log_targets_t;
 
+log_target_type_t log_target_parse_type(const char* conf);
+const char* log_target_type_to_string(log_target_type_t type);
 int log_targets_target_exists(log_targets_t* targets, log_target_type_t type);
 int log_targets_add(log_targets_t* targets, const char* conf);
+void log_targets_update_mask(log_targets_t* targets);
 void log_targets_log(log_targets_t* targets, log_prio_t prio, const char* msg);
 void log_targets_clear(log_targets_t* targets);
+int log_targets_ring_tail(log_targets_t* targets, u_int32_t n, void (*cb)(const char* line, void* arg), void* arg);
 
 
+struct log_repeat_struct {
+  char msg_[MSG_LENGTH_MAX];
+  time_t time_;
+  u_int32_t repeated_;
+};
+typedef struct log_repeat_struct log_repeat_t;
+
+struct log_rate_struct {
+  u_int32_t hash_;
+  u_int32_t tokens_;
+  time_t last_refill_;
+  time_t flushed_;             // when the last "suppressed N times" was written
+  u_int32_t suppressed_;
+  log_prio_t prio_;
+  char msg_[MSG_LENGTH_MAX];
+};
+typedef struct log_rate_struct log_rate_t;
+
 struct log_struct {
   log_prio_t max_prio_;
   log_targets_t targets_;
+  log_repeat_t last_[DEBUG + 1];
+  log_rate_t rate_[LOG_RATE_SLOTS];
+  log_rate_t shared_rate_;
+  time_t flush_next_;
+  u_int32_t repeated_total_;
+  u_int32_t ratelimited_total_;
 };
 typedef struct log_struct log_t;
 
+extern log_t stdlog;
+
 void log_init();
 void log_close();
 void update_max_prio();
 int log_add_target(const char* conf);
-void log_printf(log_prio_t prio, const char* fmt, ...);
-void log_print_hex_dump(log_prio_t prio, const u_int8_t* buf, u_int32_t len);
+int log_set_prio(const char* target, log_prio_t prio);
+void log_reset_prio();
+int log_print_prio(void (*cb)(const char* line, void* arg), void* arg);
+void log_do_printf(log_prio_t prio, const char* fmt, ...);
+void log_flush();
+void log_get_suppressed(u_int32_t* repeated, u_int32_t* ratelimited);
+void log_do_print_hex_dump(log_prio_t prio, const u_int8_t* buf, u_int32_t len);
+int log_ring_tail(u_int32_t n, void (*cb)(const char* line, void* arg), void* arg);
+
+// the arguments are only evaluated if at least one target wants messages of this priority
+#define log_printf(PRIO, ...)                                  \
+  do {                                                         \
+    if(stdlog.max_prio_ >= (PRIO))                             \
+      log_do_printf(PRIO, __VA_ARGS__);                        \
+  } while(0)
+
+#define log_print_hex_dump(PRIO, BUF, LEN)                     \
+  do {                                                         \
+    if(stdlog.max_prio_ >= (PRIO))                             \
+      log_do_print_hex_dump(PRIO, BUF, LEN);                   \
+  } while(0)
 
 #endif
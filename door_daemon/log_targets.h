@@ -38,10 +38,9 @@
 
 #include <time.h>
 
-static char* get_time_formatted()
+static char* get_time_formatted_at(time_t t)
 {
   char* time_string;
-  time_t t = time(NULL);
   if(t < 0) 
     time_string = "<time read error>";
   else {
@@ -57,6 +56,11 @@ static char* get_time_formatted()
   return time_string;
 }
 
+static char* get_time_formatted()
+{
+  return get_time_formatted_at(clock_time());
+}
+
 enum syslog_facility_enum { USER = LOG_USER, MAIL = LOG_MAIL,
                             DAEMON = LOG_DAEMON, AUTH = LOG_AUTH,
                             SYSLOG = LOG_SYSLOG, LPR = LOG_LPR,
@@ -192,6 +196,7 @@ log_target_t* log_target_syslog_new()
   tmp->opened_ = 0;
   tmp->enabled_ = 0;
   tmp->max_prio_ = NOTICE;
+  tmp->conf_prio_ = NOTICE;
   tmp->param_ = NULL;
   tmp->next_ = NULL;
 
@@ -300,6 +305,7 @@ log_target_t* log_target_file_new()
   tmp->opened_ = 0;
   tmp->enabled_ = 0;
   tmp->max_prio_ = NOTICE;
+  tmp->conf_prio_ = NOTICE;
   tmp->param_ = NULL;
   tmp->next_ = NULL;
 
@@ -327,6 +333,7 @@ log_target_t* log_target_stdout_new()
   tmp->opened_ = 0;
   tmp->enabled_ = 0;
   tmp->max_prio_ = NOTICE;
+  tmp->conf_prio_ = NOTICE;
   tmp->param_ = NULL;
   tmp->next_ = NULL;
 
@@ -354,6 +361,125 @@ log_target_t* log_target_stderr_new()
   tmp->opened_ = 0;
   tmp->enabled_ = 0;
   tmp->max_prio_ = NOTICE;
+  tmp->conf_prio_ = NOTICE;
+  tmp->param_ = NULL;
+  tmp->next_ = NULL;
+
+  return tmp;
+}
+
+
+struct log_ring_entry_struct {
+  time_t time_;
+  log_prio_t prio_;
+  char msg_[MSG_LENGTH_MAX];
+};
+typedef struct log_ring_entry_struct log_ring_entry_t;
+
+struct log_target_ring_param_struct {
+  u_int32_t size_;
+  u_int32_t next_;
+  u_int32_t count_;
+  log_ring_entry_t* entries_;
+};
+typedef struct log_target_ring_param_struct log_target_ring_param_t;
+
+int log_target_ring_init(log_target_t* self, const char* conf)
+{
+  if(!self || (conf && conf[0] == 0))
+    return -1;
+
+  u_int32_t size = 256;
+  if(conf) {
+    char* end;
+    unsigned long tmp = strtoul(conf, &end, 10);
+    if(!tmp || (end[0] != 0 && end[0] != ','))
+      return -1;
+    size = (u_int32_t)tmp;
+  }
+
+  self->param_ = malloc(sizeof(log_target_ring_param_t));
+  if(!self->param_)
+    return -2;
+
+  log_ring_entry_t* entries = malloc(size * sizeof(log_ring_entry_t));
+  if(!entries) {
+    free(self->param_);
+    return -2;
+  }
+  ((log_target_ring_param_t*)(self->param_))->size_ = size;
+  ((log_target_ring_param_t*)(self->param_))->next_ = 0;
+  ((log_target_ring_param_t*)(self->param_))->count_ = 0;
+  ((log_target_ring_param_t*)(self->param_))->entries_ = entries;
+
+  return 0;
+}
+
+void log_target_ring_log(log_target_t* self, log_prio_t prio, const char* msg)
+{
+  if(!self || !self->param_)
+    return;
+
+  log_target_ring_param_t* ring = (log_target_ring_param_t*)(self->param_);
+  log_ring_entry_t* entry = &ring->entries_[ring->next_];
+  entry->time_ = clock_time();
+  entry->prio_ = prio;
+  strncpy(entry->msg_, msg, MSG_LENGTH_MAX);
+  entry->msg_[MSG_LENGTH_MAX - 1] = 0;
+
+  ring->next_ = (ring->next_ + 1) % ring->size_;
+  if(ring->count_ < ring->size_)
+    ring->count_++;
+}
+
+void log_target_ring_clear(log_target_t* self)
+{
+  if(!self || !self->param_)
+    return;
+
+  if(((log_target_ring_param_t*)(self->param_))->entries_)
+    free(((log_target_ring_param_t*)(self->param_))->entries_);
+
+  free(self->param_);
+}
+
+int log_target_ring_tail(log_target_t* self, u_int32_t n, void (*cb)(const char* line, void* arg), void* arg)
+{
+  if(!self || !self->param_ || !cb)
+    return -1;
+
+  log_target_ring_param_t* ring = (log_target_ring_param_t*)(self->param_);
+  if(!n || n > ring->count_)
+    n = ring->count_;
+
+  char line[MSG_LENGTH_MAX + 64];
+  u_int32_t i = (ring->next_ + ring->size_ - n) % ring->size_;
+  u_int32_t cnt;
+  for(cnt = 0; cnt < n; ++cnt) {
+    log_ring_entry_t* entry = &ring->entries_[i];
+    snprintf(line, sizeof(line), "%s %s: %s", get_time_formatted_at(entry->time_), log_prio_to_string(entry->prio_), entry->msg_);
+    (*cb)(line, arg);
+    i = (i + 1) % ring->size_;
+  }
+  return n;
+}
+
+log_target_t* log_target_ring_new()
+{
+  log_target_t* tmp = malloc(sizeof(log_target_t));
+  if(!tmp)
+    return NULL;
+
+  tmp->type_ = TARGET_RING;
+  tmp->init = &log_target_ring_init;
+  tmp->open = NULL;
+  tmp->log = &log_target_ring_log;
+  tmp->close = NULL;
+  tmp->clear = &log_target_ring_clear;
+  tmp->opened_ = 0;
+  tmp->enabled_ = 0;
+  tmp->max_prio_ = NOTICE;
+  tmp->conf_prio_ = NOTICE;
   tmp->param_ = NULL;
   tmp->next_ = NULL;
 
@@ -173,6 +173,24 @@ int options_parse(options_t* opt, int argc, char* argv[])
     PARSE_STRING_LIST("-L","--log", opt->log_targets_)
     PARSE_STRING_PARAM("-d","--device", opt->door_dev_)
     PARSE_STRING_PARAM("-s","--socket", opt->command_sock_)
+    PARSE_STRING_PARAM("-S","--stats-file", opt->stats_file_)
+    PARSE_INT_PARAM("-i","--stats-interval", opt->stats_interval_)
+    PARSE_BOOL_PARAM("-V","--virtual-time", opt->virtual_time_)
+    PARSE_STRING_PARAM("-w","--capture", opt->capture_file_)
+    PARSE_INT_PARAM("-W","--capture-size", opt->capture_size_)
+    PARSE_STRING_PARAM("-r","--record", opt->session_file_)
+    PARSE_STRING_PARAM("-M","--state-map", opt->state_map_)
+    PARSE_STRING_PARAM("-J","--journal", opt->journal_file_)
+    PARSE_STRING_LIST("-e","--door", opt->doors_)
+    PARSE_INT_PARAM("-R","--rate-limit", opt->rate_limit_)
+    PARSE_INT_PARAM("-B","--rate-burst", opt->rate_burst_)
+    PARSE_INT_PARAM("-Q","--client-queue", opt->client_queue_)
+    PARSE_STRING_PARAM("-p","--priorities", opt->priorities_)
+    PARSE_BOOL_PARAM("-c","--cancel-opens", opt->cancel_opens_)
+    PARSE_INVERSE_BOOL_PARAM("-A","--no-local-answers", opt->local_answers_)
+    PARSE_STRING_LIST("-y","--retry", opt->retries_)
+    PARSE_STRING_PARAM("-t","--schedule-file", opt->schedule_file_)
+    PARSE_STRING_PARAM("-T","--state-file", opt->state_file_)
     else 
       return i;
   }
@@ -202,6 +220,24 @@ void options_default(options_t* opt)
 
   opt->door_dev_ = strdup("/dev/door");
   opt->command_sock_ = strdup("/var/run/door_daemon/cmd.sock");
+  opt->stats_file_ = NULL;
+  opt->stats_interval_ = 10;
+  opt->virtual_time_ = 0;
+  opt->capture_file_ = NULL;
+  opt->capture_size_ = 1024;
+  opt->session_file_ = NULL;
+  opt->state_map_ = NULL;
+  opt->journal_file_ = NULL;
+  string_list_init(&opt->doors_);
+  opt->rate_limit_ = 0;
+  opt->rate_burst_ = 0;
+  opt->client_queue_ = 32;
+  opt->priorities_ = NULL;
+  opt->cancel_opens_ = 0;
+  opt->local_answers_ = 1;
+  string_list_init(&opt->retries_);
+  opt->schedule_file_ = NULL;
+  opt->state_file_ = NULL;
 }
 
 void options_clear(options_t* opt)
@@ -225,6 +261,24 @@ void options_clear(options_t* opt)
     free(opt->door_dev_);
   if(opt->command_sock_)
     free(opt->command_sock_);
+  if(opt->stats_file_)
+    free(opt->stats_file_);
+  if(opt->capture_file_)
+    free(opt->capture_file_);
+  if(opt->session_file_)
+    free(opt->session_file_);
+  if(opt->state_map_)
+    free(opt->state_map_);
+  if(opt->journal_file_)
+    free(opt->journal_file_);
+  string_list_clear(&opt->doors_);
+  if(opt->priorities_)
+    free(opt->priorities_);
+  string_list_clear(&opt->retries_);
+  if(opt->schedule_file_)
+    free(opt->schedule_file_);
+  if(opt->state_file_)
+    free(opt->state_file_);
 }
 
 void options_print_usage()
@@ -238,9 +292,39 @@ void options_print_usage()
   printf("            [-P|--write-pid] <path>             write pid to this file\n");
   printf("            [-L|--log] <target>:<level>[,<param1>[,<param2>..]]\n");
   printf("                                                add a log target, can be invoked several times\n");
+  printf("                                                i.e. syslog, file, stdout, stderr or ring (param: size)\n");
 
-  printf("            [-d|--device] <tty device>          the device file e.g. /dev/door\n");
+  printf("            [-d|--device] <device>              the device file e.g. /dev/door, or pty:<path>, tcp:<host>:<port>,\n");
+  printf("                                                loop:[<motion ms>] for the built-in firmware model\n");
   printf("            [-s|--command-sock] <unix sock>     the command socket e.g. /var/run/door_daemon/cmd.sock\n");
+  printf("            [-S|--stats-file] <path>            periodically write statistics in prometheus text format to this file\n");
+  printf("            [-i|--stats-interval] <seconds>     how often to rewrite the stats file (default: 10)\n");
+  printf("            [-V|--virtual-time]                 time only advances through the 'clock advance' command (for testing)\n");
+  printf("            [-w|--capture] <path>               record all bytes exchanged with the door into this ring file\n");
+  printf("            [-W|--capture-size] <kbytes>        size of the capture ring (default: 1024)\n");
+  printf("            [-r|--record] <path>                record the session (commands, responses, door traffic) for door_replay\n");
+  printf("            [-M|--state-map] <path>             publish the door state and counters in this memory mapped file\n");
+  printf("                                                e.g. /run/door_daemon/state, read it with door_shm\n");
+  printf("            [-J|--journal] <path>               append requests, manual opens, errors and state changes to this\n");
+  printf("                                                journal, query it with 'history' or door_journal\n");
+  printf("            [-e|--door] <name>,<device>,<unix sock>[,<state map>]\n");
+  printf("                                                serve this door, can be invoked several times,\n");
+  printf("                                                -d, -s and -M are ignored if there is any -e\n");
+  printf("            [-R|--rate-limit] <cmds/s>          door commands a client may send per second (default: unlimited)\n");
+  printf("            [-B|--rate-burst] <cmds>            door commands a client may send at once (default: the rate)\n");
+  printf("            [-Q|--client-queue] <cmds>          door commands a client may have waiting (default: 32, 0 is unlimited)\n");
+  printf("            [-p|--priorities] <cmd>:<class>[,<cmd>:<class>..]\n");
+  printf("                                                priority class 0-2 of door commands, lower goes first\n");
+  printf("                                                (default: reset:0,close:0,open:1,toggle:1,status:2)\n");
+  printf("            [-c|--cancel-opens]                 a close cancels the opens which are still waiting\n");
+  printf("            [-A|--no-local-answers]             always ask the firmware, even if the door state says it will refuse\n");
+  printf("            [-y|--retry] <cmd>:<attempts>[:<backoff ms>[:<deadline ms>]]\n");
+  printf("                                                try expired commands and ones refused with 'Operation in progress'\n");
+  printf("                                                again, can be invoked several times (default backoff: 200, deadline: 5000)\n");
+  printf("            [-t|--schedule-file] <path>         keep the scheduled commands ('open for', 'schedule') in this file\n");
+  printf("                                                so they survive a restart\n");
+  printf("            [-T|--state-file] <path>            keep the door state, event sequence and schedule in this file and\n");
+  printf("                                                serve them right after a restart until the firmware confirms them\n");
 }
 
 void options_print(options_t* opt)
@@ -259,4 +343,24 @@ void options_print(options_t* opt)
 
   printf("door_dev: '%s'\n", opt->door_dev_);
   printf("command_sock: '%s'\n", opt->command_sock_);
+  printf("stats_file: '%s'\n", opt->stats_file_);
+  printf("stats_interval: %d\n", opt->stats_interval_);
+  printf("virtual_time: %d\n", opt->virtual_time_);
+  printf("capture_file: '%s'\n", opt->capture_file_);
+  printf("capture_size: %d\n", opt->capture_size_);
+  printf("session_file: '%s'\n", opt->session_file_);
+  printf("state_map: '%s'\n", opt->state_map_);
+  printf("journal_file: '%s'\n", opt->journal_file_);
+  printf("doors: \n");
+  string_list_print(&opt->doors_, "  '", "'\n");
+  printf("rate_limit: %d\n", opt->rate_limit_);
+  printf("rate_burst: %d\n", opt->rate_burst_);
+  printf("client_queue: %d\n", opt->client_queue_);
+  printf("priorities: '%s'\n", opt->priorities_);
+  printf("cancel_opens: %d\n", opt->cancel_opens_);
+  printf("local_answers: %d\n", opt->local_answers_);
+  printf("retries: \n");
+  string_list_print(&opt->retries_, "  '", "'\n");
+  printf("schedule_file: '%s'\n", opt->schedule_file_);
+  printf("state_file: '%s'\n", opt->state_file_);
 }
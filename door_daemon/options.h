@@ -35,6 +35,24 @@ struct options_struct {
 
   char* door_dev_;
   char* command_sock_;
+  char* stats_file_;
+  int stats_interval_;
+  int virtual_time_;
+  char* capture_file_;
+  int capture_size_;
+  char* session_file_;
+  char* state_map_;
+  char* journal_file_;
+  string_list_t doors_;
+  int rate_limit_;
+  int rate_burst_;
+  int client_queue_;
+  char* priorities_;
+  int cancel_opens_;
+  int local_answers_;
+  string_list_t retries_;
+  char* schedule_file_;
+  char* state_file_;
 };
 typedef struct options_struct options_t;
 
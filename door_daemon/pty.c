@@ -0,0 +1,76 @@
+/*
+ *  door_daemon
+ *
+ *  Copyright (C) 2009 Christian Pointner <equinox@spreadspace.org>
+ *
+ *  This file is part of door_daemon.
+ *
+ *  door_daemon is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  door_daemon is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with door_daemon. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include "datatypes.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+
+#include "pty.h"
+
+int pty_open(const char* prog, const char* link, int* slave_fd)
+{
+  int fd = posix_openpt(O_RDWR | O_NOCTTY);
+  if(fd < 0 || grantpt(fd) || unlockpt(fd)) {
+    fprintf(stderr, "%s: unable to create pty: %s\n", prog, strerror(errno));
+    return -1;
+  }
+
+  const char* name = ptsname(fd);
+  if(!name) {
+    fprintf(stderr, "%s: ptsname failed: %s\n", prog, strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+      // keep the slave open: the master would see EIO whenever the daemon closes it
+  *slave_fd = open(name, O_RDWR | O_NOCTTY);
+  if(*slave_fd < 0) {
+    fprintf(stderr, "%s: unable to open '%s': %s\n", prog, name, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  struct termios tmio;
+  if(!tcgetattr(*slave_fd, &tmio)) {
+    cfmakeraw(&tmio);
+    cfsetospeed(&tmio, B9600);
+    cfsetispeed(&tmio, B9600);
+    tcsetattr(*slave_fd, TCSANOW, &tmio);
+  }
+
+  unlink(link);
+  if(symlink(name, link)) {
+    fprintf(stderr, "%s: unable to create link '%s' -> '%s': %s\n", prog, link, name, strerror(errno));
+    close(*slave_fd);
+    close(fd);
+    return -1;
+  }
+  fcntl(fd, F_SETFL, O_NONBLOCK);
+  fprintf(stderr, "%s: firmware is listening on %s (%s)\n", prog, link, name);
+  return fd;
+}
@@ -0,0 +1,50 @@
+#!/bin/sh
+##
+##  door_daemon
+##
+##  Copyright (C) 2009 Christian Pointner <equinox@spreadspace.org>
+##
+##  This file is part of door_daemon.
+##
+##  door_daemon is free software: you can redistribute it and/or modify
+##  it under the terms of the GNU General Public License as published by
+##  the Free Software Foundation, either version 3 of the License, or
+##  any later version.
+##
+##  door_daemon is distributed in the hope that it will be useful,
+##  but WITHOUT ANY WARRANTY; without even the implied warranty of
+##  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+##  GNU General Public License for more details.
+##
+##  You should have received a copy of the GNU General Public License
+##  along with door_daemon. If not, see <http://www.gnu.org/licenses/>.
+##
+
+## replays a session recorded with 'door_daemon -r <file>' against this build
+## usage: ./replay.sh <session> [<results file>] [<door_replay options>]
+## the daemon runs with virtual time so recorded pauses and expiries cost no
+## wall clock time, results are appended as JSON lines labeled with the git revision
+
+SESSION=$1
+[ -n "$SESSION" ] || { echo "usage: $0 <session> [<results file>] [<door_replay options>]"; exit 1; }
+shift
+RESULTS=${1:-replay-results.jsonl}
+[ $# -gt 0 ] && shift
+
+DIR=`mktemp -d /tmp/door_replay.XXXXXX` || exit 1
+LABEL=`git describe --always --dirty 2>/dev/null || echo unknown`
+
+./door_replay -s $DIR/cmd.sock -l $DIR/door -o "$RESULTS" -L "$LABEL" "$@" "$SESSION" &
+REPLAY_PID=$!
+sleep 0.3
+./door_daemon -D -V -d $DIR/door -s $DIR/cmd.sock -L stderr:3 > $DIR/daemon.log 2>&1 &
+DAEMON_PID=$!
+
+wait $REPLAY_PID
+RET=$?
+
+kill $DAEMON_PID 2>/dev/null
+wait 2>/dev/null
+rm -rf $DIR
+tail -n 1 "$RESULTS"
+exit $RET
@@ -0,0 +1,415 @@
+/*
+ *  door_daemon
+ *
+ *  Copyright (C) 2009 Christian Pointner <equinox@spreadspace.org>
+ *
+ *  This file is part of door_daemon.
+ *
+ *  door_daemon is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  door_daemon is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with door_daemon. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "datatypes.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "schedule.h"
+
+schedule_t schedule;
+
+static const char* schedule_cmd_names[CMD_DOOR_MAX] = { "open", "close", "toggle", "reset", "status" };
+
+void schedule_init(const char* path)
+{
+  memset(&schedule, 0, sizeof(schedule));
+  schedule.next_id_ = 1;
+  if(path)
+    schedule.path_ = strdup(path);
+}
+
+void schedule_clear()
+{
+  if(schedule.path_)
+    free(schedule.path_);
+  memset(&schedule, 0, sizeof(schedule));
+}
+
+static void schedule_swap(u_int32_t a, u_int32_t b)
+{
+  schedule_entry_t tmp = schedule.heap_[a];
+  schedule.heap_[a] = schedule.heap_[b];
+  schedule.heap_[b] = tmp;
+}
+
+static int schedule_before(u_int32_t a, u_int32_t b)
+{
+  if(schedule.heap_[a].due_ != schedule.heap_[b].due_)
+    return schedule.heap_[a].due_ < schedule.heap_[b].due_;
+  return schedule.heap_[a].id_ < schedule.heap_[b].id_;
+}
+
+static void schedule_sift_up(u_int32_t i)
+{
+  while(i && schedule_before(i, (i - 1) / 2)) {
+    schedule_swap(i, (i - 1) / 2);
+    i = (i - 1) / 2;
+  }
+}
+
+static void schedule_sift_down(u_int32_t i)
+{
+  for(;;) {
+    u_int32_t min = i, l = 2 * i + 1, r = 2 * i + 2;
+    if(l < schedule.count_ && schedule_before(l, min))
+      min = l;
+    if(r < schedule.count_ && schedule_before(r, min))
+      min = r;
+    if(min == i)
+      return;
+    schedule_swap(i, min);
+    i = min;
+  }
+}
+
+static void schedule_remove_at(u_int32_t i)
+{
+  schedule.changes_++;
+  schedule.count_--;
+  if(i == schedule.count_)
+    return;
+  schedule.heap_[i] = schedule.heap_[schedule.count_];
+  schedule_sift_down(i);
+  schedule_sift_up(i);
+}
+
+static int schedule_insert(const schedule_entry_t* entry)
+{
+  if(schedule.count_ >= SCHEDULE_MAX)
+    return -1;
+  schedule.changes_++;
+  schedule.heap_[schedule.count_] = *entry;
+  schedule_sift_up(schedule.count_++);
+  if(entry->id_ >= schedule.next_id_)
+    schedule.next_id_ = entry->id_ + 1;
+  return 0;
+}
+
+    // the next time after now the local clock shows the given minute of the day
+static time_t schedule_next_daily(time_t now, int daily)
+{
+  struct tm tm;
+  localtime_r(&now, &tm);
+  tm.tm_hour = daily / 60;
+  tm.tm_min = daily % 60;
+  tm.tm_sec = 0;
+  tm.tm_isdst = -1;
+  time_t due = mktime(&tm);
+  if(due <= now) {
+    localtime_r(&now, &tm);
+    tm.tm_mday++;
+    tm.tm_hour = daily / 60;
+    tm.tm_min = daily % 60;
+    tm.tm_sec = 0;
+    tm.tm_isdst = -1;
+    due = mktime(&tm);
+  }
+  return due;
+}
+
+    // HH:MM is daily, +<sec> is relative to now, @<unix time> is absolute
+int schedule_parse_time(const char* spec, time_t now, time_t* due, int* daily)
+{
+  if(!spec || !due || !daily)
+    return -1;
+
+  char* end;
+  *daily = SCHEDULE_DAILY_NONE;
+  if(spec[0] == '+' || spec[0] == '@') {
+    long value = strtol(&spec[1], &end, 10);
+    if(end == &spec[1] || (*end && *end != ' ') || value < 0)
+      return -1;
+    *due = spec[0] == '+' ? now + value : (time_t)value;
+    return 0;
+  }
+
+  long hour = strtol(spec, &end, 10);
+  if(end == spec || *end != ':' || hour < 0 || hour > 23)
+    return -1;
+  const char* minute_str = end + 1;
+  long minute = strtol(minute_str, &end, 10);
+  if(end == minute_str || (*end && *end != ' ') || minute < 0 || minute > 59)
+    return -1;
+  *daily = hour * 60 + minute;
+  *due = schedule_next_daily(now, *daily);
+  return 0;
+}
+
+int schedule_add(u_int32_t door, cmd_id_t cmd, time_t due, int daily)
+{
+  if(cmd >= CMD_DOOR_MAX)
+    return -1;
+
+  schedule_entry_t entry;
+  entry.id_ = schedule.next_id_;
+  entry.door_ = door;
+  entry.cmd_ = cmd;
+  entry.due_ = due;
+  entry.daily_ = daily;
+  entry.attempts_ = 0;
+  entry.inflight_ = 0;
+  if(schedule_insert(&entry))
+    return -1;
+  schedule_save();
+  return entry.id_;
+}
+
+int schedule_cancel(u_int32_t door, u_int32_t id)
+{
+  u_int32_t i;
+  for(i = 0; i < schedule.count_; ++i) {
+    if(schedule.heap_[i].id_ == id && schedule.heap_[i].door_ == door) {
+      schedule_remove_at(i);
+      schedule_save();
+      return 0;
+    }
+  }
+  return -1;
+}
+
+static int schedule_compare(const void* a, const void* b)
+{
+  const schedule_entry_t* ea = a;
+  const schedule_entry_t* eb = b;
+  if(ea->due_ != eb->due_)
+    return ea->due_ < eb->due_ ? -1 : 1;
+  return ea->id_ < eb->id_ ? -1 : ea->id_ > eb->id_;
+}
+
+    // the entries of one door in the order they will run
+u_int32_t schedule_list(u_int32_t door, schedule_entry_t* entries)
+{
+  u_int32_t i, count = 0;
+  for(i = 0; i < schedule.count_; ++i)
+    if(schedule.heap_[i].door_ == door)
+      entries[count++] = schedule.heap_[i];
+  qsort(entries, count, sizeof(entries[0]), schedule_compare);
+  return count;
+}
+
+time_t schedule_next_due()
+{
+  return schedule.count_ ? schedule.heap_[0].due_ : 0;
+}
+
+    // a one-shot entry is done, a daily one waits for tomorrow
+static void schedule_finish_at(u_int32_t i, time_t now)
+{
+  if(schedule.heap_[i].daily_ == SCHEDULE_DAILY_NONE) {
+    schedule_remove_at(i);
+    return;
+  }
+  schedule.changes_++;
+  schedule.heap_[i].due_ = schedule_next_daily(now, schedule.heap_[i].daily_);
+  schedule.heap_[i].attempts_ = 0;
+  schedule.heap_[i].inflight_ = 0;
+  schedule_sift_down(i);
+  schedule_sift_up(i);
+}
+
+    // 1 if the command of the entry is to run now, inflight_ of the copy is its attempt,
+    // 2 if the command of the entry is out and the caller should make sure it is still queued,
+    // the entry stays in the heap either way until schedule_done() says how it went
+int schedule_pop_due(time_t now, schedule_entry_t* entry)
+{
+  while(schedule.count_ && schedule.heap_[0].due_ <= now) {
+    schedule_entry_t* top = &schedule.heap_[0];
+    if(top->inflight_) {
+      top->due_ = now + SCHEDULE_RETRY_S;
+      if(entry)
+        *entry = *top;
+      schedule_sift_down(0);
+      return 2;
+    }
+    if(now - top->due_ > SCHEDULE_GRACE_S) {
+      log_printf(WARNING, "schedule entry %u missed its time by %ld seconds, %s", top->id_, (long)(now - top->due_),
+                 top->daily_ == SCHEDULE_DAILY_NONE ? "dropping it" : "skipping to the next day");
+      schedule_finish_at(0, now);
+      schedule_save();
+      continue;
+    }
+    if(top->attempts_ >= SCHEDULE_ATTEMPTS) {
+      log_printf(ERROR, "giving up on schedule entry %u after %u attempts", top->id_, top->attempts_);
+      schedule_finish_at(0, now);
+      schedule_save();
+      continue;
+    }
+
+    schedule.changes_++;
+    top->attempts_++;
+    top->inflight_ = top->attempts_;
+    top->due_ = now + SCHEDULE_RETRY_S;
+    if(entry)
+      *entry = *top;
+    schedule_sift_down(0);
+    schedule_save();
+    return 1;
+  }
+  return 0;
+}
+
+    // the outcome of an attempt, an entry cancelled in the meantime is gone already
+    // and the late outcome of an attempt which was given up on doesn't count
+int schedule_done(u_int32_t id, u_int32_t attempt, int failed, time_t now)
+{
+  u_int32_t i;
+  for(i = 0; i < schedule.count_; ++i)
+    if(schedule.heap_[i].id_ == id)
+      break;
+  if(i >= schedule.count_ || !attempt || schedule.heap_[i].inflight_ != attempt)
+    return -1;
+
+  schedule_entry_t* entry = &schedule.heap_[i];
+  entry->inflight_ = 0;
+  if(!failed)
+    schedule_finish_at(i, now);
+  else if(entry->attempts_ >= SCHEDULE_ATTEMPTS) {
+    log_printf(ERROR, "giving up on schedule entry %u after %u attempts", entry->id_, entry->attempts_);
+    schedule_finish_at(i, now);
+  }
+  else {
+    log_printf(WARNING, "schedule entry %u failed, trying again in %d seconds", entry->id_, SCHEDULE_RETRY_S);
+    schedule.changes_++;
+    entry->due_ = now + SCHEDULE_RETRY_S;
+    schedule_sift_down(i);
+    schedule_sift_up(i);
+  }
+  schedule_save();
+  return 0;
+}
+
+const char* schedule_cmd_to_string(cmd_id_t cmd)
+{
+  return cmd < CMD_DOOR_MAX ? schedule_cmd_names[cmd] : "unknown";
+}
+
+int schedule_entry_to_string(const schedule_entry_t* entry, char* buf, size_t len)
+{
+  if(!entry || !buf)
+    return -1;
+
+  if(entry->daily_ == SCHEDULE_DAILY_NONE)
+    return snprintf(buf, len, "id=%u door=%u cmd=%s at=%ld", entry->id_, entry->door_,
+                    schedule_cmd_to_string(entry->cmd_), (long)entry->due_);
+  return snprintf(buf, len, "id=%u door=%u cmd=%s at=%ld daily=%02d:%02d", entry->id_, entry->door_,
+                  schedule_cmd_to_string(entry->cmd_), (long)entry->due_, entry->daily_ / 60, entry->daily_ % 60);
+}
+
+    // one entry per line: id door cmd due daily
+int schedule_write(FILE* out)
+{
+  if(!out)
+    return -1;
+
+  u_int32_t i;
+  for(i = 0; i < schedule.count_; ++i) {
+    schedule_entry_t* entry = &schedule.heap_[i];
+    fprintf(out, "%u %u %s %ld %d\n", entry->id_, entry->door_, schedule_cmd_to_string(entry->cmd_),
+            (long)entry->due_, entry->daily_);
+  }
+  return ferror(out) ? -1 : 0;
+}
+
+int schedule_read(FILE* in)
+{
+  if(!in)
+    return -1;
+
+  char line[128];
+  int loaded = 0;
+  while(fgets(line, sizeof(line), in)) {
+    schedule_entry_t entry;
+    char cmd[16];
+    long due;
+    if(sscanf(line, "%u %u %15s %ld %d", &entry.id_, &entry.door_, cmd, &due, &entry.daily_) != 5) {
+      log_printf(WARNING, "ignoring invalid schedule entry: %s", line);
+      continue;
+    }
+    for(entry.cmd_ = 0; entry.cmd_ < CMD_DOOR_MAX; ++entry.cmd_)
+      if(!strcmp(cmd, schedule_cmd_names[entry.cmd_]))
+        break;
+    if(entry.cmd_ >= CMD_DOOR_MAX || entry.daily_ < SCHEDULE_DAILY_NONE || entry.daily_ >= 24 * 60) {
+      log_printf(WARNING, "ignoring invalid schedule entry: %s", line);
+      continue;
+    }
+    entry.due_ = due;
+    entry.attempts_ = 0;
+    entry.inflight_ = 0;
+    if(schedule_insert(&entry)) {
+      log_printf(WARNING, "schedule is full, dropping entry %u", entry.id_);
+      continue;
+    }
+    loaded++;
+  }
+  return loaded;
+}
+
+int schedule_save()
+{
+  if(!schedule.path_)
+    return 0;
+
+  char tmp_path[1024];
+  if(snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", schedule.path_) >= sizeof(tmp_path))
+    return -1;
+
+  FILE* out = fopen(tmp_path, "w");
+  if(!out) {
+    log_printf(WARNING, "unable to open schedule file '%s': %s", tmp_path, strerror(errno));
+    return -1;
+  }
+  int ret = schedule_write(out);
+  if(fclose(out) || ret) {
+    log_printf(WARNING, "unable to write schedule file '%s'", tmp_path);
+    unlink(tmp_path);
+    return -1;
+  }
+  if(rename(tmp_path, schedule.path_)) {
+    log_printf(WARNING, "unable to rename schedule file to '%s': %s", schedule.path_, strerror(errno));
+    unlink(tmp_path);
+    return -1;
+  }
+  return 0;
+}
+
+int schedule_load()
+{
+  if(!schedule.path_)
+    return 0;
+
+  FILE* in = fopen(schedule.path_, "r");
+  if(!in) {
+    if(errno == ENOENT)
+      return 0;
+    log_printf(WARNING, "unable to open schedule file '%s': %s", schedule.path_, strerror(errno));
+    return -1;
+  }
+  int ret = schedule_read(in);
+  fclose(in);
+  return ret;
+}
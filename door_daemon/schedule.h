@@ -0,0 +1,99 @@
+/*
+ *  door_daemon
+ *
+ *  Copyright (C) 2009 Christian Pointner <equinox@spreadspace.org>
+ *
+ *  This file is part of door_daemon.
+ *
+ *  door_daemon is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  door_daemon is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with door_daemon. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DOOR_DAEMON_schedule_h_INCLUDED
+#define DOOR_DAEMON_schedule_h_INCLUDED
+
+#include <stdio.h>
+#include <time.h>
+
+#include "datatypes.h"
+#include "command_queue.h"
+
+// Timed door commands: 'open for <sec>' opens now and schedules the close,
+// 'schedule <time> <cmd>' runs a command once (+<sec>, @<unix time>) or
+// every day (HH:MM, local time). Pending entries are kept in a binary
+// min-heap on their due time, the main loop sleeps until the earliest one
+// and feeds due commands through the normal command path as if an internal
+// client (fd -1) had sent them. Due times are wall clock seconds
+// (clock_time()) rather than monotonic time because entries are persisted
+// across restarts and daily entries are wall clock times anyway. A daily
+// entry is rescheduled with mktime() after it ran so DST changes are
+// honoured.
+//
+// An entry stays in the heap until schedule_done() reports that its
+// command went through: a door which isn't available, a refusal like
+// 'Error: Operation in progress' or no answer at all try it again after
+// SCHEDULE_RETRY_S, up to SCHEDULE_ATTEMPTS times. While the command of an
+// attempt is queued or being retried by the door the entry is in flight
+// and doesn't run again, only the outcome of that very attempt counts.
+// Every SCHEDULE_RETRY_S the main loop makes sure the command is still
+// queued, one which got lost on the way counts as failed. An entry more
+// than SCHEDULE_GRACE_S overdue, e.g. because
+// the daemon was down, doesn't run at all: a one-shot one is dropped, a
+// daily one moves on to its next occurrence. Nobody wants the door to
+// open at noon for a visitor who was expected in the morning.
+
+#define SCHEDULE_MAX 64
+#define SCHEDULE_DAILY_NONE -1
+#define SCHEDULE_GRACE_S 60
+#define SCHEDULE_RETRY_S 5
+#define SCHEDULE_ATTEMPTS 5
+
+struct schedule_entry_struct {
+  u_int32_t id_;
+  u_int32_t door_;            // index of the door in the configuration
+  cmd_id_t cmd_;
+  time_t due_;
+  int daily_;                 // minute of the day or SCHEDULE_DAILY_NONE
+  u_int32_t attempts_;        // runs without success so far, not persisted
+  u_int32_t inflight_;        // the attempt whose command is out, 0 if none, not persisted
+};
+typedef struct schedule_entry_struct schedule_entry_t;
+
+struct schedule_struct {
+  schedule_entry_t heap_[SCHEDULE_MAX];
+  u_int32_t count_;
+  u_int32_t next_id_;
+  u_int32_t changes_;         // bumped on every change, tells the state file to rewrite
+  char* path_;                // where the entries are persisted, may be NULL
+};
+typedef struct schedule_struct schedule_t;
+
+extern schedule_t schedule;
+
+void schedule_init(const char* path);
+void schedule_clear();
+int schedule_parse_time(const char* spec, time_t now, time_t* due, int* daily);
+int schedule_add(u_int32_t door, cmd_id_t cmd, time_t due, int daily);
+int schedule_cancel(u_int32_t door, u_int32_t id);
+u_int32_t schedule_list(u_int32_t door, schedule_entry_t* entries);
+time_t schedule_next_due();
+int schedule_pop_due(time_t now, schedule_entry_t* entry);
+int schedule_done(u_int32_t id, u_int32_t attempt, int failed, time_t now);
+const char* schedule_cmd_to_string(cmd_id_t cmd);
+int schedule_entry_to_string(const schedule_entry_t* entry, char* buf, size_t len);
+int schedule_write(FILE* out);
+int schedule_read(FILE* in);
+int schedule_save();
+int schedule_load();
+
+#endif
@@ -0,0 +1,197 @@
+/*
+ *  door_daemon
+ *
+ *  Copyright (C) 2009 Christian Pointner <equinox@spreadspace.org>
+ *
+ *  This file is part of door_daemon.
+ *
+ *  door_daemon is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  door_daemon is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with door_daemon. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "datatypes.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "log.h"
+#include "clock.h"
+#include "session.h"
+
+static session_t session;
+
+static u_int64_t session_now()
+{
+  struct timeval now;
+  clock_now(&now);
+  return (u_int64_t)now.tv_sec * 1000000 + now.tv_usec;
+}
+
+static void session_emit(session_event_type_t type, u_int32_t conn, const u_int8_t* data, u_int32_t len, u_int64_t time_us)
+{
+  session_event_t ev;
+  if(len > 0xFFFF)
+    len = 0xFFFF;
+  ev.time_us_ = time_us;
+  ev.conn_ = conn;
+  ev.len_ = len;
+  ev.type_ = type;
+  ev.reserved_ = 0;
+  fwrite(&ev, sizeof(ev), 1, session.out_);
+  if(len)
+    fwrite(data, len, 1, session.out_);
+}
+
+static void session_door_flush()
+{
+  if(!session.door_pending_len_)
+    return;
+
+  session_emit(SESSION_DOOR_IN, 0, session.door_pending_, session.door_pending_len_, session.door_pending_time_);
+  session.door_pending_len_ = 0;
+}
+
+static void session_event(session_event_type_t type, u_int32_t conn, const u_int8_t* data, u_int32_t len)
+{
+  session_door_flush();
+  session_emit(type, conn, data, len, session_now());
+}
+
+int session_open(const char* path)
+{
+  if(!path)
+    return -1;
+
+  memset(&session, 0, sizeof(session));
+  session.out_ = fopen(path, "w");
+  if(!session.out_) {
+    log_printf(ERROR, "unable to open session file '%s': %s", path, strerror(errno));
+    return -1;
+  }
+  setvbuf(session.out_, NULL, _IOFBF, 64*1024);
+
+  session_header_t hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic_, SESSION_MAGIC, sizeof(hdr.magic_));
+  hdr.version_ = SESSION_VERSION;
+  hdr.started_mono_ = session_now();
+  hdr.started_ = (int64_t)clock_time() * 1000000;
+  fwrite(&hdr, sizeof(hdr), 1, session.out_);
+      // nothing may be left in the buffer when daemonize() forks and the parent exits
+  fflush(session.out_);
+  log_printf(NOTICE, "recording session to '%s'", path);
+  return 0;
+}
+
+void session_close()
+{
+  if(!session.out_)
+    return;
+
+  session_door_flush();
+  fclose(session.out_);
+  session.out_ = NULL;
+}
+
+void session_flush()
+{
+  if(!session.out_)
+    return;
+
+  session_door_flush();
+  fflush(session.out_);
+}
+
+void session_connect(int fd)
+{
+  if(!session.out_ || fd < 0 || fd >= FD_SETSIZE)
+    return;
+
+  session.conn_of_fd_[fd] = ++session.next_conn_;
+  session_event(SESSION_CONNECT, session.conn_of_fd_[fd], NULL, 0);
+}
+
+void session_disconnect(int fd)
+{
+  if(!session.out_ || fd < 0 || fd >= FD_SETSIZE || !session.conn_of_fd_[fd])
+    return;
+
+  session_event(SESSION_DISCONNECT, session.conn_of_fd_[fd], NULL, 0);
+  session.conn_of_fd_[fd] = 0;
+}
+
+void session_client_in(int fd, const char* line)
+{
+  if(!session.out_ || fd < 0 || fd >= FD_SETSIZE || !session.conn_of_fd_[fd])
+    return;
+
+  session_event(SESSION_CLIENT_IN, session.conn_of_fd_[fd], (const u_int8_t*)line, strlen(line));
+}
+
+void session_client_out(int fd, const char* response)
+{
+  if(!session.out_ || fd < 0 || fd >= FD_SETSIZE || !session.conn_of_fd_[fd])
+    return;
+
+  session_event(SESSION_CLIENT_OUT, session.conn_of_fd_[fd], (const u_int8_t*)response, strlen(response));
+}
+
+void session_door_in(const u_int8_t* buf, u_int32_t len)
+{
+  if(!session.out_)
+    return;
+
+  if(session.door_pending_len_ + len > sizeof(session.door_pending_))
+    session_door_flush();
+  if(!session.door_pending_len_)
+    session.door_pending_time_ = session_now();
+  if(len > sizeof(session.door_pending_))
+    len = sizeof(session.door_pending_);
+  memcpy(&session.door_pending_[session.door_pending_len_], buf, len);
+  session.door_pending_len_ += len;
+}
+
+void session_door_out(const u_int8_t* buf, u_int32_t len)
+{
+  if(!session.out_)
+    return;
+
+  session_event(SESSION_DOOR_OUT, 0, buf, len);
+}
+
+int session_read_header(FILE* in, session_header_t* hdr)
+{
+  if(!in || !hdr)
+    return -1;
+
+  if(fread(hdr, sizeof(*hdr), 1, in) != 1)
+    return -1;
+  if(memcmp(hdr->magic_, SESSION_MAGIC, sizeof(hdr->magic_)) || hdr->version_ != SESSION_VERSION)
+    return -1;
+  return 0;
+}
+
+int session_read_event(FILE* in, session_event_t* ev, u_int8_t* data, u_int32_t size)
+{
+  if(!in || !ev || !data)
+    return -1;
+
+  if(fread(ev, sizeof(*ev), 1, in) != 1)
+    return feof(in) ? 0 : -1;
+  if(ev->len_ >= size || (ev->len_ && fread(data, ev->len_, 1, in) != 1))
+    return -1;
+  data[ev->len_] = 0;
+  return 1;
+}
@@ -0,0 +1,88 @@
+/*
+ *  door_daemon
+ *
+ *  Copyright (C) 2009 Christian Pointner <equinox@spreadspace.org>
+ *
+ *  This file is part of door_daemon.
+ *
+ *  door_daemon is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  door_daemon is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with door_daemon. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DOOR_DAEMON_session_h_INCLUDED
+#define DOOR_DAEMON_session_h_INCLUDED
+
+#include <stdio.h>
+#include <sys/time.h>
+#include <sys/select.h>
+
+#include "datatypes.h"
+
+// Session recording: all inputs of the daemon (client connects, command
+// lines, disconnects and bytes from the door) and all outputs (responses
+// and bytes to the door) are appended to a file with their monotonic
+// timestamps. door_replay feeds the inputs to another daemon instance and
+// compares the outputs. Connections are identified by a counter instead of
+// the fd, fd numbers get reused. Door input is collected until some other
+// event happens, so a line read byte by byte becomes a single event.
+
+#define SESSION_MAGIC "DOORSES1"
+#define SESSION_VERSION 1
+#define SESSION_DOOR_PENDING_MAX 256
+
+enum session_event_type_enum { SESSION_CONNECT = 1, SESSION_DISCONNECT, SESSION_CLIENT_IN, SESSION_CLIENT_OUT,
+                               SESSION_DOOR_IN, SESSION_DOOR_OUT };
+typedef enum session_event_type_enum session_event_type_t;
+
+struct session_header_struct {
+  char magic_[8];
+  u_int32_t version_;
+  u_int32_t reserved_;
+  int64_t started_;         // unix time in usec of the first event
+  u_int64_t started_mono_;  // monotonic time in usec of the first event
+};
+typedef struct session_header_struct session_header_t;
+
+struct session_event_struct {
+  u_int64_t time_us_;
+  u_int32_t conn_;
+  u_int16_t len_;
+  u_int8_t type_;
+  u_int8_t reserved_;
+};
+typedef struct session_event_struct session_event_t;
+
+struct session_struct {
+  FILE* out_;
+  u_int32_t next_conn_;
+  u_int32_t conn_of_fd_[FD_SETSIZE];
+  u_int8_t door_pending_[SESSION_DOOR_PENDING_MAX];
+  u_int32_t door_pending_len_;
+  u_int64_t door_pending_time_;
+};
+typedef struct session_struct session_t;
+
+int session_open(const char* path);
+void session_close();
+void session_flush();
+void session_connect(int fd);
+void session_disconnect(int fd);
+void session_client_in(int fd, const char* line);
+void session_client_out(int fd, const char* response);
+void session_door_in(const u_int8_t* buf, u_int32_t len);
+void session_door_out(const u_int8_t* buf, u_int32_t len);
+
+int session_read_header(FILE* in, session_header_t* hdr);
+int session_read_event(FILE* in, session_event_t* ev, u_int8_t* data, u_int32_t size);
+
+#endif
@@ -0,0 +1,160 @@
+/*
+ *  door_daemon
+ *
+ *  Copyright (C) 2009 Christian Pointner <equinox@spreadspace.org>
+ *
+ *  This file is part of door_daemon.
+ *
+ *  door_daemon is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  door_daemon is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with door_daemon. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "datatypes.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shm_state.h"
+#include "door_state.h"
+#include "stats.h"
+#include "clock.h"
+
+    // the strings are copied as a whole
+typedef char shm_state_sizes_match[(SHM_STATE_ACTOR_MAX == DOOR_STATE_ACTOR_MAX && SHM_STATE_LINE_MAX == DOOR_STATE_LINE_MAX) ? 1 : -1];
+
+static int shm_state_map(shm_map_t* map, const char* path, int writeable)
+{
+  map->shm_ = NULL;
+  map->fd_ = open(path, writeable ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+  if(map->fd_ < 0)
+    return -1;
+
+  struct stat st;
+  if(fstat(map->fd_, &st))
+    goto error;
+  if(!writeable && st.st_size < sizeof(shm_state_t)) {
+    errno = EINVAL;
+    goto error;
+  }
+  if(writeable && st.st_size != sizeof(shm_state_t) && ftruncate(map->fd_, sizeof(shm_state_t)))
+    goto error;
+
+  void* mem = mmap(NULL, sizeof(shm_state_t), writeable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, map->fd_, 0);
+  if(mem == MAP_FAILED)
+    goto error;
+  map->shm_ = mem;
+  return 0;
+
+error:
+  close(map->fd_);
+  map->fd_ = -1;
+  return -1;
+}
+
+int shm_state_open(shm_map_t* map, const char* path)
+{
+  if(!map || !path)
+    return -1;
+
+  if(shm_state_map(map, path, 1))
+    return -1;
+
+      // readers which already have the file mapped keep seeing a valid
+      // header, only the seqlock protected part changes
+  shm_state_t* shm = map->shm_;
+  shm->seq_ |= 1;
+  memcpy(shm->magic_, SHM_STATE_MAGIC, sizeof(shm->magic_));
+  shm->version_ = SHM_STATE_VERSION;
+  shm->size_ = sizeof(shm_state_t);
+  shm->pid_ = getpid();
+  shm->seq_++;
+  return 0;
+}
+
+int shm_state_open_read(shm_map_t* map, const char* path)
+{
+  if(!map || !path)
+    return -1;
+
+  if(shm_state_map(map, path, 0))
+    return -1;
+
+  shm_state_t* shm = map->shm_;
+  if(memcmp(shm->magic_, SHM_STATE_MAGIC, sizeof(shm->magic_)) || shm->version_ != SHM_STATE_VERSION) {
+    shm_state_close(map);
+    errno = EINVAL;
+    return -1;
+  }
+  return 0;
+}
+
+void shm_state_close(shm_map_t* map)
+{
+  if(!map || !map->shm_)
+    return;
+
+  munmap(map->shm_, sizeof(shm_state_t));
+  close(map->fd_);
+  map->shm_ = NULL;
+  map->fd_ = -1;
+}
+
+    // only rewritten if something changed, readers retry while a write is in progress
+void shm_state_publish(shm_map_t* map, const door_state_t* state, const stats_door_t* counters, u_int64_t event_seq)
+{
+  if(!map || !map->shm_ || !state || !counters)
+    return;
+
+  shm_state_t* shm = map->shm_;
+  shm_state_t next;
+  memcpy(&next, shm, sizeof(next));
+  next.event_seq_ = event_seq;
+  next.lock_ = state->lock_;
+  next.motion_ = state->motion_;
+  next.ajar_ = state->ajar_;
+  next.error_ = state->error_;
+  next.changed_ = state->changed_;
+  next.unverified_ = state->unverified_;
+  next.cmds_completed_ = counters->cmds_completed_;
+  next.cmds_expired_ = counters->cmds_expired_;
+  next.queue_depth_ = counters->queue_depth_;
+  next.clients_ = counters->clients_;
+  next.listeners_ = counters->listeners_;
+  next.door_reopens_ = counters->door_reopens_;
+  next.firmware_errors_ = counters->firmware_errors_;
+  next.door_bytes_in_ = counters->door_bytes_in_;
+  next.door_bytes_out_ = counters->door_bytes_out_;
+  memcpy(next.actor_, state->actor_, sizeof(next.actor_));
+  memcpy(next.line_, state->line_, sizeof(next.line_));
+
+  size_t from = offsetof(shm_state_t, event_seq_);
+  if(!memcmp((const char*)&next + from, (const char*)shm + from, sizeof(shm_state_t) - from))
+    return;
+  next.updated_ = clock_time();
+
+  u_int32_t seq = shm->seq_ + 1;
+  __atomic_store_n(&shm->seq_, seq, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  from = offsetof(shm_state_t, updated_);
+  memcpy((char*)shm + from, (const char*)&next + from, sizeof(shm_state_t) - from);
+
+  __atomic_store_n(&shm->seq_, seq + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,102 @@
+/*
+ *  door_daemon
+ *
+ *  Copyright (C) 2009 Christian Pointner <equinox@spreadspace.org>
+ *
+ *  This file is part of door_daemon.
+ *
+ *  door_daemon is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  door_daemon is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with door_daemon. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DOOR_DAEMON_shm_state_h_INCLUDED
+#define DOOR_DAEMON_shm_state_h_INCLUDED
+
+#include <string.h>
+
+#include "datatypes.h"
+#include "door_state.h"
+#include "stats.h"
+
+// Published state: the daemon keeps a copy of the door state and its
+// counters in a small memory mapped file (e.g. /run/door_daemon/state)
+// so that local processes can read it without talking to the daemon.
+// The file is rewritten under a seqlock: seq_ is odd while the daemon is
+// writing, readers copy the whole struct and retry if seq_ was odd or
+// has changed in between. Use shm_state_read() for that, it needs no
+// system calls once the file is mapped. The daemon only writes when the
+// state or the counters of the door changed, updated_ is the time of the
+// last change. With several doors every door has its own file and
+// counters.
+
+#define SHM_STATE_MAGIC "DOORSHM1"
+#define SHM_STATE_VERSION 1
+#define SHM_STATE_ACTOR_MAX 48
+#define SHM_STATE_LINE_MAX 160
+
+struct shm_state_struct {
+  char magic_[8];
+  u_int32_t version_;
+  u_int32_t size_;            // sizeof(shm_state_t) of the writer
+  u_int32_t seq_;             // seqlock, odd while an update is in progress
+  u_int32_t pid_;
+  u_int64_t updated_;         // unix time of the last update
+  u_int64_t event_seq_;       // sequence number of the last event of this door
+  int32_t lock_;              // door_lock_t, door_motion_t and door_ajar_t values
+  int32_t motion_;
+  int32_t ajar_;
+  int32_t error_;
+  int64_t changed_;
+  u_int32_t cmds_completed_;
+  u_int32_t cmds_expired_;
+  u_int32_t queue_depth_;
+  u_int32_t clients_;
+  u_int32_t listeners_;
+  u_int32_t door_reopens_;
+  u_int32_t firmware_errors_;
+  u_int32_t unverified_;       // restored at startup and not yet confirmed by the firmware
+  u_int64_t door_bytes_in_;
+  u_int64_t door_bytes_out_;
+  char actor_[SHM_STATE_ACTOR_MAX];
+  char line_[SHM_STATE_LINE_MAX];   // the same text as answered to 'state'
+};
+typedef struct shm_state_struct shm_state_t;
+
+struct shm_map_struct {
+  int fd_;
+  shm_state_t* shm_;
+};
+typedef struct shm_map_struct shm_map_t;
+
+int shm_state_open(shm_map_t* map, const char* path);
+int shm_state_open_read(shm_map_t* map, const char* path);
+void shm_state_close(shm_map_t* map);
+void shm_state_publish(shm_map_t* map, const door_state_t* state, const stats_door_t* counters, u_int64_t event_seq);
+
+    // takes a consistent snapshot, returns -1 if the writer kept changing
+    // the state for all of the given tries
+static inline int shm_state_read(const shm_state_t* shm, shm_state_t* snap, int tries)
+{
+  while(tries-- > 0) {
+    u_int32_t seq = __atomic_load_n(&shm->seq_, __ATOMIC_ACQUIRE);
+    if(seq & 1)
+      continue;
+    memcpy(snap, (const void*)shm, sizeof(*snap));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if(__atomic_load_n(&shm->seq_, __ATOMIC_RELAXED) == seq)
+      return 0;
+  }
+  return -1;
+}
+
+#endif
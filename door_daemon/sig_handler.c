@@ -37,6 +37,7 @@
 
 #include "log.h"
 #include <signal.h>
+#include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/select.h>
@@ -133,8 +134,8 @@ int signal_handle()
       case SIGQUIT: log_printf(NOTICE, "SIG-Quit caught, exitting"); return_value = 1; break;
       case SIGTERM: log_printf(NOTICE, "SIG-Term caught, exitting"); return_value = 1; break;
       case SIGHUP: log_printf(NOTICE, "SIG-Hup caught"); break;
-      case SIGUSR1: log_printf(NOTICE, "SIG-Usr1 caught"); break;
-      case SIGUSR2: log_printf(NOTICE, "SIG-Usr2 caught"); break;
+      case SIGUSR1: log_set_prio("all", DEBUG); log_printf(NOTICE, "SIG-Usr1 caught, debug logging enabled on all targets"); break;
+      case SIGUSR2: log_reset_prio(); log_printf(NOTICE, "SIG-Usr2 caught, log levels reset to configured values"); break;
       default: log_printf(WARNING, "unknown signal %d caught, ignoring", sig); break;
       }
       sigdelset(&set, sig);
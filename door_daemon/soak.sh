@@ -0,0 +1,55 @@
+#!/bin/sh
+##
+##  door_daemon
+##
+##  Copyright (C) 2009 Christian Pointner <equinox@spreadspace.org>
+##
+##  This file is part of door_daemon.
+##
+##  door_daemon is free software: you can redistribute it and/or modify
+##  it under the terms of the GNU General Public License as published by
+##  the Free Software Foundation, either version 3 of the License, or
+##  any later version.
+##
+##  door_daemon is distributed in the hope that it will be useful,
+##  but WITHOUT ANY WARRANTY; without even the implied warranty of
+##  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+##  GNU General Public License for more details.
+##
+##  You should have received a copy of the GNU General Public License
+##  along with door_daemon. If not, see <http://www.gnu.org/licenses/>.
+##
+
+## soak test: runs door_daemon against a faulty door_sim and door_bench in
+## soak mode, fails (exit code 3) if rss, fds, queue depth or latency drift
+## usage: ./soak.sh [<results file>] [<door_bench options>], e.g. -n 2000000 -t 3600
+## results are appended as one JSON line per run, labeled with the git revision,
+## the serial faults can be changed through SIM_OPTS (see ./door_sim -h)
+
+RESULTS=${1:-soak-results.jsonl}
+[ $# -gt 0 ] && shift
+
+DIR=`mktemp -d /tmp/door_soak.XXXXXX` || exit 1
+SIM_OPTS=${SIM_OPTS:--n 1 -g 1 -x 1 -e 1 -y 60}
+LABEL=`git describe --always --dirty 2>/dev/null || echo unknown`
+
+./door_sim -l $DIR/door -m 200 -w 50 $SIM_OPTS > $DIR/sim.log 2>&1 &
+SIM_PID=$!
+sleep 0.5
+./door_daemon -D -d $DIR/door -s $DIR/cmd.sock -L stderr:3 > $DIR/daemon.log 2>&1 &
+DAEMON_PID=$!
+sleep 0.5
+
+./door_bench -s $DIR/cmd.sock -p $DAEMON_PID -o "$RESULTS" -L "$LABEL" -t 600 -I 10 \
+             -X 1 -Y 5 -W 2 "$@"
+RET=$?
+
+kill $DAEMON_PID $SIM_PID 2>/dev/null
+wait 2>/dev/null
+if [ $RET -eq 0 ]; then
+  rm -rf $DIR
+else
+  echo "soak failed, logs are in $DIR"
+fi
+tail -n 1 "$RESULTS"
+exit $RET
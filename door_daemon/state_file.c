@@ -0,0 +1,229 @@
+/*
+ *  door_daemon
+ *
+ *  Copyright (C) 2009 Christian Pointner <equinox@spreadspace.org>
+ *
+ *  This file is part of door_daemon.
+ *
+ *  door_daemon is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  door_daemon is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with door_daemon. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "datatypes.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "clock.h"
+#include "history.h"
+#include "schedule.h"
+#include "state_file.h"
+
+static u_int64_t state_file_seq;          // what the file on disk knows about
+static u_int64_t state_file_limit;        // the last sequence number a restart won't hand out again
+static u_int32_t state_file_changes;
+static struct timeval state_file_next;
+static const char* state_file_path;
+static door_t* state_file_doors;
+
+static u_int32_t state_file_sum(const char* buf, size_t len)
+{
+  u_int32_t h = 2166136261u;
+  size_t i;
+  for(i = 0; i < len; ++i)
+    h = (h ^ (u_int8_t)buf[i]) * 16777619u;
+  return h;
+}
+
+static void state_file_restore_door(door_t* doors, const char* line)
+{
+  u_int32_t index;
+  int lock, motion, ajar, error, actor_pos = 0;
+  long changed;
+  if(sscanf(line, "door %u %d %d %d %d %ld %n", &index, &lock, &motion, &ajar, &error, &changed, &actor_pos) < 6 || !actor_pos) {
+    log_printf(WARNING, "ignoring invalid door in state file: %s", line);
+    return;
+  }
+  door_t* door;
+  for(door = doors; door; door = door->next_)
+    if(door->index_ == index)
+      break;
+  if(!door) {
+    log_printf(WARNING, "state file knows door %u which is not configured", index);
+    return;
+  }
+  door_state_restore(&door->state_, lock, motion, ajar, error, changed, &line[actor_pos]);
+  log_printf(NOTICE, "restored state of door '%s': %s", door->name_, door->state_.line_);
+}
+
+int state_file_load(const char* path, door_t* doors)
+{
+  if(!path)
+    return 0;
+  state_file_path = path;
+  state_file_doors = doors;
+
+  FILE* in = fopen(path, "r");
+  if(!in) {
+    if(errno == ENOENT)
+      return 0;
+    log_printf(WARNING, "unable to open state file '%s': %s", path, strerror(errno));
+    return -1;
+  }
+  char buf[STATE_FILE_MAX + 1];
+  size_t len = fread(buf, 1, STATE_FILE_MAX, in);
+  fclose(in);
+  buf[len] = 0;
+
+  char* sum_line = NULL;
+  char* p;
+  for(p = buf; (p = strstr(p, "\nsum ")); p++)
+    sum_line = p + 1;
+  if(len >= STATE_FILE_MAX || strncmp(buf, STATE_FILE_MAGIC "\n", sizeof(STATE_FILE_MAGIC)) || !sum_line ||
+     strtoul(&sum_line[4], NULL, 16) != state_file_sum(buf, sum_line - buf)) {
+    log_printf(WARNING, "ignoring damaged state file '%s'", path);
+    return -1;
+  }
+  *sum_line = 0;
+
+  char* schedule_start = NULL;
+  char* line = strchr(buf, '\n') + 1;
+  u_int64_t seq = 0;
+  int clean = 0;
+  while(line < sum_line && !schedule_start) {
+    char* eol = strchr(line, '\n');
+    *eol = 0;
+    if(!strncmp(line, "seq ", 4))
+      seq = strtoull(&line[4], NULL, 10);
+    else if(!strcmp(line, "clean"))
+      clean = 1;
+    else if(!strncmp(line, "door ", 5))
+      state_file_restore_door(doors, line);
+    else if(!strcmp(line, "schedule"))
+      schedule_start = eol + 1;
+    line = eol + 1;
+  }
+
+  if(!clean) {
+    log_printf(WARNING, "state file '%s' was not written on shutdown, skipping %d event sequence numbers", path, STATE_FILE_SEQ_GAP);
+    seq += STATE_FILE_SEQ_GAP;
+  }
+  history_restore(seq);
+
+  if(schedule_start && !schedule.path_) {
+    FILE* entries = fmemopen(schedule_start, sum_line - schedule_start, "r");
+    if(entries) {
+      int ret = schedule_read(entries);
+      fclose(entries);
+      if(ret > 0)
+        log_printf(NOTICE, "restored %d scheduled commands from the state file", ret);
+    }
+  }
+
+      // until the first event rewrites it the file still says 'clean' or has the old sequence number
+  state_file_seq = history.seq_;
+  state_file_limit = history.seq_;
+  state_file_changes = schedule.changes_;
+  return 0;
+}
+
+static int state_file_write(const char* path, door_t* doors, int clean)
+{
+  char* buf = NULL;
+  size_t len = 0;
+  FILE* out = open_memstream(&buf, &len);
+  if(!out)
+    return -1;
+  fprintf(out, STATE_FILE_MAGIC "\n");
+  fprintf(out, "seq %llu\n", (unsigned long long)history.seq_);
+  if(clean)
+    fprintf(out, "clean\n");
+  door_t* door;
+  for(door = doors; door; door = door->next_) {
+    door_state_t* state = &door->state_;
+    fprintf(out, "door %u %d %d %d %d %ld %s\n", door->index_, state->lock_, state->motion_, state->ajar_,
+            state->error_, (long)state->changed_, state->actor_);
+  }
+  fprintf(out, "schedule\n");
+  int ret = schedule_write(out);
+  if(fclose(out) || ret) {
+    free(buf);
+    return -1;
+  }
+
+  char tmp_path[1024];
+  if(snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= sizeof(tmp_path)) {
+    free(buf);
+    return -1;
+  }
+  out = fopen(tmp_path, "w");
+  if(!out) {
+    log_printf(WARNING, "unable to open state file '%s': %s", tmp_path, strerror(errno));
+    free(buf);
+    return -1;
+  }
+  fwrite(buf, 1, len, out);
+  fprintf(out, "sum %08x\n", state_file_sum(buf, len));
+  free(buf);
+  if(ferror(out) | fclose(out)) {
+    log_printf(WARNING, "unable to write state file '%s'", tmp_path);
+    unlink(tmp_path);
+    return -1;
+  }
+  if(rename(tmp_path, path)) {
+    log_printf(WARNING, "unable to rename state file to '%s': %s", path, strerror(errno));
+    unlink(tmp_path);
+    return -1;
+  }
+
+  state_file_seq = history.seq_;
+  state_file_limit = clean ? history.seq_ : history.seq_ + STATE_FILE_SEQ_GAP;
+  state_file_changes = schedule.changes_;
+  return 0;
+}
+
+    // on shutdown, no more events will follow
+int state_file_save(const char* path, door_t* doors)
+{
+  if(!path)
+    return 0;
+  return state_file_write(path, doors, 1);
+}
+
+    // every state change is an event, so a new sequence number covers those as well
+int state_file_flush(const char* path, door_t* doors)
+{
+  if(!path || (state_file_seq == history.seq_ && state_file_changes == schedule.changes_))
+    return 0;
+
+  struct timeval now;
+  clock_now(&now);
+  if(timercmp(&now, &state_file_next, <))
+    return 0;
+  state_file_next = now;
+  state_file_next.tv_sec += STATE_FILE_FLUSH_S;
+  return state_file_write(path, doors, 0);
+}
+
+    // before the event with this sequence number goes out, a restart after a crash must not reuse it
+int state_file_reserve(u_int64_t seq)
+{
+  if(!state_file_path || seq <= state_file_limit)
+    return 0;
+  return state_file_write(state_file_path, state_file_doors, 0);
+}
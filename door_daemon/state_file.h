@@ -0,0 +1,65 @@
+/*
+ *  door_daemon
+ *
+ *  Copyright (C) 2009 Christian Pointner <equinox@spreadspace.org>
+ *
+ *  This file is part of door_daemon.
+ *
+ *  door_daemon is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  door_daemon is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with door_daemon. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DOOR_DAEMON_state_file_h_INCLUDED
+#define DOOR_DAEMON_state_file_h_INCLUDED
+
+#include "datatypes.h"
+#include "door.h"
+
+// Warm start: the last known state of every door, the event sequence
+// number and the schedule are kept in a small text file (-T). It is
+// rewritten through a temporary file and rename() when something changed,
+// at most every STATE_FILE_FLUSH_S seconds and once more on shutdown. The
+// last line is an FNV-1a checksum over the rest of the file, a file which
+// doesn't match is ignored as a whole. At startup the door states are
+// restored and served right away marked as unverified, the daemon asks
+// the firmware for its status as soon as the door is open. The schedule
+// is only taken from here if there is no schedule file (-t).
+//
+// Only the file written on shutdown knows the last sequence number for
+// sure, it says so with the 'clean' line. Otherwise the daemon never hands
+// out a number more than STATE_FILE_SEQ_GAP past the one in the file:
+// state_file_reserve() rewrites the file before it would, no matter how
+// many events came since the last flush. So after a crash the sequence
+// continues STATE_FILE_SEQ_GAP numbers further on and the history reports
+// everything in between as lost instead of handing out numbers a second
+// time. A clean file is rewritten before the first event of the next run.
+//
+//   DOORSTATE1
+//   seq <last event sequence number>
+//   clean                  (only on shutdown)
+//   door <index> <lock> <motion> <ajar> <error> <changed> <actor>
+//   schedule
+//   <entries as in the schedule file>
+//   sum <checksum>
+
+#define STATE_FILE_MAGIC "DOORSTATE1"
+#define STATE_FILE_MAX 16384
+#define STATE_FILE_FLUSH_S 1
+#define STATE_FILE_SEQ_GAP 256
+
+int state_file_load(const char* path, door_t* doors);
+int state_file_save(const char* path, door_t* doors);
+int state_file_flush(const char* path, door_t* doors);
+int state_file_reserve(u_int64_t seq);
+
+#endif
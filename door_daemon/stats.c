@@ -0,0 +1,328 @@
+/*
+ *  door_daemon
+ *
+ *  Copyright (C) 2009 Christian Pointner <equinox@spreadspace.org>
+ *
+ *  This file is part of door_daemon.
+ *
+ *  door_daemon is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  door_daemon is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with door_daemon. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "datatypes.h"
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "stats.h"
+#include "clock.h"
+#include "history.h"
+
+stats_t stats;
+
+static u_int32_t stats_hist_index(u_int32_t value)
+{
+  if(value < (1 << STATS_HIST_SUB_BITS))
+    return value;
+
+  u_int32_t msb = 31 - __builtin_clz(value);
+  u_int32_t sub = (value >> (msb - STATS_HIST_SUB_BITS)) & ((1 << STATS_HIST_SUB_BITS) - 1);
+  return ((msb - STATS_HIST_SUB_BITS + 1) << STATS_HIST_SUB_BITS) + sub;
+}
+
+static u_int32_t stats_hist_upper_bound(u_int32_t idx)
+{
+  if(idx < (1 << STATS_HIST_SUB_BITS))
+    return idx;
+
+  u_int32_t msb = (idx >> STATS_HIST_SUB_BITS) + STATS_HIST_SUB_BITS - 1;
+  u_int32_t sub = idx & ((1 << STATS_HIST_SUB_BITS) - 1);
+  u_int64_t low = (u_int64_t)((1 << STATS_HIST_SUB_BITS) + sub) << (msb - STATS_HIST_SUB_BITS);
+  u_int64_t width = (u_int64_t)1 << (msb - STATS_HIST_SUB_BITS);
+  u_int64_t upper = low + width - 1;
+  return upper > 0xFFFFFFFF ? 0xFFFFFFFF : (u_int32_t)upper;
+}
+
+void stats_hist_add(stats_hist_t* hist, u_int32_t value)
+{
+  if(!hist)
+    return;
+
+  hist->count_++;
+  hist->sum_ += value;
+  if(value > hist->max_)
+    hist->max_ = value;
+  hist->buckets_[stats_hist_index(value)]++;
+}
+
+u_int32_t stats_hist_quantile(stats_hist_t* hist, double q)
+{
+  if(!hist || !hist->count_)
+    return 0;
+
+  u_int64_t rank = (u_int64_t)(q * hist->count_ + 0.5);
+  if(rank < 1)
+    rank = 1;
+
+  u_int64_t seen = 0;
+  u_int32_t i;
+  for(i = 0; i < STATS_HIST_BUCKETS; ++i) {
+    seen += hist->buckets_[i];
+    if(seen >= rank) {
+      u_int32_t upper = stats_hist_upper_bound(i);
+      return upper < hist->max_ ? upper : hist->max_;
+    }
+  }
+  return hist->max_;
+}
+
+void stats_init()
+{
+  memset(&stats, 0, sizeof(stats));
+  clock_now(&stats.started_);
+}
+
+void stats_add_door(stats_door_t* door, const char* name)
+{
+  if(!door)
+    return;
+
+  memset(door, 0, sizeof(*door));
+  door->name_ = name;
+  stats_door_t** last = &stats.doors_;
+  while(*last)
+    last = &(*last)->next_;
+  *last = door;
+}
+
+void stats_remove_door(stats_door_t* door)
+{
+  stats_door_t** tmp;
+  for(tmp = &stats.doors_; *tmp; tmp = &(*tmp)->next_) {
+    if(*tmp == door) {
+      *tmp = door->next_;
+      door->next_ = NULL;
+      return;
+    }
+  }
+}
+
+void stats_cmd_pushed(stats_door_t* door, cmd_id_t cmd)
+{
+  if(cmd < STATS_CMD_MAX)
+    stats.cmds_[cmd]++;
+
+  if(door)
+    door->queue_depth_++;
+  stats.queue_depth_++;
+  if(stats.queue_depth_ > stats.queue_depth_max_)
+    stats.queue_depth_max_ = stats.queue_depth_;
+}
+
+static u_int32_t stats_usec_between(struct timeval* from, struct timeval* to)
+{
+  struct timeval diff;
+  timersub(to, from, &diff);
+  if(diff.tv_sec < 0)
+    return 0;
+  if(diff.tv_sec >= 4000)
+    return 0xFFFFFFFF;
+  return diff.tv_sec * 1000000 + diff.tv_usec;
+}
+
+void stats_cmd_finished(stats_door_t* door, cmd_t* cmd, int expired)
+{
+  if(stats.queue_depth_)
+    stats.queue_depth_--;
+  if(door && door->queue_depth_)
+    door->queue_depth_--;
+
+  if(!cmd)
+    return;
+
+  if(expired) {
+    if(door)
+      door->cmds_expired_++;
+    return;
+  }
+  if(door)
+    door->cmds_completed_++;
+
+  struct timeval now;
+  clock_now(&now);
+  if(cmd->sent) {
+    stats_hist_add(&stats.latency_[STAGE_QUEUE], stats_usec_between(&cmd->tv_push, &cmd->tv_start));
+    stats_hist_add(&stats.latency_[STAGE_FIRMWARE], stats_usec_between(&cmd->tv_start, &now));
+  }
+  stats_hist_add(&stats.latency_[STAGE_TOTAL], stats_usec_between(&cmd->tv_push, &now));
+}
+
+void stats_cmd_cleared(stats_door_t* door, cmd_t* cmd_q)
+{
+  for(; cmd_q; cmd_q = cmd_q->next) {
+    if(stats.queue_depth_)
+      stats.queue_depth_--;
+    if(door && door->queue_depth_)
+      door->queue_depth_--;
+  }
+}
+
+static const char* stats_cmd_to_string(cmd_id_t cmd)
+{
+  switch(cmd) {
+  case OPEN: return "open";
+  case CLOSE: return "close";
+  case TOGGLE: return "toggle";
+  case RESET: return "reset";
+  case STATUS: return "status";
+  default: return "unknown";
+  }
+}
+
+static const char* stats_stage_to_string(stats_stage_t stage)
+{
+  switch(stage) {
+  case STAGE_QUEUE: return "queue";
+  case STAGE_FIRMWARE: return "firmware";
+  case STAGE_TOTAL: return "total";
+  default: return "unknown";
+  }
+}
+
+static void stats_header(FILE* out, const char* name, const char* type, const char* help)
+{
+  fprintf(out, "# HELP %s %s\n", name, help);
+  fprintf(out, "# TYPE %s %s\n", name, type);
+}
+
+static void stats_counter(FILE* out, const char* name, const char* help, u_int64_t value)
+{
+  stats_header(out, name, "counter", help);
+  fprintf(out, "%s %llu\n", name, (unsigned long long)value);
+}
+
+static void stats_gauge(FILE* out, const char* name, const char* help, u_int64_t value)
+{
+  stats_header(out, name, "gauge", help);
+  fprintf(out, "%s %llu\n", name, (unsigned long long)value);
+}
+
+    // one family, one line per door
+static void stats_per_door(FILE* out, const char* name, const char* type, const char* help, size_t offset, int wide)
+{
+  stats_header(out, name, type, help);
+  stats_door_t* door;
+  for(door = stats.doors_; door; door = door->next_) {
+    const char* field = (const char*)door + offset;
+    unsigned long long value = wide ? *(const u_int64_t*)field : *(const u_int32_t*)field;
+    fprintf(out, "%s{door=\"%s\"} %llu\n", name, door->name_, value);
+  }
+}
+
+#define STATS_PER_DOOR(out, name, type, help, field) \
+  stats_per_door(out, name, type, help, offsetof(stats_door_t, field), sizeof(((stats_door_t*)0)->field) == 8)
+
+int stats_write(FILE* out)
+{
+  if(!out)
+    return -1;
+
+  struct timeval now, uptime;
+  clock_now(&now);
+  timersub(&now, &stats.started_, &uptime);
+  stats_gauge(out, "door_daemon_uptime_seconds", "Seconds since the daemon started.", uptime.tv_sec);
+
+  int i;
+  stats_header(out, "door_daemon_commands_total", "counter", "Door commands accepted from clients, by command.");
+  for(i = 0; i < STATS_CMD_MAX; ++i)
+    fprintf(out, "door_daemon_commands_total{cmd=\"%s\"} %u\n", stats_cmd_to_string(i), stats.cmds_[i]);
+  STATS_PER_DOOR(out, "door_daemon_commands_completed_total", "counter", "Door commands the firmware answered.", cmds_completed_);
+  STATS_PER_DOOR(out, "door_daemon_commands_expired_total", "counter", "Door commands without an answer in time.", cmds_expired_);
+  stats_counter(out, "door_daemon_commands_delayed_total", "Door commands which had to wait for another command.", stats.cmds_delayed_);
+  stats_header(out, "door_daemon_commands_rejected_total", "counter", "Door commands refused before queueing, by reason.");
+  fprintf(out, "door_daemon_commands_rejected_total{reason=\"ratelimit\"} %u\n", stats.cmds_ratelimited_);
+  fprintf(out, "door_daemon_commands_rejected_total{reason=\"queue_full\"} %u\n", stats.cmds_rejected_);
+  stats_counter(out, "door_daemon_commands_cancelled_total", "Waiting opens cancelled by a close.", stats.cmds_cancelled_);
+  stats_counter(out, "door_daemon_commands_answered_locally_total", "Door commands refused without asking the firmware.", stats.cmds_local_);
+  stats_counter(out, "door_daemon_commands_retried_total", "Door commands sent again after an expiry or refusal.", stats.cmds_retried_);
+  stats_counter(out, "door_daemon_commands_retry_failed_total", "Retried door commands which failed in the end.", stats.cmds_retry_failed_);
+  STATS_PER_DOOR(out, "door_daemon_queue_depth", "gauge", "Door commands waiting or in flight.", queue_depth_);
+  stats_gauge(out, "door_daemon_queue_depth_max", "Highest queue depth of all doors together seen.", stats.queue_depth_max_);
+  stats_gauge(out, "door_daemon_clients", "Connected clients.", stats.clients_);
+  stats_gauge(out, "door_daemon_listeners", "Connected clients listening for events.", stats.listeners_);
+  STATS_PER_DOOR(out, "door_daemon_door_bytes_in_total", "counter", "Bytes read from the door.", door_bytes_in_);
+  STATS_PER_DOOR(out, "door_daemon_door_bytes_out_total", "counter", "Bytes written to the door.", door_bytes_out_);
+  stats_counter(out, "door_daemon_client_bytes_in_total", "Bytes read from clients.", stats.client_bytes_in_);
+  stats_counter(out, "door_daemon_client_bytes_out_total", "Bytes written to clients.", stats.client_bytes_out_);
+  STATS_PER_DOOR(out, "door_daemon_door_reopens_total", "counter", "Times the door device was opened again after a failure.", door_reopens_);
+  STATS_PER_DOOR(out, "door_daemon_firmware_errors_total", "counter", "Error lines sent by the firmware.", firmware_errors_);
+  stats_counter(out, "door_daemon_tap_overruns_total", "Raw listeners which fell behind the tap.", stats.tap_overruns_);
+  stats_counter(out, "door_daemon_events_total", "Events sent to the listeners.", history.seq_);
+
+  u_int32_t repeated, ratelimited;
+  log_get_suppressed(&repeated, &ratelimited);
+  stats_header(out, "door_daemon_log_suppressed_total", "counter", "Log messages not written, by reason.");
+  fprintf(out, "door_daemon_log_suppressed_total{reason=\"repeated\"} %u\n", repeated);
+  fprintf(out, "door_daemon_log_suppressed_total{reason=\"ratelimited\"} %u\n", ratelimited);
+
+  static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+  stats_header(out, "door_daemon_latency_seconds", "summary", "Door command latency, by stage.");
+  for(i = 0; i < STAGE_MAX; ++i) {
+    stats_hist_t* hist = &stats.latency_[i];
+    const char* stage = stats_stage_to_string(i);
+    size_t j;
+    for(j = 0; j < sizeof(quantiles)/sizeof(quantiles[0]); ++j)
+      fprintf(out, "door_daemon_latency_seconds{stage=\"%s\",quantile=\"%g\"} %.6f\n", stage, quantiles[j], stats_hist_quantile(hist, quantiles[j]) / 1e6);
+    fprintf(out, "door_daemon_latency_seconds_sum{stage=\"%s\"} %.6f\n", stage, hist->sum_ / 1e6);
+    fprintf(out, "door_daemon_latency_seconds_count{stage=\"%s\"} %u\n", stage, hist->count_);
+  }
+  stats_header(out, "door_daemon_latency_seconds_max", "gauge", "Highest door command latency seen, by stage.");
+  for(i = 0; i < STAGE_MAX; ++i)
+    fprintf(out, "door_daemon_latency_seconds_max{stage=\"%s\"} %.6f\n", stats_stage_to_string(i), stats.latency_[i].max_ / 1e6);
+
+  return ferror(out) ? -1 : 0;
+}
+
+int stats_write_file(const char* path)
+{
+  if(!path)
+    return -1;
+
+  char tmp_path[1024];
+  if(snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= sizeof(tmp_path))
+    return -1;
+
+  FILE* out = fopen(tmp_path, "w");
+  if(!out) {
+    log_printf(WARNING, "unable to open stats file '%s': %s", tmp_path, strerror(errno));
+    return -1;
+  }
+  int ret = stats_write(out);
+  if(fclose(out) || ret) {
+    log_printf(WARNING, "unable to write stats file '%s'", tmp_path);
+    unlink(tmp_path);
+    return -1;
+  }
+  if(rename(tmp_path, path)) {
+    log_printf(WARNING, "unable to rename stats file to '%s': %s", path, strerror(errno));
+    unlink(tmp_path);
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,104 @@
+/*
+ *  door_daemon
+ *
+ *  Copyright (C) 2009 Christian Pointner <equinox@spreadspace.org>
+ *
+ *  This file is part of door_daemon.
+ *
+ *  door_daemon is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  door_daemon is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with door_daemon. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef DOOR_DAEMON_stats_h_INCLUDED
+#define DOOR_DAEMON_stats_h_INCLUDED
+
+#include <stdio.h>
+#include <sys/time.h>
+
+#include "datatypes.h"
+#include "command_queue.h"
+
+// log-linear histogram: every power of two is split into 2^STATS_HIST_SUB_BITS
+// buckets which keeps the relative error below 25% over the whole range
+#define STATS_HIST_SUB_BITS 2
+#define STATS_HIST_BUCKETS (32 << STATS_HIST_SUB_BITS)
+
+struct stats_hist_struct {
+  u_int32_t count_;
+  u_int64_t sum_;
+  u_int32_t max_;
+  u_int32_t buckets_[STATS_HIST_BUCKETS];
+};
+typedef struct stats_hist_struct stats_hist_t;
+
+void stats_hist_add(stats_hist_t* hist, u_int32_t value);
+u_int32_t stats_hist_quantile(stats_hist_t* hist, double q);
+
+enum stats_stage_enum { STAGE_QUEUE, STAGE_FIRMWARE, STAGE_TOTAL, STAGE_MAX };
+typedef enum stats_stage_enum stats_stage_t;
+
+#define STATS_CMD_MAX (STATUS + 1)
+
+// The counters which belong to one door, every configured door registers
+// its own with stats_add_door(). They are written labeled with the door
+// name and published in the state map of that door.
+struct stats_door_struct {
+  const char* name_;
+  u_int32_t cmds_completed_;
+  u_int32_t cmds_expired_;
+  u_int32_t queue_depth_;
+  u_int32_t clients_;
+  u_int32_t listeners_;
+  u_int32_t door_reopens_;
+  u_int32_t firmware_errors_;
+  u_int64_t door_bytes_in_;
+  u_int64_t door_bytes_out_;
+  struct stats_door_struct* next_;
+};
+typedef struct stats_door_struct stats_door_t;
+
+struct stats_struct {
+  u_int32_t cmds_[STATS_CMD_MAX];
+  u_int32_t cmds_delayed_;
+  u_int32_t cmds_ratelimited_;
+  u_int32_t cmds_rejected_;          // client queue full
+  u_int32_t cmds_cancelled_;
+  u_int32_t cmds_local_;             // refused without asking the firmware
+  u_int32_t cmds_retried_;
+  u_int32_t cmds_retry_failed_;      // still failed after being retried
+  u_int32_t queue_depth_;            // of all doors
+  u_int32_t queue_depth_max_;
+  u_int32_t clients_;
+  u_int32_t listeners_;
+  u_int64_t client_bytes_in_;
+  u_int64_t client_bytes_out_;
+  u_int32_t tap_overruns_;
+  stats_door_t* doors_;
+  stats_hist_t latency_[STAGE_MAX];
+  struct timeval started_;
+};
+typedef struct stats_struct stats_t;
+
+extern stats_t stats;
+
+void stats_init();
+void stats_add_door(stats_door_t* door, const char* name);
+void stats_remove_door(stats_door_t* door);
+void stats_cmd_pushed(stats_door_t* door, cmd_id_t cmd);
+void stats_cmd_finished(stats_door_t* door, cmd_t* cmd, int expired);
+void stats_cmd_cleared(stats_door_t* door, cmd_t* cmd_q);
+int stats_write(FILE* out);
+int stats_write_file(const char* path);
+
+#endif
@@ -0,0 +1,121 @@
+/*
+ *  door_daemon
+ *
+ *  Copyright (C) 2009 Christian Pointner <equinox@spreadspace.org>
+ *
+ *  This file is part of door_daemon.
+ *
+ *  door_daemon is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  door_daemon is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with door_daemon. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "datatypes.h"
+
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "tap.h"
+
+#define TAP_MASK (TAP_SIZE - 1)
+
+tap_t tap;
+
+void tap_init()
+{
+  tap.head_ = 0;
+  tap.open_ = 0;
+  tap.subscribers_ = 0;
+}
+
+void tap_write(tap_dir_t dir, const u_int8_t* buf, u_int32_t len)
+{
+  if(!tap.subscribers_ || !buf)
+    return;
+
+  while(len) {
+    if(tap.open_ != tap.head_ && tap.buf_[tap.head_ & TAP_MASK] != dir)
+      tap_flush();
+    if(tap.open_ == tap.head_) {
+      tap.buf_[tap.head_ & TAP_MASK] = dir;
+      tap.buf_[(tap.head_ + 1) & TAP_MASK] = 0;
+      tap.open_ = tap.head_ + 2;
+    }
+
+    u_int32_t room = TAP_FRAME_MAX - (tap.open_ - tap.head_ - 2);
+    u_int32_t n = len < room ? len : room;
+    u_int32_t off = tap.open_ & TAP_MASK;
+    u_int32_t first = TAP_SIZE - off < n ? TAP_SIZE - off : n;
+    memcpy(&tap.buf_[off], buf, first);
+    memcpy(tap.buf_, buf + first, n - first);
+    tap.open_ += n;
+    buf += n;
+    len -= n;
+
+    if(n == room)
+      tap_flush();
+  }
+}
+
+void tap_flush()
+{
+  if(tap.open_ == tap.head_)
+    return;
+
+  tap.buf_[(tap.head_ + 1) & TAP_MASK] = tap.open_ - tap.head_ - 2;
+  tap.head_ = tap.open_;
+}
+
+int tap_overrun(u_int64_t pos)
+{
+      // the frame under construction may already have overwritten what is at pos
+  return tap.open_ - pos > TAP_SIZE;
+}
+
+    // one frame per sendmsg(): a short frame goes into a unix socket in one
+    // piece or not at all, so a text line for the same listener never ends
+    // up inside a frame
+int tap_send(int fd, u_int64_t* pos)
+{
+  if(!pos || *pos >= tap.head_)
+    return 0;
+  if(tap_overrun(*pos))
+    return -1;
+
+  int sent = 0;
+  while(*pos < tap.head_) {
+    u_int32_t off = *pos & TAP_MASK;
+    u_int32_t len = 2 + tap.buf_[(*pos + 1) & TAP_MASK];
+    u_int32_t first = TAP_SIZE - off < len ? TAP_SIZE - off : len;
+    struct iovec iov[2];
+    iov[0].iov_base = &tap.buf_[off];
+    iov[0].iov_len = first;
+    iov[1].iov_base = tap.buf_;
+    iov[1].iov_len = len - first;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = first < len ? 2 : 1;
+
+    int ret = sendmsg(fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if(ret < 0)
+      return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? sent : -2;
+    if(ret != len)
+      return -2;    // the rest of a torn frame can't be told apart from a text line
+    *pos += len;
+    sent += len;
+  }
+  return sent;
+}
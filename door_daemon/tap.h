@@ -0,0 +1,61 @@
+/*
+ *  door_daemon
+ *
+ *  Copyright (C) 2009 Christian Pointner <equinox@spreadspace.org>
+ *
+ *  This file is part of door_daemon.
+ *
+ *  door_daemon is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  door_daemon is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with door_daemon. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DOOR_DAEMON_tap_h_INCLUDED
+#define DOOR_DAEMON_tap_h_INCLUDED
+
+#include "datatypes.h"
+
+// Live raw tap: the bytes exchanged with the door are stored once in a
+// shared ring and every 'listen raw' subscriber is sent its part straight
+// out of that ring, there are no per subscriber copies or queues. The
+// stream is a sequence of frames: one direction byte ('<' from the door,
+// '>' to the door), one length byte and up to TAP_FRAME_MAX data bytes.
+// Bytes become visible to subscribers with tap_flush(), which the main
+// loop calls once per round, so bytes read one at a time share a frame.
+// A subscriber which falls more than TAP_SIZE bytes behind has lost data
+// and gets disconnected, the door path never waits for a subscriber.
+// Frames are sent whole, one at a time, so text lines to a subscriber
+// which listens for events as well only ever come between frames.
+
+#define TAP_SIZE 65536
+#define TAP_FRAME_MAX 255
+
+enum tap_dir_enum { TAP_RX = '<', TAP_TX = '>' };
+typedef enum tap_dir_enum tap_dir_t;
+
+struct tap_struct {
+  u_int8_t buf_[TAP_SIZE];
+  u_int64_t head_;          // end of the data visible to subscribers, always at a frame boundary
+  u_int64_t open_;          // end of the frame under construction, equals head_ if there is none
+  u_int32_t subscribers_;
+};
+typedef struct tap_struct tap_t;
+
+extern tap_t tap;
+
+void tap_init();
+void tap_write(tap_dir_t dir, const u_int8_t* buf, u_int32_t len);
+void tap_flush();
+int tap_overrun(u_int64_t pos);
+int tap_send(int fd, u_int64_t* pos);
+
+#endif
@@ -0,0 +1,526 @@
+/*
+ *  door_daemon
+ *
+ *  Copyright (C) 2009 Christian Pointner <equinox@spreadspace.org>
+ *
+ *  This file is part of door_daemon.
+ *
+ *  door_daemon is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  door_daemon is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with door_daemon. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "datatypes.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <netdb.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "log.h"
+#include "clock.h"
+#include "firmware_sim.h"
+#include "transport.h"
+
+static int fd_set_nonblock(int fd)
+{
+  int flags = fcntl(fd, F_GETFL);
+  if(flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+    log_printf(ERROR, "Error on fcntl(): %s", strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+static int fd_read(transport_t* t, u_int8_t* buf, u_int32_t len)
+{
+  for(;;) {
+    int ret = read(t->fd_, buf, len);
+    if(ret > 0)
+      return ret;
+    if(!ret) {
+      log_printf(ERROR, "%s:%s closed", t->ops_->name_, t->addr_);
+      t->failed_ = 1;
+      return -1;
+    }
+    if(errno == EINTR)
+      continue;
+    if(errno == EAGAIN || errno == EWOULDBLOCK)
+      return 0;
+    log_printf(ERROR, "read from door returned with error: %s", strerror(errno));
+    t->failed_ = 1;
+    return -1;
+  }
+}
+
+    // writes as much of the queue as the descriptor takes
+static int fd_write_queued(transport_t* t)
+{
+  u_int32_t offset = 0;
+  while(offset < t->out_len_) {
+    int ret = write(t->fd_, &t->out_[offset], t->out_len_ - offset);
+    if(ret > 0) {
+      offset += ret;
+      continue;
+    }
+    if(ret < 0 && errno == EINTR)
+      continue;
+    if(ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      break;
+    log_printf(ERROR, "write to door returned with error: %s", ret < 0 ? strerror(errno) : "nothing written");
+    t->failed_ = 1;
+    return -1;
+  }
+  t->out_len_ -= offset;
+  memmove(t->out_, &t->out_[offset], t->out_len_);
+  return 0;
+}
+
+    // the descriptor is non-blocking, the rest is queued for transport_flush()
+static int fd_write(transport_t* t, const u_int8_t* buf, u_int32_t len)
+{
+  if(t->out_len_ + len > sizeof(t->out_)) {
+    log_printf(ERROR, "%s:%s output buffer is full", t->ops_->name_, t->addr_);
+    t->failed_ = 1;
+    return -1;
+  }
+  memcpy(&t->out_[t->out_len_], buf, len);
+  t->out_len_ += len;
+  if(!t->connecting_ && fd_write_queued(t))
+    return -1;
+  return len;
+}
+
+static void fd_close(transport_t* t)
+{
+  close(t->fd_);
+}
+
+static int fd_health(transport_t* t, struct timeval* timeout)
+{
+  return t->failed_ ? -1 : 0;
+}
+
+static int tty_open(transport_t* t)
+{
+  t->fd_ = open(t->addr_, O_RDWR | O_NOCTTY);
+  return t->fd_ < 0 ? -1 : 0;
+}
+
+static int tty_configure(transport_t* t)
+{
+  int fd = t->fd_;
+  struct termios tmio;
+  
+  int ret = tcgetattr(fd, &tmio);
+  if(ret) {
+    log_printf(ERROR, "Error on tcgetattr(): %s", strerror(errno));
+    return ret;
+  }
+
+  ret = cfsetospeed(&tmio, B9600);
+  if(ret) {
+    log_printf(ERROR, "Error on cfsetospeed(): %s", strerror(errno));
+    return ret;
+  }
+
+  ret = cfsetispeed(&tmio, B9600);
+  if(ret) {
+    log_printf(ERROR, "Error on cfsetispeed(): %s", strerror(errno));
+    return ret;
+  }
+
+  tmio.c_lflag &= ~ECHO;
+
+  ret = tcsetattr(fd, TCSANOW, &tmio);
+  if(ret) {
+    log_printf(ERROR, "Error on tcsetattr(): %s", strerror(errno));
+    return ret;
+  }
+  
+  ret = tcflush(fd, TCIFLUSH);
+  if(ret) {
+    log_printf(ERROR, "Error on tcflush(): %s", strerror(errno));
+    return ret;
+  }
+
+  fd_set fds;
+  struct timeval tv;
+  FD_ZERO(&fds);
+  FD_SET(fd, &fds);
+  tv.tv_sec = 0;
+  tv.tv_usec = 50000;
+  for(;;) {
+    ret = select(fd+1, &fds, NULL, NULL, &tv);
+    if(ret > 0) {
+      char buffer[100];
+      ret = read(fd, buffer, sizeof(buffer));
+    }
+    else
+      break;
+  }
+
+  return fd_set_nonblock(fd);
+}
+
+    // nobody else is on the other side of a pty, no need to wait for line noise
+static int pty_configure(transport_t* t)
+{
+  struct termios tmio;
+  if(tcgetattr(t->fd_, &tmio)) {
+    log_printf(ERROR, "Error on tcgetattr(): %s", strerror(errno));
+    return -1;
+  }
+  cfmakeraw(&tmio);
+  if(tcsetattr(t->fd_, TCSANOW, &tmio) || tcflush(t->fd_, TCIFLUSH)) {
+    log_printf(ERROR, "Error on tcsetattr(): %s", strerror(errno));
+    return -1;
+  }
+  return fd_set_nonblock(t->fd_);
+}
+
+struct tcp_struct {
+  struct sockaddr_storage addr_;
+  socklen_t addr_len_;
+  struct timeval deadline_;         // of a connect() in progress
+};
+typedef struct tcp_struct tcp_t;
+
+    // the name is looked up once, a lookup blocks and wouldn't work after chroot anyway
+static int tcp_init(transport_t* t)
+{
+  char* host = strdup(t->addr_);
+  if(!host)
+    return -2;
+  char* port = strrchr(host, ':');
+  if(!port) {
+    log_printf(ERROR, "tcp:%s: missing port", t->addr_);
+    free(host);
+    return -1;
+  }
+  *(port++) = 0;
+
+  struct addrinfo hints, *res;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  int ret = getaddrinfo(host, port, &hints, &res);
+  free(host);
+  if(ret) {
+    log_printf(ERROR, "tcp:%s: %s", t->addr_, gai_strerror(ret));
+    return -1;
+  }
+  tcp_t* tcp = malloc(sizeof(tcp_t));
+  if(!tcp) {
+    freeaddrinfo(res);
+    return -2;
+  }
+  memset(tcp, 0, sizeof(*tcp));
+  memcpy(&tcp->addr_, res->ai_addr, res->ai_addrlen);
+  tcp->addr_len_ = res->ai_addrlen;
+  freeaddrinfo(res);
+  t->priv_ = tcp;
+  return 0;
+}
+
+static void tcp_clear(transport_t* t)
+{
+  free(t->priv_);
+  t->priv_ = NULL;
+}
+
+static int tcp_open(transport_t* t)
+{
+  tcp_t* tcp = (tcp_t*)t->priv_;
+  t->fd_ = socket(tcp->addr_.ss_family, SOCK_STREAM, 0);
+  if(t->fd_ < 0) {
+    log_printf(ERROR, "Error on socket(): %s", strerror(errno));
+    return -1;
+  }
+  if(fd_set_nonblock(t->fd_))
+    return -1;
+  if(!connect(t->fd_, (struct sockaddr*)&tcp->addr_, tcp->addr_len_))
+    return 0;
+  if(errno != EINPROGRESS) {
+    log_printf(ERROR, "tcp:%s: %s", t->addr_, strerror(errno));
+    return -1;
+  }
+  t->connecting_ = 1;
+  clock_now(&tcp->deadline_);
+  tcp->deadline_.tv_sec += TCP_CONNECT_TIMEOUT_S;
+  return 0;
+}
+
+static int tcp_configure(transport_t* t)
+{
+  int on = 1;
+  setsockopt(t->fd_, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  setsockopt(t->fd_, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+  return 0;
+}
+
+    // a connect() that never finishes would otherwise keep the door unavailable without a reopen
+static int tcp_health(transport_t* t, struct timeval* timeout)
+{
+  if(t->failed_)
+    return -1;
+  if(!t->connecting_)
+    return 0;
+
+  tcp_t* tcp = (tcp_t*)t->priv_;
+  struct timeval now, left;
+  clock_now(&now);
+  if(!timercmp(&now, &tcp->deadline_, <)) {
+    log_printf(ERROR, "tcp:%s: connect timed out", t->addr_);
+    t->failed_ = 1;
+    return -1;
+  }
+  timersub(&tcp->deadline_, &now, &left);
+  if(timeout && timercmp(&left, timeout, <))
+    *timeout = left;
+  return 0;
+}
+
+    // the firmware model answers into a pipe, fd_ is its reading end
+struct loop_struct {
+  fwsim_t sim_;
+  int out_fd_;
+};
+typedef struct loop_struct loop_t;
+
+static u_int64_t loop_now()
+{
+  struct timeval now;
+  clock_now(&now);
+  return (u_int64_t)now.tv_sec * 1000 + now.tv_usec / 1000;
+}
+
+static void loop_output(void* arg, const char* line)
+{
+  loop_t* loop = (loop_t*)arg;
+  char buf[128];
+  int len = snprintf(buf, sizeof(buf), "%s\r\n", line);
+  if(len >= sizeof(buf))
+    len = sizeof(buf) - 1;
+  if(write(loop->out_fd_, buf, len) != len)
+    log_printf(WARNING, "loop: dropped firmware output");
+}
+
+static int loop_open(transport_t* t)
+{
+  loop_t* loop = malloc(sizeof(loop_t));
+  if(!loop)
+    return -2;
+
+  int fds[2];
+  if(pipe(fds)) {
+    log_printf(ERROR, "Error on pipe(): %s", strerror(errno));
+    free(loop);
+    return -1;
+  }
+  t->fd_ = fds[0];
+  loop->out_fd_ = fds[1];
+  t->priv_ = loop;
+
+        // no output while starting, a real tty is flushed on open as well
+  fwsim_init(&loop->sim_, NULL, NULL);
+  if(t->addr_[0])
+    loop->sim_.motion_ms_ = atoi(t->addr_);
+  fwsim_start(&loop->sim_, loop_now(), 0);
+  loop->sim_.output_ = loop_output;
+  loop->sim_.output_arg_ = loop;
+  return 0;
+}
+
+static int loop_configure(transport_t* t)
+{
+  loop_t* loop = (loop_t*)t->priv_;
+  if(fd_set_nonblock(t->fd_) || fd_set_nonblock(loop->out_fd_))
+    return -1;
+  return 0;
+}
+
+static int loop_write(transport_t* t, const u_int8_t* buf, u_int32_t len)
+{
+  loop_t* loop = (loop_t*)t->priv_;
+  u_int64_t now = loop_now();
+  u_int32_t i;
+  for(i = 0; i < len; ++i)
+    fwsim_input(&loop->sim_, buf[i], now);
+  return len;
+}
+
+static void loop_close(transport_t* t)
+{
+  loop_t* loop = (loop_t*)t->priv_;
+  close(t->fd_);
+  if(loop) {
+    close(loop->out_fd_);
+    free(loop);
+  }
+  t->priv_ = NULL;
+}
+
+    // motions and waits of the model end in here
+static int loop_health(transport_t* t, struct timeval* timeout)
+{
+  loop_t* loop = (loop_t*)t->priv_;
+  u_int64_t now = loop_now();
+  fwsim_tick(&loop->sim_, now);
+  int next = fwsim_next_event(&loop->sim_, now);
+  if(next >= 0 && timeout) {
+    struct timeval tv = { next / 1000, (next % 1000) * 1000 };
+    if(timercmp(&tv, timeout, <))
+      *timeout = tv;
+  }
+  return 0;
+}
+
+static const transport_ops_t transport_types[] = {
+  { "tty", NULL, NULL, tty_open, tty_configure, fd_read, fd_write, fd_close, fd_health },
+  { "pty", NULL, NULL, tty_open, pty_configure, fd_read, fd_write, fd_close, fd_health },
+  { "tcp", tcp_init, tcp_clear, tcp_open, tcp_configure, fd_read, fd_write, fd_close, tcp_health },
+  { "loop", NULL, NULL, loop_open, loop_configure, fd_read, loop_write, loop_close, loop_health },
+};
+
+int transport_init(transport_t* t, const char* spec)
+{
+  if(!t || !spec)
+    return -1;
+
+  memset(t, 0, sizeof(*t));
+  t->fd_ = -1;
+  t->ops_ = &transport_types[0];
+  const char* addr = spec;
+  const char* colon = strchr(spec, ':');
+  if(colon) {
+    int i;
+    for(i = 0; i < sizeof(transport_types)/sizeof(transport_types[0]); ++i) {
+      size_t len = strlen(transport_types[i].name_);
+      if(colon - spec == len && !strncmp(spec, transport_types[i].name_, len)) {
+        t->ops_ = &transport_types[i];
+        addr = colon + 1;
+        break;
+      }
+    }
+  }
+  t->addr_ = strdup(addr);
+  if(!t->addr_)
+    return -2;
+  if(t->ops_->init)
+    return (*t->ops_->init)(t);
+  return 0;
+}
+
+void transport_clear(transport_t* t)
+{
+  if(!t)
+    return;
+
+  transport_close(t);
+  if(t->ops_ && t->ops_->clear)
+    (*t->ops_->clear)(t);
+  if(t->addr_)
+    free(t->addr_);
+  t->addr_ = NULL;
+}
+
+int transport_open(transport_t* t)
+{
+  if(!t || !t->ops_)
+    return -1;
+
+  transport_close(t);
+  t->failed_ = 0;
+  int ret = (*t->ops_->open)(t);
+  if(!ret)
+    ret = (*t->ops_->configure)(t);
+  if(ret) {
+    transport_close(t);
+    return ret;
+  }
+  return 0;
+}
+
+void transport_close(transport_t* t)
+{
+  if(!t || t->fd_ < 0)
+    return;
+
+  (*t->ops_->close)(t);
+  t->fd_ = -1;
+  t->connecting_ = 0;
+  t->out_len_ = 0;
+}
+
+int transport_read(transport_t* t, u_int8_t* buf, u_int32_t len)
+{
+  if(!t || t->fd_ < 0)
+    return -1;
+  return (*t->ops_->read)(t, buf, len);
+}
+
+int transport_write(transport_t* t, const u_int8_t* buf, u_int32_t len)
+{
+  if(!t || t->fd_ < 0)
+    return -1;
+  return (*t->ops_->write)(t, buf, len);
+}
+
+int transport_want_write(transport_t* t)
+{
+  return t && t->fd_ >= 0 && (t->connecting_ || t->out_len_);
+}
+
+    // called once the descriptor is writeable, finishes a connect() and writes the queue
+int transport_flush(transport_t* t)
+{
+  if(!t || t->fd_ < 0)
+    return -1;
+
+  if(t->connecting_) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if(getsockopt(t->fd_, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+      err = errno;
+    if(err) {
+      log_printf(ERROR, "%s:%s: %s", t->ops_->name_, t->addr_, strerror(err));
+      t->failed_ = 1;
+      return -1;
+    }
+    t->connecting_ = 0;
+    log_printf(DEBUG, "%s:%s connected", t->ops_->name_, t->addr_);
+  }
+  return fd_write_queued(t);
+}
+
+int transport_health(transport_t* t, struct timeval* timeout)
+{
+  if(!t || t->fd_ < 0)
+    return -1;
+  return (*t->ops_->health)(t, timeout);
+}
+
+const char* transport_name(transport_t* t)
+{
+  if(!t || !t->ops_)
+    return "none";
+  return t->ops_->name_;
+}
@@ -0,0 +1,87 @@
+/*
+ *  door_daemon
+ *
+ *  Copyright (C) 2009 Christian Pointner <equinox@spreadspace.org>
+ *
+ *  This file is part of door_daemon.
+ *
+ *  door_daemon is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  door_daemon is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with door_daemon. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DOOR_DAEMON_transport_h_INCLUDED
+#define DOOR_DAEMON_transport_h_INCLUDED
+
+#include <sys/time.h>
+
+#include "datatypes.h"
+
+// The link to the firmware of a door. The type is chosen by a prefix of the
+// device string:
+//   <path> or tty:<path>   a serial port, 9600 baud, input flushed on open
+//   pty:<path>             a pseudo terminal e.g. door_sim, raw mode, no drain
+//   tcp:<host>:<port>      a TCP to serial bridge (ser2net in raw mode)
+//   loop:[<motion ms>]     the firmware model running inside the daemon
+// All of them hand out a file descriptor for select(). read() never blocks
+// and returns 0 when nothing is available, read() and write() return -1
+// once the link is broken, health() says so as well and may shorten the
+// select() timeout for transports with timers of their own.
+// write() never blocks either, what the descriptor doesn't take right away
+// is queued (up to TRANSPORT_OUT_MAX bytes) and written by
+// transport_flush() once select() reports the descriptor writeable, the
+// main loop asks transport_want_write() whether to wait for that. A TCP
+// address is resolved once by transport_init(), the connect doesn't block
+// and counts as failed if it is not done within TCP_CONNECT_TIMEOUT_S.
+
+#define TRANSPORT_OUT_MAX 256
+#define TCP_CONNECT_TIMEOUT_S 5
+
+struct transport_struct;
+
+struct transport_ops_struct {
+  const char* name_;
+  int (*init)(struct transport_struct* t);        // optional, once per configured device
+  void (*clear)(struct transport_struct* t);      // optional
+  int (*open)(struct transport_struct* t);
+  int (*configure)(struct transport_struct* t);
+  int (*read)(struct transport_struct* t, u_int8_t* buf, u_int32_t len);
+  int (*write)(struct transport_struct* t, const u_int8_t* buf, u_int32_t len);
+  void (*close)(struct transport_struct* t);
+  int (*health)(struct transport_struct* t, struct timeval* timeout);
+};
+typedef struct transport_ops_struct transport_ops_t;
+
+struct transport_struct {
+  const transport_ops_t* ops_;
+  char* addr_;                      // device string without the prefix
+  int fd_;                          // -1 while closed
+  int failed_;
+  int connecting_;                  // connect() has not finished yet
+  u_int8_t out_[TRANSPORT_OUT_MAX]; // bytes the descriptor didn't take yet
+  u_int32_t out_len_;
+  void* priv_;
+};
+typedef struct transport_struct transport_t;
+
+int transport_init(transport_t* t, const char* spec);
+void transport_clear(transport_t* t);
+int transport_open(transport_t* t);
+void transport_close(transport_t* t);
+int transport_read(transport_t* t, u_int8_t* buf, u_int32_t len);
+int transport_write(transport_t* t, const u_int8_t* buf, u_int32_t len);
+int transport_want_write(transport_t* t);
+int transport_flush(transport_t* t);
+int transport_health(transport_t* t, struct timeval* timeout);
+const char* transport_name(transport_t* t);
+
+#endif
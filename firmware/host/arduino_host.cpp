@@ -0,0 +1,340 @@
+/*
+ *  door_daemon
+ *
+ *  Copyright (C) 2009 Christian Pointner <equinox@spreadspace.org>
+ *
+ *  This file is part of door_daemon.
+ *
+ *  door_daemon is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  door_daemon is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with door_daemon. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "arduino_host.h"
+
+host_reg PORTB(REG_PORTB), DDRB(REG_DDRB), PORTC(REG_PORTC), DDRC(REG_DDRC), PORTD(REG_PORTD), DDRD(REG_DDRD);
+host_reg TCCR0A(REG_TCCR0A), TCCR0B(REG_TCCR0B), OCR0A(REG_OCR0A), TCNT0(REG_TCNT0), TIMSK0(REG_TIMSK0);
+host_reg TCCR1A(REG_TCCR1A), TCCR1B(REG_TCCR1B), OCR1A(REG_OCR1A), TCNT1(REG_TCNT1), TIMSK1(REG_TIMSK1);
+host_reg TCCR2A(REG_TCCR2A), TCCR2B(REG_TCCR2B), OCR2A(REG_OCR2A), TCNT2(REG_TCNT2), TIMSK2(REG_TIMSK2);
+
+host_serial Serial;
+
+struct host_timer_struct {
+  host_reg* tccra_;
+  host_reg* tccrb_;
+  host_reg* ocr_;
+  host_reg* tcnt_;
+  host_reg* timsk_;
+  const uint16_t* prescalers_;
+  uint32_t mask_;        // 0xFF or 0xFFFF
+  int ctc_in_a_;         // WGMx1 lives in TCCRxA for timer 0 and 2, WGM12 in TCCR1B
+  void (*isr_)(void);
+
+  uint32_t prescaler_;
+  uint64_t base_cycle_;  // counter had value base_count_ at base_cycle_
+  uint32_t base_count_;
+  uint64_t next_fire_;   // 0 .. not armed
+};
+typedef struct host_timer_struct host_timer_t;
+
+static const uint16_t prescalers_01[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 }; // 6,7: external clock, unused
+static const uint16_t prescalers_2[8] = { 0, 1, 8, 32, 64, 128, 256, 1024 };
+
+static host_timer_t timers[3] = {
+  { &TCCR0A, &TCCR0B, &OCR0A, &TCNT0, &TIMSK0, prescalers_01, 0xFF, 1, TIMER0_COMPA_vect, 0, 0, 0, 0 },
+  { &TCCR1A, &TCCR1B, &OCR1A, &TCNT1, &TIMSK1, prescalers_01, 0xFFFF, 0, TIMER1_COMPA_vect, 0, 0, 0, 0 },
+  { &TCCR2A, &TCCR2B, &OCR2A, &TCNT2, &TIMSK2, prescalers_2, 0xFF, 1, TIMER2_COMPA_vect, 0, 0, 0, 0 },
+};
+
+static struct {
+  uint64_t now_;
+  uint64_t next_loop_;
+  uint32_t loop_cycles_;
+
+  uint8_t ext_driven_[HOST_PINS];
+  uint8_t ext_level_[HOST_PINS];
+
+  char rx_[HOST_SERIAL_BUF];
+  int rx_head_;
+  int rx_count_;
+  char tx_[HOST_SERIAL_BUF];
+  int tx_len_;
+
+  host_output_cb_t output_;
+  host_port_cb_t port_;
+  void* arg_;
+} host;
+
+/**********************************************************************/
+
+static int timer_is_ctc(host_timer_t* t)
+{
+  if(t->ctc_in_a_)
+    return (*t->tccra_ >> 1) & 1;
+  return (*t->tccrb_ >> 3) & 1;
+}
+
+static uint32_t timer_count(host_timer_t* t, uint64_t cycle)
+{
+  if(!t->prescaler_)
+    return t->base_count_;
+
+  uint64_t ticks = (cycle - t->base_cycle_) / t->prescaler_;
+  if(timer_is_ctc(t) && t->base_count_ <= *t->ocr_)
+    return (t->base_count_ + ticks) % ((uint64_t)*t->ocr_ + 1);
+  return (t->base_count_ + ticks) & t->mask_;
+}
+
+static void timer_arm(host_timer_t* t)
+{
+  t->next_fire_ = 0;
+  if(!t->prescaler_ || !((*t->timsk_ >> 1) & 1)) // OCIExA is bit 1 for all timers
+    return;
+
+  uint64_t ticks = ((*t->ocr_ - t->base_count_) & t->mask_) + 1;
+  t->next_fire_ = t->base_cycle_ + ticks * t->prescaler_;
+  if(t->next_fire_ < host.now_) {
+    uint64_t period = (timer_is_ctc(t) ? (uint64_t)*t->ocr_ + 1 : (uint64_t)t->mask_ + 1) * t->prescaler_;
+    t->next_fire_ += ((host.now_ - t->next_fire_) / period + 1) * period;
+  }
+}
+
+static void timer_written(host_timer_t* t, host_reg* reg)
+{
+  if(reg == t->tcnt_) {
+    t->base_cycle_ = host.now_;
+    t->base_count_ = *reg & t->mask_;
+  }
+  else if(reg == t->tccrb_) {
+    uint32_t prescaler = t->prescalers_[*reg & 0x07];
+    if(prescaler != t->prescaler_) {
+      t->base_count_ = timer_count(t, host.now_);
+      t->base_cycle_ = host.now_;
+      t->prescaler_ = prescaler;
+    }
+  }
+  timer_arm(t);
+}
+
+static void timer_fire(host_timer_t* t)
+{
+  t->base_cycle_ = t->next_fire_;
+  t->base_count_ = timer_is_ctc(t) ? 0 : (*t->ocr_ + 1) & t->mask_;
+  timer_arm(t);
+  t->isr_();
+}
+
+void host_reg_written(host_reg_id_t id)
+{
+  if(id >= REG_TCCR0A) {
+    int idx = (id - REG_TCCR0A) / 5; // 5 registers per timer
+    host_reg* regs[5] = { timers[idx].tccra_, timers[idx].tccrb_, timers[idx].ocr_, timers[idx].tcnt_, timers[idx].timsk_ };
+    timer_written(&timers[idx], regs[(id - REG_TCCR0A) % 5]);
+    return;
+  }
+
+  if(host.port_ && (id == REG_PORTB || id == REG_PORTC || id == REG_PORTD)) {
+    host_reg* port = id == REG_PORTB ? &PORTB : (id == REG_PORTC ? &PORTC : &PORTD);
+    host.port_(id, (uint8_t)*port, host.arg_);
+  }
+}
+
+/**********************************************************************/
+
+static void pin_regs(uint8_t pin, host_reg** port, host_reg** ddr, uint8_t* bit)
+{
+  if(pin < 8) {
+    *port = &PORTD; *ddr = &DDRD; *bit = pin;
+  }
+  else if(pin < 14) {
+    *port = &PORTB; *ddr = &DDRB; *bit = pin - 8;
+  }
+  else {
+    *port = &PORTC; *ddr = &DDRC; *bit = pin - 14;
+  }
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+  if(pin >= HOST_PINS)
+    return;
+  host_reg *port, *ddr;
+  uint8_t bit;
+  pin_regs(pin, &port, &ddr, &bit);
+  if(mode == OUTPUT)
+    *ddr = *ddr | (1 << bit);
+  else
+    *ddr = *ddr & ~(1 << bit);
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+  if(pin >= HOST_PINS)
+    return;
+  host_reg *port, *ddr;
+  uint8_t bit;
+  pin_regs(pin, &port, &ddr, &bit);
+  if(value == LOW)
+    *port = *port & ~(1 << bit);
+  else
+    *port = *port | (1 << bit);
+}
+
+int digitalRead(uint8_t pin)
+{
+  if(pin >= HOST_PINS)
+    return LOW;
+  host_reg *port, *ddr;
+  uint8_t bit;
+  pin_regs(pin, &port, &ddr, &bit);
+  if(!((*ddr >> bit) & 1) && host.ext_driven_[pin])
+    return host.ext_level_[pin];
+  return ((*port >> bit) & 1) ? HIGH : LOW; // output level or pull-up
+}
+
+int host_pin_output(uint8_t pin)
+{
+  if(pin >= HOST_PINS)
+    return LOW;
+  host_reg *port, *ddr;
+  uint8_t bit;
+  pin_regs(pin, &port, &ddr, &bit);
+  return ((*port >> bit) & 1) ? HIGH : LOW;
+}
+
+void host_pin_drive(uint8_t pin, uint8_t level)
+{
+  if(pin >= HOST_PINS)
+    return;
+  host.ext_driven_[pin] = 1;
+  host.ext_level_[pin] = level;
+}
+
+void host_pin_release(uint8_t pin)
+{
+  if(pin >= HOST_PINS)
+    return;
+  host.ext_driven_[pin] = 0;
+}
+
+/**********************************************************************/
+
+void host_serial::begin(long baud)
+{
+}
+
+int host_serial::available()
+{
+  return host.rx_count_;
+}
+
+int host_serial::read()
+{
+  if(!host.rx_count_)
+    return -1;
+  char c = host.rx_[host.rx_head_];
+  host.rx_head_ = (host.rx_head_ + 1) % HOST_SERIAL_BUF;
+  host.rx_count_--;
+  return c;
+}
+
+void host_serial::print(const char* str)
+{
+  while(*str && host.tx_len_ < HOST_SERIAL_BUF - 1)
+    host.tx_[host.tx_len_++] = *str++;
+}
+
+void host_serial::println(const char* str)
+{
+  print(str);
+  host.tx_[host.tx_len_] = 0;
+  if(host.output_)
+    host.output_(host.tx_, host.arg_);
+  host.tx_len_ = 0;
+}
+
+int host_serial_input(const char* buf, int len)
+{
+  int i;
+  for(i = 0; i < len && host.rx_count_ < HOST_SERIAL_BUF; ++i) {
+    host.rx_[(host.rx_head_ + host.rx_count_) % HOST_SERIAL_BUF] = buf[i];
+    host.rx_count_++;
+  }
+  return i;
+}
+
+/**********************************************************************/
+
+void host_init(host_output_cb_t output, host_port_cb_t port, void* arg)
+{
+  host_reg* regs[] = { &PORTB, &DDRB, &PORTC, &DDRC, &PORTD, &DDRD,
+                       &TCCR0A, &TCCR0B, &OCR0A, &TCNT0, &TIMSK0,
+                       &TCCR1A, &TCCR1B, &OCR1A, &TCNT1, &TIMSK1,
+                       &TCCR2A, &TCCR2B, &OCR2A, &TCNT2, &TIMSK2 };
+  unsigned int i;
+  for(i = 0; i < sizeof(regs)/sizeof(regs[0]); ++i)
+    regs[i]->set_silent(0);
+  for(i = 0; i < 3; ++i) {
+    timers[i].prescaler_ = 0;
+    timers[i].base_cycle_ = 0;
+    timers[i].base_count_ = 0;
+    timers[i].next_fire_ = 0;
+  }
+
+  memset(&host, 0, sizeof(host));
+  host.loop_cycles_ = 800; // 50us per loop() on a 16 MHz atmega
+  host.output_ = output;
+  host.port_ = port;
+  host.arg_ = arg;
+}
+
+void host_set_loop_cycles(uint32_t cycles)
+{
+  host.loop_cycles_ = cycles ? cycles : 1;
+}
+
+uint64_t host_now()
+{
+  return host.now_;
+}
+
+uint64_t host_ms_to_cycles(uint32_t ms)
+{
+  return (uint64_t)ms * (F_CPU / 1000);
+}
+
+void host_run(uint64_t cycles)
+{
+  uint64_t end = host.now_ + cycles;
+  for(;;) {
+    host_timer_t* next = NULL;
+    int i;
+    for(i = 0; i < 3; ++i)
+      if(timers[i].next_fire_ && (!next || timers[i].next_fire_ < next->next_fire_))
+        next = &timers[i];
+
+    if(next && next->next_fire_ <= host.next_loop_ && next->next_fire_ <= end) {
+      host.now_ = next->next_fire_;
+      timer_fire(next);
+    }
+    else if(host.next_loop_ <= end) {
+      host.now_ = host.next_loop_;
+      loop();
+      host.next_loop_ += host.loop_cycles_;
+    }
+    else
+      break;
+  }
+  host.now_ = end;
+}
@@ -0,0 +1,148 @@
+/*
+ *  door_daemon
+ *
+ *  Copyright (C) 2009 Christian Pointner <equinox@spreadspace.org>
+ *
+ *  This file is part of door_daemon.
+ *
+ *  door_daemon is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  door_daemon is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with door_daemon. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * host replacement for the arduino core (WProgram.h) and the few avr
+ * registers used by tuer.pde, so the firmware can be compiled and run on
+ * the build machine. Time is virtual: it only advances inside host_run(),
+ * which calls loop() and fires the timer compare interrupts at the cycle
+ * they would occur on a 16 MHz atmega328p.
+ */
+
+#ifndef FIRMWARE_arduino_host_h_INCLUDED
+#define FIRMWARE_arduino_host_h_INCLUDED
+
+#include <stdint.h>
+
+#define F_CPU 16000000UL
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+
+#define HOST_PINS 20
+
+/* registers: writes are seen by the timer and pin emulation */
+
+enum host_reg_id_enum { REG_PORTB, REG_DDRB, REG_PORTC, REG_DDRC, REG_PORTD, REG_DDRD,
+                        REG_TCCR0A, REG_TCCR0B, REG_OCR0A, REG_TCNT0, REG_TIMSK0,
+                        REG_TCCR1A, REG_TCCR1B, REG_OCR1A, REG_TCNT1, REG_TIMSK1,
+                        REG_TCCR2A, REG_TCCR2B, REG_OCR2A, REG_TCNT2, REG_TIMSK2,
+                        REG_MAX };
+typedef enum host_reg_id_enum host_reg_id_t;
+
+void host_reg_written(host_reg_id_t id);
+
+class host_reg
+{
+public:
+  host_reg(host_reg_id_t id) : id_(id), value_(0) {}
+
+  host_reg& operator=(unsigned int value) { value_ = value; host_reg_written(id_); return *this; }
+  host_reg& operator|=(unsigned int value) { return *this = value_ | value; }
+  host_reg& operator&=(unsigned int value) { return *this = value_ & value; }
+  operator unsigned int() const { return value_; }
+
+  void set_silent(unsigned int value) { value_ = value; }
+
+private:
+  host_reg_id_t id_;
+  uint16_t value_;
+};
+
+extern host_reg PORTB, DDRB, PORTC, DDRC, PORTD, DDRD;
+extern host_reg TCCR0A, TCCR0B, OCR0A, TCNT0, TIMSK0;
+extern host_reg TCCR1A, TCCR1B, OCR1A, TCNT1, TIMSK1;
+extern host_reg TCCR2A, TCCR2B, OCR2A, TCNT2, TIMSK2;
+
+#define CS00 0
+#define CS01 1
+#define CS02 2
+#define WGM01 1
+#define OCIE0A 1
+#define OCF0A 1
+
+#define CS10 0
+#define CS11 1
+#define CS12 2
+#define WGM12 3
+#define OCIE1A 1
+
+#define CS20 0
+#define CS21 1
+#define CS22 2
+#define WGM21 1
+#define OCIE2A 1
+
+#define TIMER0_COMPA_vect host_isr_timer0_compa
+#define TIMER1_COMPA_vect host_isr_timer1_compa
+#define TIMER2_COMPA_vect host_isr_timer2_compa
+#define ISR(vect) void vect(void)
+
+void TIMER0_COMPA_vect(void);
+void TIMER1_COMPA_vect(void);
+void TIMER2_COMPA_vect(void);
+
+/* arduino core */
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+
+class host_serial
+{
+public:
+  void begin(long baud);
+  int available();
+  int read();
+  void print(const char* str);
+  void println(const char* str);
+};
+
+extern host_serial Serial;
+
+void setup();
+void loop();
+
+/* host side */
+
+#define HOST_SERIAL_BUF 256
+
+typedef void (*host_output_cb_t)(const char* line, void* arg);
+typedef void (*host_port_cb_t)(host_reg_id_t port, uint8_t value, void* arg);
+
+void host_init(host_output_cb_t output, host_port_cb_t port, void* arg);
+void host_set_loop_cycles(uint32_t cycles);
+uint64_t host_now();
+uint64_t host_ms_to_cycles(uint32_t ms);
+void host_run(uint64_t cycles);
+int host_serial_input(const char* buf, int len);
+
+void host_pin_drive(uint8_t pin, uint8_t level);
+void host_pin_release(uint8_t pin);
+int host_pin_output(uint8_t pin);
+
+#endif
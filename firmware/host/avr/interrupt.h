@@ -0,0 +1,2 @@
+/* host build: ISR() comes from arduino_host.h */
+#include "arduino_host.h"
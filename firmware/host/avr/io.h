@@ -0,0 +1,2 @@
+/* host build: registers and bit names come from arduino_host.h */
+#include "arduino_host.h"
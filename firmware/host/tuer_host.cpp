@@ -0,0 +1,270 @@
+/*
+ *  door_daemon
+ *
+ *  Copyright (C) 2009 Christian Pointner <equinox@spreadspace.org>
+ *
+ *  This file is part of door_daemon.
+ *
+ *  door_daemon is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  door_daemon is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with door_daemon. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * tuer_host: runs the unmodified tuer.pde against a model of the lock
+ *
+ * The stepper phases written to PORTB move the bolt one step each, the
+ * limit switches close when the bolt reaches either end. In benchmark mode
+ * the door is opened and closed over the serial line as often as requested
+ * and every reply is checked, in script mode commands are read from stdin
+ * (see usage) and the firmware output is printed with its virtual time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "arduino_host.h"
+
+#define PIN_AJAR 14
+#define PIN_MANUAL_OPEN 12
+#define PIN_MANUAL_CLOSE 13
+#define PIN_LIMIT_OPENED 18
+#define PIN_LIMIT_CLOSED 19
+
+extern byte current_state;
+
+struct door_model_struct {
+  int position_;  // 0 .. closed, travel_ .. opened
+  int travel_;
+  int phase_;     // last stepper phase 0..3, -1 if coils are off
+  int jammed_;
+  int verbose_;
+  char last_line_[HOST_SERIAL_BUF];
+  uint32_t lines_;
+};
+typedef struct door_model_struct door_model_t;
+
+static int stepper_phase(uint8_t portb)
+{
+  switch(portb & 0x0F) {
+  case 0x03: return 0;
+  case 0x06: return 1;
+  case 0x0C: return 2;
+  case 0x09: return 3;
+  }
+  return -1;
+}
+
+static void door_model_update(door_model_t* door)
+{
+  if(door->position_ <= 0)
+    host_pin_drive(PIN_LIMIT_CLOSED, LOW);
+  else
+    host_pin_release(PIN_LIMIT_CLOSED);
+
+  if(door->position_ >= door->travel_)
+    host_pin_drive(PIN_LIMIT_OPENED, LOW);
+  else
+    host_pin_release(PIN_LIMIT_OPENED);
+}
+
+static void door_model_port(host_reg_id_t port, uint8_t value, void* arg)
+{
+  door_model_t* door = (door_model_t*)arg;
+  if(port != REG_PORTB)
+    return;
+
+  int phase = stepper_phase(value);
+  if(phase >= 0 && door->phase_ >= 0 && !door->jammed_) {
+    int delta = (phase - door->phase_ + 4) % 4;
+    if(delta == 1 && door->position_ < door->travel_)
+      door->position_++;
+    else if(delta == 3 && door->position_ > 0)
+      door->position_--;
+    door_model_update(door);
+  }
+  door->phase_ = phase;
+}
+
+static void door_model_output(const char* line, void* arg)
+{
+  door_model_t* door = (door_model_t*)arg;
+  strncpy(door->last_line_, line, sizeof(door->last_line_) - 1);
+  door->lines_++;
+  if(door->verbose_) {
+    uint64_t us = host_now() / (F_CPU / 1000000);
+    printf("[%llu.%06llu] %s\n", (unsigned long long)(us / 1000000), (unsigned long long)(us % 1000000), line);
+  }
+}
+
+static void door_model_init(door_model_t* door, int travel, int opened, int verbose)
+{
+  memset(door, 0, sizeof(*door));
+  door->travel_ = travel;
+  door->position_ = opened ? travel : 0;
+  door->phase_ = -1;
+  door->verbose_ = verbose;
+
+  host_init(door_model_output, door_model_port, door);
+  host_pin_drive(PIN_AJAR, LOW);
+  door_model_update(door);
+  setup();
+}
+
+/* runs until the firmware printed a line starting with prefix, 0 on success */
+static int run_until(door_model_t* door, const char* prefix, uint32_t timeout_ms)
+{
+  uint64_t step = host_ms_to_cycles(2);
+  uint64_t end = host_now() + host_ms_to_cycles(timeout_ms);
+  uint32_t lines = door->lines_;
+  while(host_now() < end) {
+    host_run(step);
+    if(door->lines_ != lines) {
+      lines = door->lines_;
+      if(!strncmp(door->last_line_, prefix, strlen(prefix)))
+        return 0;
+    }
+  }
+  return -1;
+}
+
+static int run_cycle(door_model_t* door)
+{
+  static const struct { char cmd_; const char* reply_; const char* done_; } steps[2] = {
+    { 'o', "Ok", "Status: opened, idle" },
+    { 'c', "Ok", "Status: closed, idle" }
+  };
+  int i;
+  for(i = 0; i < 2; ++i) {
+    host_serial_input(&steps[i].cmd_, 1);
+    if(run_until(door, steps[i].reply_, 100))
+      return -1;
+    if(run_until(door, steps[i].done_, 10000))
+      return -1;
+  }
+  return 0;
+}
+
+static void print_usage()
+{
+  printf("USAGE:\n");
+  printf("tuer_host [-h|--help]                         prints this...\n");
+  printf("          [-n|--cycles] <n>                   open/close cycles to run (default: 1000)\n");
+  printf("          [-s|--steps] <n>                    stepper steps between the limit switches (default: 500)\n");
+  printf("          [-l|--loop] <us>                    virtual duration of one loop() (default: 50)\n");
+  printf("          [-o|--opened]                       start with the door opened\n");
+  printf("          [-i|--script]                       read commands from stdin instead of benchmarking:\n");
+  printf("                                                send <chars>, run <ms>, press open|close, release,\n");
+  printf("                                                ajar, shut, jam, unjam, state\n");
+  printf("          [-v|--verbose]                      print the firmware output\n");
+}
+
+static void run_script(door_model_t* door)
+{
+  char line[256];
+  while(fgets(line, sizeof(line), stdin)) {
+    line[strcspn(line, "\r\n")] = 0;
+    if(!strncmp(line, "send ", 5))
+      host_serial_input(&line[5], strlen(&line[5]));
+    else if(!strncmp(line, "run ", 4))
+      host_run(host_ms_to_cycles(atoi(&line[4])));
+    else if(!strcmp(line, "press open"))
+      host_pin_drive(PIN_MANUAL_OPEN, LOW);
+    else if(!strcmp(line, "press close"))
+      host_pin_drive(PIN_MANUAL_CLOSE, LOW);
+    else if(!strcmp(line, "release")) {
+      host_pin_release(PIN_MANUAL_OPEN);
+      host_pin_release(PIN_MANUAL_CLOSE);
+    }
+    else if(!strcmp(line, "ajar"))
+      host_pin_release(PIN_AJAR);
+    else if(!strcmp(line, "shut"))
+      host_pin_drive(PIN_AJAR, LOW);
+    else if(!strcmp(line, "jam"))
+      door->jammed_ = 1;
+    else if(!strcmp(line, "unjam"))
+      door->jammed_ = 0;
+    else if(!strcmp(line, "state"))
+      printf("state %d, position %d/%d, heartbeat %s\n", current_state, door->position_, door->travel_,
+             host_pin_output(15) == LOW ? "on" : "off");
+    else if(line[0] && line[0] != '#')
+      fprintf(stderr, "tuer_host: unknown script command '%s'\n", line);
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  int cycles = 1000, travel = 500, loop_us = 50, opened = 0, script = 0, verbose = 0;
+  int i;
+  for(i = 1; i < argc; ++i) {
+    const char* str = argv[i];
+    if(!strcmp(str, "-h") || !strcmp(str, "--help")) {
+      print_usage();
+      return 0;
+    }
+    else if(!strcmp(str, "-o") || !strcmp(str, "--opened"))
+      opened = 1;
+    else if(!strcmp(str, "-i") || !strcmp(str, "--script"))
+      script = verbose = 1;
+    else if(!strcmp(str, "-v") || !strcmp(str, "--verbose"))
+      verbose = 1;
+    else if(i + 1 < argc && (!strcmp(str, "-n") || !strcmp(str, "--cycles")))
+      cycles = atoi(argv[++i]);
+    else if(i + 1 < argc && (!strcmp(str, "-s") || !strcmp(str, "--steps")))
+      travel = atoi(argv[++i]);
+    else if(i + 1 < argc && (!strcmp(str, "-l") || !strcmp(str, "--loop")))
+      loop_us = atoi(argv[++i]);
+    else {
+      print_usage();
+      return 1;
+    }
+  }
+  if(travel < 1 || loop_us < 1) {
+    print_usage();
+    return 1;
+  }
+
+  door_model_t door;
+  door_model_init(&door, travel, opened, verbose);
+  host_set_loop_cycles(loop_us * (F_CPU / 1000000));
+
+  if(script) {
+    run_script(&door);
+    return 0;
+  }
+
+  if(opened && run_until(&door, "Status: closed, idle", 10000)) {
+    fprintf(stderr, "tuer_host: firmware did not reach closed state after startup\n");
+    return 2;
+  }
+
+  struct timespec start, stop;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  uint64_t virt_start = host_now();
+  int failed = 0;
+  for(i = 0; i < cycles; ++i) {
+    if(run_cycle(&door)) {
+      fprintf(stderr, "tuer_host: cycle %d failed, last output: '%s'\n", i, door.last_line_);
+      failed++;
+      break;
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+  double wall = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+  double virt = (double)(host_now() - virt_start) / F_CPU;
+
+  printf("%d cycles in %.3f s (%.0f cycles/s), %.1f s of firmware time (%.0fx real time)%s\n",
+         i, wall, wall > 0 ? i / wall : 0.0, virt, wall > 0 ? virt / wall : 0.0, failed ? ", FAILED" : "");
+  return failed ? 2 : 0;
+}